@@ -11,6 +11,7 @@
 #include "sylar/core/module.h"
 #include "sylar/net/rock/rock_stream.h"
 #include "sylar/core/worker.h"
+#include "sylar/core/util/topology.h"
 // #include "sylar/http/ws_server.h"
 #include "sylar/net/rock/rock_server.h"
 #include "sylar/net/ns/name_server_module.h"
@@ -314,6 +315,14 @@ int Application::run_fiber()
         if (!i.name.empty()) {
             server->setName(i.name);
         }
+        if (i.shards > 0) {
+            std::vector<int> cpus;
+            if (!i.cpus.empty() && !CpuTopologyMgr::GetInstance()->parseCpuList(i.cpus, cpus)) {
+                SYLAR_LOG_ERROR(g_logger) << "invalid server cpus: " << i.cpus;
+                _exit(0);
+            }
+            server->setShards(i.shards, cpus);
+        }
         std::vector<Address::ptr> fails;
         if (!server->bind(address, fails, i.ssl)) {
             for (auto &x : fails) {
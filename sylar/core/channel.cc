@@ -0,0 +1,220 @@
+#include "channel.h"
+#include "iomanager.h"
+#include "sylar/core/common/macro.h"
+#include "sylar/core/util/util.h"
+
+namespace sylar
+{
+
+bool ChannelWaiter::wake(State to, ChannelWaitNode *node)
+{
+    int expected = WAITING;
+    if (!state.compare_exchange_strong(expected, to)) {
+        return false;
+    }
+    wokenBy = node;
+    // 抢到唤醒权之后等待者一定还挂着(或者正要 yield)，这里访问成员是安全的
+    scheduler->schedule(fiber);
+    return true;
+}
+
+ChannelBase::~ChannelBase()
+{
+    SYLAR_ASSERT(!m_head[RECV] && !m_head[SEND]);
+}
+
+void ChannelBase::close()
+{
+    MutexType::Lock lock(m_mutex);
+    m_closed = true;
+    for (int dir = RECV; dir <= SEND; ++dir) {
+        while (ChannelWaitNode *node = m_head[dir]) {
+            removeWaiterLocked(node, (Direction)dir);
+            node->waiter->wake(ChannelWaiter::WOKEN, node);
+        }
+    }
+}
+
+bool ChannelBase::isClosed()
+{
+    MutexType::Lock lock(m_mutex);
+    return m_closed;
+}
+
+void ChannelBase::wakeOneLocked(Direction dir)
+{
+    // 挂在多个通道上的 select 可能已经被别的通道唤醒，跳过继续找下一个
+    while (ChannelWaitNode *node = m_head[dir]) {
+        removeWaiterLocked(node, dir);
+        if (node->waiter->wake(ChannelWaiter::WOKEN, node)) {
+            return;
+        }
+    }
+}
+
+void ChannelBase::addWaiterLocked(ChannelWaitNode *node, Direction dir)
+{
+    node->prev = m_tail[dir];
+    node->next = nullptr;
+    if (m_tail[dir]) {
+        m_tail[dir]->next = node;
+    } else {
+        m_head[dir] = node;
+    }
+    m_tail[dir] = node;
+    node->linked = true;
+}
+
+void ChannelBase::removeWaiterLocked(ChannelWaitNode *node, Direction dir)
+{
+    if (!node->linked) {
+        return;
+    }
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        m_head[dir] = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        m_tail[dir] = node->prev;
+    }
+    node->prev = node->next = nullptr;
+    node->linked = false;
+}
+
+void ChannelBase::removeWaiter(ChannelWaitNode *node, Direction dir)
+{
+    MutexType::Lock lock(m_mutex);
+    removeWaiterLocked(node, dir);
+}
+
+void ChannelBase::passWakeup()
+{
+    MutexType::Lock lock(m_mutex);
+    if (m_closed) {
+        return;
+    }
+    if (m_head[RECV] && readableLocked()) {
+        wakeOneLocked(RECV);
+    }
+    if (m_head[SEND] && writableLocked()) {
+        wakeOneLocked(SEND);
+    }
+}
+
+/**
+ * @brief select 挂起时的等待者，每个分支的等待节点和它一起分配
+ */
+struct SelectWaiter : ChannelWaiter {
+    ChannelWaitNode nodes[FiberSelect::MAX_CASES];
+};
+
+int FiberSelect::addCase(ChannelBase *ch, ChannelBase::Direction dir, void *slot, bool *ok,
+                         TryFunc fn)
+{
+    SYLAR_ASSERT2(m_count < MAX_CASES, "too many select cases");
+    Case &c = m_cases[m_count];
+    c.channel = ch;
+    c.dir = dir;
+    c.slot = slot;
+    c.ok = ok ? ok : &c.okIgnored;
+    c.tryLocked = fn;
+    return m_count++;
+}
+
+int FiberSelect::tryCases(ChannelWaiter *waiter, ChannelWaitNode *nodes)
+{
+    for (size_t i = 0; i < m_count; ++i) {
+        Case &c = m_cases[i];
+        ChannelBase::MutexType::Lock lock(c.channel->m_mutex);
+        if (c.tryLocked(c.channel, c.slot, c.ok)) {
+            return i;
+        }
+        // 检查和登记在同一把锁里，之后这个通道的状态变化一定能看到这个等待者
+        if (nodes) {
+            nodes[i].waiter = waiter;
+            c.channel->addWaiterLocked(&nodes[i], c.dir);
+        }
+    }
+    return -1;
+}
+
+void FiberSelect::removeWaiters(ChannelWaiter *waiter, ChannelWaitNode *nodes, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        // 唤醒方已经在它的锁里摘掉了这个节点，单通道收发醒来之后不用再加锁
+        if (&nodes[i] != waiter->wokenBy) {
+            m_cases[i].channel->removeWaiter(&nodes[i], m_cases[i].dir);
+        }
+    }
+}
+
+int FiberSelect::wait(uint64_t timeout_ms)
+{
+    int rt = tryCases(nullptr, nullptr);
+    if (rt >= 0 || timeout_ms == 0) {
+        return rt;
+    }
+
+    Scheduler *scheduler = Scheduler::GetThis();
+    SYLAR_ASSERT2(scheduler, "FiberSelect::wait must be called in a scheduler fiber");
+    // 等待者和等待节点在挂起期间由别的协程读写，放到堆上：共享栈协程挂起后栈区域会被覆盖。
+    // 定时器回调可能在返回之后才执行，等待者由回调一起持有
+    auto waiter = std::make_shared<SelectWaiter>();
+    ChannelWaitNode *nodes = waiter->nodes;
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    Timer::ptr timer;
+    waiter->scheduler = scheduler;
+    waiter->fiber = Fiber::GetThis();
+
+    bool woken = false;
+    while (true) {
+        waiter->wokenBy = nullptr;
+        waiter->state = ChannelWaiter::WAITING;
+        rt = tryCases(waiter.get(), nodes);
+        uint64_t now = deadline == ~0ull ? 0 : GetCurrentMS();
+        if (rt < 0 && now >= deadline) {
+            // 被唤醒之后重试时已经到期(定时器可能在重置状态之前触发过)
+            rt = -1;
+        } else if (rt < 0) {
+            if (!timer && deadline != ~0ull) {
+                IOManager *iom = IOManager::GetThis();
+                SYLAR_ASSERT2(iom, "FiberSelect::wait with timeout needs an IOManager");
+                timer = iom->addTimer(deadline - now,
+                                      [waiter]() { waiter->wake(ChannelWaiter::TIMEOUT); });
+            }
+            Fiber::GetThis()->yield();
+            removeWaiters(waiter.get(), nodes, m_count);
+            woken = true;
+            if (waiter->state == ChannelWaiter::TIMEOUT) {
+                break;
+            }
+            continue;
+        }
+        // 已经完成(或者到期)，登记之后如果被唤醒过，yield 一次消化掉那次调度
+        int expected = ChannelWaiter::WAITING;
+        if (!waiter->state.compare_exchange_strong(expected, ChannelWaiter::DONE)) {
+            Fiber::GetThis()->yield();
+            woken = true;
+        }
+        // 只有完成的分支之前的分支挂了等待节点
+        removeWaiters(waiter.get(), nodes, rt < 0 ? m_count : rt);
+        break;
+    }
+    if (timer) {
+        timer->cancel();
+    }
+    // 唤醒可能来自没有选中的分支，把那些通道上的就绪状态传给下一个等待者，避免丢唤醒
+    if (woken) {
+        for (size_t i = 0; i < m_count; ++i) {
+            if ((int)i != rt) {
+                m_cases[i].channel->passWakeup();
+            }
+        }
+    }
+    return rt;
+}
+
+} // namespace sylar
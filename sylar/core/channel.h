@@ -0,0 +1,410 @@
+/**
+ * @file channel.h
+ * @brief 协程通道，协程之间按流水线传递数据
+ * @details 发送/接收阻塞时挂起的是协程，不阻塞线程；元素全程移动，不拷贝。
+ *          FiberSelect 同时等待多个通道，支持超时(定时器来自当前 IOManager)。
+ */
+#ifndef __SYLAR_CHANNEL_H__
+#define __SYLAR_CHANNEL_H__
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "sylar/core/common/noncopyable.h"
+#include "sylar/core/fiber.h"
+#include "sylar/core/mutex.h"
+
+namespace sylar
+{
+
+class Scheduler;
+
+/**
+ * @brief 在通道上挂起的协程
+ * @details select 时同一个等待者挂在多个通道上，用 state 抢唤醒权，只有抢到的一方调度协程
+ */
+struct ChannelWaitNode;
+
+struct ChannelWaiter {
+    enum State {
+        /// 挂起中
+        WAITING = 0,
+        /// 被通道唤醒(有数据、有空位或者关闭)
+        WOKEN,
+        /// 超时
+        TIMEOUT,
+        /// 已经自己完成，不再需要唤醒
+        DONE,
+    };
+
+    /**
+     * @brief 从 WAITING 切到 to 并调度协程，没抢到返回 false
+     * @param[in] node 唤醒它的通道节点(已经从通道上摘掉)
+     */
+    bool wake(State to, ChannelWaitNode *node = nullptr);
+
+    std::atomic<int> state{WAITING};
+    /// 唤醒它的节点，等待者醒来之后不用再加锁摘这个节点
+    ChannelWaitNode *wokenBy = nullptr;
+    Scheduler *scheduler = nullptr;
+    Fiber::ptr fiber;
+};
+
+/**
+ * @brief 等待者挂在某个通道上的节点，每个 select 分支一个，侵入式双向链表
+ * @details 和 ChannelWaiter 一样分配在堆上：挂起期间别的协程要读写它们，
+ *          共享栈协程挂起时栈区域会被别的协程覆盖，不能放在栈上
+ */
+struct ChannelWaitNode {
+    ChannelWaiter *waiter = nullptr;
+    ChannelWaitNode *prev = nullptr;
+    ChannelWaitNode *next = nullptr;
+    bool linked = false;
+};
+
+class FiberSelect;
+
+/**
+ * @brief 通道的公共部分：锁、关闭状态和两个方向的等待队列
+ */
+class ChannelBase : Noncopyable
+{
+    friend class FiberSelect;
+
+public:
+    typedef Spinlock MutexType;
+
+    /**
+     * @brief 等待方向
+     */
+    enum Direction {
+        /// 等数据
+        RECV = 0,
+        /// 等空位
+        SEND = 1,
+    };
+
+    virtual ~ChannelBase();
+
+    /**
+     * @brief 关闭通道，唤醒所有等待者
+     * @details 关闭后发送失败，接收把剩余的数据取完之后失败
+     */
+    void close();
+
+    bool isClosed();
+
+protected:
+    /**
+     * @brief 可以接收(有数据或者已关闭)，调用方持有锁
+     */
+    virtual bool readableLocked() const = 0;
+
+    /**
+     * @brief 可以发送(有空位或者已关闭)，调用方持有锁
+     */
+    virtual bool writableLocked() const = 0;
+
+    /**
+     * @brief 唤醒 dir 方向的一个等待者，调用方持有锁
+     */
+    void wakeOneLocked(Direction dir);
+
+    /**
+     * @brief 挂上等待节点，调用方持有锁
+     */
+    void addWaiterLocked(ChannelWaitNode *node, Direction dir);
+
+    /**
+     * @brief 摘掉等待节点(已经被唤醒摘掉的忽略)，调用方持有锁
+     */
+    void removeWaiterLocked(ChannelWaitNode *node, Direction dir);
+
+    /**
+     * @brief 加锁摘掉等待节点
+     */
+    void removeWaiter(ChannelWaitNode *node, Direction dir);
+
+    /**
+     * @brief 把唤醒传给下一个等待者
+     * @details select 被某个通道唤醒之后可能选了别的分支，这个通道上的就绪状态要继续传下去
+     */
+    void passWakeup();
+
+protected:
+    MutexType m_mutex;
+    bool m_closed = false;
+
+private:
+    ChannelWaitNode *m_head[2] = {nullptr, nullptr};
+    ChannelWaitNode *m_tail[2] = {nullptr, nullptr};
+};
+
+/**
+ * @brief 同时等待多个通道，哪个先就绪执行哪个
+ * @details 用法：
+ *          FiberSelect sel;
+ *          int a = sel.recv(ch1, v1);
+ *          int b = sel.send(ch2, v2);
+ *          int rt = sel.wait(100); // 返回完成的分支下标，超时返回 -1
+ *          多个分支同时就绪时按添加顺序优先。
+ *          接收分支在通道关闭且取空之后完成，ok 为 false；发送分支在通道关闭时完成，ok 为 false。
+ */
+class FiberSelect : Noncopyable
+{
+public:
+    /// 最多分支数
+    static const size_t MAX_CASES = 16;
+
+    /**
+     * @brief 添加接收分支
+     * @param[out] out 接收到的数据
+     * @param[out] ok 为 false 表示通道已关闭，没有接收到数据
+     * @return 分支下标
+     */
+    template <class T, class Channel>
+    int recv(Channel &ch, T &out, bool *ok = nullptr)
+    {
+        return addCase(&ch, ChannelBase::RECV, &out, ok, &Channel::TryRecvLocked);
+    }
+
+    /**
+     * @brief 添加发送分支，这个分支完成时 value 被移走
+     * @param[out] ok 为 false 表示通道已关闭，没有发送
+     * @return 分支下标
+     */
+    template <class T, class Channel>
+    int send(Channel &ch, T &value, bool *ok = nullptr)
+    {
+        return addCase(&ch, ChannelBase::SEND, &value, ok, &Channel::TrySendLocked);
+    }
+
+    /**
+     * @brief 等待某个分支完成
+     * @param[in] timeout_ms 超时时间，~0ull 一直等，0 只检查一遍不挂起
+     * @return 完成的分支下标，超时返回 -1
+     */
+    int wait(uint64_t timeout_ms = ~0ull);
+
+private:
+    /**
+     * @brief 持有通道锁时尝试完成分支，完成返回 true
+     */
+    typedef bool (*TryFunc)(ChannelBase *ch, void *slot, bool *ok);
+
+    struct Case {
+        ChannelBase *channel;
+        ChannelBase::Direction dir;
+        void *slot;
+        bool *ok;
+        TryFunc tryLocked;
+        /// 调用方不关心 ok 时写到这里
+        bool okIgnored;
+    };
+
+    int addCase(ChannelBase *ch, ChannelBase::Direction dir, void *slot, bool *ok, TryFunc fn);
+
+    /**
+     * @brief 依次尝试每个分支，没有就绪的挂上等待节点(nodes 不为空时，每个分支一个)
+     * @return 完成的分支下标，都没就绪返回 -1
+     */
+    int tryCases(ChannelWaiter *waiter, ChannelWaitNode *nodes);
+
+    /**
+     * @brief 摘掉前 count 个分支的等待节点
+     */
+    void removeWaiters(ChannelWaiter *waiter, ChannelWaitNode *nodes, size_t count);
+
+private:
+    Case m_cases[MAX_CASES];
+    size_t m_count = 0;
+};
+
+/**
+ * @brief 协程通道
+ * @details capacity 为 0 时不限长度，发送永不挂起；否则满了之后发送方挂起。
+ *          元素存放在环形缓冲里，稳定运行时收发不分配内存。
+ *          阻塞的收发需要在调度器的协程里调用，try 系列在任意线程都可以用。
+ * @tparam T 元素类型，只要求可以移动
+ */
+template <class T>
+class FiberChannel : public ChannelBase
+{
+    friend class FiberSelect;
+
+public:
+    typedef std::shared_ptr<FiberChannel> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量，0 表示不限
+     */
+    explicit FiberChannel(size_t capacity = 0) : m_capacity(capacity)
+    {
+        m_buf.resize(capacity ? capacity : 16);
+    }
+
+    /**
+     * @brief 发送，满了挂起当前协程直到有空位
+     * @return 通道已关闭返回 false
+     */
+    bool send(T value)
+    {
+        bool ok = false;
+        FiberSelect sel;
+        sel.send(*this, value, &ok);
+        sel.wait();
+        return ok;
+    }
+
+    /**
+     * @brief 发送，满了最多等 timeout_ms
+     * @return 超时或者通道已关闭返回 false
+     */
+    bool send(T value, uint64_t timeout_ms)
+    {
+        bool ok = false;
+        FiberSelect sel;
+        sel.send(*this, value, &ok);
+        return sel.wait(timeout_ms) == 0 && ok;
+    }
+
+    /**
+     * @brief 不挂起的发送，成功时 value 被移走
+     */
+    bool trySend(T &&value)
+    {
+        bool ok = false;
+        MutexType::Lock lock(m_mutex);
+        return TrySendLocked(this, &value, &ok) && ok;
+    }
+
+    /**
+     * @brief 接收，没有数据时挂起当前协程
+     * @return 通道已关闭并且取空了返回 false
+     */
+    bool recv(T &out)
+    {
+        bool ok = false;
+        FiberSelect sel;
+        sel.recv(*this, out, &ok);
+        sel.wait();
+        return ok;
+    }
+
+    /**
+     * @brief 接收，没有数据时最多等 timeout_ms
+     * @return 超时或者通道已关闭并且取空了返回 false
+     */
+    bool recv(T &out, uint64_t timeout_ms)
+    {
+        bool ok = false;
+        FiberSelect sel;
+        sel.recv(*this, out, &ok);
+        return sel.wait(timeout_ms) == 0 && ok;
+    }
+
+    /**
+     * @brief 不挂起的接收
+     */
+    bool tryRecv(T &out)
+    {
+        bool ok = false;
+        MutexType::Lock lock(m_mutex);
+        return TryRecvLocked(this, &out, &ok) && ok;
+    }
+
+    size_t size()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_count;
+    }
+
+    bool empty() { return size() == 0; }
+
+    /**
+     * @brief 容量，0 表示不限
+     */
+    size_t capacity() const { return m_capacity; }
+
+protected:
+    bool readableLocked() const override { return m_count > 0 || m_closed; }
+
+    bool writableLocked() const override
+    {
+        return m_closed || !m_capacity || m_count < m_capacity;
+    }
+
+private:
+    static bool TryRecvLocked(ChannelBase *base, void *slot, bool *ok)
+    {
+        FiberChannel *ch = static_cast<FiberChannel *>(base);
+        if (ch->m_count == 0) {
+            if (ch->m_closed) {
+                *ok = false;
+                return true;
+            }
+            return false;
+        }
+        std::optional<T> &item = ch->m_buf[ch->m_head];
+        *static_cast<T *>(slot) = std::move(*item);
+        item.reset();
+        ch->m_head = (ch->m_head + 1) % ch->m_buf.size();
+        --ch->m_count;
+        *ok = true;
+        if (ch->m_capacity) {
+            ch->wakeOneLocked(SEND);
+        }
+        return true;
+    }
+
+    static bool TrySendLocked(ChannelBase *base, void *slot, bool *ok)
+    {
+        FiberChannel *ch = static_cast<FiberChannel *>(base);
+        if (ch->m_closed) {
+            *ok = false;
+            return true;
+        }
+        if (ch->m_count == ch->m_buf.size()) {
+            if (ch->m_capacity) {
+                return false;
+            }
+            ch->grow();
+        }
+        ch->m_buf[(ch->m_head + ch->m_count) % ch->m_buf.size()].emplace(
+            std::move(*static_cast<T *>(slot)));
+        ++ch->m_count;
+        *ok = true;
+        ch->wakeOneLocked(RECV);
+        return true;
+    }
+
+    /**
+     * @brief 不限长度的通道满了之后扩容一倍
+     */
+    void grow()
+    {
+        std::vector<std::optional<T> > buf(m_buf.size() * 2);
+        for (size_t i = 0; i < m_count; ++i) {
+            buf[i] = std::move(m_buf[(m_head + i) % m_buf.size()]);
+        }
+        m_buf.swap(buf);
+        m_head = 0;
+    }
+
+private:
+    /// 容量，0 表示不限
+    size_t m_capacity;
+    /// 环形缓冲
+    std::vector<std::optional<T> > m_buf;
+    /// 队首下标
+    size_t m_head = 0;
+    /// 元素个数
+    size_t m_count = 0;
+};
+
+} // namespace sylar
+
+#endif
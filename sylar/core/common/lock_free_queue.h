@@ -0,0 +1,228 @@
+#ifndef __SYLAR_COMMON_LOCK_FREE_QUEUE_H__
+#define __SYLAR_COMMON_LOCK_FREE_QUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace sylar {
+namespace ds {
+
+/**
+ * @brief MpscQueue 的侵入式节点
+ * @details 需要入队的类型继承该节点。拷贝/移动时不带走 next 指针，
+ *          这样继承它的值类型依旧可以正常拷贝和移动
+ */
+struct MpscNode {
+    MpscNode() : mpscNext(nullptr) {}
+    MpscNode(const MpscNode &) : mpscNext(nullptr) {}
+    MpscNode &operator=(const MpscNode &) { return *this; }
+
+    std::atomic<MpscNode *> mpscNext;
+};
+
+/**
+ * @brief 侵入式多生产者单消费者队列（Vyukov）
+ * @details push 只有一次 exchange 加一次 store，生产者之间不会互相阻塞；
+ *          pop 只能由同一个消费者调用。
+ *          生产者 exchange 之后、链接 next 之前被打断时，pop 会暂时返回 nullptr，
+ *          此时队列并不为空，需要依赖外部计数判断是否稍后重试。
+ *          队列不持有节点的所有权，节点的生命周期由调用方管理。
+ *          参考 http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+ * @tparam T 元素类型，必须继承 MpscNode
+ */
+template <class T>
+class MpscQueue
+{
+public:
+    MpscQueue() : m_head(&m_stub), m_tail(&m_stub) {}
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    /**
+     * @brief 入队，任意线程可调用
+     */
+    void push(T *item)
+    {
+        static_assert(std::is_base_of<MpscNode, T>::value, "MpscQueue item must derive MpscNode");
+        pushNode(item);
+    }
+
+    /**
+     * @brief 出队，只能由消费者调用
+     * @return 队列为空（或生产者还未完成链接）返回 nullptr
+     */
+    T *pop()
+    {
+        MpscNode *tail = m_tail;
+        MpscNode *next = tail->mpscNext.load(std::memory_order_acquire);
+        if (tail == &m_stub) {
+            if (!next) {
+                return nullptr;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->mpscNext.load(std::memory_order_acquire);
+        }
+        if (next) {
+            m_tail = next;
+            return static_cast<T *>(tail);
+        }
+        if (tail != m_head.load(std::memory_order_acquire)) {
+            // 有生产者正在入队
+            return nullptr;
+        }
+        // 只剩最后一个节点，把 stub 放回去才能把它摘下来
+        pushNode(&m_stub);
+        next = tail->mpscNext.load(std::memory_order_acquire);
+        if (next) {
+            m_tail = next;
+            return static_cast<T *>(tail);
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 是否为空，只能由消费者调用，结果是近似的
+     */
+    bool empty() const
+    {
+        return m_tail == &m_stub && !m_stub.mpscNext.load(std::memory_order_acquire);
+    }
+
+private:
+    void pushNode(MpscNode *node)
+    {
+        node->mpscNext.store(nullptr, std::memory_order_relaxed);
+        MpscNode *prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->mpscNext.store(node, std::memory_order_release);
+    }
+
+private:
+    /// 生产者端，和消费者端分开缓存行
+    alignas(64) std::atomic<MpscNode *> m_head;
+    alignas(64) MpscNode *m_tail;
+    MpscNode m_stub;
+};
+
+/**
+ * @brief 有界多生产者多消费者环形队列（Vyukov）
+ * @details 每个槽位带一个序号，生产者/消费者各自只在自己的游标上做一次 CAS，
+ *          满了 push 返回 false，空了 pop 返回 false，都不会阻塞
+ *          参考 http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ * @tparam T 元素类型，需要可默认构造、可移动
+ */
+template <class T>
+class MpmcRing
+{
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量，向上取整为2的幂
+     */
+    explicit MpmcRing(size_t capacity = 1024)
+    {
+        size_t cap = 2;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        m_mask = cap - 1;
+        m_cells.reset(new Cell[cap]);
+        for (size_t i = 0; i < cap; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcRing(const MpmcRing &) = delete;
+    MpmcRing &operator=(const MpmcRing &) = delete;
+
+    /**
+     * @brief 入队
+     * @return 队列满返回 false，item 保持不变
+     */
+    template <class U>
+    bool push(U &&item)
+    {
+        Cell *cell;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::forward<U>(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 出队
+     * @return 队列空返回 false
+     */
+    bool pop(T &item)
+    {
+        Cell *cell;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data);
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 近似大小，仅用于统计和唤醒判断
+     */
+    size_t size() const
+    {
+        size_t e = m_enqueuePos.load(std::memory_order_relaxed);
+        size_t d = m_dequeuePos.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+private:
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_enqueuePos{0};
+    alignas(64) std::atomic<size_t> m_dequeuePos{0};
+};
+
+} // namespace ds
+} // namespace sylar
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef __SYLAR_COMMON_TASK_FUNCTION_H__
+#define __SYLAR_COMMON_TASK_FUNCTION_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sylar {
+
+/**
+ * @brief 只能移动的 void() 回调，调度任务、IO 事件和定时器回调使用
+ * @details std::function 要求可拷贝，libstdc++ 只给 16 字节的内联空间，
+ *          捕获稍多一点的 lambda/std::bind 都会在堆上分配，拷贝一次再分配一次。
+ *          TaskFunction 不支持拷贝，内联 INLINE_SIZE 字节，加上操作表指针整个对象刚好 64 字节；
+ *          放得下且移动不抛异常的可调用对象直接构造在内部，否则才分配到堆上。
+ *          空的 std::function 和空函数指针转换过来仍然是空的。
+ */
+class TaskFunction
+{
+public:
+    /// 内联存储大小
+    static constexpr size_t INLINE_SIZE = 56;
+
+    TaskFunction() noexcept = default;
+
+    TaskFunction(std::nullptr_t) noexcept {}
+
+    /**
+     * @brief 从任意可调用对象构造
+     */
+    template <class F, class D = std::decay_t<F>,
+              class = std::enable_if_t<!std::is_same<D, TaskFunction>::value
+                                       && std::is_invocable_r<void, D &>::value> >
+    TaskFunction(F &&f)
+    {
+        if constexpr (std::is_pointer<D>::value || std::is_member_pointer<D>::value
+                      || IsStdFunction<D>::value) {
+            if (!f) {
+                return;
+            }
+        }
+        if constexpr (IsInline<D>::value) {
+            ::new ((void *)m_buf) D(std::forward<F>(f));
+            m_ops = &InlineOps<D>::OPS;
+        } else {
+            *reinterpret_cast<D **>(m_buf) = new D(std::forward<F>(f));
+            m_ops = &HeapOps<D>::OPS;
+        }
+    }
+
+    TaskFunction(TaskFunction &&rhs) noexcept { moveFrom(rhs); }
+
+    TaskFunction &operator=(TaskFunction &&rhs) noexcept
+    {
+        if (this != &rhs) {
+            reset();
+            moveFrom(rhs);
+        }
+        return *this;
+    }
+
+    TaskFunction &operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    template <class F, class = std::enable_if_t<!std::is_same<std::decay_t<F>, TaskFunction>::value> >
+    TaskFunction &operator=(F &&f)
+    {
+        return *this = TaskFunction(std::forward<F>(f));
+    }
+
+    TaskFunction(const TaskFunction &) = delete;
+    TaskFunction &operator=(const TaskFunction &) = delete;
+
+    ~TaskFunction() { reset(); }
+
+    explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+    /**
+     * @brief 调用，和 std::function 一样 const 对象也按非 const 调用目标
+     */
+    void operator()() const { m_ops->invoke(const_cast<unsigned char *>(m_buf)); }
+
+    void swap(TaskFunction &rhs) noexcept
+    {
+        TaskFunction tmp(std::move(rhs));
+        rhs = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    /**
+     * @brief 可调用对象是否存放在内联空间里(没有堆分配)
+     */
+    bool isInline() const noexcept { return m_ops && m_ops->inlined; }
+
+    /**
+     * @brief 类型 F 能否内联存放
+     */
+    template <class F>
+    static constexpr bool Inlinable()
+    {
+        return IsInline<std::decay_t<F> >::value;
+    }
+
+private:
+    /**
+     * @brief 每个可调用类型一张操作表
+     */
+    struct Ops {
+        void (*invoke)(void *buf);
+        /// 把 src 里的对象移动到 dst，并析构 src 里的对象
+        void (*move)(void *dst, void *src) noexcept;
+        void (*destroy)(void *buf) noexcept;
+        bool inlined;
+    };
+
+    template <class D>
+    struct IsInline
+        : std::integral_constant<bool, sizeof(D) <= INLINE_SIZE
+                                           && alignof(D) <= alignof(std::max_align_t)
+                                           && std::is_nothrow_move_constructible<D>::value> {};
+
+    template <class D>
+    struct IsStdFunction : std::false_type {};
+
+    template <class Sig>
+    struct IsStdFunction<std::function<Sig> > : std::true_type {};
+
+    template <class D>
+    struct InlineOps {
+        static void Invoke(void *buf) { std::invoke(*static_cast<D *>(buf)); }
+        static void Move(void *dst, void *src) noexcept
+        {
+            ::new (dst) D(std::move(*static_cast<D *>(src)));
+            static_cast<D *>(src)->~D();
+        }
+        static void Destroy(void *buf) noexcept { static_cast<D *>(buf)->~D(); }
+        static constexpr Ops OPS = {&Invoke, &Move, &Destroy, true};
+    };
+
+    template <class D>
+    struct HeapOps {
+        static void Invoke(void *buf) { std::invoke(**static_cast<D **>(buf)); }
+        static void Move(void *dst, void *src) noexcept
+        {
+            *static_cast<D **>(dst) = *static_cast<D **>(src);
+        }
+        static void Destroy(void *buf) noexcept { delete *static_cast<D **>(buf); }
+        static constexpr Ops OPS = {&Invoke, &Move, &Destroy, false};
+    };
+
+    void moveFrom(TaskFunction &rhs) noexcept
+    {
+        if (rhs.m_ops) {
+            rhs.m_ops->move(m_buf, rhs.m_buf);
+            m_ops = rhs.m_ops;
+            rhs.m_ops = nullptr;
+        }
+    }
+
+    void reset() noexcept
+    {
+        if (m_ops) {
+            const Ops *ops = m_ops;
+            m_ops = nullptr;
+            ops->destroy(m_buf);
+        }
+    }
+
+private:
+    /// 内联存储，放不下时存放堆上对象的指针
+    alignas(std::max_align_t) unsigned char m_buf[INLINE_SIZE];
+    /// 操作表，nullptr 表示空
+    const Ops *m_ops = nullptr;
+};
+
+inline bool operator==(const TaskFunction &f, std::nullptr_t) noexcept
+{
+    return !f;
+}
+
+inline bool operator!=(const TaskFunction &f, std::nullptr_t) noexcept
+{
+    return static_cast<bool>(f);
+}
+
+} // namespace sylar
+
+#endif
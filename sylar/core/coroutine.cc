@@ -0,0 +1,23 @@
+#include "coroutine.h"
+#include "sylar/core/log/log.h"
+#include "sylar/core/util/util.h"
+
+namespace sylar
+{
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+void detail::DetachedTask::promise_type::unhandled_exception() noexcept
+{
+    try {
+        throw;
+    } catch (std::exception &ex) {
+        SYLAR_LOG_ERROR(g_logger) << "Coroutine Except: " << ex.what() << std::endl
+                                  << sylar::BacktraceToString();
+    } catch (...) {
+        SYLAR_LOG_ERROR(g_logger) << "Coroutine Except" << std::endl
+                                  << sylar::BacktraceToString();
+    }
+}
+
+} // namespace sylar
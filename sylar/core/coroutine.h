@@ -0,0 +1,481 @@
+/**
+ * @file coroutine.h
+ * @brief C++20 无栈协程前端
+ * @details Task<T> 是惰性启动的无栈协程，协程帧在堆上，挂起时不占用协程栈，
+ *          适合大量空闲连接这类场景。协程跑在调度器上：挂起时把恢复动作(一个回调)交给
+ *          IOManager 的事件、定时器或者 FiberSemaphore，唤醒时调度器在自己的回调协程里恢复它。
+ *          用法：
+ *          sylar::Task<int> add(int a, int b) { co_await sylar::CoSleep(10); co_return a + b; }
+ *          sylar::Task<> run() { int v = co_await add(1, 2); ... }
+ *          sylar::CoSpawn(run(), iom);            // 调度到 iom 上执行，不等结果
+ *          int v = sylar::CoWait(add(1, 2));      // 在有栈协程里等协程的结果
+ *          int n = co_await sylar::CoRunInFiber([]() { return blocking_call(); }); // 反过来
+ */
+#ifndef __SYLAR_COROUTINE_H__
+#define __SYLAR_COROUTINE_H__
+
+#include <atomic>
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "sylar/core/common/macro.h"
+#include "sylar/core/fd_manager.h"
+#include "sylar/core/fiber.h"
+#include "sylar/core/iomanager.h"
+#include "sylar/core/mutex.h"
+#include "sylar/core/scheduler.h"
+
+namespace sylar
+{
+
+template <class T = void>
+class Task;
+
+namespace detail
+{
+
+/**
+ * @brief Task 的 promise 公共部分
+ * @details 结束时对称转移到等待它的协程，没有等待者就停在 final_suspend，由 Task 析构时销毁
+ */
+struct TaskPromiseBase {
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            std::coroutine_handle<> next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+    /// 等待这个任务的协程
+    std::coroutine_handle<> continuation;
+    /// 协程体抛出的异常，co_await 时重新抛出
+    std::exception_ptr exception;
+};
+
+template <class T>
+struct TaskPromise : TaskPromiseBase {
+    Task<T> get_return_object() noexcept;
+
+    template <class U>
+    void return_value(U &&v)
+    {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T result()
+    {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result()
+    {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+/**
+ * @brief 独立运行的根协程，结束时自己销毁
+ */
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() noexcept
+        {
+            return DetachedTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept;
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * @brief 恢复协程的回调，调度器/IOManager/定时器唤醒时执行
+ */
+struct ResumeCallback {
+    void operator()() const { handle.resume(); }
+
+    std::coroutine_handle<> handle;
+};
+
+template <class T>
+DetachedTask RunDetached(Task<T> task)
+{
+    co_await std::move(task);
+}
+
+/**
+ * @brief CoWait 的根协程，跑完任务之后把结果交给等待的有栈协程
+ * @details 结果由协程帧和等待者共同持有，等待者挂起期间可能在别的线程上写入
+ */
+template <class T, class Result>
+DetachedTask RunAndNotify(Task<T> task, std::shared_ptr<Result> result)
+{
+    try {
+        if constexpr (std::is_void<T>::value) {
+            co_await std::move(task);
+        } else {
+            result->value.emplace(co_await std::move(task));
+        }
+    } catch (...) {
+        result->exception = std::current_exception();
+    }
+    result->finish();
+}
+
+} // namespace detail
+
+/**
+ * @brief 惰性启动的无栈协程
+ * @details 只能移动。co_await 一个 Task 时才开始执行，执行完对称转移回等待者，不经过调度器。
+ * @tparam T 返回值类型
+ */
+template <class T>
+class Task
+{
+public:
+    typedef detail::TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    Task() noexcept = default;
+
+    explicit Task(handle_type h) noexcept : m_handle(h) {}
+
+    Task(Task &&rhs) noexcept : m_handle(std::exchange(rhs.m_handle, nullptr)) {}
+
+    Task &operator=(Task &&rhs) noexcept
+    {
+        if (this != &rhs) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(rhs.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool valid() const noexcept { return (bool)m_handle; }
+
+    bool done() const noexcept { return !m_handle || m_handle.done(); }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter {
+            bool await_ready() noexcept { return !handle || handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+            {
+                handle.promise().continuation = caller;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().result(); }
+
+            handle_type handle;
+        };
+        return Awaiter{m_handle};
+    }
+
+private:
+    handle_type m_handle;
+};
+
+namespace detail
+{
+
+template <class T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+
+} // namespace detail
+
+/**
+ * @brief 把协程调度到 scheduler 上独立运行，不等结果
+ * @param[in] scheduler 调度器，nullptr 使用当前调度器
+ * @param[in] thread 指定线程，-1 不指定
+ * @details 协程里没有捕获的异常记录日志后丢弃，和有栈协程一致
+ */
+template <class T>
+void CoSpawn(Task<T> task, Scheduler *scheduler = nullptr, int thread = -1)
+{
+    if (!scheduler) {
+        scheduler = Scheduler::GetThis();
+    }
+    SYLAR_ASSERT(scheduler);
+    detail::DetachedTask root = detail::RunDetached(std::move(task));
+    scheduler->schedule(detail::ResumeCallback{root.handle}, thread);
+}
+
+/**
+ * @brief 在有栈协程里等待无栈协程执行完成，返回结果(或者重新抛出异常)
+ * @details 协程在当前协程栈上开始执行，第一次挂起后当前协程让出，
+ *          无栈协程结束时再把当前协程调度回来；中途没有挂起就直接返回，不让出
+ */
+template <class T>
+T CoWait(Task<T> task)
+{
+    struct Result {
+        enum { RUNNING, PARKED, DONE };
+
+        void finish()
+        {
+            // 等待者已经让出才需要调度它回来
+            if (state.exchange(DONE) == PARKED) {
+                scheduler->schedule(fiber);
+            }
+        }
+
+        std::conditional_t<std::is_void<T>::value, std::optional<int>, std::optional<T> > value;
+        std::exception_ptr exception;
+        std::atomic<int> state{RUNNING};
+        Scheduler *scheduler;
+        Fiber::ptr fiber;
+    };
+
+    // 结果放在堆上：等待者挂起期间别的线程会写入它，共享栈协程挂起后栈区域会被别的协程覆盖
+    auto result = std::make_shared<Result>();
+    result->scheduler = Scheduler::GetThis();
+    SYLAR_ASSERT2(result->scheduler, "CoWait must be called in a scheduler fiber");
+    result->fiber = Fiber::GetThis();
+    detail::RunAndNotify(std::move(task), result).handle.resume();
+    int expected = Result::RUNNING;
+    if (result->state.compare_exchange_strong(expected, Result::PARKED)) {
+        Fiber::GetThis()->yield();
+    }
+    result->fiber.reset();
+    if (result->exception) {
+        std::rethrow_exception(result->exception);
+    }
+    if constexpr (!std::is_void<T>::value) {
+        return std::move(*result->value);
+    }
+}
+
+/**
+ * @brief 切换到 scheduler(的 thread 线程)上继续执行
+ */
+struct CoSchedule {
+    explicit CoSchedule(Scheduler *s = nullptr, int t = -1) : scheduler(s), thread(t) {}
+
+    bool await_ready() noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        Scheduler *s = scheduler ? scheduler : Scheduler::GetThis();
+        SYLAR_ASSERT(s);
+        s->schedule(detail::ResumeCallback{h}, thread);
+    }
+
+    void await_resume() noexcept {}
+
+    Scheduler *scheduler;
+    int thread;
+};
+
+/**
+ * @brief 让出执行权，重新排到当前调度器的队列里
+ */
+inline CoSchedule CoYield()
+{
+    return CoSchedule();
+}
+
+/**
+ * @brief 挂起 ms 毫秒，定时器来自当前 IOManager
+ */
+struct CoSleep {
+    explicit CoSleep(uint64_t m) : ms(m) {}
+
+    bool await_ready() noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        IOManager *iom = IOManager::GetThis();
+        SYLAR_ASSERT2(iom, "CoSleep needs an IOManager");
+        iom->addTimer(ms, detail::ResumeCallback{h});
+    }
+
+    void await_resume() noexcept {}
+
+    uint64_t ms;
+};
+
+/**
+ * @brief 等待 fd 上的读/写事件就绪
+ * @details co_await 的结果：就绪或者被取消返回 0；注册失败返回 -1；超时返回 -1，errno 为 ETIMEDOUT
+ */
+struct CoWaitEvent {
+    CoWaitEvent(int f, IOManager::Event e, uint64_t timeout = ~0ull)
+        : fd(f), event(e), timeout_ms(timeout)
+    {
+    }
+
+    bool await_ready() noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        iom = IOManager::GetThis();
+        SYLAR_ASSERT2(iom, "CoWaitEvent needs an IOManager");
+        if (FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd)) {
+            ctx->bindIOManager(iom);
+        }
+        suspended = true;
+        int rt = iom->waitEventAsync(fd, event, timeout_ms, detail::ResumeCallback{h});
+        if (rt == 0) {
+            // 注册成功之后协程随时可能在别的线程恢复，不能再碰这个对象
+            return true;
+        }
+        suspended = false;
+        result = rt < 0 ? -1 : 0;
+        return false;
+    }
+
+    int await_resume()
+    {
+        if (suspended && timeout_ms != ~0ull && iom->eventTimedOut(fd, event)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        return result;
+    }
+
+    int fd;
+    IOManager::Event event;
+    uint64_t timeout_ms;
+    IOManager *iom = nullptr;
+    bool suspended = false;
+    int result = 0;
+};
+
+/**
+ * @brief 获取 FiberSemaphore，拿不到时挂起协程，notify 时恢复
+ */
+struct CoAcquire {
+    explicit CoAcquire(FiberSemaphore &s) : sem(s) {}
+
+    bool await_ready() noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        return sem.waitAsync(Scheduler::GetThis(), detail::ResumeCallback{h});
+    }
+
+    void await_resume() noexcept {}
+
+    FiberSemaphore &sem;
+};
+
+/**
+ * @brief 把 fn 放到有栈协程里执行(可以调用 hook 过的阻塞接口)，执行完恢复当前协程
+ * @details fn 在调度器的回调协程里执行，执行完直接在那个协程里恢复等待者，
+ *          co_await 的结果是 fn 的返回值，fn 抛出的异常在 co_await 处重新抛出
+ */
+template <class F>
+class CoRunInFiber
+{
+public:
+    typedef std::invoke_result_t<F &> result_type;
+
+    explicit CoRunInFiber(F fn, Scheduler *scheduler = nullptr)
+        : m_fn(std::move(fn)), m_scheduler(scheduler)
+    {
+    }
+
+    bool await_ready() noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        Scheduler *s = m_scheduler ? m_scheduler : Scheduler::GetThis();
+        SYLAR_ASSERT(s);
+        m_handle = h;
+        s->schedule([this]() {
+            run();
+            m_handle.resume();
+        });
+    }
+
+    result_type await_resume()
+    {
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+        if constexpr (!std::is_void<result_type>::value) {
+            return std::move(*m_value);
+        }
+    }
+
+private:
+    void run()
+    {
+        try {
+            if constexpr (std::is_void<result_type>::value) {
+                m_fn();
+            } else {
+                m_value.emplace(m_fn());
+            }
+        } catch (...) {
+            m_exception = std::current_exception();
+        }
+    }
+
+private:
+    F m_fn;
+    Scheduler *m_scheduler;
+    std::coroutine_handle<> m_handle;
+    std::conditional_t<std::is_void<result_type>::value, std::optional<int>,
+                       std::optional<result_type> >
+        m_value;
+    std::exception_ptr m_exception;
+};
+
+} // namespace sylar
+
+#endif
@@ -200,7 +200,7 @@ void DAGExecutor::executeTask(const TaskPtr &task)
 
     // 将任务提交到调度器
     if (m_worker) {
-        m_worker->schedule(execute_func);
+        m_worker->schedule(std::move(execute_func), -1, m_priority);
     }
 }
 
@@ -68,6 +68,16 @@ namespace dag
          */
         void setWorker(IOManager::ptr worker);
 
+        /**
+         * @brief 设置任务的调度优先级，默认是后台优先级，不和请求处理争抢调度线程
+         */
+        void setPriority(Scheduler::Priority priority) { m_priority = priority; }
+
+        /**
+         * @brief 获取任务的调度优先级
+         */
+        Scheduler::Priority getPriority() const { return m_priority; }
+
         /**
          * @brief 开始执行DAG
          * @return 是否开始成功
@@ -173,6 +183,7 @@ namespace dag
         std::mutex m_mutex;                       // 互斥锁
         std::condition_variable m_cv;             // 条件变量
         bool m_own_worker{false};                 // 是否拥有调度器的所有权
+        Scheduler::Priority m_priority{Scheduler::BACKGROUND}; // 任务的调度优先级
     };
 
 } // namespace dag
@@ -421,11 +421,13 @@ sylar::Address::ptr DnsManager::getAddress(const std::string &service, bool cach
     }
 
     if (cache) {
-        sylar::IOManager::GetThis()->schedule([service, this]() {
-            Dns::ptr dns = std::make_shared<Dns>(service, Dns::TYPE_DOMAIN);
-            dns->refresh();
-            add(dns);
-        });
+        sylar::IOManager::GetThis()->schedule(
+            [service, this]() {
+                Dns::ptr dns = std::make_shared<Dns>(service, Dns::TYPE_DOMAIN);
+                dns->refresh();
+                add(dns);
+            },
+            -1, sylar::Scheduler::BACKGROUND);
     }
 
     return sylar::Address::LookupAny(service, sylar::Socket::IPv4, sylar::Socket::TCP);
@@ -440,11 +442,13 @@ sylar::Socket::ptr DnsManager::getSocket(const std::string &service, bool cache,
     }
 
     if (cache) {
-        sylar::IOManager::GetThis()->schedule([service, this]() {
-            Dns::ptr dns = std::make_shared<Dns>(service, Dns::TYPE_DOMAIN, 1);
-            dns->refresh();
-            add(dns);
-        });
+        sylar::IOManager::GetThis()->schedule(
+            [service, this]() {
+                Dns::ptr dns = std::make_shared<Dns>(service, Dns::TYPE_DOMAIN, 1);
+                dns->refresh();
+                add(dns);
+            },
+            -1, sylar::Scheduler::BACKGROUND);
     }
     auto addr = sylar::Address::LookupAny(service, sylar::Socket::IPv4, sylar::Socket::TCP);
     sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
@@ -471,13 +475,19 @@ void DnsManager::init()
     m_lastUpdateTime = time(0);
 }
 
-// 启动 1s 周期的刷新定时器
+// 启动 1s 周期的刷新定时器，刷新是阻塞的解析，放到后台优先级，不挡住请求协程
 void DnsManager::start()
 {
     if (m_timer) {
         return;
     }
-    m_timer = sylar::IOManager::GetThis()->addTimer(1000, std::bind(&DnsManager::init, this), true);
+    m_timer = sylar::IOManager::GetThis()->addTimer(
+        1000,
+        [this]() {
+            sylar::IOManager::GetThis()->schedule(std::bind(&DnsManager::init, this), -1,
+                                                  sylar::Scheduler::BACKGROUND);
+        },
+        true);
 }
 
 // 打印当前管理器快照
@@ -0,0 +1,314 @@
+#ifndef __SYLAR_DS_TIMING_WHEEL_H__
+#define __SYLAR_DS_TIMING_WHEEL_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace sylar {
+namespace ds {
+
+/**
+ * @brief TimingWheel 的侵入式节点
+ * @details 需要挂到时间轮上的类型继承该节点。拷贝时不带走链表指针
+ */
+struct TimingWheelNode {
+    TimingWheelNode() {}
+    TimingWheelNode(const TimingWheelNode &) {}
+    TimingWheelNode &operator=(const TimingWheelNode &) { return *this; }
+
+    /// 是否挂在时间轮上
+    bool wheelLinked() const { return wheelSlot >= 0; }
+
+    /// 到期时间(绝对毫秒)
+    uint64_t wheelExpire = 0;
+    TimingWheelNode *wheelPrev = nullptr;
+    TimingWheelNode *wheelNext = nullptr;
+    /// 所在槽位，-1 表示不在时间轮上
+    int wheelSlot = -1;
+};
+
+/**
+ * @brief 分层时间轮，不加锁，由调用方保证互斥
+ * @details 第 0 层 256 个槽，每槽 1ms；之后 4 层各 64 个槽，每槽分别是
+ *          256ms、16s、17min、18h，最多覆盖约 49 天，更远的节点先挂在最高层，级联时重新计算。
+ *          节点用侵入式双向链表挂在槽上，插入/删除 O(1)，不分配内存。
+ *          m_current 走到上层槽的边界时，把上层对应槽里的节点重新插入（级联）到下层。
+ *          每层用位图记录非空的槽，推进和计算最近到期时间时跳过空槽。
+ */
+class TimingWheel
+{
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] now_ms 当前时间(毫秒)
+     */
+    explicit TimingWheel(uint64_t now_ms) : m_current(now_ms) {}
+
+    TimingWheel(const TimingWheel &) = delete;
+    TimingWheel &operator=(const TimingWheel &) = delete;
+
+    size_t size() const { return m_size; }
+
+    bool empty() const { return m_size == 0; }
+
+    /**
+     * @brief 插入节点，已经过期的节点在下一次 expire 时取出
+     * @pre node 不在任何时间轮上
+     */
+    void insert(TimingWheelNode *node, uint64_t expire)
+    {
+        node->wheelExpire = expire;
+        link(node, slotOf(expire));
+        ++m_size;
+    }
+
+    /**
+     * @brief 删除节点，不在时间轮上返回 false
+     */
+    bool erase(TimingWheelNode *node)
+    {
+        if (!node->wheelLinked()) {
+            return false;
+        }
+        unlink(node);
+        --m_size;
+        return true;
+    }
+
+    /**
+     * @brief 最近的到期时间(绝对毫秒)，可以是偏早的估计，没有节点返回 ~0ull
+     */
+    uint64_t next() const
+    {
+        if (!m_size) {
+            return ~0ull;
+        }
+        // 第 0 层的槽对应精确的到期时间，从当前槽开始，绕一圈
+        size_t idx = m_current & ROOT_MASK;
+        uint64_t base = m_current & ~(uint64_t)ROOT_MASK;
+        int slot = findRoot(idx);
+        if (slot >= 0) {
+            return base + slot;
+        }
+        uint64_t next = ~0ull;
+        slot = findRoot(0);
+        if (slot >= 0) {
+            next = base + ROOT_SLOTS + slot;
+        }
+        // 上层的槽只知道级联的时间，是到期时间的下界
+        for (int level = 1; level < LEVELS; ++level) {
+            uint64_t bits = m_bits[LevelWord(level)];
+            if (!bits) {
+                continue;
+            }
+            int shift = LevelShift(level);
+            unsigned cur = (m_current >> shift) & LEVEL_MASK;
+            // 循环右移 cur + 1 位，最低位就是下一个槽
+            unsigned n = cur + 1;
+            uint64_t r = n == LEVEL_SLOTS ? bits : ((bits >> n) | (bits << (LEVEL_SLOTS - n)));
+            uint64_t dist = __builtin_ctzll(r) + 1;
+            next = std::min(next, ((m_current >> shift) + dist) << shift);
+        }
+        return next;
+    }
+
+    /**
+     * @brief 推进到 now_ms，取出所有到期的节点
+     * @param[in] cb 对每个到期节点调用 cb(TimingWheelNode *)，调用时节点已经摘下；
+     *               cb 里不能再操作时间轮
+     * @details 时间被往回调时，按新的时间把所有节点重新挂一遍
+     */
+    template <class F>
+    void expire(uint64_t now_ms, F cb)
+    {
+        if (now_ms + 1 < m_current) {
+            rebase(now_ms);
+        }
+        while (m_size && m_current <= now_ms) {
+            size_t idx = m_current & ROOT_MASK;
+            if (idx == 0) {
+                cascade();
+            }
+            TimingWheelNode *node = m_slots[idx];
+            while (node) {
+                TimingWheelNode *next = node->wheelNext;
+                unlink(node);
+                --m_size;
+                cb(node);
+                node = next;
+            }
+            // 跳到下一个非空的槽，或者下一个需要级联的边界，但不超过 now_ms + 1
+            int slot = findRoot(idx + 1);
+            uint64_t target = (m_current & ~(uint64_t)ROOT_MASK) + (slot >= 0 ? slot : ROOT_SLOTS);
+            m_current = std::min(target, now_ms + 1);
+        }
+        if (m_current <= now_ms) {
+            m_current = now_ms + 1;
+        }
+    }
+
+    /**
+     * @brief 取出全部节点
+     * @param[in] cb 同 expire
+     */
+    template <class F>
+    void clear(F cb)
+    {
+        for (size_t slot = 0; slot < SLOTS; ++slot) {
+            while (m_slots[slot]) {
+                TimingWheelNode *node = m_slots[slot];
+                unlink(node);
+                --m_size;
+                cb(node);
+            }
+        }
+    }
+
+private:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 5;
+    static const size_t ROOT_SLOTS = 1 << ROOT_BITS;
+    static const size_t LEVEL_SLOTS = 1 << LEVEL_BITS;
+    static const size_t ROOT_MASK = ROOT_SLOTS - 1;
+    static const size_t LEVEL_MASK = LEVEL_SLOTS - 1;
+    static const size_t SLOTS = ROOT_SLOTS + (LEVELS - 1) * LEVEL_SLOTS;
+
+    /// 第 level 层(>=1)每个槽覆盖 2^shift 毫秒
+    static int LevelShift(int level) { return ROOT_BITS + (level - 1) * LEVEL_BITS; }
+    /// 第 level 层(>=1)的第一个槽在 m_slots 中的下标
+    static size_t LevelBase(int level) { return ROOT_SLOTS + (level - 1) * LEVEL_SLOTS; }
+    /// 第 level 层(>=1)在位图中的下标，上层每层正好一个 uint64_t
+    static size_t LevelWord(int level) { return LevelBase(level) / 64; }
+
+    /**
+     * @brief 根据到期时间和 m_current 计算槽位
+     */
+    size_t slotOf(uint64_t expire) const
+    {
+        expire = std::max(expire, m_current);
+        uint64_t delta = expire - m_current;
+        if (delta < ROOT_SLOTS) {
+            return expire & ROOT_MASK;
+        }
+        int level = 1;
+        while (level < LEVELS - 1 && delta >> (LevelShift(level) + LEVEL_BITS)) {
+            ++level;
+        }
+        int shift = LevelShift(level);
+        uint64_t span = 1ull << (shift + LEVEL_BITS);
+        if (delta >= span) {
+            // 超出时间轮范围，挂在最高层最远的槽上，级联时再算
+            expire = m_current + span - 1;
+        }
+        return LevelBase(level) + ((expire >> shift) & LEVEL_MASK);
+    }
+
+    void link(TimingWheelNode *node, size_t slot)
+    {
+        node->wheelSlot = slot;
+        node->wheelPrev = nullptr;
+        node->wheelNext = m_slots[slot];
+        if (m_slots[slot]) {
+            m_slots[slot]->wheelPrev = node;
+        }
+        m_slots[slot] = node;
+        m_bits[slot / 64] |= 1ull << (slot % 64);
+    }
+
+    void unlink(TimingWheelNode *node)
+    {
+        size_t slot = node->wheelSlot;
+        if (node->wheelPrev) {
+            node->wheelPrev->wheelNext = node->wheelNext;
+        } else {
+            m_slots[slot] = node->wheelNext;
+        }
+        if (node->wheelNext) {
+            node->wheelNext->wheelPrev = node->wheelPrev;
+        }
+        if (!m_slots[slot]) {
+            m_bits[slot / 64] &= ~(1ull << (slot % 64));
+        }
+        node->wheelPrev = node->wheelNext = nullptr;
+        node->wheelSlot = -1;
+    }
+
+    /**
+     * @brief m_current 走到第 0 层的边界，逐层把上层当前槽里的节点重新插入
+     */
+    void cascade()
+    {
+        for (int level = 1; level < LEVELS; ++level) {
+            int shift = LevelShift(level);
+            size_t idx = (m_current >> shift) & LEVEL_MASK;
+            size_t slot = LevelBase(level) + idx;
+            TimingWheelNode *node = m_slots[slot];
+            while (node) {
+                TimingWheelNode *next = node->wheelNext;
+                unlink(node);
+                link(node, slotOf(node->wheelExpire));
+                node = next;
+            }
+            // 还没走到上一层的边界
+            if (idx) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief 时间往回调了，把所有节点摘下来串成单链表，再按新的时间挂回去
+     */
+    void rebase(uint64_t now_ms)
+    {
+        TimingWheelNode *head = nullptr;
+        for (size_t slot = 0; slot < SLOTS; ++slot) {
+            while (m_slots[slot]) {
+                TimingWheelNode *node = m_slots[slot];
+                unlink(node);
+                node->wheelNext = head;
+                head = node;
+            }
+        }
+        m_current = now_ms;
+        while (head) {
+            TimingWheelNode *node = head;
+            head = head->wheelNext;
+            link(node, slotOf(node->wheelExpire));
+        }
+    }
+
+    /**
+     * @brief 第 0 层 [from, ROOT_SLOTS) 中第一个非空的槽，没有返回 -1
+     */
+    int findRoot(size_t from) const
+    {
+        for (size_t w = from / 64; w < ROOT_SLOTS / 64; ++w) {
+            uint64_t bits = m_bits[w];
+            if (w == from / 64) {
+                bits &= ~0ull << (from % 64);
+            }
+            if (bits) {
+                return w * 64 + __builtin_ctzll(bits);
+            }
+        }
+        return -1;
+    }
+
+private:
+    /// 下一个要处理的毫秒
+    uint64_t m_current;
+    /// 节点个数
+    size_t m_size = 0;
+    /// 每个槽的链表头
+    TimingWheelNode *m_slots[SLOTS] = {nullptr};
+    /// 非空槽位图
+    uint64_t m_bits[SLOTS / 64] = {0};
+};
+
+} // namespace ds
+} // namespace sylar
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef __SYLAR_DS_WORK_STEAL_QUEUE_H__
+#define __SYLAR_DS_WORK_STEAL_QUEUE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+namespace sylar {
+namespace ds {
+
+/**
+ * @brief 有界 Chase-Lev 工作窃取队列
+ * @details 单生产者(owner)多消费者：
+ *          owner 线程在 bottom 端 push/pop（LIFO，缓存友好），
+ *          其他线程在 top 端 steal（FIFO，先拿最老的任务）。
+ *          队列满时 push 返回 false，由调用方溢出到全局队列。
+ *          参考 "Correct and Efficient Work-Stealing for Weak Memory Models"(Lê et al. 2013)
+ * @tparam T 元素类型，必须是指针（槽位需要原子读写）
+ */
+template <class T>
+class WorkStealQueue
+{
+public:
+    static_assert(std::is_pointer<T>::value, "WorkStealQueue only holds pointers");
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量，向上取整为2的幂
+     */
+    explicit WorkStealQueue(size_t capacity = 256)
+    {
+        size_t cap = 2;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        m_capacity = cap;
+        m_mask = cap - 1;
+        m_buffer.reset(new std::atomic<T>[cap]);
+        for (size_t i = 0; i < cap; ++i) {
+            m_buffer[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief owner 线程压入元素
+     * @return 队列已满返回 false
+     */
+    bool push(T item)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        if (b - t >= (int64_t)m_capacity) {
+            return false;
+        }
+        m_buffer[b & m_mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief owner 线程从 bottom 端弹出（LIFO）
+     * @return 队列为空返回 nullptr
+     */
+    T pop()
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if (t > b) {
+            // 空队列，恢复 bottom
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T item = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // 最后一个元素，和窃取者竞争
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    /**
+     * @brief 其他线程从 top 端窃取（FIFO）
+     * @return 队列为空或竞争失败返回 nullptr
+     */
+    T steal()
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        T item = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    /**
+     * @brief 近似大小，仅用于统计和唤醒判断
+     */
+    size_t size() const
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? (size_t)(b - t) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_t capacity() const { return m_capacity; }
+
+private:
+    /// 窃取端，单独占一条缓存行，避免和 owner 的 bottom 伪共享
+    alignas(64) std::atomic<int64_t> m_top{0};
+    alignas(64) std::atomic<int64_t> m_bottom{0};
+    size_t m_capacity;
+    size_t m_mask;
+    std::unique_ptr<std::atomic<T>[]> m_buffer;
+};
+
+} // namespace ds
+} // namespace sylar
+
+#endif
@@ -8,6 +8,7 @@
 #include "sylar/core/log/log.h"
 #include "sylar/core/util/util.h"
 #include "hook.h"
+#include "sylar/core/iomanager.h"
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
@@ -104,6 +105,18 @@ int FdCtx::getTimeout(int type)
     }
 }
 
+void FdCtx::bindIOManager(IOManager *iom)
+{
+    IOManager *old = m_iom.load(std::memory_order_acquire);
+    if (old == iom) {
+        return;
+    }
+    old = m_iom.exchange(iom, std::memory_order_acq_rel);
+    if (old && old != iom) {
+        IOManager::ReleaseFd(old, m_fd, false);
+    }
+}
+
 FdManager::FdManager()
 {
     m_datas.resize(64);
@@ -1,6 +1,7 @@
 #ifndef __SYLAR_FD_MANAGER_H__
 #define __SYLAR_FD_MANAGER_H__
 
+#include <atomic>
 #include <vector>
 #include <memory>
 #include "mutex.h"
@@ -9,6 +10,8 @@
 namespace sylar
 {
 
+class IOManager;
+
 class FdCtx : public std::enable_shared_from_this<FdCtx>
 {
 public:
@@ -46,6 +49,18 @@ public:
      */
     int getTimeout(int type);
 
+    /**
+     * @brief 最后一次在哪个 IOManager 上等待，关闭时在它上面 cancelAll
+     */
+    IOManager *getIOManager() const { return m_iom.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 在 iom 上等待之前调用
+     * @details 持久注册模式下 fd 在等待它的 IOManager 上注册，换到别的 IOManager 时从原来的上面注销，
+     *          否则原来的 IOManager 会被这个 fd 的每次就绪唤醒
+     */
+    void bindIOManager(IOManager *iom);
+
 private:
     bool m_isInit : 1;
     bool m_isSocket : 1;
@@ -55,6 +70,7 @@ private:
     int m_fd;
     uint64_t m_recvTimeout; // 读超时时间毫秒
     uint64_t m_sendTimeout; // 写超时时间毫秒
+    std::atomic<IOManager *> m_iom{nullptr}; // 最后一次等待的 IOManager
 };
 
 class FdManager
@@ -6,7 +6,7 @@
 #include "sylar/core/config/config.h"
 #include "sylar/core/common/macro.h"
 #include "scheduler.h"
-#include "sylar/core/memory/memorypool.h"
+#include "sylar/core/memory/stack_pool.h"
 
 namespace sylar
 {
@@ -24,28 +24,172 @@ static thread_local Fiber::ptr t_thread_fiber{nullptr};
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
+static ConfigVar<uint32_t>::ptr g_stack_class_small = Config::Lookup<uint32_t>(
+    "fiber.stack_class.small", 32 * 1024, "fiber stack size of Fiber::STACK_SMALL");
+
+static ConfigVar<uint32_t>::ptr g_stack_class_medium = Config::Lookup<uint32_t>(
+    "fiber.stack_class.medium", 128 * 1024, "fiber stack size of Fiber::STACK_MEDIUM");
+
+static ConfigVar<uint32_t>::ptr g_stack_class_large = Config::Lookup<uint32_t>(
+    "fiber.stack_class.large", 512 * 1024, "fiber stack size of Fiber::STACK_LARGE");
+
+static ConfigVar<uint32_t>::ptr g_shared_stack_size = Config::Lookup<uint32_t>(
+    "fiber.shared_stack.size", 1024 * 1024, "fiber shared stack size");
+
+static ConfigVar<uint32_t>::ptr g_shared_stack_count = Config::Lookup<uint32_t>(
+    "fiber.shared_stack.count", 4, "fiber shared stack count per thread");
+
+/**
+ * @brief 线程共享栈
+ */
+struct SharedStack {
+    char *stack = nullptr;
+    size_t size = 0;
+    /// 当前栈上的协程
+    Context *occupant = nullptr;
+};
+
+/**
+ * @brief 线程的共享栈集合，第一次使用时创建，线程退出时归还
+ */
+class SharedStackSet
+{
+public:
+    ~SharedStackSet()
+    {
+        for (auto &i : m_stacks) {
+            FiberStackPool::Deallocate(i.stack, i.size);
+        }
+    }
+
+    /**
+     * @brief 轮流分配，让挂起的协程均匀分布，减少切换时的拷贝
+     */
+    SharedStack *next()
+    {
+        if (m_stacks.empty()) {
+            size_t count = std::max(g_shared_stack_count->getValue(), 1u);
+            m_stacks.resize(count);
+            for (auto &i : m_stacks) {
+                i.size = g_shared_stack_size->getValue();
+                i.stack = FiberStackPool::Allocate(i.size);
+                SYLAR_ASSERT2(i.stack, "alloc shared stack failed, size=" << i.size);
+            }
+        }
+        return &m_stacks[m_next++ % m_stacks.size()];
+    }
+
+private:
+    std::vector<SharedStack> m_stacks;
+    size_t m_next = 0;
+};
+
+static thread_local SharedStackSet t_shared_stacks;
+
+/// 共享栈每次切换都要校验线程，缓存一下线程id，避免每次都走系统调用
+static int CurrentThreadId()
+{
+    static thread_local int t_tid = GetThreadId();
+    return t_tid;
+}
+
 // 上下文
-Context::Context(fn_t fn, intptr_t vp, std::size_t stackSize) : fn_(fn), vp_(vp)
+Context::Context(fn_t fn, intptr_t vp, std::size_t stackSize, bool sharedStack)
+    : fn_(fn), vp_(vp)
 {
-    stackSize_ = stackSize_ ? stackSize : g_fiber_stack_size->getValue();
-    stack_ = (char *)::malloc(stackSize_);
+    if (sharedStack) {
+        // 共享栈延迟到第一次切入时绑定，这样协程可以在任意线程开始运行
+        shared_ = true;
+        fresh_ = true;
+        return;
+    }
+    size_t size = stackSize ? stackSize : g_fiber_stack_size->getValue();
+    // 从线程栈池取，保护页在栈池 mmap 时已经设置好（低地址处）
+    stack_ = FiberStackPool::Allocate(size);
+    SYLAR_ASSERT2(stack_, "alloc fiber stack failed, size=" << size);
+    stackSize_ = size;
 
-    // malloc分配的堆地址，但是实际协程会模拟为栈（从高地址开始使用空间）
+    // 实际协程会模拟为栈（从高地址开始使用空间）
     ctx_ = libgo_make_fcontext(stack_ + stackSize_, stackSize_, fn_);
-
-    // 设置保护页（设置在低地址处）
-    SYLAR_MALLOC_PROTECT(stack_, stackSize_);
 }
 
 Context::~Context()
 {
-    if (stack_) {
-        SYLAR_MALLOC_UNPROTECT(stack_);
-        SYLAR_THREAD_FREE(stack_, stackSize_);
+    if (shared_) {
+        if (sharedStack_ && sharedStack_->occupant == this && thread_ == CurrentThreadId()) {
+            sharedStack_->occupant = nullptr;
+        }
+        free(saved_);
+        saved_ = nullptr;
+        stack_ = nullptr;
+    } else if (stack_) {
+        FiberStackPool::Deallocate(stack_, stackSize_);
         stack_ = nullptr;
     }
 }
 
+void Context::reset()
+{
+    if (shared_) {
+        fresh_ = true;
+        return;
+    }
+    ctx_ = libgo_make_fcontext(stack_ + stackSize_, stackSize_, fn_);
+}
+
+void Context::switchIn()
+{
+    if (!sharedStack_) {
+        sharedStack_ = t_shared_stacks.next();
+        stack_ = sharedStack_->stack;
+        stackSize_ = sharedStack_->size;
+        thread_ = CurrentThreadId();
+    }
+    SYLAR_ASSERT2(thread_ == CurrentThreadId(),
+                  "shared stack fiber must run on thread " << thread_);
+
+    Context *occupant = sharedStack_->occupant;
+    if (occupant != this) {
+        if (occupant) {
+            occupant->saveStack();
+        }
+        sharedStack_->occupant = this;
+        if (!fresh_ && savedSize_) {
+            memcpy(stack_ + stackSize_ - savedSize_, saved_, savedSize_);
+        }
+    }
+    if (fresh_) {
+        ctx_ = libgo_make_fcontext(stack_ + stackSize_, stackSize_, fn_);
+        fresh_ = false;
+    }
+}
+
+void Context::saveStack()
+{
+    // 挂起时 ctx_ 就是切出那一刻的栈顶，往上到栈底都是在用的
+    size_t used = stack_ + stackSize_ - (char *)ctx_;
+    if (savedCap_ < used || savedCap_ > used * 2) {
+        free(saved_);
+        saved_ = (char *)malloc(used);
+        SYLAR_ASSERT2(saved_, "save shared stack failed, size=" << used);
+        savedCap_ = used;
+    }
+    memcpy(saved_, ctx_, used);
+    savedSize_ = used;
+}
+
+void Context::releaseSharedStack()
+{
+    // 仍运行在共享栈上，但切走之前不会再有别的协程用到它
+    if (sharedStack_ && sharedStack_->occupant == this) {
+        sharedStack_->occupant = nullptr;
+    }
+    free(saved_);
+    saved_ = nullptr;
+    savedSize_ = 0;
+    savedCap_ = 0;
+}
+
 // 主协程
 Fiber::Fiber()
 {
@@ -56,9 +200,12 @@ Fiber::Fiber()
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber() main id = " << m_id;
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
-    : m_id(s_fiber_id++), m_ctx(&Fiber::MainFunc, (intptr_t)(this), stacksize), m_cb(cb),
-      m_runInScheduler(run_in_scheduler)
+Fiber::Fiber(TaskFunction cb, size_t stacksize, bool run_in_scheduler, bool shared_stack,
+             std::source_location site)
+    : m_id(s_fiber_id++), m_ctx(&Fiber::MainFunc, (intptr_t)(this), stacksize, shared_stack),
+      m_cb(std::move(cb)),
+      m_runInScheduler(run_in_scheduler),
+      m_site(site)
 {
     ++s_fiber_count;
     // SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber() id = " << m_id;
@@ -86,12 +233,15 @@ Fiber::~Fiber()
     // SYLAR_LOG_DEBUG(g_logger) << "Fiber::~Fiber id=" << m_id << " total=" << s_fiber_count;
 }
 
-void Fiber::reset(std::function<void()> cb)
+void Fiber::reset(TaskFunction cb, std::source_location site)
 {
     SYLAR_ASSERT(m_ctx.hasStack());
     SYLAR_ASSERT(m_state == TERM);
 
-    m_cb = cb;
+    m_locals.clear();
+    m_cb = std::move(cb);
+    m_site = site;
+    m_ctx.reset();
     m_state = READY;
 }
 
@@ -111,6 +261,15 @@ void Fiber::resume()
     } else { // t_thread_fiber --> t_scheduler_fiber
         t_thread_fiber->m_ctx.SwapTo(m_ctx);
     }
+    // 回到这里时协程的上下文已经保存好了，这时才能让别的线程 resume 它
+    if (m_state == RUNNING) {
+        m_state = READY;
+    } else if (m_state == TERM && !m_ctx.isSharedStack() && FiberStackWatermark::IsEnabled()) {
+        // 已经切回了调度协程的栈，执行完的协程栈可以放心扫描和清 0
+        FiberStackWatermark::Record(
+            m_site, m_ctx.getStackSize(),
+            FiberStackWatermark::Measure(m_ctx.getStackAddr(), m_ctx.getStackSize()));
+    }
 }
 
 /**
@@ -123,15 +282,14 @@ void Fiber::yield()
     SYLAR_ASSERT(m_state == TERM || m_state == RUNNING) // 当前子协程可以是 TERM，RUNNING
     SetThis(t_thread_fiber.get());
 
-    if (m_state != TERM) { // 如果没有结束，中途进行yield，状态设置为READY，可能还会回来继续执行。
-        m_state = READY;
-    }
+    // 如果没有结束，中途进行yield，可能还会回来继续执行。状态由 resume 在切换完成之后设置为 READY，
+    // 在这之前其他线程(比如 IO 事件就绪后调度了这个协程)看到的一直是 RUNNING，不会提前 resume
 
     if (m_runInScheduler) { // 同 resume()   t_fiber --> t_scheduler_fiber
-        m_ctx.SwapTo(Scheduler::GetMainFiber()->m_ctx);
+        m_ctx.SwapTo(Scheduler::GetMainFiber()->m_ctx, m_state == TERM);
 
     } else { // t_scheduler_fiber --> t_thread_fiber
-        m_ctx.SwapTo(t_thread_fiber->m_ctx);
+        m_ctx.SwapTo(t_thread_fiber->m_ctx, m_state == TERM);
     }
 }
 
@@ -167,6 +325,8 @@ void Fiber::MainFunc(intptr_t vp)
     try {
         cur->m_cb();
         cur->m_cb = nullptr;
+        // 协程局部变量在协程自己的上下文里析构(析构函数里还可能让出)，复用的协程不会看到上一个任务的值
+        cur->m_locals.clear();
         cur->m_state = TERM;
     } catch (std::exception &ex) {
         SYLAR_LOG_ERROR(g_logger) << "Fiber Except: " << ex.what() << " fiber_id=" << cur->getId()
@@ -182,6 +342,40 @@ void Fiber::MainFunc(intptr_t vp)
     raw_ptr->yield();
 }
 
+FiberLocalStorage *GetFiberLocals()
+{
+    if (SYLAR_LIKELY(t_fiber)) {
+        return &t_fiber->getLocals();
+    }
+    return &Fiber::GetThis()->getLocals();
+}
+
+size_t Fiber::GetStackSize(StackClass stack_class)
+{
+    switch (stack_class) {
+        case STACK_SMALL:
+            return g_stack_class_small->getValue();
+        case STACK_MEDIUM:
+            return g_stack_class_medium->getValue();
+        case STACK_LARGE:
+            return g_stack_class_large->getValue();
+        default:
+            return g_fiber_stack_size->getValue();
+    }
+}
+
+Fiber::StackClass Fiber::ParseStackClass(const std::string &name)
+{
+    if (name == "small") {
+        return STACK_SMALL;
+    } else if (name == "medium") {
+        return STACK_MEDIUM;
+    } else if (name == "large") {
+        return STACK_LARGE;
+    }
+    return STACK_DEFAULT;
+}
+
 uint64_t Fiber::GetFiberId()
 {
     if (t_fiber) {
@@ -1,10 +1,16 @@
 #ifndef __SYLAR_FIBER_H__
 #define __SYLAR_FIBER_H__
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <source_location>
+#include <string>
 #include <ucontext.h>
 #include <cstring>
 
+#include "sylar/core/common/task_function.h"
+#include "sylar/core/fiber_local.h"
+
 namespace sylar
 {
 
@@ -21,29 +27,99 @@ extern "C"
 
 } // extern "C
 
+struct SharedStack;
+
+/**
+ * @brief 协程上下文
+ * @details 私有栈模式：构造时从栈池取一块独占的栈。
+ *          共享栈模式：第一次切入时绑定当前线程的一块共享栈，之后只能在这个线程上运行。
+ *          切入时如果共享栈被别的协程占着，先把占用者已用的部分（栈顶到 sp）拷出去，
+ *          再把自己之前拷出的内容拷回来。挂起的协程只占用实际用到的那部分内存。
+ */
 class Context
 {
 public:
     Context() = default;
 
-    Context(fn_t fn, intptr_t vp, std::size_t stackSize);
+    /**
+     * @param[in] fn 入口函数
+     * @param[in] vp 入口参数
+     * @param[in] stackSize 私有栈大小，0 表示用 fiber.stack_size，共享栈模式下忽略
+     * @param[in] sharedStack 是否使用共享栈
+     */
+    Context(fn_t fn, intptr_t vp, std::size_t stackSize, bool sharedStack = false);
 
     ~Context();
 
-    bool hasStack() { return stack_ != nullptr; }
+    /**
+     * @brief 复用栈空间，重新生成入口上下文
+     */
+    void reset();
+
+    bool hasStack() const { return stack_ != nullptr || shared_; }
 
     char *getStackAddr() const { return stack_; }
     uint32_t getStackSize() const { return stackSize_; }
 
-    void SwapTo(Context &other) { libgo_jump_fcontext(&ctx_, other.ctx_, other.vp_); }
+    bool isSharedStack() const { return shared_; }
+
+    /**
+     * @brief 共享栈协程绑定的线程id，还没运行过或者私有栈返回 -1
+     */
+    int getThread() const { return thread_; }
+
+    /**
+     * @brief 共享栈协程挂起时拷出的字节数
+     */
+    size_t getSavedSize() const { return savedSize_; }
+
+    /**
+     * @brief 切换到 other
+     * @param[in] finished 当前上下文是否已经执行完，执行完的共享栈协程直接让出共享栈，不用拷出
+     */
+    void SwapTo(Context &other, bool finished = false)
+    {
+        if (shared_ && finished) {
+            releaseSharedStack();
+        }
+        if (other.shared_) {
+            other.switchIn();
+        }
+        libgo_jump_fcontext(&ctx_, other.ctx_, other.vp_);
+    }
 
 private:
-    fcontext_t ctx_;
+    /**
+     * @brief 切入前占用共享栈，必要时拷出原占用者、拷回自己
+     */
+    void switchIn();
+
+    /**
+     * @brief 把已用的栈拷出到 saved_
+     */
+    void saveStack();
+
+    void releaseSharedStack();
+
+private:
+    fcontext_t ctx_ = nullptr;
     fn_t fn_;
     intptr_t vp_;
     char *stack_ = nullptr;
     uint32_t stackSize_ = 0;
     int protectPage_ = 0;
+
+    /// 是否共享栈
+    bool shared_ = false;
+    /// 共享栈下次切入时需要重新生成入口上下文
+    bool fresh_ = false;
+    /// 绑定的线程
+    int thread_ = -1;
+    SharedStack *sharedStack_ = nullptr;
+    /// 挂起时拷出的栈内容
+    char *saved_ = nullptr;
+    size_t savedSize_ = 0;
+    size_t savedCap_ = 0;
 };
 
 /**
@@ -71,6 +147,23 @@ public:
         TERM
     };
 
+    /**
+     * @brief 栈大小档位
+     * @details 大部分协程(定时器回调、简单的请求处理)用不了 fiber.stack_size 那么多栈，
+     *          按 fiber.stack_watermark 统计到的各创建位置的用量选档位，省下内存
+     */
+    enum StackClass {
+        /// fiber.stack_size
+        STACK_DEFAULT = 0,
+        /// fiber.stack_class.small
+        STACK_SMALL,
+        /// fiber.stack_class.medium
+        STACK_MEDIUM,
+        /// fiber.stack_class.large
+        STACK_LARGE,
+        STACK_CLASS_COUNT
+    };
+
 private:
     /**
      * @brief 构造函数
@@ -85,18 +178,23 @@ public:
      * @param[in] cb 协程入口函数
      * @param[in] stacksize 栈大小
      * @param[in] run_in_scheduler 本协程是否参与调度器调度，默认为true
+     * @param[in] shared_stack 是否使用共享栈，适合长时间挂起的连接协程，
+     *            第一次运行后只能在该线程上继续调度
+     * @param[in] site 创建位置，栈用量按它汇总
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+    Fiber(TaskFunction cb, size_t stacksize = 0, bool run_in_scheduler = true,
+          bool shared_stack = false, std::source_location site = std::source_location::current());
 
     /**
      * @brief 析构函数
      */
     ~Fiber();
     /**
-     * @brief 重置协程状态和入口函数，复用栈空间，不重新创建栈
+     * @brief 重置协程状态和入口函数，复用栈空间，不重新创建栈，协程局部变量清空
      * @param[] cb 
+     * @param[in] site 新的创建位置
      */
-    void reset(std::function<void()> cb);
+    void reset(TaskFunction cb, std::source_location site = std::source_location::current());
     /**
      * @brief 将当前协程切到到执行状态
      * @details 当前协程和正在运行的协程进行交换，前者状态变为RUNNING，后者状态变为READY
@@ -117,6 +215,14 @@ public:
     State getState() const { return m_state; }
     void setState(State state) { m_state = state; }
     const Context &getContext() const { return m_ctx; }
+    /**
+     * @brief 创建位置
+     */
+    const std::source_location &getSite() const { return m_site; }
+    /**
+     * @brief 协程局部变量
+     */
+    FiberLocalStorage &getLocals() { return m_locals; }
 
 public:
     /**
@@ -143,18 +249,31 @@ public:
      * @brief 获取当前协程id
      */
     static uint64_t GetFiberId();
+    /**
+     * @brief 栈大小档位对应的栈大小
+     */
+    static size_t GetStackSize(StackClass stack_class);
+    /**
+     * @brief 按名字(default/small/medium/large)解析栈大小档位，不认识的名字返回 STACK_DEFAULT
+     */
+    static StackClass ParseStackClass(const std::string &name);
 
 private:
     /// 协程id
     uint64_t m_id = 0;
     /// 协程状态
-    State m_state = READY;
+    /// 其他线程会读(调度器判断协程是否已经让出)，挂起的协程在切换完成之后才变为 READY
+    std::atomic<State> m_state{READY};
     /// 协程上下文
     Context m_ctx;
     /// 协程入口函数
-    std::function<void()> m_cb;
+    TaskFunction m_cb;
     /// 本协程是否参与调度器调度，相当于当前协程，是任务协程。
     bool m_runInScheduler;
+    /// 协程局部变量，协程函数执行完时析构
+    FiberLocalStorage m_locals;
+    /// 创建位置
+    std::source_location m_site;
 };
 } // namespace sylar
 
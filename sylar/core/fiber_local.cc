@@ -0,0 +1,80 @@
+#include "fiber_local.h"
+#include "sylar/core/common/macro.h"
+#include "sylar/core/log/log.h"
+
+#include <atomic>
+
+namespace sylar
+{
+
+/**
+ * FiberLocal 一般在静态初始化阶段登记，用函数内的静态变量避免初始化顺序问题，
+ * 这时日志系统可能还没初始化，登记时不打日志
+ */
+static FiberLocalKeyInfo *GetKeys()
+{
+    static FiberLocalKeyInfo s_keys[FiberLocalStorage::SLOT_COUNT];
+    return s_keys;
+}
+
+static std::atomic<size_t> s_key_count{0};
+
+size_t RegisterFiberLocal(const FiberLocalKeyInfo &info)
+{
+    SYLAR_ASSERT2(!info.inheritable || info.copy,
+                  "inheritable FiberLocal must be copyable, name=" << info.name);
+    size_t idx = s_key_count++;
+    SYLAR_ASSERT2(idx < FiberLocalStorage::SLOT_COUNT,
+                  "too many FiberLocal, max=" << FiberLocalStorage::SLOT_COUNT
+                                              << " name=" << info.name);
+    GetKeys()[idx] = info;
+    return idx;
+}
+
+void FiberLocalStorage::destroy(size_t idx)
+{
+    if (has(idx)) {
+        // 先清标记，析构函数里再访问这个变量会重新构造一份，由 clear 继续析构
+        m_live &= ~(1u << idx);
+        GetKeys()[idx].destroy(data(idx));
+    }
+}
+
+void FiberLocalStorage::clearSlow()
+{
+    while (m_live) {
+        destroy(__builtin_ctz(m_live));
+    }
+}
+
+void FiberLocalStorage::inheritFrom(FiberLocalStorage &parent)
+{
+    FiberLocalKeyInfo *keys = GetKeys();
+    for (uint32_t live = parent.m_live; live; live &= live - 1) {
+        size_t idx = __builtin_ctz(live);
+        if (!keys[idx].inheritable) {
+            continue;
+        }
+        destroy(idx);
+        keys[idx].copy(data(idx), parent.data(idx));
+        setLive(idx);
+    }
+}
+
+std::unique_ptr<FiberLocalStorage> FiberLocalStorage::CaptureInheritable()
+{
+    FiberLocalStorage *cur = GetFiberLocals();
+    FiberLocalKeyInfo *keys = GetKeys();
+    bool any = false;
+    for (uint32_t live = cur->m_live; live && !any; live &= live - 1) {
+        any = keys[__builtin_ctz(live)].inheritable;
+    }
+    if (!any) {
+        return nullptr;
+    }
+    std::unique_ptr<FiberLocalStorage> locals(new FiberLocalStorage);
+    locals->inheritFrom(*cur);
+    return locals;
+}
+
+} // namespace sylar
@@ -0,0 +1,230 @@
+/**
+ * @file fiber_local.h
+ * @brief 协程局部变量
+ * @details 请求级的上下文(trace id、截止时间、鉴权信息)放在 thread_local 里是错的：
+ *          协程会被窃取到别的线程继续运行，同一个线程也会轮流运行很多个协程。
+ *          FiberLocal<T> 把值存在当前协程里：
+ *          1. 每个协程有固定 SLOT_COUNT 个槽位，每个槽位 SLOT_SIZE 字节，值直接构造在槽位里，不分配内存
+ *          2. 槽位在 FiberLocal 对象构造时(一般是全局/静态变量的初始化阶段)分配，之后不回收
+ *          3. 第一次 get() 时默认构造，协程函数执行完、Fiber::reset 复用、协程析构时析构
+ *          4. 声明为可继承的变量，用 InheritFiberLocals(cb) 包装的任务会带上调度时协程里的值
+ *
+ *          static sylar::FiberLocal<std::string> s_trace_id("trace_id", true);
+ *          s_trace_id.get() = req->getHeader("X-Trace-Id");
+ *          iom->schedule(sylar::InheritFiberLocals([]() { ... s_trace_id.get() ... }));
+ *
+ *          放不下的类型用 std::shared_ptr/std::unique_ptr 包一层。
+ */
+#ifndef __SYLAR_FIBER_LOCAL_H__
+#define __SYLAR_FIBER_LOCAL_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "sylar/core/common/noncopyable.h"
+
+namespace sylar
+{
+
+/**
+ * @brief 协程局部变量的类型信息，按槽位登记，析构和继承时使用
+ */
+struct FiberLocalKeyInfo {
+    /// 变量名，只用于诊断
+    const char *name = nullptr;
+    /// 是否可继承
+    bool inheritable = false;
+    /// 析构槽位里的值
+    void (*destroy)(void *p) = nullptr;
+    /// 在 dst 上拷贝构造 src，不可拷贝的类型为空
+    void (*copy)(void *dst, const void *src) = nullptr;
+};
+
+/**
+ * @brief 一个协程的局部变量槽位
+ */
+class FiberLocalStorage : Noncopyable
+{
+public:
+    /// 槽位个数，即整个进程最多能定义的 FiberLocal 个数
+    static constexpr size_t SLOT_COUNT = 8;
+    /// 每个槽位的大小，放得下 std::string、std::shared_ptr
+    static constexpr size_t SLOT_SIZE = 32;
+
+    FiberLocalStorage() = default;
+
+    ~FiberLocalStorage() { clear(); }
+
+    /**
+     * @brief 槽位 idx 里是否有值
+     */
+    bool has(size_t idx) const { return m_live & (1u << idx); }
+
+    /**
+     * @brief 槽位 idx 的存储空间
+     */
+    void *data(size_t idx) { return m_slots[idx].data; }
+
+    /**
+     * @brief 在槽位 idx 上构造好值之后调用
+     */
+    void setLive(size_t idx) { m_live |= 1u << idx; }
+
+    /**
+     * @brief 析构槽位 idx 里的值，没有值什么也不做
+     */
+    void destroy(size_t idx);
+
+    /**
+     * @brief 析构所有的值
+     */
+    void clear()
+    {
+        if (m_live) {
+            clearSlow();
+        }
+    }
+
+    bool empty() const { return m_live == 0; }
+
+    /**
+     * @brief 把 parent 里可继承的值拷贝过来，覆盖已有的值
+     */
+    void inheritFrom(FiberLocalStorage &parent);
+
+    /**
+     * @brief 拷贝当前协程里可继承的值，没有可继承的值返回空(不分配内存)
+     */
+    static std::unique_ptr<FiberLocalStorage> CaptureInheritable();
+
+private:
+    void clearSlow();
+
+private:
+    struct Slot {
+        alignas(std::max_align_t) unsigned char data[SLOT_SIZE];
+    };
+    Slot m_slots[SLOT_COUNT];
+    /// 有值的槽位，按位
+    uint32_t m_live = 0;
+};
+
+/**
+ * @brief 登记一个协程局部变量，返回分配的槽位，槽位用完了直接断言失败
+ */
+size_t RegisterFiberLocal(const FiberLocalKeyInfo &info);
+
+/**
+ * @brief 当前协程的局部变量槽位，线程还没有协程时创建线程的主协程
+ */
+FiberLocalStorage *GetFiberLocals();
+
+/**
+ * @brief 协程局部变量
+ * @tparam T 值类型，不超过 SLOT_SIZE 字节，对齐不超过 std::max_align_t
+ * @details 一般定义成全局或者静态变量；对象本身只记录槽位，值在每个协程里各有一份
+ */
+template <class T>
+class FiberLocal : Noncopyable
+{
+public:
+    static_assert(sizeof(T) <= FiberLocalStorage::SLOT_SIZE,
+                  "FiberLocal value too large, wrap it in a smart pointer");
+    static_assert(alignof(T) <= alignof(std::max_align_t), "FiberLocal value over-aligned");
+
+    /**
+     * @param[in] name 变量名
+     * @param[in] inheritable 是否可继承，可继承的类型必须可拷贝
+     */
+    explicit FiberLocal(const char *name, bool inheritable = false)
+    {
+        FiberLocalKeyInfo info;
+        info.name = name;
+        info.inheritable = inheritable;
+        info.destroy = &Destroy;
+        if constexpr (std::is_copy_constructible<T>::value) {
+            info.copy = &Copy;
+        }
+        m_index = RegisterFiberLocal(info);
+    }
+
+    /**
+     * @brief 当前协程里的值，第一次访问时默认构造
+     */
+    T &get()
+    {
+        FiberLocalStorage *s = GetFiberLocals();
+        void *p = s->data(m_index);
+        if (!s->has(m_index)) {
+            ::new (p) T();
+            s->setLive(m_index);
+        }
+        return *static_cast<T *>(p);
+    }
+
+    T &operator*() { return get(); }
+    T *operator->() { return &get(); }
+
+    /**
+     * @brief 当前协程里的值，还没有构造返回 nullptr
+     */
+    T *peek()
+    {
+        FiberLocalStorage *s = GetFiberLocals();
+        return s->has(m_index) ? static_cast<T *>(s->data(m_index)) : nullptr;
+    }
+
+    /**
+     * @brief 设置当前协程里的值
+     */
+    template <class V>
+    void set(V &&v)
+    {
+        FiberLocalStorage *s = GetFiberLocals();
+        if (s->has(m_index)) {
+            *static_cast<T *>(s->data(m_index)) = std::forward<V>(v);
+        } else {
+            ::new (s->data(m_index)) T(std::forward<V>(v));
+            s->setLive(m_index);
+        }
+    }
+
+    /**
+     * @brief 析构当前协程里的值，下次 get() 重新默认构造
+     */
+    void reset() { GetFiberLocals()->destroy(m_index); }
+
+    size_t index() const { return m_index; }
+
+private:
+    static void Destroy(void *p) { static_cast<T *>(p)->~T(); }
+
+    static void Copy(void *dst, const void *src) { ::new (dst) T(*static_cast<const T *>(src)); }
+
+private:
+    size_t m_index;
+};
+
+/**
+ * @brief 包装调度任务，任务运行前把调度时所在协程里可继承的局部变量拷贝过去
+ * @details 在调用 schedule() 的协程里构造，没有可继承的值时不分配内存
+ */
+template <class F>
+auto InheritFiberLocals(F &&cb)
+{
+    return [locals = FiberLocalStorage::CaptureInheritable(),
+            cb = std::forward<F>(cb)]() mutable {
+        if (locals) {
+            GetFiberLocals()->inheritFrom(*locals);
+        }
+        cb();
+    };
+}
+
+} // namespace sylar
+
+#endif
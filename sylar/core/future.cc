@@ -0,0 +1,100 @@
+#include "future.h"
+#include "channel.h"
+#include "iomanager.h"
+#include "sylar/core/util/util.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace sylar
+{
+
+namespace detail
+{
+
+bool FutureStateBase::addCallback(TaskFunction &cb)
+{
+    if (isReady()) {
+        return false;
+    }
+    MutexType::Lock lock(m_mutex);
+    if (m_ready) {
+        return false;
+    }
+    m_callbacks.push_back(std::move(cb));
+    return true;
+}
+
+void FutureStateBase::finishLocked(MutexType::Lock &lock)
+{
+    m_ready.store(true, std::memory_order_release);
+    std::vector<TaskFunction> cbs;
+    cbs.swap(m_callbacks);
+    lock.unlock();
+    for (auto &cb : cbs) {
+        cb();
+    }
+}
+
+bool FutureStateBase::wait(uint64_t timeout_ms)
+{
+    if (isReady()) {
+        return true;
+    }
+    if (timeout_ms == 0) {
+        return false;
+    }
+
+    Scheduler *scheduler = Scheduler::GetThis();
+    if (!scheduler) {
+        // 不在调度器线程里，阻塞线程等
+        struct ThreadWaiter {
+            std::mutex mutex;
+            std::condition_variable cond;
+            bool done = false;
+        };
+        auto waiter = std::make_shared<ThreadWaiter>();
+        TaskFunction cb = [waiter]() {
+            std::lock_guard<std::mutex> lock(waiter->mutex);
+            waiter->done = true;
+            waiter->cond.notify_all();
+        };
+        if (!addCallback(cb)) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(waiter->mutex);
+        if (timeout_ms == ~0ull) {
+            waiter->cond.wait(lock, [&waiter]() { return waiter->done; });
+        } else {
+            waiter->cond.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                  [&waiter]() { return waiter->done; });
+        }
+        return isReady();
+    }
+
+    // 就绪回调和超时定时器抢唤醒权，超时之后回调还留在状态里，所以等待者放到堆上
+    auto waiter = std::make_shared<ChannelWaiter>();
+    waiter->scheduler = scheduler;
+    waiter->fiber = Fiber::GetThis();
+    TaskFunction cb = [waiter]() { waiter->wake(ChannelWaiter::WOKEN); };
+    if (!addCallback(cb)) {
+        return true;
+    }
+    Timer::ptr timer;
+    if (timeout_ms != ~0ull) {
+        IOManager *iom = IOManager::GetThis();
+        SYLAR_ASSERT2(iom, "Future::wait with timeout needs an IOManager");
+        timer = iom->addTimer(timeout_ms, [waiter]() { waiter->wake(ChannelWaiter::TIMEOUT); });
+    }
+    Fiber::GetThis()->yield();
+    if (timer) {
+        timer->cancel();
+    }
+    waiter->fiber.reset();
+    return isReady();
+}
+
+} // namespace detail
+
+} // namespace sylar
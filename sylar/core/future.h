@@ -0,0 +1,395 @@
+/**
+ * @file future.h
+ * @brief 协程感知的 Future/Promise，用于在一个协程里并发调用多个后端
+ * @details 等待结果时挂起的是协程，不阻塞线程(不在调度器线程里时退化成条件变量)。
+ *          结果就绪时在设置结果的线程里直接执行注册的回调，WhenAll/WhenAny 基于回调组合。
+ *          用法：
+ *          auto f1 = sylar::Async(iom, []() { return pool->doGet("/a", 200); });
+ *          auto f2 = rock_conn->asyncRequest(req, 200);
+ *          auto all = sylar::WhenAll(std::move(futures));
+ *          if (all.waitUntil(deadline_ms)) { auto results = all.get(); }
+ */
+#ifndef __SYLAR_FUTURE_H__
+#define __SYLAR_FUTURE_H__
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "sylar/core/common/macro.h"
+#include "sylar/core/common/noncopyable.h"
+#include "sylar/core/common/task_function.h"
+#include "sylar/core/coroutine.h"
+#include "sylar/core/mutex.h"
+#include "sylar/core/scheduler.h"
+
+namespace sylar
+{
+
+/**
+ * @brief Promise 没有设置结果就析构时，Future 上抛出的异常
+ */
+class BrokenPromise : public std::logic_error
+{
+public:
+    BrokenPromise() : std::logic_error("broken promise") {}
+};
+
+namespace detail
+{
+
+/**
+ * @brief Future/Promise 共享状态中和结果类型无关的部分：就绪标志、异常和就绪回调
+ */
+class FutureStateBase : Noncopyable
+{
+public:
+    typedef Spinlock MutexType;
+
+    bool isReady() const { return m_ready.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 等待结果就绪
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull 表示一直等
+     * @return 是否就绪
+     * @details 调度器线程里挂起当前协程(超时定时器来自当前 IOManager)，其他线程用条件变量等待
+     */
+    bool wait(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 注册就绪回调，已经就绪返回 false，cb 不会被取走
+     */
+    bool addCallback(TaskFunction &cb);
+
+    /**
+     * @brief 就绪时执行 cb(在设置结果的线程里)，已经就绪时直接执行
+     */
+    void onReady(TaskFunction cb)
+    {
+        if (!addCallback(cb)) {
+            cb();
+        }
+    }
+
+    bool setException(std::exception_ptr e)
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_ready) {
+            return false;
+        }
+        m_exception = e;
+        finishLocked(lock);
+        return true;
+    }
+
+    const std::exception_ptr &getException() const { return m_exception; }
+
+protected:
+    /**
+     * @brief 结果已经写好，置就绪，释放锁之后执行回调
+     */
+    void finishLocked(MutexType::Lock &lock);
+
+protected:
+    MutexType m_mutex;
+    std::atomic<bool> m_ready{false};
+    std::exception_ptr m_exception;
+    std::vector<TaskFunction> m_callbacks;
+};
+
+template <class T>
+class FutureState : public FutureStateBase
+{
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+    typedef std::conditional_t<std::is_void<T>::value, bool, T> value_type;
+
+    template <class... Args>
+    bool setValue(Args &&...args)
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_ready) {
+            return false;
+        }
+        m_value.emplace(std::forward<Args>(args)...);
+        finishLocked(lock);
+        return true;
+    }
+
+    value_type &value() { return *m_value; }
+
+private:
+    std::optional<value_type> m_value;
+};
+
+} // namespace detail
+
+/**
+ * @brief 异步结果，只能移动，get 取走结果之后不再可用
+ */
+template <class T>
+class Future
+{
+public:
+    typedef T value_type;
+
+    Future() = default;
+    explicit Future(typename detail::FutureState<T>::ptr state) : m_state(std::move(state)) {}
+
+    Future(Future &&) = default;
+    Future &operator=(Future &&) = default;
+    Future(const Future &) = delete;
+    Future &operator=(const Future &) = delete;
+
+    bool valid() const { return m_state != nullptr; }
+    bool isReady() const { return m_state && m_state->isReady(); }
+
+    /**
+     * @brief 等待结果就绪，超时返回 false
+     */
+    bool wait(uint64_t timeout_ms = ~0ull) const
+    {
+        SYLAR_ASSERT2(m_state, "wait on an invalid future");
+        return m_state->wait(timeout_ms);
+    }
+
+    /**
+     * @brief 等到绝对时间 deadline_ms(GetCurrentMS 的时间)，多个 Future 共用一个截止时间时使用
+     */
+    bool waitUntil(uint64_t deadline_ms) const
+    {
+        uint64_t now = GetCurrentMS();
+        return wait(deadline_ms > now ? deadline_ms - now : 0);
+    }
+
+    /**
+     * @brief 等待并取走结果，异常结果在这里重新抛出
+     */
+    T get()
+    {
+        SYLAR_ASSERT2(m_state, "get on an invalid future");
+        m_state->wait();
+        typename detail::FutureState<T>::ptr state = std::move(m_state);
+        if (state->getException()) {
+            std::rethrow_exception(state->getException());
+        }
+        if constexpr (!std::is_void<T>::value) {
+            return std::move(state->value());
+        }
+    }
+
+    /**
+     * @brief 就绪时执行 cb(在设置结果的线程里)
+     */
+    void onReady(TaskFunction cb) const
+    {
+        SYLAR_ASSERT2(m_state, "onReady on an invalid future");
+        m_state->onReady(std::move(cb));
+    }
+
+    /**
+     * @brief 在 C++20 协程里 co_await，就绪时把协程调度回当前调度器
+     */
+    auto operator co_await() &&
+    {
+        struct Awaiter {
+            bool await_ready() const { return future.isReady(); }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                Scheduler *scheduler = Scheduler::GetThis();
+                future.onReady([scheduler, h]() {
+                    if (scheduler) {
+                        scheduler->schedule(detail::ResumeCallback{h});
+                    } else {
+                        h.resume();
+                    }
+                });
+            }
+
+            T await_resume() { return future.get(); }
+
+            Future future;
+        };
+        return Awaiter{std::move(*this)};
+    }
+
+private:
+    typename detail::FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 异步结果的生产方，只能移动
+ * @details 没有设置结果就析构时 Future 得到 BrokenPromise 异常，等待者不会一直挂着
+ */
+template <class T>
+class Promise
+{
+public:
+    Promise() : m_state(std::make_shared<detail::FutureState<T> >()) {}
+
+    Promise(Promise &&) = default;
+    Promise &operator=(Promise &&other)
+    {
+        if (this != &other) {
+            breakPromise();
+            m_state = std::move(other.m_state);
+        }
+        return *this;
+    }
+    Promise(const Promise &) = delete;
+    Promise &operator=(const Promise &) = delete;
+
+    ~Promise() { breakPromise(); }
+
+    Future<T> getFuture() { return Future<T>(m_state); }
+
+    /**
+     * @brief 设置结果，已经设置过返回 false
+     */
+    template <class... Args>
+    bool setValue(Args &&...args)
+    {
+        return m_state->setValue(std::forward<Args>(args)...);
+    }
+
+    bool setException(std::exception_ptr e) { return m_state->setException(e); }
+
+private:
+    void breakPromise()
+    {
+        if (m_state && !m_state->isReady()) {
+            m_state->setException(std::make_exception_ptr(BrokenPromise()));
+        }
+    }
+
+private:
+    typename detail::FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 一个已经就绪的 Future
+ */
+template <class T, class... Args>
+Future<T> MakeReadyFuture(Args &&...args)
+{
+    Promise<T> promise;
+    promise.setValue(std::forward<Args>(args)...);
+    return promise.getFuture();
+}
+
+/**
+ * @brief 把 fn 调度到 scheduler(的 thread 线程)上执行，返回它的结果
+ * @param[in] scheduler 调度器，nullptr 使用当前调度器
+ * @details fn 在有栈协程里执行，可以调用 hook 过的阻塞接口；fn 抛出的异常在 get 时重新抛出
+ */
+template <class F>
+Future<std::invoke_result_t<F &> > Async(Scheduler *scheduler, F fn, int thread = -1)
+{
+    typedef std::invoke_result_t<F &> R;
+    if (!scheduler) {
+        scheduler = Scheduler::GetThis();
+    }
+    SYLAR_ASSERT(scheduler);
+    Promise<R> promise;
+    Future<R> future = promise.getFuture();
+    scheduler->schedule(
+        [promise = std::move(promise), fn = std::move(fn)]() mutable {
+            try {
+                if constexpr (std::is_void<R>::value) {
+                    fn();
+                    promise.setValue();
+                } else {
+                    promise.setValue(fn());
+                }
+            } catch (...) {
+                promise.setException(std::current_exception());
+            }
+        },
+        thread);
+    return future;
+}
+
+/**
+ * @brief 所有 Future 都就绪之后就绪，结果按原顺序排列
+ * @details 任意一个是异常结果时，等全部结束后以第一个异常结束
+ */
+template <class T>
+auto WhenAll(std::vector<Future<T> > futures)
+{
+    typedef std::conditional_t<std::is_void<T>::value, void, std::vector<T> > R;
+    struct Context {
+        std::vector<Future<T> > futures;
+        std::atomic<size_t> remaining;
+        Promise<R> promise;
+
+        void finish()
+        {
+            try {
+                if constexpr (std::is_void<T>::value) {
+                    for (auto &f : futures) {
+                        f.get();
+                    }
+                    promise.setValue();
+                } else {
+                    std::vector<T> values;
+                    values.reserve(futures.size());
+                    for (auto &f : futures) {
+                        values.push_back(f.get());
+                    }
+                    promise.setValue(std::move(values));
+                }
+            } catch (...) {
+                promise.setException(std::current_exception());
+            }
+        }
+    };
+    auto ctx = std::make_shared<Context>();
+    ctx->futures = std::move(futures);
+    ctx->remaining = ctx->futures.size();
+    Future<R> future = ctx->promise.getFuture();
+    if (ctx->futures.empty()) {
+        ctx->finish();
+        return future;
+    }
+    for (auto &f : ctx->futures) {
+        // 回调持有 ctx，ctx 持有 futures，最后一个回调执行完这个环就断开了
+        f.onReady([ctx]() {
+            if (--ctx->remaining == 0) {
+                ctx->finish();
+            }
+        });
+    }
+    return future;
+}
+
+/**
+ * @brief 任意一个 Future 就绪时就绪，结果是它在 futures 里的下标
+ * @details futures 不会被取走，调用方用下标拿到对应的结果，其余的可以继续等或者直接丢弃
+ */
+template <class T>
+Future<size_t> WhenAny(const std::vector<Future<T> > &futures)
+{
+    if (futures.empty()) {
+        Promise<size_t> promise;
+        promise.setException(std::make_exception_ptr(std::invalid_argument("WhenAny on no futures")));
+        return promise.getFuture();
+    }
+    auto promise = std::make_shared<Promise<size_t> >();
+    Future<size_t> future = promise->getFuture();
+    for (size_t i = 0; i < futures.size(); ++i) {
+        futures[i].onReady([promise, i]() { promise->setValue(i); });
+        if (future.isReady()) {
+            break;
+        }
+    }
+    return future;
+}
+
+} // namespace sylar
+
+#endif
@@ -6,6 +6,7 @@
 #include <sys/sendfile.h>
 
 #include "sylar/core/iomanager.h"
+#include "sylar/core/uring.h"
 #include "hook.h"
 #include "sylar/core/config/config.h"
 #include "fd_manager.h"
@@ -84,10 +85,6 @@ void set_hook_enable(bool flag)
 
 } // namespace sylar
 
-struct timer_info {
-    int cancelled = 0;
-};
-
 /**
  * 重点 ！！！
  *
@@ -99,9 +96,10 @@ struct timer_info {
  *
  * std::forward 保持参数的原始值类别
  */
-template <typename OriginFun, typename... Args>
+template <typename OriginFun, typename UringPrep, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t event,
                      int timeout_so, // 读 / 写 超时 宏标签
+                     UringPrep prep, // io_uring 后端直接读写时填充请求，nullptr 表示只能等待就绪
                      Args &&...args)
 {
     if (!sylar::t_hook_enable) {
@@ -127,7 +125,6 @@ static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t
 
     // 接下来，socket情况
     uint64_t to = ctx->getTimeout(timeout_so);
-    std::shared_ptr<timer_info> tinfo = std::make_shared<timer_info>();
 
 retry:
     // SYLAR_LOG_DEBUG(g_logger) << hook_fun_name << " event " << event;
@@ -139,49 +136,40 @@ retry:
     if (n == -1 && errno == EAGAIN) { // 非阻塞操作无法立即完成
         // SYLAR_LOG_DEBUG(g_logger) << "hook doing " << hook_fun_name << " event " << event;
         sylar::IOManager *iom = sylar::IOManager::GetThis();
-        sylar::Timer::ptr timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
-
-        if (to != (uint64_t)-1) {
-            // 添加一个条件定时器，如果 tinfo 还在意味着 fd还没等到event触发。
-            // 到了超时时间，就直接取消事件。
-            timer = iom->addConditionTimer(
-                to,
-                [iom, winfo, fd, event]() {
-                    auto it = winfo.lock();
-                    if (!it || it->cancelled) {
-                        return;
+        // 持久注册模式下 fd 注册在等待它的 IOManager 上，关闭时在这个 IOManager 上取消
+        ctx->bindIOManager(iom);
+        // io_uring 后端直接把读写请求交给内核，完成之后再唤醒，不用等就绪之后再调用一次
+        if constexpr (!std::is_same_v<UringPrep, std::nullptr_t>) {
+            if (iom->isUring()) {
+                io_uring_sqe sqe;
+                prep(sqe);
+                ssize_t res = 0;
+                if (iom->submitIo(fd, sqe, to, res)) {
+                    if (res >= 0) {
+                        return res;
                     }
-                    it->cancelled = ETIMEDOUT;
-                    iom->cancelEvent(fd, (sylar::IOManager::Event)event);
-                },
-                winfo);
+                    if (res == -EAGAIN || res == -EINTR) {
+                        goto retry;
+                    }
+                    errno = -res;
+                    return -1;
+                }
+            }
         }
-        // 正式 注册事件。
-        // 没有传入cb，相当于把当前协程传入。当事件触发，会回到这个协程继续运行。 妙 ~
-        int rt = iom->addEvent(fd, (sylar::IOManager::Event)event);
-        if (SYLAR_UNLIKELY(rt)) { //添加失败
-            SYLAR_LOG_ERROR(g_logger)
-                << hook_fun_name << " addEvent(" << fd << ", " << event << ")";
-            if (timer) {         //超时删除事件的定时器不需要了。
-                timer->cancel(); // 删除定时器的权利 交给了定时器
+        // 注册事件并让出当前协程，超时时间记在 fd 的事件上下文里，
+        // 到了超时时间由 IOManager 直接取消事件，不需要再分配定时器。
+        // 回到这里有两种情况：
+        // 1. 超时之前，事件触发，重新操作 fd。
+        // 2. 超时，事件被取消，errno 为 ETIMEDOUT。
+        int rt = iom->waitEvent(fd, (sylar::IOManager::Event)event, to);
+        if (SYLAR_UNLIKELY(rt)) {
+            if (errno != ETIMEDOUT) { //添加失败
+                SYLAR_LOG_ERROR(g_logger)
+                    << hook_fun_name << " addEvent(" << fd << ", " << event << ")";
             }
             return -1;
-        } else { //添加成功
-            sylar::Fiber::GetThis()->yield();
-            // 如果再次回到这里，
-            // 两种情况：
-            // 1. 超时之前，事件触发。
-            // 2. 超时，事件条件被cancelEvent，直接触发。
-            if (timer) {
-                timer->cancel();
-            }
-            if (tinfo->cancelled) { // 情况2
-                errno = tinfo->cancelled;
-                return -1;
-            }
-            goto retry; // 情况1，event已经满足，重新操作 fd。
         }
+        goto retry; // 情况1，event已经满足，重新操作 fd。
     }
     return n;
 }
@@ -217,13 +205,19 @@ extern "C"
          * (存在多继承或虚继承导致this指针偏移)
          *
          * 或者
-         * std::bind(&Scheduler::schedule, static_cast<Scheduler*>(iom), fiber, -1)
+         * std::bind(&Scheduler::schedule, static_cast<Scheduler*>(iom), fiber, -1, Scheduler::INTERACTIVE,
+         *           Fiber::STACK_DEFAULT, std::source_location::current())
+         * 默认参数不会带进成员函数指针，所有参数都要写全
          *
          */
         iom->addTimer(seconds * 1000,
-                      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread))
+                      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread,
+                                                    sylar::Scheduler::Priority,
+                                                    sylar::Fiber::StackClass,
+                                                    std::source_location))
                                     & sylar::IOManager::schedule,
-                                iom, fiber, -1));
+                                iom, fiber, -1, sylar::Scheduler::INTERACTIVE,
+                                sylar::Fiber::STACK_DEFAULT, std::source_location::current()));
         sylar::Fiber::GetThis()->yield();
         return 0;
     }
@@ -236,9 +230,13 @@ extern "C"
         sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
         sylar::IOManager *iom = sylar::IOManager::GetThis();
         iom->addTimer(usec / 1000,
-                      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread))
+                      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread,
+                                                    sylar::Scheduler::Priority,
+                                                    sylar::Fiber::StackClass,
+                                                    std::source_location))
                                     & sylar::IOManager::schedule,
-                                iom, fiber, -1));
+                                iom, fiber, -1, sylar::Scheduler::INTERACTIVE,
+                                sylar::Fiber::STACK_DEFAULT, std::source_location::current()));
         sylar::Fiber::GetThis()->yield();
         return 0;
     }
@@ -252,9 +250,13 @@ extern "C"
         sylar::IOManager *iom = sylar::IOManager::GetThis();
         int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
         iom->addTimer(timeout_ms,
-                      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread))
+                      std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread,
+                                                    sylar::Scheduler::Priority,
+                                                    sylar::Fiber::StackClass,
+                                                    std::source_location))
                                     & sylar::IOManager::schedule,
-                                iom, fiber, -1));
+                                iom, fiber, -1, sylar::Scheduler::INTERACTIVE,
+                                sylar::Fiber::STACK_DEFAULT, std::source_location::current()));
         sylar::Fiber::GetThis()->yield();
         return 0;
     }
@@ -314,38 +316,12 @@ extern "C"
         }
 
         sylar::IOManager *iom = sylar::IOManager::GetThis();
-        sylar::Timer::ptr timer;
-        std::shared_ptr<timer_info> tinfo = std::make_shared<timer_info>();
-        std::weak_ptr<timer_info> winfo(tinfo);
-
-        if (timeout_ms != (uint64_t)-1) {
-            iom->addConditionTimer(
-                timeout_ms,
-                [winfo, fd, iom]() {
-                    auto it = winfo.lock();
-                    if (!it || it->cancelled) {
-                        return;
-                    }
-                    it->cancelled = ETIMEDOUT;
-                    iom->cancelEvent(fd, sylar::IOManager::Event::WRITE);
-                },
-                winfo);
-        }
-
-        int rt = iom->addEvent(fd, sylar::IOManager::Event::WRITE);
-        if (rt == 0) {
-            sylar::Fiber::GetThis()->yield();
-            if (timer) {
-                timer->cancel();
-            }
-            if (tinfo->cancelled) {
-                errno = tinfo->cancelled;
+        ctx->bindIOManager(iom);
+        int rt = iom->waitEvent(fd, sylar::IOManager::Event::WRITE, timeout_ms);
+        if (rt) {
+            if (errno == ETIMEDOUT) {
                 return -1;
             }
-        } else {
-            if (timer) {
-                timer->cancel();
-            }
             SYLAR_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
         }
 
@@ -371,7 +347,9 @@ extern "C"
     int accept(int s, struct sockaddr *addr, socklen_t *addrlen)
     {
         int fd =
-            do_io(s, accept_f, "accept", sylar::IOManager::Event::READ, SO_RCVTIMEO, addr, addrlen);
+            do_io(s, accept_f, "accept", sylar::IOManager::Event::READ, SO_RCVTIMEO,
+                  [=](io_uring_sqe &sqe) { sylar::IoUring::PrepAccept(sqe, s, addr, addrlen, 0); },
+                  addr, addrlen);
 
         if (fd != -1) {
             sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd, true);
@@ -391,62 +369,81 @@ extern "C"
     {
         static const bool _sylar_hook_init_ = sylar::hook_init();
         (void)_sylar_hook_init_;
-        return do_io(fd, read_f, "read", sylar::IOManager::Event::READ, SO_RCVTIMEO, buf, count);
+        return do_io(
+            fd, read_f, "read", sylar::IOManager::Event::READ, SO_RCVTIMEO,
+            [=](io_uring_sqe &sqe) { sylar::IoUring::PrepRecv(sqe, fd, buf, count, 0); }, buf,
+            count);
     }
 
     ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
     {
-        return do_io(fd, readv_f, "readv", sylar::IOManager::Event::READ, SO_RCVTIMEO, iov, iovcnt);
+        return do_io(
+            fd, readv_f, "readv", sylar::IOManager::Event::READ, SO_RCVTIMEO,
+            [=](io_uring_sqe &sqe) { sylar::IoUring::PrepReadv(sqe, fd, iov, iovcnt); }, iov,
+            iovcnt);
     }
 
     ssize_t recv(int sockfd, void *buf, size_t len, int flags)
     {
-        return do_io(sockfd, recv_f, "recv", sylar::IOManager::Event::READ, SO_RCVTIMEO, buf, len,
-                     flags);
+        return do_io(
+            sockfd, recv_f, "recv", sylar::IOManager::Event::READ, SO_RCVTIMEO,
+            [=](io_uring_sqe &sqe) { sylar::IoUring::PrepRecv(sqe, sockfd, buf, len, flags); },
+            buf, len, flags);
     }
 
     ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr,
                      socklen_t *addrlen)
     {
         return do_io(sockfd, recvfrom_f, "recvfrom", sylar::IOManager::Event::READ, SO_RCVTIMEO,
-                     buf, len, flags, src_addr, addrlen);
+                     nullptr, buf, len, flags, src_addr, addrlen);
     }
 
     ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
     {
-        return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::Event::READ, SO_RCVTIMEO, msg,
-                     flags);
+        return do_io(
+            sockfd, recvmsg_f, "recvmsg", sylar::IOManager::Event::READ, SO_RCVTIMEO,
+            [=](io_uring_sqe &sqe) { sylar::IoUring::PrepRecvmsg(sqe, sockfd, msg, flags); }, msg,
+            flags);
     }
 
     // write
     ssize_t write(int fd, const void *buf, size_t count)
     {
-        return do_io(fd, write_f, "write", sylar::IOManager::Event::WRITE, SO_SNDTIMEO, buf, count);
+        return do_io(
+            fd, write_f, "write", sylar::IOManager::Event::WRITE, SO_SNDTIMEO,
+            [=](io_uring_sqe &sqe) { sylar::IoUring::PrepSend(sqe, fd, buf, count, 0); },
+            buf, count);
     }
 
     ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
     {
-        return do_io(fd, writev_f, "writev", sylar::IOManager::Event::WRITE, SO_SNDTIMEO, iov,
-                     iovcnt);
+        return do_io(
+            fd, writev_f, "writev", sylar::IOManager::Event::WRITE, SO_SNDTIMEO,
+            [=](io_uring_sqe &sqe) { sylar::IoUring::PrepWritev(sqe, fd, iov, iovcnt); }, iov,
+            iovcnt);
     }
 
     ssize_t send(int s, const void *msg, size_t len, int flags)
     {
-        return do_io(s, send_f, "send", sylar::IOManager::Event::WRITE, SO_SNDTIMEO, msg, len,
-                     flags);
+        return do_io(
+            s, send_f, "send", sylar::IOManager::Event::WRITE, SO_SNDTIMEO,
+            [=](io_uring_sqe &sqe) { sylar::IoUring::PrepSend(sqe, s, msg, len, flags); }, msg,
+            len, flags);
     }
 
     ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to,
                    socklen_t tolen)
     {
-        return do_io(s, sendto_f, "sendto", sylar::IOManager::Event::WRITE, SO_SNDTIMEO, msg, len,
-                     flags, to, tolen);
+        return do_io(s, sendto_f, "sendto", sylar::IOManager::Event::WRITE, SO_SNDTIMEO, nullptr,
+                     msg, len, flags, to, tolen);
     }
 
     ssize_t sendmsg(int s, const struct msghdr *msg, int flags)
     {
-        return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::Event::WRITE, SO_SNDTIMEO, msg,
-                     flags);
+        return do_io(
+            s, sendmsg_f, "sendmsg", sylar::IOManager::Event::WRITE, SO_SNDTIMEO,
+            [=](io_uring_sqe &sqe) { sylar::IoUring::PrepSendmsg(sqe, s, msg, flags); }, msg,
+            flags);
     }
 
     int close(int fd)
@@ -458,6 +455,11 @@ extern "C"
         sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
         if (ctx) {
             auto iom = sylar::IOManager::GetThis();
+            // fd 可能在别的 IOManager 上注册、等待，在那边取消
+            sylar::IOManager *owner = ctx->getIOManager();
+            if (owner && owner != iom) {
+                sylar::IOManager::ReleaseFd(owner, fd, true);
+            }
             if (iom) { // 删除
                 iom->cancelAll(fd);
             }
@@ -593,6 +595,8 @@ extern "C"
 
     ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
     {
-        return do_io(out_fd, sendfile_f, "sendfile", sylar::IOManager::Event::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+        // io_uring 没有 sendfile，走 multishot poll 等待可写
+        return do_io(out_fd, sendfile_f, "sendfile", sylar::IOManager::Event::WRITE, SO_SNDTIMEO,
+                     nullptr, in_fd, offset, count);
     }
 }
\ No newline at end of file
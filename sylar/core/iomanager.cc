@@ -1,20 +1,66 @@
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <vector>
+#include <unordered_set>
 
 #include "sylar/core/util/util.h"
 #include "sylar/core/iomanager.h"
 #include "sylar/core/common/macro.h"
+#include "sylar/core/config/config.h"
 #include "sylar/core/log/log.h"
+#include "sylar/core/memory/stack_pool.h"
+#include "sylar/core/uring.h"
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
 namespace sylar
 {
 
+static ConfigVar<bool>::ptr g_iomanager_persistent_epoll = Config::Lookup<bool>(
+    "iomanager.persistent_epoll", false,
+    "register each fd once for EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET and track readiness in user space");
+
+static ConfigVar<std::string>::ptr g_iomanager_backend = Config::Lookup<std::string>(
+    "iomanager.backend", "epoll",
+    "io multiplexing backend, epoll or io_uring, falls back to epoll when io_uring is unavailable");
+
+static ConfigVar<bool>::ptr g_iomanager_uring_direct_io = Config::Lookup<bool>(
+    "iomanager.uring_direct_io", true,
+    "io_uring backend submits recv/send/accept directly when a hooked call would block");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_busy_poll_us = Config::Lookup<uint32_t>(
+    "iomanager.busy_poll_us", 0,
+    "max microseconds an idle thread spins on its run queue (and epoll_wait with zero timeout) "
+    "before blocking, adapted per thread, 0 disables");
+
+static ConfigVar<std::string>::ptr g_iomanager_timer_stack_class = Config::Lookup<std::string>(
+    "iomanager.timer_stack_class", "default",
+    "stack class of timer callback fibers, default/small/medium/large (see fiber.stack_class.*)");
+
+/// 每个 io_uring 的提交队列长度
+static const unsigned URING_ENTRIES = 256;
+
+/**
+ * io_uring 请求的 user_data 编码：
+ * 1. 最高位为 1：fd 的 multishot poll，低 32 位是 fd，中间是 FdContext::generation
+ * 2. URING_TICKLE：线程自己的 tickle eventfd 的 multishot poll
+ * 3. URING_IGNORE：POLL_REMOVE / ASYNC_CANCEL 自己的完成事件，不关心
+ * 4. 其他：直接读写请求 UringOp 的地址，最低位为 1 表示对应的 LINK_TIMEOUT
+ */
+static const uint64_t URING_POLL = 1ull << 63;
+static const uint64_t URING_TICKLE = 1ull << 62;
+static const uint64_t URING_IGNORE = URING_TICKLE | 1;
+static const uint32_t URING_GEN_MASK = 0x3fffffff;
+
+/// 当前线程认领的 io_uring 和所属的 IOManager，线程退出 idle 时清空
+static thread_local IoUring *t_ring = nullptr;
+static thread_local IOManager *t_ring_iom = nullptr;
+
 enum EpollCtlOp {};
 
 static std::ostream &operator<<(std::ostream &os, const EpollCtlOp &op)
@@ -72,6 +118,14 @@ IOManager *IOManager::GetThis()
     return dynamic_cast<IOManager *>(Scheduler::GetThis());
 }
 
+IOManager::FdContext::FdContext()
+{
+    read.owner = this;
+    read.event = READ;
+    write.owner = this;
+    write.event = WRITE;
+}
+
 IOManager::FdContext::EventContext &IOManager::FdContext::getEventContext(Event event)
 {
     switch (event) {
@@ -90,6 +144,7 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx)
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    ctx.stackClass = Fiber::STACK_DEFAULT;
 }
 
 void IOManager::FdContext::triggerEvent(Event event)
@@ -109,51 +164,143 @@ void IOManager::FdContext::triggerEvent(Event event)
     }
     events = (Event)(events & ~event);
     EventContext &ev_ctx = getEventContext(event);
+    // IO 就绪唤醒的都是在等待的请求，按默认的交互优先级调度
     if (ev_ctx.cb) {
-        ev_ctx.scheduler->schedule(ev_ctx.cb);
+        ev_ctx.scheduler->schedule(std::move(ev_ctx.cb), -1, Scheduler::INTERACTIVE,
+                                   ev_ctx.stackClass, ev_ctx.site);
     } else {
-        ev_ctx.scheduler->schedule(ev_ctx.fiber);
+        ev_ctx.scheduler->schedule(std::move(ev_ctx.fiber));
     }
     resetEventContext(ev_ctx);
     return;
 }
 
+/**
+ * 直接读写请求，放在等待的协程栈上，所有完成事件都收到之后才唤醒协程
+ */
+struct IOManager::UringOp {
+    FdContext *fd_ctx = nullptr;
+    Scheduler *scheduler = nullptr;
+    Fiber::ptr fiber;
+    /// 请求的返回值
+    int result = 0;
+    /// 还没收到的完成事件个数
+    int inflight = 0;
+    /// LINK_TIMEOUT 是否触发
+    bool timedout = false;
+    __kernel_timespec ts;
+};
+
+static uint64_t PollUserData(int fd, uint32_t generation)
+{
+    return URING_POLL | (uint64_t)(generation & URING_GEN_MASK) << 32 | (uint32_t)fd;
+}
+
+/**
+ * @brief 还没有析构的 IOManager
+ * @details FdCtx 记着 fd 最后在哪个 IOManager 上等待，fd 换地方或者关闭时那个 IOManager 可能已经析构，
+ *          ReleaseFd 持有读锁确认还在再调用，析构时持有写锁摘掉。故意不释放，静态析构顺序不影响
+ */
+struct LiveIOManagers {
+    RWSpinlock mutex;
+    std::unordered_set<IOManager *> iomanagers;
+};
+
+static LiveIOManagers &GetLiveIOManagers()
+{
+    static LiveIOManagers *s_live = new LiveIOManagers;
+    return *s_live;
+}
+
 IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
-    : Scheduler(threads, use_caller, name)
+    : Scheduler(threads, use_caller, name), TimerManager(threads), m_deadlines(GetCurrentMS())
 {
+    m_persistentEpoll = g_iomanager_persistent_epoll->getValue();
+    m_busyPollUs = g_iomanager_busy_poll_us->getValue();
+    m_timerStackClass = Fiber::ParseStackClass(g_iomanager_timer_stack_class->getValue());
+
+    if (g_iomanager_backend->getValue() == "io_uring") {
+        if (IoUring::IsSupported()) {
+            // 每个调度线程一个 io_uring，线程第一次进入 idle 时认领
+            for (size_t i = 0; i < threads; ++i) {
+                IoUring *ring = IoUring::Create(URING_ENTRIES);
+                if (!ring) {
+                    break;
+                }
+                m_rings.push_back(ring);
+            }
+            if (m_rings.size() != threads) {
+                for (auto ring : m_rings) {
+                    delete ring;
+                }
+                m_rings.clear();
+            }
+            m_directIo = g_iomanager_uring_direct_io->getValue();
+        }
+        if (m_rings.empty()) {
+            SYLAR_LOG_WARN(g_logger) << "IOManager " << name
+                                     << " io_uring unavailable, fall back to epoll";
+        }
+    }
 
-    m_epfd = epoll_create(1);
-    SYLAR_ASSERT(m_epfd > 0);
+    // 每个调度线程一个 eventfd，非阻塞方式，唤醒之后读一次清零
+    m_tickleFds.resize(slotCount());
+    for (auto &fd : m_tickleFds) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(fd >= 0);
+    }
+    m_parkedWords = (slotCount() + 63) / 64;
+    m_parked.reset(new std::atomic<uint64_t>[m_parkedWords]());
 
-    int ret = pipe(m_tickleFds); // [0]读端， [1]写端
-    SYLAR_ASSERT(ret == 0);
+    // io_uring 后端每个线程在自己的 io_uring 上 poll 自己的 eventfd，见 idleUring
+    if (!isUring()) {
+        m_epfd = epoll_create(1);
+        SYLAR_ASSERT(m_epfd > 0);
 
-    epoll_event ev;
-    memset(&ev, 0, sizeof(epoll_event));
-    ev.events =
-        EPOLLIN | EPOLLET; // 边沿触发  绑定pipe读端。 我们就可以对pipe写端写入，以tickle协程
-    ev.data.fd = m_tickleFds[0];
+        // 只有等 epoll 的线程需要通过 epoll 唤醒，其他挂起的线程 poll 自己的 eventfd
+        m_pollerTickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(m_pollerTickleFd >= 0);
 
-    // 非阻塞方式，配合边缘触发
-    // epoll_wait，当为 EL 的时候，即使没有数据获取到，也不会阻塞
-    ret = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    SYLAR_ASSERT(!ret);
+        epoll_event ev;
+        memset(&ev, 0, sizeof(epoll_event));
+        ev.events = EPOLLIN | EPOLLET; // 边沿触发，写 eventfd 就能 tickle 等 epoll 的线程
+        ev.data.fd = m_pollerTickleFd;
 
-    ret = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &ev);
-    SYLAR_ASSERT(!ret);
+        int ret = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_pollerTickleFd, &ev);
+        SYLAR_ASSERT(!ret);
+    }
 
     contextResize(32);
 
+    {
+        LiveIOManagers &live = GetLiveIOManagers();
+        RWSpinlock::WriteLock lock(live.mutex);
+        live.iomanagers.insert(this);
+    }
+
     start(); // 启动 Scheduler,其中 this就说 IOManager,实际调用到 IOManager 重写的方法
 }
 
 IOManager::~IOManager()
 {
     SYLAR_LOG_DEBUG(g_logger) << "IOManager::~IOManager() start";
+    {
+        LiveIOManagers &live = GetLiveIOManagers();
+        RWSpinlock::WriteLock lock(live.mutex);
+        live.iomanagers.erase(this);
+    }
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
+    // 先关 io_uring，内核取消上面所有的请求，释放持有的文件引用
+    for (auto ring : m_rings) {
+        delete ring;
+    }
+    if (m_epfd > 0) {
+        close(m_epfd);
+        close(m_pollerTickleFd);
+    }
+    for (int fd : m_tickleFds) {
+        close(fd);
+    }
     for (size_t i = 0; i < m_fdContexts.size(); ++i) {
         if (m_fdContexts[i]) {
             delete m_fdContexts[i];
@@ -162,42 +309,241 @@ IOManager::~IOManager()
 }
 
 // 返回 0 成功， 返回 -1 失败
-int IOManager::addEvent(int fd, IOManager::Event event, std::function<void()> cb)
+int IOManager::addEvent(int fd, IOManager::Event event, TaskFunction cb,
+                        Fiber::StackClass stack_class, std::source_location site)
 {
     SYLAR_LOG_DEBUG(g_logger) << "addEvent called, fd=" << fd << ", event=" << (EPOLL_EVENTS)event
                               << ", has_cb=" << (cb ? "true" : "false");
-    FdContext *fd_ctx = nullptr;
+    FdContext *fd_ctx = getFdContext(fd);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    int rt = registerEvent(fd_ctx, event, cb, ~0ull);
+    if (rt == 0) {
+        FdContext::EventContext &ev_ctx = fd_ctx->getEventContext(event);
+        ev_ctx.stackClass = stack_class;
+        ev_ctx.site = site;
+    } else if (rt == 1) {
+        // 事件已经就绪，不用等 epoll_wait，直接调度
+        if (cb) {
+            Scheduler::GetThis()->schedule(std::move(cb), -1, Scheduler::INTERACTIVE, stack_class,
+                                           site);
+        } else {
+            Scheduler::GetThis()->schedule(Fiber::GetThis());
+        }
+        return 0;
+    }
+    return rt;
+}
+
+int IOManager::waitEvent(int fd, Event event, uint64_t timeout_ms)
+{
+    FdContext *fd_ctx = getFdContext(fd);
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        TaskFunction cb;
+        int rt = registerEvent(fd_ctx, event, cb, timeout_ms);
+        if (rt) {
+            // 注册失败，或者事件已经就绪，不需要让出
+            return rt < 0 ? -1 : 0;
+        }
+    }
+    Fiber::GetThis()->yield();
+    // 回到这里有两种情况：事件就绪/被取消，或者超时被 expireDeadlines 取消
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if (fd_ctx->getEventContext(event).timedout) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+int IOManager::waitEventAsync(int fd, Event event, uint64_t timeout_ms, TaskFunction cb)
+{
+    FdContext *fd_ctx = getFdContext(fd);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    return registerEvent(fd_ctx, event, cb, timeout_ms);
+}
+
+bool IOManager::eventTimedOut(int fd, Event event)
+{
+    FdContext *fd_ctx = getFdContext(fd);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    return fd_ctx->getEventContext(event).timedout;
+}
+
+void IOManager::ReleaseFd(IOManager *iom, int fd, bool cancel)
+{
+    LiveIOManagers &live = GetLiveIOManagers();
+    RWSpinlock::ReadLock lock(live.mutex);
+    if (!live.iomanagers.count(iom)) {
+        return;
+    }
+    if (cancel) {
+        iom->cancelAll(fd);
+    } else {
+        iom->unregisterFd(fd);
+    }
+}
+
+void IOManager::unregisterFd(int fd)
+{
+    if (!persistent()) {
+        return;
+    }
     RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
+    if ((int)m_fdContexts.size() <= fd) {
+        return;
+    }
+    FdContext *fd_ctx = m_fdContexts[fd];
+    lock.unlock();
+
+    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    // 还有等待者(同时在两个 IOManager 上读写)时保留，等待者自己醒来
+    if (fd_ctx->events || fd_ctx->directOps) {
+        return;
+    }
+    pollUnregister(fd_ctx);
+}
+
+bool IOManager::submitIo(int fd, io_uring_sqe &sqe, uint64_t timeout_ms, ssize_t &result)
+{
+    if (!m_directIo) {
+        return false;
+    }
+    IoUring *ring = ownRing();
+    Fiber *fiber = Fiber::GetThis().get();
+    // 共享栈协程让出之后栈会被别的协程覆盖，内核不能往上面写
+    if (!ring || fiber->getContext().isSharedStack()) {
+        return false;
+    }
+
+    UringOp op;
+    op.fd_ctx = getFdContext(fd);
+    op.scheduler = Scheduler::GetThis();
+    op.fiber = fiber->shared_from_this();
+    io_uring_sqe sqes[2];
+    sqes[0] = sqe;
+    sqes[0].user_data = (uint64_t)&op;
+    op.inflight = 1;
+    if (timeout_ms != ~0ull) {
+        op.ts.tv_sec = timeout_ms / 1000;
+        op.ts.tv_nsec = timeout_ms % 1000 * 1000000;
+        sqes[0].flags |= IOSQE_IO_LINK;
+        IoUring::PrepLinkTimeout(sqes[1], &op.ts, (uint64_t)&op | 1);
+        op.inflight = 2;
+    }
+    {
+        FdContext::MutexType::Lock lock(op.fd_ctx->mutex);
+        // 不马上提交，等本线程进入 idle 时和等待合并成一次 io_uring_enter
+        if (!ring->submit(sqes, op.inflight, false)) {
+            return false;
+        }
+        ++op.fd_ctx->directOps;
+        ++m_pendingEventCount;
+    }
+    fiber->yield();
+
+    if (op.result == -ECANCELED) {
+        // 被 LINK_TIMEOUT 取消是超时，否则是 cancelAll(close) 取消的
+        result = op.timedout ? -ETIMEDOUT : -EBADF;
     } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
+        result = op.result;
+    }
+    return true;
+}
+
+IOManager::FdContext *IOManager::getFdContext(int fd)
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    if ((int)m_fdContexts.size() > fd) {
+        return m_fdContexts[fd];
+    }
+    lock.unlock();
+    RWMutexType::WriteLock lock2(m_mutex);
+    if ((int)m_fdContexts.size() <= fd) {
         contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
     }
+    return m_fdContexts[fd];
+}
+
+bool IOManager::pollRegister(FdContext *fd_ctx)
+{
+    if (isUring()) {
+        if (fd_ctx->registered) {
+            pollUnregister(fd_ctx);
+        }
+        IoUring *ring = submitRing();
+        io_uring_sqe sqe;
+        ++fd_ctx->generation;
+        IoUring::PrepPollAdd(sqe, fd_ctx->fd, POLLIN | POLLOUT | POLLRDHUP, true,
+                             PollUserData(fd_ctx->fd, fd_ctx->generation));
+        // 自己的 io_uring 等到 idle 时再提交，别的线程的马上提交
+        if (!ring->submit(sqe, ring != ownRing())) {
+            return false;
+        }
+        fd_ctx->ring = ring;
+        fd_ctx->registered = true;
+        fd_ctx->ready = NONE;
+        return true;
+    }
+
+    epoll_event epevent;
+    epevent.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    epevent.data.ptr = fd_ctx;
+    int op = EPOLL_CTL_ADD;
+    int rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &epevent);
+    if (rt && errno == EEXIST) {
+        // dup 出来的 fd 还开着，内核里的注册还在
+        op = EPOLL_CTL_MOD;
+        rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &epevent);
+    }
+    if (rt) {
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", "
+                                  << fd_ctx->fd << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt
+                                  << "(" << errno << ") (" << strerror(errno) << ")";
+        fd_ctx->registered = false;
+        return false;
+    }
+    fd_ctx->registered = true;
+    // ET 模式注册之后，当前已经就绪的事件会马上通知一次
+    fd_ctx->ready = NONE;
+    return true;
+}
 
+int IOManager::registerEvent(FdContext *fd_ctx, Event event, TaskFunction &cb,
+                             uint64_t timeout_ms)
+{
     // 同一个fd不允许重复添加相同的事件
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (SYLAR_UNLIKELY(fd_ctx->events & event)) {
-        SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd << " event=" << (EPOLL_EVENTS)event
+        SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd_ctx->fd
+                                  << " event=" << (EPOLL_EVENTS)event
                                   << " fd_ctx.event=" << (EPOLL_EVENTS)fd_ctx->events;
         SYLAR_ASSERT(!(fd_ctx->events & event));
     }
 
-    // 将新添加的事件加入epoll_wait，使用epoll_wait私有指针存储 FdContext
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
-                                  << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << "("
-                                  << errno << ") (" << strerror(errno)
-                                  << ") 原本的 fd_ctx->events=" << (EPOLL_EVENTS)fd_ctx->events;
-        return -1;
+    if (persistent()) {
+        // 之前就绪过、还没有被消费，直接返回，由调用方重试 IO
+        if (fd_ctx->ready & event) {
+            fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+            return 1;
+        }
+        if (!fd_ctx->registered && !pollRegister(fd_ctx)) {
+            return -1;
+        }
+    } else {
+        // 将新添加的事件加入epoll_wait，使用epoll_wait私有指针存储 FdContext
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | fd_ctx->events | event;
+        epevent.data.ptr = fd_ctx;
+        int rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &epevent);
+        if (rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", "
+                                      << fd_ctx->fd << ", " << (EPOLL_EVENTS)epevent.events
+                                      << "):" << rt << "(" << errno << ") (" << strerror(errno)
+                                      << ") 原本的 fd_ctx->events="
+                                      << (EPOLL_EVENTS)fd_ctx->events;
+            return -1;
+        }
     }
 
     ++m_pendingEventCount;
@@ -216,6 +562,10 @@ int IOManager::addEvent(int fd, IOManager::Event event, std::function<void()> cb
         SYLAR_ASSERT2(ev_ctx.fiber->getState() == Fiber::RUNNING,
                       "state=" << ev_ctx.fiber->getState());
     }
+    ev_ctx.timedout = false;
+    if (timeout_ms != ~0ull) {
+        armDeadline(ev_ctx, timeout_ms);
+    }
     return 0;
 }
 
@@ -242,17 +592,7 @@ bool IOManager::delEvent(int fd, Event event)
 
     // 删除后事件
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL; // 如果没了就是全删，如果还有事件就是修改
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
-                                  << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << "("
-                                  << errno << ") (" << strerror(errno)
-                                  << ") 原本的 fd_ctx->events=" << (EPOLL_EVENTS)fd_ctx->events;
+    if (!persistent() && !epollUpdate(fd_ctx, new_events)) {
         return false;
     }
 
@@ -261,6 +601,7 @@ bool IOManager::delEvent(int fd, Event event)
     // 修改 fd_ctx，重置事件，以及删除的event事件对应的EventContext需要被reset
     fd_ctx->events = new_events;
     FdContext::EventContext &ev_ctx = fd_ctx->getEventContext(event);
+    disarmDeadline(ev_ctx);
     fd_ctx->resetEventContext(ev_ctx);
     return true;
 }
@@ -281,26 +622,22 @@ bool IOManager::cancelEvent(int fd, Event event)
     lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    return cancelEvent(fd_ctx, event);
+}
+
+bool IOManager::cancelEvent(FdContext *fd_ctx, Event event)
+{
     if (SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
         SYLAR_LOG_ERROR(g_logger) << "canalEvent event error";
         return false;
     }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
-                                  << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << "("
-                                  << errno << ") (" << strerror(errno)
-                                  << ") 原本的  fd_ctx->events=" << (EPOLL_EVENTS)fd_ctx->events;
+    if (!persistent() && !epollUpdate(fd_ctx, new_events)) {
         return false;
     }
 
+    disarmDeadline(fd_ctx->getEventContext(event));
     fd_ctx->triggerEvent(event);
 
     --m_pendingEventCount;
@@ -318,35 +655,91 @@ bool IOManager::cancelAll(int fd)
     lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if (!fd_ctx->events) {
+    if (!fd_ctx->events && !fd_ctx->registered && !fd_ctx->directOps) {
         return false;
     }
 
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
-                                  << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << "("
-                                  << errno << ") (" << strerror(errno)
-                                  << ") 原本的  fd_ctx->events=" << (EPOLL_EVENTS)fd_ctx->events;
+    if (persistent()) {
+        // 持久注册模式下 cancelAll 一般紧跟着 close，顺便注销，fd 复用时重新注册
+        pollUnregister(fd_ctx);
+        // 直接读写请求被取消之后由完成事件唤醒等待的协程
+        if (fd_ctx->directOps) {
+            cancelDirectOps(fd);
+        }
+    } else if (!epollUpdate(fd_ctx, NONE)) {
         return false;
     }
 
-    if (fd_ctx->events & READ) {
+    triggerEvents(fd_ctx, fd_ctx->events);
+
+    SYLAR_ASSERT(fd_ctx->events == 0);
+    return true;
+}
+
+void IOManager::pollUnregister(FdContext *fd_ctx)
+{
+    if (fd_ctx->registered) {
+        if (isUring()) {
+            io_uring_sqe sqe;
+            IoUring::PrepPollRemove(sqe, PollUserData(fd_ctx->fd, fd_ctx->generation),
+                                    URING_IGNORE);
+            // 马上提交，紧接着的 close 才能真正关闭连接
+            fd_ctx->ring->submit(sqe, true);
+            fd_ctx->ring = nullptr;
+            // 已经在完成队列里的旧事件按代数丢弃
+            ++fd_ctx->generation;
+        } else {
+            epollUpdate(fd_ctx, NONE);
+        }
+    }
+    fd_ctx->registered = false;
+    fd_ctx->ready = NONE;
+}
+
+void IOManager::onReady(FdContext *fd_ctx, uint32_t revents)
+{
+    int real_events = NONE;
+    if (revents & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+        real_events |= READ;
+    }
+    if (revents & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        real_events |= WRITE;
+    }
+    // 没有等待者的就绪事件记下来，之后的等待者不用再等
+    int trigger_events = fd_ctx->events & real_events;
+    fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~trigger_events));
+    triggerEvents(fd_ctx, trigger_events);
+}
+
+void IOManager::triggerEvents(FdContext *fd_ctx, int events)
+{
+    if (events & READ) {
+        disarmDeadline(fd_ctx->read);
         fd_ctx->triggerEvent(READ);
         --m_pendingEventCount;
     }
-
-    if (fd_ctx->events & WRITE) {
+    if (events & WRITE) {
+        disarmDeadline(fd_ctx->write);
         fd_ctx->triggerEvent(WRITE);
         --m_pendingEventCount;
     }
+}
 
-    SYLAR_ASSERT(fd_ctx->events == 0);
+bool IOManager::epollUpdate(FdContext *fd_ctx, Event new_events)
+{
+    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL; // 如果没了就是全删，如果还有事件就是修改
+    epoll_event epevent;
+    epevent.events = EPOLLET | new_events;
+    epevent.data.ptr = fd_ctx;
+
+    int rt = epoll_ctl(m_epfd, op, fd_ctx->fd, &epevent);
+    if (rt) {
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", "
+                                  << fd_ctx->fd << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt
+                                  << "(" << errno << ") (" << strerror(errno)
+                                  << ") 原本的 fd_ctx->events=" << (EPOLL_EVENTS)fd_ctx->events;
+        return false;
+    }
     return true;
 }
 
@@ -365,15 +758,90 @@ void IOManager::contextResize(size_t size)
 /**
  * 通知调度协程，也就是让 协程 Scheduler::run() 中 idle 中退出
  * Scheduler::run() 每次从idle协程中退出之后，都会重新把任务队列里的所有任务执行完了再重新进入idle
- * 如果没有调度线程处于idle状态，那就没必要发通知了。
+ *
+ * 挂起的线程在 m_parked 里有一位，谁把这一位清掉谁负责写它的 eventfd，所以一次 tickle 最多唤醒一个线程；
+ * 目标线程正在跑任务(没有挂起)时它自己会看到新任务，不需要系统调用
  */
-void IOManager::tickle()
+void IOManager::tickle(int thread)
+{
+    // 和 park 里的 fence 配对：要么这里看到挂起位，要么挂起的线程看到刚入队的任务
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int slot = thread == -1 ? -1 : findSlot(thread);
+    if (slot == -1) {
+        slot = claimParked();
+        if (slot == -1) {
+            return;
+        }
+    } else if (!unpark(slot)) {
+        return;
+    }
+    wake(slot);
+}
+
+void IOManager::ticklePoller()
 {
-    if (!(hasIdleThreads())) {
+    if (isUring()) {
+        // 每个线程都按自己算出的超时等待，叫醒任意一个重新计算
+        tickle();
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);
-    SYLAR_ASSERT(rt == 1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int poller = m_poller;
+    // 没有线程在等 epoll 时，下一个等 epoll 的线程会重新计算超时
+    if (poller != -1 && unpark(poller)) {
+        wake(poller);
+    }
+}
+
+bool IOManager::park(int slot, bool polling, uint64_t &next_timeout)
+{
+    m_parked[slot / 64].fetch_or(1ull << (slot % 64));
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 记下挂起位之后再检查，和 tickle / ticklePoller / 交出 epoll 时的检查配对，不会漏掉唤醒
+    if (hasPendingTasks(slot) || stopping(next_timeout)
+        || (!polling && !isUring() && m_poller == -1)) {
+        unpark(slot);
+        return false;
+    }
+    return true;
+}
+
+bool IOManager::unpark(int slot)
+{
+    uint64_t mask = 1ull << (slot % 64);
+    return m_parked[slot / 64].fetch_and(~mask) & mask;
+}
+
+int IOManager::claimParked()
+{
+    int poller = m_poller;
+    // 第一遍跳过等 epoll 的线程，让它继续等 IO 事件
+    for (int pass = poller == -1 ? 1 : 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < m_parkedWords; ++i) {
+            uint64_t word = m_parked[i];
+            while (word) {
+                int slot = i * 64 + __builtin_ctzll(word);
+                word &= word - 1;
+                if (pass == 0 && slot == poller) {
+                    continue;
+                }
+                if (unpark(slot)) {
+                    return slot;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+void IOManager::wake(int slot)
+{
+    // 挂起期间线程的角色不会变，等 epoll 的线程只能通过 epoll 里的 eventfd 唤醒。
+    // 线程如果已经被别的事件唤醒，多写的一次只会让它下次挂起时多醒一次
+    int fd = !isUring() && slot == m_poller ? m_pollerTickleFd : m_tickleFds[slot];
+    uint64_t one = 1;
+    int rt = write(fd, &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
 }
 
 bool IOManager::stopping()
@@ -384,7 +852,7 @@ bool IOManager::stopping()
 
 bool IOManager::stopping(uint64_t &next_timeout)
 {
-    next_timeout = getNextTimer();
+    next_timeout = std::min(getNextTimer(), getNextDeadline());
     return next_timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
@@ -397,6 +865,10 @@ bool IOManager::stopping(uint64_t &next_timeout)
 void IOManager::idle()
 {
     // SYLAR_LOG_DEBUG(g_logger) << "IOManager::idle() started";
+    if (isUring()) {
+        idleUring();
+        return;
+    }
 
     // 一次epoll_wait最多检测 256 个就绪事件
     const uint64_t MAX_EVENTS = 256;
@@ -406,46 +878,86 @@ void IOManager::idle()
     // 通过shared_ptr管理，避免内存泄漏
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event *ev) { delete[] ev; });
 
+    int slot = currentSlot();
+    uint64_t tickle_count = 0;
+    static const int MAX_TIMEOUT = 5000;
+    // 本线程当前的忙等预算(微秒)，在 [0, m_busyPollUs] 之间自适应
+    uint64_t spin_us = m_busyPollUs;
     while (true) {
         // 获取下一个定时器的超时事件，顺便判断调度器是否停止。
         uint64_t next_timeout = 0;
         if (SYLAR_UNLIKELY(stopping(next_timeout))) {
             SYLAR_LOG_DEBUG(g_logger) << "IOManager::idle() stopping, name=" << getName();
+            // 挂起的线程不会再被任务唤醒，一个叫醒一个依次退出
+            tickle();
             break;
         }
+
+        /**
+         * 同一时间只有一个线程等 epoll(leader)，IO 事件和定时器只唤醒它；
+         * 其他挂起的线程只 poll 自己的 eventfd，由 tickle 按需单独唤醒
+         */
         int rt = 0;
-        do {
-            static const int MAX_TIMEOUT = 5000;
-            if (next_timeout != ~0ull) {
-                next_timeout = std::min((int)next_timeout, MAX_TIMEOUT);
+        int expected = -1;
+        // 还有任务可做时不去抢 epoll，否则抢到马上又要交出去，还要叫醒别的线程来接
+        bool polling = !hasPendingTasks(slot) && m_poller.compare_exchange_strong(expected, slot);
+        // 先忙等一会儿：没有挂起位，这期间的 tickle 不用写 eventfd，本线程也不用睡下再被叫醒
+        bool spun = spin_us > 0 && next_timeout > 0
+                    && busyPoll(slot, polling, spin_us, next_timeout, events, MAX_EVENTS, rt);
+        if (spun) {
+            spin_us = std::min<uint64_t>(m_busyPollUs, spin_us * 2);
+        } else if (park(slot, polling, next_timeout)) {
+            uint64_t park_begin = m_busyPollUs ? GetCurrentUS() : 0;
+            if (polling) {
+                do {
+                    if (next_timeout != ~0ull) {
+                        next_timeout = std::min((int)next_timeout, MAX_TIMEOUT);
+                    } else {
+                        next_timeout = MAX_TIMEOUT;
+                    }
+                    // SYLAR_LOG_DEBUG(g_logger) << "epoll_wait with timeout=" << next_timeout;
+                    rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
+
+                    if (rt < 0 && errno == EINTR) {
+                    } else {
+                        break;
+                    }
+                } while (true);
             } else {
-                next_timeout = MAX_TIMEOUT;
+                pollfd pfd;
+                pfd.fd = m_tickleFds[slot];
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                if (poll(&pfd, 1, MAX_TIMEOUT) > 0) {
+                    (void)!read(m_tickleFds[slot], &tickle_count, sizeof(tickle_count));
+                }
             }
-            // SYLAR_LOG_DEBUG(g_logger) << "epoll_wait with timeout=" << next_timeout;
-            rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
-
-            if (rt < 0 && errno == EINTR) {
-            } else {
-                break;
+            unpark(slot);
+            if (m_busyPollUs) {
+                // 挂起没多久就被叫醒，说明多等一会儿就能接住，加预算；一直空转则减半直到不再忙等
+                uint64_t parked_us = GetCurrentUS() - park_begin;
+                if (parked_us <= m_busyPollUs) {
+                    spin_us = std::min<uint64_t>(
+                        m_busyPollUs, std::max<uint64_t>(spin_us * 2, m_busyPollUs / 16 + 1));
+                } else {
+                    spin_us /= 2;
+                }
             }
-        } while (true);
-
-        // 退出epoll_wait
-        std::vector<std::function<void()>> cbs;
-        listExpiredCb(cbs);
-        if (!cbs.empty()) {
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
+        }
+        if (polling) {
+            // 交出 epoll，还有挂起的线程就叫醒一个接着等，自己去执行任务
+            m_poller = -1;
+            tickle();
         }
 
+        processTimeouts();
+
         for (int i = 0; i < rt; ++i) {
             epoll_event &event = events[i];
 
-            // ticklefd[0]用于通知协程调度，这时只需要把管道读完
-            if (event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
-                    ;
+            // eventfd 用于通知协程调度，这时只需要读一次清零
+            if (event.data.fd == m_pollerTickleFd) {
+                (void)!read(m_pollerTickleFd, &tickle_count, sizeof(tickle_count));
                 continue;
             }
             // 如果不是 pipe 的读端触发，那就对应 IO事件被触发了。
@@ -458,6 +970,11 @@ void IOManager::idle()
              * 出现这两种事件，应该同时触发fd 的读写事件，否则有可能出现注册的事件永远执行不到的情况
              */
 
+            if (m_persistentEpoll) {
+                onReady(fd_ctx, event.events);
+                continue;
+            }
+
             // event.events 只有当前就绪的事件类型
             if (event.events & (EPOLLERR | EPOLLHUP)) {
                 // 过滤掉当前fd实际关注的事件类型 （如 READ / WRITE）
@@ -479,28 +996,11 @@ void IOManager::idle()
             }
 
             // 执行完real_events后的events
-            int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
-
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if (rt2) {
-                SYLAR_LOG_ERROR(g_logger)
-                    << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd_ctx->fd
-                    << ", " << (EPOLL_EVENTS)event.events << "):" << rt2 << " (" << errno << ") ("
-                    << strerror(errno) << ")";
+            if (!epollUpdate(fd_ctx, (Event)(fd_ctx->events & ~real_events))) {
                 continue;
             }
 
-            if (real_events & READ) {
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
-            }
-            if (real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
-            }
-
+            triggerEvents(fd_ctx, real_events);
         } // end for
 
         /**
@@ -515,9 +1015,280 @@ void IOManager::idle()
     } // end while(true)
 }
 
+bool IOManager::busyPoll(int slot, bool polling, uint64_t budget_us, uint64_t next_timeout,
+                         epoll_event *events, int max_events, int &rt)
+{
+    uint64_t deadline = GetCurrentUS() + budget_us;
+    if (next_timeout != ~0ull) {
+        // 定时器先到期就不用再等了，回去处理定时器
+        deadline = std::min(deadline, GetCurrentUS() + next_timeout * 1000);
+    }
+    while (true) {
+        if (hasPendingTasks(slot)) {
+            return true;
+        }
+        if (polling) {
+            rt = epoll_wait(m_epfd, events, max_events, 0);
+            if (rt > 0) {
+                return true;
+            }
+            rt = 0;
+        }
+        if (GetCurrentUS() >= deadline) {
+            return false;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+void IOManager::processTimeouts()
+{
+    // 退出等待，顺便回收空闲太久的协程栈
+    FiberStackPool::Trim();
+
+    expireDeadlines();
+
+    std::vector<TaskFunction> cbs;
+    listExpiredCb(cbs);
+    if (!cbs.empty()) {
+        schedule(cbs.begin(), cbs.end(), m_timerStackClass);
+        cbs.clear();
+    }
+}
+
+/**
+ * io_uring 后端的 idle：每个调度线程等待自己的 io_uring
+ * 1. 第一次进入时认领一个 io_uring，并在上面 poll 自己的 tickle eventfd
+ * 2. 本线程攒下的请求在等待时一起提交
+ * 3. 唤醒之后处理超时，再消费完成队列
+ */
+void IOManager::idleUring()
+{
+    IoUring *ring = ownRing();
+    int slot = currentSlot();
+    if (!ring) {
+        size_t idx = m_claimedRings++;
+        SYLAR_ASSERT2(idx < m_rings.size(), "idx=" << idx << " rings=" << m_rings.size());
+        ring = m_rings[idx];
+        ring->setOwner(GetThreadId());
+        t_ring = ring;
+        t_ring_iom = this;
+        io_uring_sqe sqe;
+        IoUring::PrepPollAdd(sqe, m_tickleFds[slot], POLLIN, true, URING_TICKLE);
+        ring->submit(sqe, false);
+    }
+
+    while (true) {
+        uint64_t next_timeout = 0;
+        if (SYLAR_UNLIKELY(stopping(next_timeout))) {
+            SYLAR_LOG_DEBUG(g_logger) << "IOManager::idle() stopping, name=" << getName();
+            // 挂起的线程不会再被任务唤醒，一个叫醒一个依次退出
+            tickle();
+            break;
+        }
+        static const uint64_t MAX_TIMEOUT = 5000;
+        // 不能挂起时也要进一次内核，把本线程攒下的请求提交掉
+        bool parked = park(slot, true, next_timeout);
+        int rt = ring->wait(parked ? std::min(next_timeout, MAX_TIMEOUT) : 0);
+        if (parked) {
+            unpark(slot);
+        }
+        if (SYLAR_UNLIKELY(rt)) {
+            SYLAR_LOG_ERROR(g_logger) << "io_uring_enter(" << ring->getFd() << ") wait error=" << -rt
+                                      << " " << strerror(-rt);
+        }
+
+        processTimeouts();
+
+        ring->reap([this](const io_uring_cqe &cqe) { onCompletion(cqe); });
+
+        Fiber::ptr cur = Fiber::GetThis();
+        auto raw_ptr = cur.get();
+        cur.reset();
+
+        raw_ptr->yield();
+    }
+    t_ring = nullptr;
+    t_ring_iom = nullptr;
+}
+
+IoUring *IOManager::ownRing()
+{
+    return t_ring_iom == this ? t_ring : nullptr;
+}
+
+IoUring *IOManager::submitRing()
+{
+    IoUring *ring = ownRing();
+    if (ring) {
+        return ring;
+    }
+    // 外部线程，或者还没进入过 idle 的调度线程，轮流用已经有线程在等待的 io_uring
+    size_t claimed = std::min(m_claimedRings.load(), m_rings.size());
+    if (!claimed) {
+        return m_rings[0];
+    }
+    return m_rings[m_ringSeq++ % claimed];
+}
+
+void IOManager::onCompletion(const io_uring_cqe &cqe)
+{
+    uint64_t data = cqe.user_data;
+    if (data & URING_POLL) {
+        int fd = (uint32_t)data;
+        FdContext *fd_ctx = getFdContext(fd);
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        // 已经注销，或者注销之后又重新注册过
+        if (!fd_ctx->registered
+            || (fd_ctx->generation & URING_GEN_MASK) != ((data >> 32) & URING_GEN_MASK)) {
+            return;
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            // multishot poll 被内核结束了，还有等待者的话下面重新注册
+            fd_ctx->registered = false;
+            fd_ctx->ring = nullptr;
+        }
+        if (cqe.res > 0) {
+            onReady(fd_ctx, cqe.res);
+        } else if (cqe.res < 0 && cqe.res != -ECANCELED) {
+            // 唤醒所有等待者，重试 IO 时拿到具体的错误
+            onReady(fd_ctx, EPOLLERR);
+        }
+        if (!fd_ctx->registered && fd_ctx->events) {
+            pollRegister(fd_ctx);
+        }
+        return;
+    }
+    if (data == URING_TICKLE) {
+        // 完成事件只在认领 io_uring 的线程上处理，poll 的是当前线程自己的 eventfd
+        int fd = m_tickleFds[currentSlot()];
+        uint64_t count = 0;
+        (void)!read(fd, &count, sizeof(count));
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            io_uring_sqe sqe;
+            IoUring::PrepPollAdd(sqe, fd, POLLIN, true, URING_TICKLE);
+            ownRing()->submit(sqe, false);
+        }
+        return;
+    }
+    if (data == URING_IGNORE) {
+        return;
+    }
+
+    UringOp *op = (UringOp *)(data & ~1ull);
+    if (data & 1) {
+        op->timedout = cqe.res == -ETIME;
+    } else {
+        op->result = cqe.res;
+    }
+    if (--op->inflight) {
+        return;
+    }
+    {
+        FdContext::MutexType::Lock lock(op->fd_ctx->mutex);
+        --op->fd_ctx->directOps;
+    }
+    // 调度之后协程可能马上在别的线程恢复，op 随着协程栈失效，先把需要的拿出来
+    Fiber::ptr fiber;
+    fiber.swap(op->fiber);
+    Scheduler *scheduler = op->scheduler;
+    scheduler->schedule(std::move(fiber));
+    --m_pendingEventCount;
+}
+
+void IOManager::cancelDirectOps(int fd)
+{
+    io_uring_sqe sqe;
+    IoUring::PrepCancelFd(sqe, fd, URING_IGNORE);
+    // 请求提交在哪个 io_uring 上没有记录，每个都取消一遍，只有 close 正在等待的 fd 才会走到这里
+    size_t claimed = std::min(m_claimedRings.load(), m_rings.size());
+    for (size_t i = 0; i < claimed; ++i) {
+        m_rings[i]->submit(sqe, true);
+    }
+}
+
 void IOManager::onTimerInsertedAtFront()
 {
-    tickle();
+    ticklePoller();
+}
+
+void IOManager::armDeadline(FdContext::EventContext &ev_ctx, uint64_t timeout_ms)
+{
+    uint64_t now_ms = GetCurrentMS();
+    if (timeout_ms >= ~0ull - now_ms) {
+        return;
+    }
+    ev_ctx.deadline = now_ms + timeout_ms;
+    {
+        Spinlock::Lock lock(m_deadlineMutex);
+        m_deadlines.insert(&ev_ctx, ev_ctx.deadline);
+    }
+    // 和 TimerManager 一样，比 epoll_wait 等待的时间更早超时，需要唤醒
+    if (ev_ctx.deadline < m_deadlineWake && !m_deadlineTickled.exchange(true)) {
+        ticklePoller();
+    }
+}
+
+void IOManager::disarmDeadline(FdContext::EventContext &ev_ctx)
+{
+    if (!ev_ctx.deadline) {
+        return;
+    }
+    ev_ctx.deadline = 0;
+    Spinlock::Lock lock(m_deadlineMutex);
+    m_deadlines.erase(&ev_ctx);
+}
+
+uint64_t IOManager::getNextDeadline()
+{
+    m_deadlineTickled = false;
+    uint64_t next = 0;
+    {
+        Spinlock::Lock lock(m_deadlineMutex);
+        next = m_deadlines.next();
+    }
+    m_deadlineWake = next;
+    if (next == ~0ull) {
+        return ~0ull;
+    }
+    uint64_t now_ms = GetCurrentMS();
+    return now_ms >= next ? 0 : next - now_ms;
+}
+
+void IOManager::expireDeadlines()
+{
+    uint64_t now_ms = GetCurrentMS();
+    // 只有真的超时才会分配，正常路径不分配内存
+    std::vector<FdContext::EventContext *> expired;
+    {
+        Spinlock::Lock lock(m_deadlineMutex);
+        if (m_deadlines.empty()) {
+            return;
+        }
+        m_deadlines.expire(now_ms, [&expired](ds::TimingWheelNode *node) {
+            expired.push_back(static_cast<FdContext::EventContext *>(node));
+        });
+    }
+
+    // 先摘下再加 fd 锁（加锁顺序是 fd 锁 -> m_deadlineMutex），
+    // 这期间事件可能已经触发（deadline 被清零），甚至重新注册了新的超时（又挂回了时间轮）
+    for (auto ev_ctx : expired) {
+        FdContext *fd_ctx = ev_ctx->owner;
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        if (!ev_ctx->deadline) {
+            continue;
+        }
+        {
+            Spinlock::Lock lock2(m_deadlineMutex);
+            if (ev_ctx->wheelLinked()) {
+                continue;
+            }
+        }
+        ev_ctx->timedout = true;
+        cancelEvent(fd_ctx, ev_ctx->event);
+    }
 }
 
 } // end namespace sylar
\ No newline at end of file
@@ -1,13 +1,20 @@
 #ifndef __SYLAR_IO_MANAGER_H__
 #define __SYLAR_IO_MANAGER_H__
+#include <sys/epoll.h>
 #include <unordered_map>
 
 #include "scheduler.h"
 #include "sylar/core/mutex.h"
+#include "sylar/core/ds/timing_wheel.h"
 #include "sylar/core/timermanager.h"
 
+struct io_uring_sqe;
+struct io_uring_cqe;
+
 namespace sylar {
 
+class IoUring;
+
 class IOManager : public Scheduler , public TimerManager{
 public:
     typedef std::shared_ptr<IOManager> ptr;
@@ -34,15 +41,32 @@ private:
     struct FdContext{
         typedef Spinlock MutexType;
 
-        struct EventContext{
+        /**
+         * 事件上下文，同时是超时时间轮上的节点，等待超时不需要额外分配定时器
+         */
+        struct EventContext : public ds::TimingWheelNode {
             ///执行事件回调的调度器
             Scheduler* scheduler = nullptr;
             /// 回调协程
             Fiber::ptr fiber;
             /// 回调函数
-            std::function<void()> cb;
+            TaskFunction cb;
+            /// 回调函数运行在多大的栈上
+            Fiber::StackClass stackClass = Fiber::STACK_DEFAULT;
+            /// 注册回调的位置
+            std::source_location site;
+            /// 超时时间(绝对毫秒)，0 表示没有设置超时
+            uint64_t deadline = 0;
+            /// 上一次等待是否因为超时结束，下一次设置超时时清除
+            bool timedout = false;
+            /// 所属的 FdContext
+            FdContext *owner = nullptr;
+            /// 对应的事件
+            Event event = NONE;
         };
 
+        FdContext();
+
         EventContext& getEventContext(Event event);
         void resetEventContext(EventContext& ctx);
         void triggerEvent(Event event);
@@ -59,6 +83,21 @@ private:
         // 注册事件
         Event events = NONE;
 
+        // 持久注册模式下，已经就绪但还没有等待者消费的事件
+        Event ready = NONE;
+
+        // 持久注册模式下，是否已经注册到 epoll / io_uring
+        bool registered = false;
+
+        // io_uring 后端下 multishot poll 所在的 io_uring
+        IoUring *ring = nullptr;
+
+        // io_uring 后端下每次注册加一，旧的注册产生的完成事件直接丢弃
+        uint32_t generation = 0;
+
+        // io_uring 后端下还没有完成的直接读写请求个数
+        uint32_t directOps = 0;
+
         MutexType mutex;
     };
 
@@ -75,11 +114,15 @@ public:
      * fd socket句柄
      * event 事件类型
      * cb 事件回调函数
+     * stack_class 回调函数运行在多大的栈上，不传回调时忽略
+     * site 调用位置，回调的栈用量按它汇总
      * 
      * @return 添加成功返回0，失败返回-1
      */
 
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, TaskFunction cb = nullptr,
+                 Fiber::StackClass stack_class = Fiber::STACK_DEFAULT,
+                 std::source_location site = std::source_location::current());
     
     /**
      * 删除事件
@@ -96,14 +139,70 @@ public:
     bool cancelEvent(int fd, Event event);
 
     bool cancelAll(int fd);
+
+    /**
+     * @brief 当前协程等待 fd 上的事件，带超时
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull 表示不超时
+     * @details 超时时间记在 fd 的事件上下文里，挂到 IOManager 的超时时间轮上，
+     *          epoll_wait 返回后检查，超时等同于 cancelEvent。整个过程不分配内存。
+     * @return 事件就绪或者被取消返回 0；注册失败返回 -1；超时返回 -1，errno 为 ETIMEDOUT
+     */
+    int waitEvent(int fd, Event event, uint64_t timeout_ms);
+
+    /**
+     * @brief 不挂起协程的 waitEvent，事件就绪、被取消或者超时后调度 cb，C++20 协程使用
+     * @details 超时和 waitEvent 一样记在 fd 的事件上下文里，cb 执行之后用 eventTimedOut 查询
+     * @return 已经就绪返回 1(cb 不会被调度)；注册成功返回 0；注册失败返回 -1
+     */
+    int waitEventAsync(int fd, Event event, uint64_t timeout_ms, TaskFunction cb);
+
+    /**
+     * @brief fd 上最近一次等待的事件是不是超时取消的
+     */
+    bool eventTimedOut(int fd, Event event);
+
+    /**
+     * @brief fd 不再在 iom 上等待时从 iom 上注销，iom 已经析构时什么都不做
+     * @details 持久注册模式(iomanager.persistent_epoll)下，每个 fd 在第一次等待它的 IOManager 上注册一次
+     *          EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET，就绪状态记在 FdContext 里：
+     *          就绪时没有等待者就记下来，之后的等待者直接返回，不需要任何系统调用；
+     *          添加/删除/取消事件都不再调用 epoll_ctl，只在 cancelAll(一般紧跟着 close)时注销。
+     *          io_uring 后端(iomanager.backend)同样是持久注册，用 multishot poll 代替 epoll。
+     *          fd 记着最后一次在哪个 IOManager 上等待(FdCtx::bindIOManager)，换到别的 IOManager 时
+     *          调用这里从原来的注销(还有等待者时保留)，否则原来的 IOManager 会被这个 fd 的每次就绪唤醒；
+     *          关闭时(cancel 为 true)调用 cancelAll，唤醒上面的等待者并注销。
+     *          非持久注册模式下只有 cancel 为 true 时有作用
+     * @param[in] iom fd 之前等待的 IOManager
+     * @param[in] cancel 是否 cancelAll
+     */
+    static void ReleaseFd(IOManager *iom, int fd, bool cancel);
+
+    /**
+     * @brief io_uring 后端下直接提交读写请求，当前协程让出直到请求完成
+     * @param[in] fd 句柄
+     * @param[in] sqe 填好的请求，user_data 由 IOManager 设置
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull 表示不超时，超时用 IORING_OP_LINK_TIMEOUT 实现
+     * @param[out] result 请求的返回值，失败为 -errno，超时为 -ETIMEDOUT，被 cancelAll 取消为 -EBADF
+     * @return 是否提交了请求。不是 io_uring 后端、没有开启 iomanager.uring_direct_io、
+     *         当前线程没有自己的 io_uring、当前协程使用共享栈(缓冲区可能在栈上)时返回 false，
+     *         调用方改用 waitEvent
+     */
+    bool submitIo(int fd, io_uring_sqe &sqe, uint64_t timeout_ms, ssize_t &result);
+
+    /**
+     * @brief 是否使用 io_uring 后端
+     */
+    bool isUring() const { return !m_rings.empty(); }
     
     void contextResize(size_t size);
 
 protected:
     /**
-      * @brief 通知协程调度器有任务了
-      */
-    void tickle() override;
+     * @brief 通知协程调度器有任务了
+     * @details 只唤醒一个挂起的线程：指定了目标线程时只唤醒目标线程，目标线程没有挂起就什么都不做；
+     *          没有指定时优先唤醒不在等 epoll 的线程
+     */
+    void tickle(int thread = -1) override;
 
 
     /**
@@ -127,17 +226,191 @@ protected:
      * 这里是唤醒idle协程以便使用新的超时时间
      */
     void onTimerInsertedAtFront() override;
+
+private:
+    /**
+     * @brief 获取 fd 的上下文，不够时扩容
+     */
+    FdContext *getFdContext(int fd);
+
+    /**
+     * @brief 注册事件，调用时持有 fd_ctx->mutex
+     * @return 0 注册成功；1 事件已经就绪，没有注册；-1 失败
+     */
+    int registerEvent(FdContext *fd_ctx, Event event, TaskFunction &cb,
+                      uint64_t timeout_ms);
+
+    /**
+     * @brief 是否是持久注册模式，io_uring 后端总是持久注册
+     */
+    bool persistent() const { return m_persistentEpoll || isUring(); }
+
+    /**
+     * @brief 持久注册模式下把 fd 注册到 epoll / io_uring，调用时持有 fd_ctx->mutex
+     */
+    bool pollRegister(FdContext *fd_ctx);
+
+    /**
+     * @brief 持久注册模式下注销 fd，调用时持有 fd_ctx->mutex
+     */
+    void pollUnregister(FdContext *fd_ctx);
+
+    /**
+     * @brief 持久注册模式下 fd 上没有等待者时注销，fd 换到别的 IOManager 上等待时调用
+     */
+    void unregisterFd(int fd);
+
+    /**
+     * @brief 持久注册模式下 fd 上就绪了 revents(EPOLLIN/EPOLLOUT 等)，
+     *        有等待者的触发，没有的记到 ready 里，调用时持有 fd_ctx->mutex
+     */
+    void onReady(FdContext *fd_ctx, uint32_t revents);
+
+    /**
+     * @brief 把 fd 在 epoll 中关注的事件改成 new_events，NONE 表示删除，调用时持有 fd_ctx->mutex
+     */
+    bool epollUpdate(FdContext *fd_ctx, Event new_events);
+
+    /**
+     * @brief 触发 events 中的事件，调用时持有 fd_ctx->mutex
+     */
+    void triggerEvents(FdContext *fd_ctx, int events);
+
+    /**
+     * @brief 取消事件并触发，调用时持有 fd_ctx->mutex
+     */
+    bool cancelEvent(FdContext *fd_ctx, Event event);
+
+    /**
+     * @brief 设置/取消事件的超时，调用时持有 fd_ctx->mutex
+     */
+    void armDeadline(FdContext::EventContext &ev_ctx, uint64_t timeout_ms);
+    void disarmDeadline(FdContext::EventContext &ev_ctx);
+
+    /**
+     * @brief 最近的超时距离现在的毫秒数，没有返回 ~0ull
+     */
+    uint64_t getNextDeadline();
+
+    /**
+     * @brief 取消所有已经超时的事件
+     */
+    void expireDeadlines();
+
+    /**
+     * @brief idle 被唤醒之后处理超时：回收协程栈、事件超时、定时器
+     */
+    void processTimeouts();
+
+    /**
+     * @brief io_uring 后端的 idle
+     */
+    void idleUring();
+
+    /**
+     * @brief 当前线程认领的 io_uring，没有返回 nullptr
+     */
+    IoUring *ownRing();
+
+    /**
+     * @brief 提交请求用的 io_uring：当前线程有自己的用自己的，否则轮流用已经被认领的
+     */
+    IoUring *submitRing();
+
+    /**
+     * @brief 处理 io_uring 的一个完成事件
+     */
+    void onCompletion(const io_uring_cqe &cqe);
+
+    /**
+     * @brief 在所有已经认领的 io_uring 上取消 fd 的直接读写请求
+     */
+    void cancelDirectOps(int fd);
+
+    /**
+     * @brief 挂起之前在 m_parked 里记下自己，再检查一遍有没有任务、是否停止、epoll 是否有人等
+     * @param[in] slot 当前线程的槽位
+     * @param[in] polling 当前线程是否负责等 epoll
+     * @param[out] next_timeout 重新计算的最近超时
+     * @return 是否可以挂起，不能挂起时已经清掉了挂起位
+     */
+    bool park(int slot, bool polling, uint64_t &next_timeout);
+
+    /**
+     * @brief 挂起之前忙等：反复检查本线程能拿到的任务，等 epoll 的线程顺便 epoll_wait(0)
+     * @param[in] budget_us 最多忙等的时间(微秒)，不超过最近的定时器
+     * @param[out] rt 等到的 IO 事件个数
+     * @return 是否等到了任务或者 IO 事件，没等到需要挂起
+     */
+    bool busyPoll(int slot, bool polling, uint64_t budget_us, uint64_t next_timeout,
+                  epoll_event *events, int max_events, int &rt);
+
+    /**
+     * @brief 清掉 slot 的挂起位
+     * @return 清之前是否挂起，返回 true 的一方负责唤醒它
+     */
+    bool unpark(int slot);
+
+    /**
+     * @brief 认领一个挂起的线程，优先不在等 epoll 的，没有返回 -1
+     */
+    int claimParked();
+
+    /**
+     * @brief 写 eventfd 唤醒已经认领的挂起线程
+     */
+    void wake(int slot);
+
+    /**
+     * @brief 唤醒负责等定时器的线程，让它重新计算等待时间
+     */
+    void ticklePoller();
+
 private:
+    struct UringOp;
+
     // epoll 文件句柄
     int m_epfd = 0;
-    // pipe 句柄 fd[0]读端 fd[1]写端
-    int m_tickleFds[2];
+    // 每个调度线程一个 eventfd，按槽位下标，tickle 只写要唤醒的线程的
+    std::vector<int> m_tickleFds;
+    // epoll 后端注册在 m_epfd 里的 eventfd，唤醒正在等 epoll 的线程
+    int m_pollerTickleFd = -1;
+    // epoll 后端正在等 epoll 的线程槽位，同一时间只有一个，-1 表示没有
+    std::atomic<int> m_poller{-1};
+    // 挂起在 epoll_wait / poll / io_uring_enter 里的线程，每个槽位一位
+    std::unique_ptr<std::atomic<uint64_t>[]> m_parked;
+    size_t m_parkedWords = 0;
     // 当前等待执行的IO事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
 
     RWMutexType m_mutex;
 
     std::vector<FdContext *> m_fdContexts;
+
+    /// 是否持久注册模式，构造时从 iomanager.persistent_epoll 读取
+    bool m_persistentEpoll = false;
+    /// 挂起之前忙等的最长时间(微秒)，构造时从 iomanager.busy_poll_us 读取，0 表示不忙等
+    uint32_t m_busyPollUs = 0;
+    /// 定时器回调的栈大小档位，构造时从 iomanager.timer_stack_class 读取
+    Fiber::StackClass m_timerStackClass = Fiber::STACK_DEFAULT;
+
+    /// io_uring 后端每个调度线程一个 io_uring，epoll 后端为空
+    std::vector<IoUring *> m_rings;
+    /// 已经被认领的 io_uring 个数
+    std::atomic<size_t> m_claimedRings{0};
+    /// 外部线程轮流选择 io_uring 的计数
+    std::atomic<size_t> m_ringSeq{0};
+    /// 是否开启直接读写，构造时从 iomanager.uring_direct_io 读取
+    bool m_directIo = false;
+
+    /// 保护 m_deadlines
+    Spinlock m_deadlineMutex;
+    /// 事件超时时间轮
+    ds::TimingWheel m_deadlines;
+    /// 是否已经因为新的超时唤醒过 epoll_wait
+    std::atomic<bool> m_deadlineTickled{false};
+    /// 上次 getNextDeadline 算出的最近超时时间，比它更早的超时需要唤醒 epoll_wait
+    std::atomic<uint64_t> m_deadlineWake{~0ull};
 };
 
 }
@@ -1,7 +1,12 @@
+#include <execinfo.h>
 #include <sys/mman.h>
+#include <algorithm>
+#include <random>
 
 #include "sylar/core/memory/memorypool.h"
 #include "sylar/core/config/config.h"
+#include "sylar/core/util/topology.h"
+#include "sylar/core/util/util.h"
 
 namespace sylar
 {
@@ -13,8 +18,104 @@ static sylar::ConfigVar<std::map<std::string, std::map<std::string, std::string>
 static sylar::ConfigVar<int>::ptr g_protectStackPageSize =
     sylar::Config::Lookup("protect_stack_pagesize", 1, "protectStackPageSize");
 
+static sylar::ConfigVar<uint32_t>::ptr g_release_idle_ms = sylar::Config::Lookup<uint32_t>(
+    "memory_pool.release_idle_ms", 10 * 1000,
+    "free page cache spans idle longer than this are returned to the os by a background "
+    "thread, 0 disables it");
+
+static sylar::ConfigVar<uint64_t>::ptr g_release_rate = sylar::Config::Lookup<uint64_t>(
+    "memory_pool.release_rate", 64 * 1024 * 1024,
+    "max bytes per second the page cache returns to the os");
+
+static sylar::ConfigVar<std::string>::ptr g_huge_pages = sylar::Config::Lookup<std::string>(
+    "memory_pool.huge_pages", "none",
+    "back page cache regions with 2MB pages: none, thp (madvise MADV_HUGEPAGE on 2MB aligned "
+    "regions) or hugetlb (MAP_HUGETLB, falls back to thp when no huge pages are reserved)");
+
+static sylar::ConfigVar<uint64_t>::ptr g_sample_interval = sylar::Config::Lookup<uint64_t>(
+    "memory_pool.sample_interval", 0,
+    "record an allocation stack trace about every this many bytes allocated per thread, "
+    "0 disables it");
+
 static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+/// 每次分配都要判断，缓存采样间隔
+static std::atomic<uint64_t> s_sample_interval{0};
+
+struct _MemoryPoolSampleIniter {
+    _MemoryPoolSampleIniter()
+    {
+        s_sample_interval = g_sample_interval->getValue();
+        g_sample_interval->addListener([](const uint64_t &, const uint64_t &new_value) {
+            s_sample_interval = new_value;
+        });
+    }
+};
+
+static _MemoryPoolSampleIniter s_memory_pool_sample_initer;
+
+/**
+ * @brief 单写者的计数：写的一方是所属线程或者持有锁的线程，不需要原子加
+ */
+template <class T>
+static inline void Bump(std::atomic<T> &c, T n)
+{
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 所有线程的 ThreadCache，汇总统计用；线程退出时计数并到 retired 里
+ * @details 故意不析构，进程退出时还在跑的线程析构 ThreadCache 时它还要在
+ */
+struct ThreadCacheRegistry {
+    std::mutex mutex;
+    std::vector<ThreadCache *> caches;
+    std::array<SizeClassCounters, FREE_LIST_SIZE> retired;
+    SizeClassCounters retiredLarge;
+    uint64_t threads = 0;
+};
+
+static ThreadCacheRegistry &GetThreadCacheRegistry()
+{
+    static ThreadCacheRegistry *s_registry = new ThreadCacheRegistry;
+    return *s_registry;
+}
+
+static void MergeCounters(SizeClassCounters &to, const SizeClassCounters &from)
+{
+    Bump<uint64_t>(to.allocs, from.allocs.load(std::memory_order_relaxed));
+    Bump<uint64_t>(to.frees, from.frees.load(std::memory_order_relaxed));
+    Bump<uint64_t>(to.misses, from.misses.load(std::memory_order_relaxed));
+    Bump<uint64_t>(to.fetchedBlocks, from.fetchedBlocks.load(std::memory_order_relaxed));
+    Bump<uint64_t>(to.returns, from.returns.load(std::memory_order_relaxed));
+    Bump<uint64_t>(to.returnedBlocks, from.returnedBlocks.load(std::memory_order_relaxed));
+    Bump<int64_t>(to.requestedBytes, from.requestedBytes.load(std::memory_order_relaxed));
+}
+
+/**
+ * @brief 采样到的调用栈，按栈地址汇总
+ */
+struct AllocSampleTable {
+    struct Stat {
+        uint64_t count = 0;
+        uint64_t bytes = 0;
+        uint64_t estimatedBytes = 0;
+    };
+    /// 不同调用栈太多时，新的栈都记到空栈下面
+    static const size_t MAX_STACKS = 10000;
+    /// 记录的最大栈深度
+    static const int MAX_DEPTH = 32;
+
+    std::mutex mutex;
+    std::map<std::vector<void *>, Stat> stacks;
+};
+
+static AllocSampleTable &GetAllocSampleTable()
+{
+    static AllocSampleTable *s_table = new AllocSampleTable;
+    return *s_table;
+}
+
 bool ProtectStack(void *ptr, std::size_t size)
 {
     int pageSize = g_protectStackPageSize->getValue();
@@ -71,14 +172,33 @@ ThreadCache::ThreadCache()
 {
     freeList_.fill(nullptr);
     freeListSize_.fill(0);
+    ThreadCacheRegistry &registry = GetThreadCacheRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.caches.push_back(this);
+    ++registry.threads;
 }
 
 ThreadCache::~ThreadCache()
+{
+    // 线程退出时还给中心缓存，否则这些块就丢了
+    flush();
+    ThreadCacheRegistry &registry = GetThreadCacheRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (size_t i = 0; i < FREE_LIST_SIZE; ++i) {
+        MergeCounters(registry.retired[i], counters_[i]);
+    }
+    MergeCounters(registry.retiredLarge, large_);
+    registry.caches.erase(std::find(registry.caches.begin(), registry.caches.end(), this));
+}
+
+void ThreadCache::flush()
 {
     for (size_t i = 0; i < FREE_LIST_SIZE; ++i) {
         if (freeList_[i]) {
-            size_t blockSize = (i + 1) * ALIGNMENT;
+            size_t blockSize = SizeClass::getSize(i);
             size_t blockNum = freeListSize_[i];
+            Bump<uint64_t>(counters_[i].returns, 1);
+            Bump<uint64_t>(counters_[i].returnedBlocks, blockNum);
             CentralCache::GetInstance().returnRange(freeList_[i], blockNum * blockSize, i);
             freeList_[i] = nullptr;
             freeListSize_[i] = 0;
@@ -91,18 +211,25 @@ void *ThreadCache::allocate(size_t size)
     if (size == 0) {
         size = ALIGNMENT;
     }
+    if (s_sample_interval.load(std::memory_order_relaxed)
+        && (sampleCountdown_ -= size) <= 0) {
+        recordSample(size);
+    }
 
     if (size > MAX_BYTES) {
+        Bump<uint64_t>(large_.allocs, 1);
+        Bump<int64_t>(large_.requestedBytes, size);
         return ::malloc(size);
     }
 
     size_t index = SizeClass::getIndex(size);
-
-    freeListSize_[index]--;
+    Bump<uint64_t>(counters_[index].allocs, 1);
+    Bump<int64_t>(counters_[index].requestedBytes, size);
 
     if (void *ptr = freeList_[index]) {
         // ptr void*类型强转为void**，再解引用即可得到 ptr->next 的值
         freeList_[index] = *reinterpret_cast<void **>(ptr);
+        freeListSize_[index]--;
         return ptr;
     }
 
@@ -112,12 +239,19 @@ void *ThreadCache::allocate(size_t size)
 
 void ThreadCache::deallocate(void *ptr, size_t size)
 {
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
     if (size > MAX_BYTES) {
+        Bump<uint64_t>(large_.frees, 1);
+        Bump<int64_t>(large_.requestedBytes, -(int64_t)size);
         ::free(ptr);
         return;
     }
 
     size_t index = SizeClass::getIndex(size);
+    Bump<uint64_t>(counters_[index].frees, 1);
+    Bump<int64_t>(counters_[index].requestedBytes, -(int64_t)size);
 
     // 插入到线程本地自由链表
     *reinterpret_cast<void **>(ptr) = freeList_[index];
@@ -134,22 +268,20 @@ void ThreadCache::deallocate(void *ptr, size_t size)
 void *ThreadCache::fetchFromCentralCache(size_t index)
 {
     // 从中心缓存批量获取内存
-    size_t size = (index + 1) * ALIGNMENT;
+    size_t size = SizeClass::getSize(index);
     size_t batchNum = getBatchNum(size);
     // 返回 batchNum 个 哈希序号为index 的块
     size_t realBatchNum;
     void *start = CentralCache::GetInstance().fetchRange(index, batchNum, realBatchNum);
+    Bump<uint64_t>(counters_[index].misses, 1);
     if (!start)
         return nullptr;
-
-    // 调用 fetchFromCentralCache 之前已经减-1了
-    freeListSize_[index] += realBatchNum;
+    Bump<uint64_t>(counters_[index].fetchedBlocks, realBatchNum);
 
     // 取一个返回，其余放入自由链表
     void *result = start;
-    if (batchNum > 1) {
-        freeList_[index] = *reinterpret_cast<void **>(start);
-    }
+    freeList_[index] = *reinterpret_cast<void **>(start);
+    freeListSize_[index] = realBatchNum - 1;
     *reinterpret_cast<void **>(result) = nullptr;
 
     return result;
@@ -187,7 +319,9 @@ void ThreadCache::returnToCentralCache(size_t index)
         freeListSize_[index] = keepNum;
 
         if (returnNum > 0 && nextNode != nullptr) {
-            CentralCache::GetInstance().returnRange(nextNode, returnNum * (index + 1) * ALIGNMENT,
+            Bump<uint64_t>(counters_[index].returns, 1);
+            Bump<uint64_t>(counters_[index].returnedBlocks, returnNum);
+            CentralCache::GetInstance().returnRange(nextNode, returnNum * SizeClass::getSize(index),
                                                     index);
         }
     }
@@ -225,14 +359,41 @@ size_t ThreadCache::getBatchNum(size_t size)
     return std::max(size_t(1), std::min(maxNum, baseNum));
 }
 
+// 不内联，采样时跳过的栈顶层数才固定
+__attribute__((noinline)) void ThreadCache::recordSample(size_t size)
+{
+    uint64_t interval = s_sample_interval.load(std::memory_order_relaxed);
+    // 间隔在 [interval / 2, interval * 3 / 2] 里随机，平均是 interval
+    static thread_local std::minstd_rand t_rng(std::hash<const void *>()(this));
+    sampleCountdown_ = interval / 2 + t_rng() % (interval + 1);
+
+    void *frames[AllocSampleTable::MAX_DEPTH + 2];
+    int n = ::backtrace(frames, AllocSampleTable::MAX_DEPTH + 2);
+    // 跳过 recordSample 和 allocate
+    std::vector<void *> stack;
+    if (n > 2) {
+        stack.assign(frames + 2, frames + n);
+    }
+
+    AllocSampleTable &table = GetAllocSampleTable();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    auto it = table.stacks.find(stack);
+    if (it == table.stacks.end()) {
+        if (table.stacks.size() >= AllocSampleTable::MAX_STACKS) {
+            stack.clear();
+        }
+        it = table.stacks.emplace(std::move(stack), AllocSampleTable::Stat()).first;
+    }
+    ++it->second.count;
+    it->second.bytes += size;
+    // 比间隔大的分配几乎每次都会被采到，按实际大小算
+    it->second.estimatedBytes += std::max<uint64_t>(interval, size);
+}
+
 // ********************************* CentralCache *********************************
 CentralCache::~CentralCache()
 {
     // 仅需清理状态，内存由 PageCache 释放
-    for (size_t i = 0; i < FREE_LIST_SIZE; ++i) {
-        centralFreeList_[i] = nullptr;
-    }
-    //printf("~CentralCache()");
 }
 
 // batchNum返回实际分配的块数量
@@ -246,221 +407,427 @@ void *CentralCache::fetchRange(size_t index, size_t batchNum, size_t &realBatchN
         std::this_thread::yield();
     }
 
+    // 从有空闲小块的 span 里依次取，不够再向页缓存要新的 span；至少取到一块就返回
+    SpanList &list = spans_[index];
     void *result = nullptr;
-    try {
-        result = centralFreeList_[index].load(std::memory_order_relaxed);
-
-        if (!result) {
-            // 中心缓存为空，从页缓存获取新的内存块
-            size_t size = (index + 1) * ALIGNMENT;
-            size_t numPages;
-            result = fetchFromPageCache(size, batchNum, numPages);
-            if (!result) {
-                locks_[index].clear(std::memory_order_release);
-                return nullptr;
-            }
-
-            // 将获取的内存块切分为小块
-
-            // 分配到的 块数量
-            size_t totalBlocks = (numPages * PageCache::PAGE_SIZE) / size;
-            size_t allocBlocks = std::min(batchNum, totalBlocks);
-            realBatchNum = allocBlocks;
-
-            // 转成char*进行 地址加减运算
-            char *start = static_cast<char *>(result);
-
-            // result 返回的链表 allocBlocks块
-            if (allocBlocks > 1) {
-                for (size_t i = 1; i < allocBlocks; i++) {
-                    void *current = start + (i - 1) * size;
-                    void *next = start + i * size;
-                    *reinterpret_cast<void **>(current) = next;
-                }
-                *reinterpret_cast<void **>(start + (allocBlocks - 1) * size) = nullptr;
-            }
-
-            // 还剩下的 添加到 自由链表
-            if (totalBlocks > allocBlocks) {
-                void *remainStart = start + allocBlocks * size;
-                for (size_t i = allocBlocks + 1; i < totalBlocks; ++i) {
-                    void *current = start + (i - 1) * size;
-                    void *next = start + i * size;
-                    *reinterpret_cast<void **>(current) = next;
-                }
-                *reinterpret_cast<void **>(start + (totalBlocks - 1) * size) = nullptr;
-
-                centralFreeList_[index].store(remainStart, std::memory_order_release);
-            }
-        } else {
-            // 中心缓存有index对应大小的内存块
-            void *current = result;
-            void *prev = nullptr;
-            size_t count = 0;
-
-            while (current && count < batchNum) {
-                prev = current;
-                current = *reinterpret_cast<void **>(current);
-                count++;
+    void **tail = &result;
+    realBatchNum = 0;
+    while (realBatchNum < batchNum) {
+        Span *span = list.empty() ? nullptr : list.front();
+        if (!span) {
+            if (realBatchNum) {
+                break;
             }
-
-            realBatchNum = count; // 这里同上，只会获得已有的。
-
-            if (prev) {
-                *reinterpret_cast<void **>(prev) = nullptr; // 断开
+            span = fetchFromPageCache(index, batchNum);
+            if (!span) {
+                break;
             }
-            centralFreeList_[index] = current;
+            list.push(span);
+        }
+        while (span->objects && realBatchNum < batchNum) {
+            void *obj = span->objects;
+            span->objects = *reinterpret_cast<void **>(obj);
+            *tail = obj;
+            tail = reinterpret_cast<void **>(obj);
+            ++span->useCount;
+            ++realBatchNum;
+        }
+        if (!span->objects) {
+            SpanList::Erase(span);
         }
-    } catch (...) {
-        locks_[index].clear(std::memory_order_release);
-        throw;
     }
+    *tail = nullptr;
+    Bump<uint64_t>(counters_[index].usedBlocks, realBatchNum);
     locks_[index].clear(std::memory_order_release);
     return result;
 }
 
 void CentralCache::returnRange(void *start, size_t size, size_t index)
 {
-    if (!start || size > FREE_LIST_SIZE)
+    if (!start || index >= FREE_LIST_SIZE)
         return;
 
+    size_t blockSize = SizeClass::getSize(index);
+    size_t blockNum = size / blockSize;
+    PageCache &pc = PageCache::GetInstance();
+
     while (locks_[index].test_and_set(std::memory_order_acquire)) {
         std::this_thread::yield();
     }
 
-    try {
-        size_t blockSize = (index + 1) * ALIGNMENT;
-        size_t blockNum = size / blockSize;
-
-        // 找到要归还的链表的最后一个节点
-        void *end = start;
-        size_t count = 1;
-        while (*reinterpret_cast<void **>(end) != nullptr && count < blockNum) {
-            end = *reinterpret_cast<void **>(end);
-            count++;
+    // 每一块还给所在的 span，span 的小块全部还回来时整个 span 还给页缓存
+    Counters &counters = counters_[index];
+    void *current = start;
+    size_t i = 0;
+    for (; current && i < blockNum; ++i) {
+        void *next = *reinterpret_cast<void **>(current);
+        Span *span = pc.getSpan(current);
+        SYLAR_ASSERT2(span && span->inUse && span->sizeClass == index,
+                      "returnRange invalid block " << current << " index=" << index);
+        if (!span->objects) {
+            spans_[index].push(span);
         }
-
-        void *current = centralFreeList_[index].load(std::memory_order_relaxed);
-        *reinterpret_cast<void **>(end) = current;
-        centralFreeList_[index].store(start, std::memory_order_release);
-    } catch (...) {
-        locks_[index].clear(std::memory_order_release);
-        throw;
+        *reinterpret_cast<void **>(current) = span->objects;
+        span->objects = current;
+        if (--span->useCount == 0) {
+            SpanList::Erase(span);
+            Bump<uint64_t>(counters.spans, -1);
+            Bump<uint64_t>(counters.blocks, -(span->numPages * PageCache::PAGE_SIZE / blockSize));
+            Bump<uint64_t>(counters.spanFrees, 1);
+            pc.deallocate(span);
+        }
+        current = next;
     }
+    Bump<uint64_t>(counters.usedBlocks, -i);
     locks_[index].clear(std::memory_order_release);
 }
 
-void *CentralCache::fetchFromPageCache(size_t size, size_t batchNum, size_t &outNumPages)
+Span *CentralCache::fetchFromPageCache(size_t index, size_t batchNum)
 {
-    size_t totalSize = batchNum * size;
-    outNumPages = PageCache::getSpanPage(totalSize);
-    return PageCache::GetInstance().allocateSpan(outNumPages);
+    size_t size = SizeClass::getSize(index);
+    size_t numPages = PageCache::getSpanPage(batchNum * size);
+    // 每一页都登记映射，还回来的小块才能找到所在的 span
+    Span *span = PageCache::GetInstance().allocate(numPages, true);
+    if (!span) {
+        return nullptr;
+    }
+
+    // 将获取的内存块切分为小块，串成 span 的空闲链表
+    size_t totalBlocks = (numPages * PageCache::PAGE_SIZE) / size;
+    char *start = static_cast<char *>(span->pageAddr);
+    for (size_t i = 0; i + 1 < totalBlocks; ++i) {
+        *reinterpret_cast<void **>(start + i * size) = start + (i + 1) * size;
+    }
+    *reinterpret_cast<void **>(start + (totalBlocks - 1) * size) = nullptr;
+    span->objects = start;
+    span->useCount = 0;
+    span->sizeClass = index;
+    Bump<uint64_t>(counters_[index].spans, 1);
+    Bump<uint64_t>(counters_[index].blocks, totalBlocks);
+    Bump<uint64_t>(counters_[index].spanAllocs, 1);
+    return span;
 }
 
 // ********************************* PageCache *********************************
 
-void *PageCache::allocateSpan(size_t numPages)
+uint64_t PageCacheStats::retainedBytes() const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    return freePages * PageCache::PAGE_SIZE;
+}
 
-    // 寻找合适的 空闲的span
-    // lower_bound 函数返回第一个大于等于numPages的元素迭代器
-    auto it = freeSpans_.lower_bound(numPages);
-    if (it != freeSpans_.end()) {
-        Span *span = it->second;
+uint64_t PageCacheStats::releasedBytes() const
+{
+    return releasedPages * PageCache::PAGE_SIZE;
+}
 
-        // 将取出的span从原来的空间链表freeSpans_[it->first]中移除
-        if (span->next) {
-            freeSpans_[it->first] = span->next;
-        } else {
-            freeSpans_.erase(it);
+HugePageMode GetHugePageMode()
+{
+    // 静态初始化期间配置项可能还没构造
+    if (!g_huge_pages) {
+        return HugePageMode::NONE;
+    }
+    std::string v = g_huge_pages->getValue();
+    if (v == "thp") {
+        return HugePageMode::THP;
+    } else if (v == "hugetlb") {
+        return HugePageMode::HUGETLB;
+    } else if (v != "none" && !v.empty()) {
+        static std::atomic<bool> s_warned{false};
+        if (!s_warned.exchange(true)) {
+            SYLAR_LOG_ERROR(g_logger) << "invalid memory_pool.huge_pages=" << v << ", use none";
         }
+    }
+    return HugePageMode::NONE;
+}
 
-        // 如果 span 的 numPages 大于 需要的 numPages
-        if (span->numPages > numPages) {
-            // 把 大页分割出剩余的小页 ，存放
-            Span *newSpan = new Span;
-            newSpan->pageAddr = static_cast<char *>(span->pageAddr) + numPages * PAGE_SIZE;
-            newSpan->numPages = span->numPages - numPages;
-            newSpan->next = nullptr;
-            // 记录空闲span
-            spanMap_[newSpan->pageAddr] = newSpan;
-
-            // 超出的部分 newSpan 放回 freeSpans_列表头部
-            auto &list = freeSpans_[newSpan->numPages];
-            newSpan->next = list;
-            list = newSpan;
-
-            span->numPages = numPages;
+/**
+ * @brief 映射 size 字节的区域，size 已经是 2MB 的整数倍(mode 不是 NONE 时)
+ * @param[out] huge 是否用上了大页
+ * @details hugetlb 需要预留的大页(vm.nr_hugepages)，不够时 mmap 失败，退回 thp；
+ *          thp 多映射 2MB 再把首尾裁掉，保证区域按 2MB 对齐，内核才能整块换成大页；
+ *          MADV_HUGEPAGE 失败(内核没开 THP)就是普通页。
+ */
+static void *MapRegion(size_t size, HugePageMode mode, bool &huge)
+{
+    huge = false;
+    if (mode == HugePageMode::HUGETLB) {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+        if (ptr != MAP_FAILED) {
+            huge = true;
+            return ptr;
         }
-
-        // 记录分配span信息用于回收
-        // 理论上这个 span->pageAddr在创建的时候已经记录了一遍
-        // spanMap_[span->pageAddr] = span;
-        return span->pageAddr;
+        static std::atomic<bool> s_warned{false};
+        if (!s_warned.exchange(true)) {
+            SYLAR_LOG_WARN(g_logger) << "mmap MAP_HUGETLB size=" << size
+                                     << " error: " << strerror(errno) << ", fall back to thp";
+        }
+        mode = HugePageMode::THP;
+    }
+    if (mode == HugePageMode::NONE) {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return ptr == MAP_FAILED ? nullptr : ptr;
     }
 
-    // 没有合适的Span，向系统申请
-    void *memory = systemAlloc(numPages);
-    if (!memory)
+    const size_t align = PageCache::HUGE_PAGE_SIZE;
+    char *raw = (char *)mmap(nullptr, size + align, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
         return nullptr;
+    }
+    char *ptr = (char *)(((uintptr_t)raw + align - 1) / align * align);
+    if (ptr != raw) {
+        munmap(raw, ptr - raw);
+    }
+    if (raw + align != ptr) {
+        munmap(ptr + size, raw + align - ptr);
+    }
+    if (madvise(ptr, size, MADV_HUGEPAGE)) {
+        static std::atomic<bool> s_warned{false};
+        if (!s_warned.exchange(true)) {
+            SYLAR_LOG_WARN(g_logger) << "madvise MADV_HUGEPAGE error: " << strerror(errno)
+                                     << ", use normal pages";
+        }
+    } else {
+        huge = true;
+    }
+    return ptr;
+}
 
-    Span *span = new Span;
-    span->pageAddr = memory;
-    span->numPages = numPages;
-    span->next = nullptr;
+PageCache::PageCache()
+{
+    size_t nodes = CpuTopologyMgr::GetInstance()->getNodeCount();
+    for (size_t i = 0; i < nodes * SHARDS_PER_NODE; ++i) {
+        shards_.emplace_back(new Shard);
+        shards_.back()->index = i;
+        shards_.back()->node = i / SHARDS_PER_NODE;
+    }
+}
 
-    spanMap_[span->pageAddr] = span;
-    return memory;
+PageCache::Shard &PageCache::currentShard()
+{
+    CpuTopology *topo = CpuTopologyMgr::GetInstance();
+    int cpu = CpuTopology::CurrentCpu();
+    size_t node = topo->isLocalAlloc() ? topo->getNodeOfCpu(cpu) : 0;
+    return *shards_[node * SHARDS_PER_NODE + cpu % SHARDS_PER_NODE];
 }
 
-void PageCache::deallocateSpan(void *ptr, size_t numPages)
+Span *PageCache::newSpan(Shard &shard)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    if (!shard.spareSpans) {
+        // 一次 new 一批，串到回收链表上
+        static const size_t CHUNK = 64;
+        Span *chunk = new Span[CHUNK];
+        shard.spanChunks.push_back(chunk);
+        for (size_t i = 0; i < CHUNK; ++i) {
+            chunk[i].shard = shard.index;
+            chunk[i].next = shard.spareSpans;
+            shard.spareSpans = &chunk[i];
+        }
+    }
+    Span *span = shard.spareSpans;
+    shard.spareSpans = span->next;
+    span->prev = span->next = nullptr;
+    span->inUse = false;
+    span->released = false;
+    span->freeTime = 0;
+    span->objects = nullptr;
+    span->useCount = 0;
+    span->sizeClass = 0;
+    return span;
+}
 
-    // 查找对应的 span
-    auto it = spanMap_.find(ptr);
-    if (it == spanMap_.end())
-        return;
+void PageCache::deleteSpan(Shard &shard, Span *span)
+{
+    span->next = shard.spareSpans;
+    shard.spareSpans = span;
+}
 
-    Span *span = it->second;
+void PageCache::insertFree(Shard &shard, Span *span)
+{
+    size_t idx = std::min(span->numPages, MAX_BUCKET_PAGES);
+    int kind = span->released;
+    span->inUse = false;
+    shard.freeLists[kind][idx].push(span);
+    shard.nonEmpty[kind][idx / 64] |= 1ull << (idx % 64);
+    ++shard.stats.freeSpans;
+    (kind ? shard.stats.releasedPages : shard.stats.freePages) += span->numPages;
+}
 
-    // 尝试合并相邻的span
-    void *nextAddr = static_cast<char *>(ptr) + numPages * PAGE_SIZE;
-    auto nextIt = spanMap_.find(nextAddr);
+void PageCache::eraseFree(Shard &shard, Span *span)
+{
+    size_t idx = std::min(span->numPages, MAX_BUCKET_PAGES);
+    int kind = span->released;
+    SpanList::Erase(span);
+    if (shard.freeLists[kind][idx].empty()) {
+        shard.nonEmpty[kind][idx / 64] &= ~(1ull << (idx % 64));
+    }
+    --shard.stats.freeSpans;
+    (kind ? shard.stats.releasedPages : shard.stats.freePages) -= span->numPages;
+}
 
-    if (nextIt != spanMap_.end()) {
-        Span *nextSpan = nextIt->second;
-        size_t nextSize = nextSpan->numPages;
+Span *PageCache::findFree(Shard &shard, size_t numPages, bool released)
+{
+    // 页数刚好的链表里随便取一个，比它大的取最小的非空链表
+    uint64_t *nonEmpty = shard.nonEmpty[released];
+    for (size_t idx = std::min(numPages, MAX_BUCKET_PAGES); idx < MAX_BUCKET_PAGES + 1;) {
+        uint64_t bits = nonEmpty[idx / 64] >> (idx % 64);
+        if (!bits) {
+            idx = (idx / 64 + 1) * 64;
+            continue;
+        }
+        idx += __builtin_ctzll(bits);
+        if (idx < MAX_BUCKET_PAGES) {
+            return shard.freeLists[released][idx].front();
+        }
+        // 大 span 的链表里挑够用的最小的一个
+        Span *best = nullptr;
+        SpanList &list = shard.freeLists[released][MAX_BUCKET_PAGES];
+        for (Span *i = list.head.next; i != &list.head; i = i->next) {
+            if (i->numPages >= numPages && (!best || i->numPages < best->numPages)) {
+                best = i;
+                if (i->numPages == numPages) {
+                    break;
+                }
+            }
+        }
+        return best;
+    }
+    return nullptr;
+}
 
-        auto &nextList = freeSpans_[nextSize];
+Span *PageCache::coalesce(Shard &shard, Span *span)
+{
+    // 相邻页的 span 可能属于别的分片，shard 字段不会变，可以不加锁读；
+    // 属于本分片的才继续看，这时已经持有本分片的锁
+    uintptr_t page = RadixPageMap<Span>::PageId(span->pageAddr);
+    Span *prev = pageMap_.get(page - 1);
+    if (prev && prev->shard == span->shard && !prev->inUse && prev->released == span->released
+        && static_cast<char *>(prev->pageAddr) + prev->numPages * PAGE_SIZE == span->pageAddr) {
+        eraseFree(shard, prev);
+        prev->numPages += span->numPages;
+        // 合并后按最近一次释放的时间算空闲时间
+        prev->freeTime = std::max(prev->freeTime, span->freeTime);
+        deleteSpan(shard, span);
+        span = prev;
+    }
+    char *end = static_cast<char *>(span->pageAddr) + span->numPages * PAGE_SIZE;
+    Span *next = pageMap_.get(RadixPageMap<Span>::PageId(end));
+    if (next && next->shard == span->shard && !next->inUse && next->released == span->released
+        && next->pageAddr == end) {
+        eraseFree(shard, next);
+        span->numPages += next->numPages;
+        span->freeTime = std::max(span->freeTime, next->freeTime);
+        deleteSpan(shard, next);
+    }
+    registerSpan(span);
+    return span;
+}
 
-        Span dummy;
-        dummy.next = nextList;
-        Span *prev = &dummy;
-        bool found = false;
+Span *PageCache::splitSpan(Shard &shard, Span *span, size_t numPages)
+{
+    Span *rest = newSpan(shard);
+    rest->pageAddr = static_cast<char *>(span->pageAddr) + numPages * PAGE_SIZE;
+    rest->numPages = span->numPages - numPages;
+    rest->released = span->released;
+    rest->freeTime = span->freeTime;
+    registerSpan(rest);
+    span->numPages = numPages;
+    registerSpan(span);
+    return rest;
+}
 
-        while (prev->next) {
-            if (prev->next == nextSpan) {
-                prev->next = prev->next->next;
-                found = true;
-                break;
-            }
-            prev = prev->next;
+void PageCache::registerSpan(Span *span)
+{
+    uintptr_t page = RadixPageMap<Span>::PageId(span->pageAddr);
+    pageMap_.set(page, span);
+    pageMap_.set(page + span->numPages - 1, span);
+}
+
+void *PageCache::allocateSpan(size_t numPages)
+{
+    Span *span = allocate(numPages);
+    return span ? span->pageAddr : nullptr;
+}
+
+Span *PageCache::allocate(size_t numPages, bool mapAllPages)
+{
+    if (numPages == 0) {
+        return nullptr;
+    }
+    Shard &shard = currentShard();
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // 先用还占着物理内存的，没有再用已经还给系统的
+    Span *span = findFree(shard, numPages, false);
+    if (!span) {
+        span = findFree(shard, numPages, true);
+    }
+    if (span) {
+        eraseFree(shard, span);
+    } else {
+        // 没有合适的Span，向系统申请
+        span = systemAlloc(shard, std::max(numPages, SYSTEM_ALLOC_PAGES));
+        if (!span) {
+            return nullptr;
         }
+    }
+
+    // 如果 span 的 numPages 大于 需要的 numPages，把剩下的页切出来放回空闲链表
+    if (span->numPages > numPages) {
+        insertFree(shard, splitSpan(shard, span, numPages));
+    }
+    span->inUse = true;
+    span->released = false;
+    registerSpan(span);
+    if (mapAllPages) {
+        uintptr_t page = RadixPageMap<Span>::PageId(span->pageAddr);
+        for (size_t i = 1; i + 1 < numPages; ++i) {
+            pageMap_.set(page + i, span);
+        }
+    }
+    ++shard.stats.inUseSpans;
+    shard.stats.inUsePages += numPages;
+    return span;
+}
 
-        if (found) {
-            // 更新链表并合并
-            nextList = dummy.next;
-            span->numPages += nextSpan->numPages;
-            spanMap_.erase(nextAddr);
-            delete nextSpan;
+void PageCache::deallocateSpan(void *ptr, size_t numPages)
+{
+    Span *span = getSpan(ptr);
+    if (!span) {
+        return;
+    }
+    {
+        Shard &shard = *shards_[span->shard];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!span->inUse || span->pageAddr != ptr) {
+            SYLAR_LOG_ERROR(g_logger) << "deallocateSpan invalid ptr=" << ptr
+                                      << " numPages=" << numPages;
+            return;
+        }
+        if (span->numPages != numPages) {
+            SYLAR_LOG_ERROR(g_logger) << "deallocateSpan ptr=" << ptr << " numPages=" << numPages
+                                      << " span numPages=" << span->numPages;
         }
     }
+    deallocate(span);
+}
 
-    auto &targetList = freeSpans_[span->numPages];
-    span->next = targetList;
-    targetList = span;
+void PageCache::deallocate(Span *span)
+{
+    {
+        Shard &shard = *shards_[span->shard];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        --shard.stats.inUseSpans;
+        shard.stats.inUsePages -= span->numPages;
+        span->inUse = false;
+        span->released = false;
+        span->objects = nullptr;
+        span->freeTime = GetCurrentMS();
+        span = coalesce(shard, span);
+        insertFree(shard, span);
+    }
+    startScavenger();
 }
 
 // 当size <= 32KB，默认获取32KB，8页。如果size > 32KB，就按实际需求分配
@@ -473,33 +840,380 @@ size_t PageCache::getSpanPage(size_t size)
     }
 }
 
-void *PageCache::systemAlloc(size_t numPages)
+PageCacheStats PageCache::getStats()
+{
+    PageCacheStats stats;
+    for (auto &i : shards_) {
+        std::lock_guard<std::mutex> lock(i->mutex);
+        stats.systemBytes += i->stats.systemBytes;
+        stats.inUseSpans += i->stats.inUseSpans;
+        stats.inUsePages += i->stats.inUsePages;
+        stats.freeSpans += i->stats.freeSpans;
+        stats.freePages += i->stats.freePages;
+        stats.releasedPages += i->stats.releasedPages;
+        stats.releasedBytesTotal += i->stats.releasedBytesTotal;
+        stats.releaseCount += i->stats.releaseCount;
+        stats.hugePageBytes += i->stats.hugePageBytes;
+    }
+    return stats;
+}
+
+size_t PageCache::release(uint64_t idle_ms, size_t max_bytes)
 {
+    uint64_t now = GetCurrentMS();
+    size_t released = 0;
+    // 开了大页时只还按 2MB 对齐的整块，还一部分会把大页拆回普通页
+    size_t align = GetHugePageMode() == HugePageMode::NONE ? PAGE_SIZE : HUGE_PAGE_SIZE;
+    for (auto &i : shards_) {
+        Shard &shard = *i;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        // 链表头插，越靠后空闲得越久，从后往前还，碰到还不够久的就换下一个链表
+        for (size_t idx = 0; idx <= MAX_BUCKET_PAGES; ++idx) {
+            SpanList &list = shard.freeLists[0][idx];
+            Span *span = list.back();
+            while (span != &list.head && now - span->freeTime >= idle_ms) {
+                if (released >= max_bytes) {
+                    return released;
+                }
+                Span *prev = span->prev;
+                uintptr_t begin = (uintptr_t)span->pageAddr;
+                uintptr_t end = begin + span->numPages * PAGE_SIZE;
+                begin = (begin + align - 1) / align * align;
+                end = end / align * align;
+                if (begin >= end) {
+                    // 不含整块大页的 span 留着，和相邻的合并以后再还
+                    span = prev;
+                    continue;
+                }
+                // 超过剩下的额度时只还前面一段，剩下的留着下次再还
+                size_t quota = (max_bytes - released + align - 1) / align * align;
+                end = std::min<uintptr_t>(end, begin + quota);
+                eraseFree(shard, span);
+                if (begin != (uintptr_t)span->pageAddr) {
+                    Span *head = span;
+                    span = splitSpan(shard, head, (begin - (uintptr_t)head->pageAddr) / PAGE_SIZE);
+                    insertFree(shard, head);
+                }
+                if (end != (uintptr_t)span->pageAddr + span->numPages * PAGE_SIZE) {
+                    insertFree(shard, splitSpan(shard, span, (end - begin) / PAGE_SIZE));
+                }
+                size_t bytes = end - begin;
+                if (madvise(span->pageAddr, bytes, MADV_DONTNEED)) {
+                    // 还不掉的当作刚释放的，过一个空闲周期再试
+                    SYLAR_LOG_ERROR(g_logger) << "madvise span " << span->pageAddr
+                                              << " size=" << bytes << " error: " << strerror(errno);
+                    span->freeTime = now;
+                    insertFree(shard, span);
+                    span = prev;
+                    continue;
+                }
+                span->released = true;
+                released += bytes;
+                shard.stats.releasedBytesTotal += bytes;
+                ++shard.stats.releaseCount;
+                insertFree(shard, coalesce(shard, span));
+                span = prev;
+            }
+        }
+    }
+    return released;
+}
+
+void PageCache::startScavenger()
+{
+    if (scavengerStarted_.load(std::memory_order_relaxed) || !g_release_idle_ms
+        || !g_release_idle_ms->getValue()) {
+        return;
+    }
+    if (!scavengerStarted_.exchange(true)) {
+        scavenger_.reset(new Thread(std::bind(&PageCache::runScavenger, this), "mem_scavenger"));
+    }
+}
+
+void PageCache::runScavenger()
+{
+    uint64_t last = GetCurrentMS();
+    // 可以还的字节数，按速率累加，最多攒一秒的量；还一个大 span 可能透支，之后慢慢补上
+    int64_t budget = 0;
+    std::unique_lock<std::mutex> lock(scavengerMutex_);
+    while (!stopping_) {
+        uint64_t idle_ms = g_release_idle_ms->getValue();
+        uint64_t interval = std::max<uint64_t>(10, std::min<uint64_t>(1000, idle_ms / 2));
+        scavengerCond_.wait_for(lock, std::chrono::milliseconds(idle_ms ? interval : 1000));
+        if (stopping_) {
+            break;
+        }
+        uint64_t now = GetCurrentMS();
+        int64_t rate = g_release_rate->getValue();
+        budget = std::min<int64_t>(budget + rate * (int64_t)(now - last) / 1000, rate);
+        last = now;
+        if (!idle_ms || budget <= 0) {
+            continue;
+        }
+        lock.unlock();
+        budget -= release(idle_ms, budget);
+        lock.lock();
+    }
+}
+
+Span *PageCache::systemAlloc(Shard &shard, size_t numPages)
+{
+    HugePageMode mode = GetHugePageMode();
+    if (mode != HugePageMode::NONE) {
+        numPages = (numPages + HUGE_PAGE_PAGES - 1) / HUGE_PAGE_PAGES * HUGE_PAGE_PAGES;
+    }
     size_t size = numPages * PAGE_SIZE;
 
-    // 使用mmap分配内存
-    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (ptr == MAP_FAILED)
+    // 使用mmap分配内存，匿名映射本身就是全 0 的，不再清零，物理页在第一次访问时才分配
+    bool huge = false;
+    void *ptr = MapRegion(size, mode, huge);
+    if (!ptr)
+        return nullptr;
+    if (!pageMap_.ensure(RadixPageMap<Span>::PageId(ptr), numPages)) {
+        munmap(ptr, size);
         return nullptr;
+    }
 
-    // 清零内存
-    memset(ptr, 0, size);
-    return ptr;
+    CpuTopologyMgr::GetInstance()->bindMemory(ptr, size, shard.node);
+    shard.regions.emplace_back(ptr, size);
+    shard.stats.systemBytes += size;
+    if (huge) {
+        shard.stats.hugePageBytes += size;
+    }
+
+    // 还没访问过的页不占物理内存，和已经还给系统的一样对待
+    Span *span = newSpan(shard);
+    span->pageAddr = ptr;
+    span->numPages = numPages;
+    span->released = true;
+    return span;
 }
 
 PageCache::~PageCache()
 {
-    // 释放所有 Span 占用的系统内存
-    for (auto &entry : spanMap_) {
-        Span *span = entry.second;
-        if (span->pageAddr) {
-            munmap(span->pageAddr, span->numPages * PAGE_SIZE);
-            span->pageAddr = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(scavengerMutex_);
+        stopping_ = true;
+    }
+    scavengerCond_.notify_all();
+    if (scavenger_) {
+        scavenger_->join();
+    }
+    // 释放所有向系统申请的内存和 Span 对象
+    for (auto &shard : shards_) {
+        for (auto &i : shard->regions) {
+            munmap(i.first, i.second);
+        }
+        for (auto &i : shard->spanChunks) {
+            delete[] i;
+        }
+    }
+    shards_.clear();
+}
+
+// ********************************* MemoryPoolProfiler *********************************
+
+uint64_t SizeClassStats::threadCachedBlocks() const
+{
+    int64_t n = (int64_t)(fetchedBlocks + frees) - (int64_t)(allocs + returnedBlocks);
+    return n > 0 ? n : 0;
+}
+
+uint64_t MemoryPoolStats::allocs() const
+{
+    uint64_t n = 0;
+    for (auto &i : classes) {
+        n += i.allocs;
+    }
+    return n;
+}
+
+uint64_t MemoryPoolStats::misses() const
+{
+    uint64_t n = 0;
+    for (auto &i : classes) {
+        n += i.misses;
+    }
+    return n;
+}
+
+uint64_t MemoryPoolStats::inUseBytes() const
+{
+    uint64_t n = 0;
+    for (auto &i : classes) {
+        n += i.inUseBlocks() * i.size;
+    }
+    return n;
+}
+
+int64_t MemoryPoolStats::requestedBytes() const
+{
+    int64_t n = 0;
+    for (auto &i : classes) {
+        n += i.requestedBytes;
+    }
+    return n;
+}
+
+uint64_t MemoryPoolStats::threadCachedBytes() const
+{
+    uint64_t n = 0;
+    for (auto &i : classes) {
+        n += i.threadCachedBlocks() * i.size;
+    }
+    return n;
+}
+
+uint64_t MemoryPoolStats::centralCachedBytes() const
+{
+    uint64_t n = 0;
+    for (auto &i : classes) {
+        n += i.centralFreeBlocks * i.size;
+    }
+    return n;
+}
+
+static void AddCounters(SizeClassStats &stats, const SizeClassCounters &c)
+{
+    stats.allocs += c.allocs.load(std::memory_order_relaxed);
+    stats.frees += c.frees.load(std::memory_order_relaxed);
+    stats.misses += c.misses.load(std::memory_order_relaxed);
+    stats.fetchedBlocks += c.fetchedBlocks.load(std::memory_order_relaxed);
+    stats.returns += c.returns.load(std::memory_order_relaxed);
+    stats.returnedBlocks += c.returnedBlocks.load(std::memory_order_relaxed);
+    stats.requestedBytes += c.requestedBytes.load(std::memory_order_relaxed);
+}
+
+uint64_t MemoryPoolProfiler::GetSampleInterval()
+{
+    return s_sample_interval.load(std::memory_order_relaxed);
+}
+
+MemoryPoolStats MemoryPoolProfiler::GetStats()
+{
+    MemoryPoolStats stats;
+    stats.classes.resize(FREE_LIST_SIZE);
+    SizeClassStats large;
+    {
+        ThreadCacheRegistry &registry = GetThreadCacheRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (size_t i = 0; i < FREE_LIST_SIZE; ++i) {
+            AddCounters(stats.classes[i], registry.retired[i]);
+            for (auto cache : registry.caches) {
+                AddCounters(stats.classes[i], cache->getCounters()[i]);
+            }
+        }
+        AddCounters(large, registry.retiredLarge);
+        for (auto cache : registry.caches) {
+            AddCounters(large, cache->getLargeCounters());
+        }
+        stats.threads = registry.threads;
+        stats.liveThreads = registry.caches.size();
+    }
+    stats.largeAllocs = large.allocs;
+    stats.largeFrees = large.frees;
+    stats.largeBytes = large.requestedBytes;
+
+    CentralCache &cc = CentralCache::GetInstance();
+    for (size_t i = 0; i < FREE_LIST_SIZE; ++i) {
+        SizeClassStats &st = stats.classes[i];
+        const CentralCache::Counters &c = cc.getCounters(i);
+        st.size = SizeClass::getSize(i);
+        st.spans = c.spans.load(std::memory_order_relaxed);
+        st.spanBlocks = c.blocks.load(std::memory_order_relaxed);
+        uint64_t used = c.usedBlocks.load(std::memory_order_relaxed);
+        st.centralFreeBlocks = st.spanBlocks > used ? st.spanBlocks - used : 0;
+        st.spanAllocs = c.spanAllocs.load(std::memory_order_relaxed);
+        st.spanFrees = c.spanFrees.load(std::memory_order_relaxed);
+    }
+    stats.pageCache = PageCache::GetInstance().getStats();
+    return stats;
+}
+
+void MemoryPoolProfiler::ListSamples(std::vector<AllocSample> &samples, size_t limit)
+{
+    std::vector<std::pair<std::vector<void *>, AllocSampleTable::Stat> > stacks;
+    {
+        AllocSampleTable &table = GetAllocSampleTable();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        stacks.assign(table.stacks.begin(), table.stacks.end());
+    }
+    std::sort(stacks.begin(), stacks.end(), [](const auto &a, const auto &b) {
+        return a.second.estimatedBytes > b.second.estimatedBytes;
+    });
+    if (limit && stacks.size() > limit) {
+        stacks.resize(limit);
+    }
+    // 翻译符号比较慢，不在锁里做
+    samples.clear();
+    for (auto &i : stacks) {
+        AllocSample sample;
+        if (i.first.empty()) {
+            sample.stack.push_back("<other stacks>");
+        } else {
+            BacktraceSymbols(i.first.data(), i.first.size(), sample.stack);
+        }
+        sample.count = i.second.count;
+        sample.bytes = i.second.bytes;
+        sample.estimatedBytes = i.second.estimatedBytes;
+        samples.push_back(std::move(sample));
+    }
+}
+
+void MemoryPoolProfiler::ResetSamples()
+{
+    AllocSampleTable &table = GetAllocSampleTable();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    table.stacks.clear();
+}
+
+std::ostream &MemoryPoolProfiler::Dump(std::ostream &os, bool classes)
+{
+    MemoryPoolStats stats = GetStats();
+    uint64_t allocs = stats.allocs();
+    os << "[MemoryPool threads=" << stats.threads << " live_threads=" << stats.liveThreads
+       << " allocs=" << allocs
+       << " hit_rate=" << (allocs ? 1 - (double)stats.misses() / allocs : 0)
+       << " in_use_bytes=" << stats.inUseBytes() << " requested_bytes=" << stats.requestedBytes()
+       << " thread_cached_bytes=" << stats.threadCachedBytes()
+       << " central_cached_bytes=" << stats.centralCachedBytes()
+       << " page_cache_free_bytes=" << stats.pageCache.retainedBytes()
+       << " page_cache_released_bytes=" << stats.pageCache.releasedBytes()
+       << " system_bytes=" << stats.pageCache.systemBytes
+       << " huge_page_bytes=" << stats.pageCache.hugePageBytes
+       << " large_allocs=" << stats.largeAllocs << " large_bytes=" << stats.largeBytes << "]";
+    if (!classes) {
+        return os;
+    }
+    for (auto &i : stats.classes) {
+        if (!i.allocs && !i.spans) {
+            continue;
+        }
+        os << std::endl
+           << "    size=" << i.size << " allocs=" << i.allocs << " frees=" << i.frees
+           << " hit_rate=" << i.hitRate() << " misses=" << i.misses
+           << " fetched=" << i.fetchedBlocks << " returns=" << i.returns
+           << " returned=" << i.returnedBlocks << " in_use=" << i.inUseBlocks()
+           << " thread_cached=" << i.threadCachedBlocks() << " spans=" << i.spans
+           << " central_free=" << i.centralFreeBlocks << " requested_bytes=" << i.requestedBytes;
+    }
+    return os;
+}
+
+std::ostream &MemoryPoolProfiler::DumpSamples(std::ostream &os, size_t limit)
+{
+    std::vector<AllocSample> samples;
+    ListSamples(samples, limit);
+    os << "[AllocSamples interval=" << GetSampleInterval() << " stacks=" << samples.size() << "]";
+    for (auto &i : samples) {
+        os << std::endl
+           << "    estimated_bytes=" << i.estimatedBytes << " count=" << i.count
+           << " bytes=" << i.bytes;
+        for (auto &f : i.stack) {
+            os << std::endl << "        " << f;
         }
-        delete span; // 释放 Span 对象本身
     }
-    spanMap_.clear();
-    freeSpans_.clear();
+    return os;
 }
 
 } // namespace sylar
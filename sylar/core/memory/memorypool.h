@@ -2,12 +2,21 @@
 #define __SYLAR_MEMORYPOOL_H__
 
 #include <cstddef>
+#include <cstdint>
 #include <array>
 #include <atomic>
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
 #include "sylar/core/log/log.h"
 #include "sylar/core/mutex.h"
+#include "sylar/core/thread.h"
 #include "sylar/core/common/singleton.h"
+#include "sylar/core/memory/page_map.h"
 // 包含必要的头文件以使用 mprotect 和 PROT_NONE 定义
 #include <sys/mman.h>
 
@@ -21,8 +30,42 @@ namespace sylar
 {
 
 constexpr size_t ALIGNMENT = 8;
-constexpr size_t MAX_BYTES = 256 * 1024;                 // 256KB
-constexpr size_t FREE_LIST_SIZE = MAX_BYTES / ALIGNMENT; // ALIGNMENT等于指针void*的大小
+constexpr size_t MAX_BYTES = 256 * 1024; // 256KB
+/// 不超过这个大小按 8 字节查大小类，超过按 128 字节查
+constexpr size_t SMALL_CLASS_MAX = 1024;
+constexpr size_t LARGE_CLASS_ALIGN = 128;
+
+/**
+ * @brief 大小类 c 的下一个大小类
+ * @details 几何增长：在对齐允许的前提下取不超过 c * 8 / 7 的最大值，
+ *          所以落在这个类里的请求浪费的空间不超过类大小的 1/8(64 字节以下受 8 字节对齐限制会超过)。
+ *          128 字节以上按 16 字节对齐，1024 字节以上按 128 字节对齐，方便查表
+ */
+constexpr size_t SizeClassNext(size_t c)
+{
+    size_t limit = c * 8 / 7;
+    size_t align = limit > SMALL_CLASS_MAX ? LARGE_CLASS_ALIGN : (limit > 128 ? 16 : ALIGNMENT);
+    size_t next = limit / align * align;
+    if (next <= c) {
+        next = (c / align + 1) * align;
+    }
+    if (c < SMALL_CLASS_MAX && next > SMALL_CLASS_MAX) {
+        next = SMALL_CLASS_MAX;
+    }
+    return next < MAX_BYTES ? next : MAX_BYTES;
+}
+
+constexpr size_t SizeClassCount()
+{
+    size_t n = 1;
+    for (size_t c = ALIGNMENT; c < MAX_BYTES; c = SizeClassNext(c)) {
+        ++n;
+    }
+    return n;
+}
+
+/// 大小类个数，也是 ThreadCache / CentralCache 自由链表的个数
+constexpr size_t FREE_LIST_SIZE = SizeClassCount();
 
 constexpr size_t SPAN_PAGES = 8;
 
@@ -36,19 +79,84 @@ struct BlockHeader {
     BlockHeader *next; // 指向下一个内存块
 };
 
+/// 大小类的块大小和 大小 -> 大小类 的查找表，编译期生成
+struct SizeClassTable {
+    uint32_t sizes[FREE_LIST_SIZE];
+    /// 按 8 字节向上取整后查大小类
+    uint8_t small[SMALL_CLASS_MAX / ALIGNMENT + 1];
+    /// 按 128 字节向上取整后查大小类
+    uint8_t large[MAX_BYTES / LARGE_CLASS_ALIGN + 1];
+};
+
+static_assert(FREE_LIST_SIZE <= 256, "size class index must fit in uint8_t");
+
+constexpr SizeClassTable BuildSizeClassTable()
+{
+    SizeClassTable t{};
+    size_t c = ALIGNMENT;
+    for (size_t i = 0; i < FREE_LIST_SIZE; ++i, c = SizeClassNext(c)) {
+        t.sizes[i] = c;
+    }
+    size_t idx = 0;
+    for (size_t i = 0; i <= SMALL_CLASS_MAX / ALIGNMENT; ++i) {
+        while (t.sizes[idx] < i * ALIGNMENT) {
+            ++idx;
+        }
+        t.small[i] = idx;
+    }
+    idx = 0;
+    for (size_t i = 0; i <= MAX_BYTES / LARGE_CLASS_ALIGN; ++i) {
+        while (t.sizes[idx] < i * LARGE_CLASS_ALIGN) {
+            ++idx;
+        }
+        t.large[i] = idx;
+    }
+    return t;
+}
+
+inline constexpr SizeClassTable g_sizeClassTable = BuildSizeClassTable();
+
 // 大小类管理
 class SizeClass
 {
 public:
-    static size_t roundUp(size_t bytes) { return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+    /**
+     * @brief 请求大小向上取整到所在大小类的大小
+     */
+    static size_t roundUp(size_t bytes) { return getSize(getIndex(bytes)); }
 
+    /**
+     * @brief 请求大小所在的大小类，bytes 不能超过 MAX_BYTES，0 当作 ALIGNMENT
+     */
     static size_t getIndex(size_t bytes)
     {
-        // 确保bytes至少为ALIGNMENT
-        bytes = std::max(bytes, ALIGNMENT);
-        // 向上取整后-1
-        return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
+        return bytes <= SMALL_CLASS_MAX
+                   ? g_sizeClassTable.small[(bytes + ALIGNMENT - 1) / ALIGNMENT]
+                   : g_sizeClassTable.large[(bytes + LARGE_CLASS_ALIGN - 1) / LARGE_CLASS_ALIGN];
     }
+
+    /**
+     * @brief 大小类 index 的块大小
+     */
+    static size_t getSize(size_t index) { return g_sizeClassTable.sizes[index]; }
+};
+
+/**
+ * @brief 一个大小类的分配计数
+ * @details ThreadCache 里每个线程一份，只有所属线程写(relaxed 的 load + store，不用加锁的原子加)，
+ *          汇总时别的线程直接读，读到的是某个时刻附近的值
+ */
+struct SizeClassCounters {
+    std::atomic<uint64_t> allocs{0};
+    std::atomic<uint64_t> frees{0};
+    /// 自由链表为空、去中心缓存取的次数，和取到的块数
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> fetchedBlocks{0};
+    /// 还给中心缓存的次数和块数
+    std::atomic<uint64_t> returns{0};
+    std::atomic<uint64_t> returnedBlocks{0};
+    /// 调用方申请的字节数减去释放的字节数(按传入的大小，不是大小类的大小)
+    std::atomic<int64_t> requestedBytes{0};
 };
 
 class ThreadCache
@@ -63,6 +171,21 @@ public:
     void *allocate(size_t size);
     void deallocate(void *ptr, size_t size);
 
+    /**
+     * @brief 把所有自由链表还给中心缓存，线程退出时自动调用
+     */
+    void flush();
+
+    /**
+     * @brief 每个大小类的计数
+     */
+    const std::array<SizeClassCounters, FREE_LIST_SIZE> &getCounters() const { return counters_; }
+
+    /**
+     * @brief 超过 MAX_BYTES、直接 malloc 的分配的计数，只用 allocs、frees、requestedBytes
+     */
+    const SizeClassCounters &getLargeCounters() const { return large_; }
+
 private:
     ThreadCache();
     ~ThreadCache();
@@ -74,11 +197,62 @@ private:
     bool shouldReturnToCentralCache(size_t index);
     // 计算批量获取内存块的数量
     size_t getBatchNum(size_t size);
+    // 记录一次采样的调用栈，重新开始倒数
+    void recordSample(size_t size);
 
 private:
-    // freeList_ 是一个 FREE_LIST_SIZE 个 void* 数组。
+    // 每个大小类一个自由链表，freeListSize_ 是链表长度
     std::array<void *, FREE_LIST_SIZE> freeList_;
     std::array<size_t, FREE_LIST_SIZE> freeListSize_;
+    std::array<SizeClassCounters, FREE_LIST_SIZE> counters_;
+    SizeClassCounters large_;
+    /// 离下一次采样还要分配的字节数
+    int64_t sampleCountdown_ = 0;
+};
+
+/**
+ * @brief 按页管理的一段连续内存
+ * @details 由 PageCache 分配和回收；交给 CentralCache 时切成同样大小的小块，
+ *          小块全部还回来之后整个 span 还给 PageCache
+ */
+struct Span {
+    void *pageAddr;  // 页起始地址
+    size_t numPages; // 页数
+    Span *prev;      // 所在链表的指针
+    Span *next;
+    uint32_t shard;  // 所属分片，Span 对象只在分片内复用，创建后不变
+    bool inUse;      // 是否已分配出去
+    bool released;   // 空闲时物理页是否已经还给系统
+    uint64_t freeTime; // 进入空闲链表的时间(毫秒)
+
+    // 以下 CentralCache 使用
+    void *objects;      // 空闲小块链表
+    uint32_t useCount;  // 分出去还没还回来的小块数
+    uint32_t sizeClass; // 大小类
+};
+
+/**
+ * @brief Span 双向链表，头结点是哨兵
+ */
+struct SpanList {
+    Span head;
+    SpanList() { head.prev = head.next = &head; }
+    bool empty() const { return head.next == &head; }
+    Span *front() const { return head.next; }
+    Span *back() const { return head.prev; }
+    void push(Span *span)
+    {
+        span->next = head.next;
+        span->prev = &head;
+        head.next->prev = span;
+        head.next = span;
+    }
+    static void Erase(Span *span)
+    {
+        span->prev->next = span->next;
+        span->next->prev = span->prev;
+        span->prev = span->next = nullptr;
+    }
 };
 
 class CentralCache
@@ -96,30 +270,106 @@ public:
     // 返回，start首地址，size字节总长度，index返还对应的下标
     void returnRange(void *start, size_t size, size_t index);
 
+    /**
+     * @brief 一个大小类的 span 计数，持有该大小类的锁时写，汇总时直接读
+     */
+    struct Counters {
+        /// 切给这个大小类的 span 个数和切出来的块数
+        std::atomic<uint64_t> spans{0};
+        std::atomic<uint64_t> blocks{0};
+        /// 分给 ThreadCache 还没还回来的块数
+        std::atomic<uint64_t> usedBlocks{0};
+        /// 累计向页缓存要的、还给页缓存的 span 个数
+        std::atomic<uint64_t> spanAllocs{0};
+        std::atomic<uint64_t> spanFrees{0};
+    };
+
+    const Counters &getCounters(size_t index) const { return counters_[index]; }
+
 private:
     CentralCache()
     {
-        for (auto &ptr : centralFreeList_) {
-            ptr.store(nullptr, std::memory_order_relaxed);
-        }
         // 初始化所有锁
         for (auto &lock : locks_) {
             lock.clear();
         }
     }
     ~CentralCache();
-    // 从页缓存获取内存
-    void *fetchFromPageCache(size_t size, size_t batchNum, size_t &outNumPages);
+    // 从页缓存获取一个 span 并切成小块
+    Span *fetchFromPageCache(size_t index, size_t batchNum);
 
 private:
-    std::array<std::atomic<void *>, FREE_LIST_SIZE> centralFreeList_;
+    // 每个大小类有空闲小块的 span，小块全部分出去的 span 不在链表里
+    std::array<SpanList, FREE_LIST_SIZE> spans_;
     std::array<std::atomic_flag, FREE_LIST_SIZE> locks_;
+    std::array<Counters, FREE_LIST_SIZE> counters_;
+};
+
+/**
+ * @brief 页缓存统计，所有分片汇总
+ */
+struct PageCacheStats {
+    /// 向系统申请的字节数
+    uint64_t systemBytes = 0;
+    /// 分配出去的 span 个数和页数
+    uint64_t inUseSpans = 0;
+    uint64_t inUsePages = 0;
+    /// 空闲的 span 个数(包括已经还给系统的)
+    uint64_t freeSpans = 0;
+    /// 空闲并且还占着物理内存的页数
+    uint64_t freePages = 0;
+    /// 空闲并且已经还给系统的页数，没访问过的新区域也算在这里
+    uint64_t releasedPages = 0;
+    /// 回收线程累计还给系统的字节数和 madvise 次数
+    uint64_t releasedBytesTotal = 0;
+    uint64_t releaseCount = 0;
+    /// 向系统申请的字节数里按大页映射(MAP_HUGETLB 或者 MADV_HUGEPAGE 成功)的部分
+    uint64_t hugePageBytes = 0;
+
+    uint64_t retainedBytes() const;
+    uint64_t releasedBytes() const;
 };
 
+/**
+ * @brief 页缓存区域用不用大页，对应配置 memory_pool.huge_pages
+ */
+enum class HugePageMode {
+    /// 普通 4KB 页
+    NONE,
+    /// 透明大页，区域按 2MB 对齐后 madvise(MADV_HUGEPAGE)
+    THP,
+    /// MAP_HUGETLB，用预留的大页，预留不够时退回 THP
+    HUGETLB,
+};
+
+/**
+ * @brief 当前配置的大页模式，配置不认识时按 NONE
+ */
+HugePageMode GetHugePageMode();
+
+/**
+ * @brief 页缓存，按页管理 span
+ * @details 分成若干个分片，每个分片一把锁，管理自己向系统申请的内存区域；线程按所在 NUMA 节点和 CPU
+ *          选分片，不同 CPU 上的 CentralCache 取 span 基本不会抢同一把锁。
+ *          页号到 span 的映射是一棵全局的基数树，查询不加锁，释放时用来找 span 和相邻的 span；
+ *          相邻的空闲 span 只在同一个分片内、并且都还占着或者都已经还给系统时合并。
+ *          后台回收线程把空闲超过 memory_pool.release_idle_ms 的 span 用 madvise 还给系统，
+ *          每秒最多还 memory_pool.release_rate 字节，第一次向系统申请内存时启动。
+ *          memory_pool.huge_pages 打开时新的区域按 2MB 对齐、大小是 2MB 的整数倍，用大页映射，
+ *          回收线程也只还整块对齐的 2MB，不把大页拆碎；大页用不了时退回普通页。
+ */
 class PageCache
 {
 public:
     static const size_t PAGE_SIZE = 4096;
+    /// 每个 NUMA 节点的分片数
+    static const size_t SHARDS_PER_NODE = 8;
+    /// 页数小于这个值的空闲 span 按页数放在各自的链表里，不小于的放在一个链表里按最合适的挑
+    static const size_t MAX_BUCKET_PAGES = 128;
+    /// 每次向系统至少申请这么多页，多出来的作为空闲 span 留在分片里
+    static const size_t SYSTEM_ALLOC_PAGES = 256;
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+    static const size_t HUGE_PAGE_PAGES = HUGE_PAGE_SIZE / PAGE_SIZE;
 
     static PageCache &GetInstance()
     {
@@ -129,29 +379,195 @@ public:
 
     void *allocateSpan(size_t numPages);
 
+    /**
+     * @brief 归还 allocateSpan 分配的 span，ptr 必须是 span 的起始地址
+     * @details span 的页数以分配时记录的为准，numPages 只用来核对
+     */
     void deallocateSpan(void *ptr, size_t numPages);
 
+    /**
+     * @brief 分配一个 span
+     * @param[in] mapAllPages 是否登记每一页的映射，之后要用 getSpan 查 span 里任意地址的传 true
+     */
+    Span *allocate(size_t numPages, bool mapAllPages = false);
+
+    /**
+     * @brief 归还 allocate 分配的 span
+     */
+    void deallocate(Span *span);
+
+    /**
+     * @brief 地址所在的 span，只对 span 首页、末页和 mapAllPages 分配的 span 可靠，不加锁
+     */
+    Span *getSpan(const void *ptr) const { return pageMap_.get(RadixPageMap<Span>::PageId(ptr)); }
+
     static size_t getSpanPage(size_t size);
 
+    PageCacheStats getStats();
+
+    /**
+     * @brief 把空闲超过 idle_ms 的 span 还给系统，最多还 max_bytes 字节(按页向上取整)
+     * @return 还给系统的字节数
+     */
+    size_t release(uint64_t idle_ms, size_t max_bytes);
+
 private:
-    PageCache() = default;
+    PageCache();
     ~PageCache();
 
-    // 向系统申请内存
-    void *systemAlloc(size_t numPages);
-
 private:
-    struct Span {
-        void *pageAddr;  // 页起始地址
-        size_t numPages; // 页数
-        Span *next;      // 链表指针
+    struct Shard {
+        std::mutex mutex;
+        uint32_t index = 0;
+        /// 物理页优先分配到的 NUMA 节点
+        int node = 0;
+        /// [0] 还占着物理内存的，[1] 已经还给系统的；
+        /// 第 i 个链表放 i 页的空闲 span，最后一个放不小于 MAX_BUCKET_PAGES 页的
+        SpanList freeLists[2][MAX_BUCKET_PAGES + 1];
+        /// 第 i 位表示对应的链表非空，找第一个够大的链表不用逐个看
+        uint64_t nonEmpty[2][(MAX_BUCKET_PAGES + 1 + 63) / 64] = {};
+        /// 回收的 Span 对象
+        Span *spareSpans = nullptr;
+        /// 批量 new 出来的 Span 对象，析构时释放
+        std::vector<Span *> spanChunks;
+        /// 向系统申请的内存区域
+        std::vector<std::pair<void *, size_t> > regions;
+        PageCacheStats stats;
     };
-    // 按页数管理空闲 Span ，不同页数对应不同 Span 链表
-    std::map<size_t, Span *> freeSpans_;
-    // 页首地址 到 span 的映射，用于回收
-    // spanMap_不仅记录已分配的span，也记录空闲span
-    std::map<void *, Span *> spanMap_;
-    std::mutex mutex_;
+
+    Shard &currentShard();
+    Span *newSpan(Shard &shard);
+    void deleteSpan(Shard &shard, Span *span);
+    void insertFree(Shard &shard, Span *span);
+    void eraseFree(Shard &shard, Span *span);
+    Span *findFree(Shard &shard, size_t numPages, bool released);
+    /// 把 span 截成 numPages 页，返回切下来的后半段，两段都登记好映射，都不在空闲链表里
+    Span *splitSpan(Shard &shard, Span *span, size_t numPages);
+    /// 和相邻的同类空闲 span 合并，返回合并后的 span，调用时 span 不在空闲链表里
+    Span *coalesce(Shard &shard, Span *span);
+    /// 在 span 的首页和末页登记映射
+    void registerSpan(Span *span);
+    // 向系统申请内存，物理页优先从 shard 所在的 NUMA 节点分配，按 memory_pool.huge_pages 用大页
+    Span *systemAlloc(Shard &shard, size_t numPages);
+    void startScavenger();
+    void runScavenger();
+
+private:
+    std::vector<std::unique_ptr<Shard> > shards_;
+    /// 页号 -> span，分配出去的和空闲的 span 首页末页都有记录，中间页的记录可能是过期的
+    RadixPageMap<Span> pageMap_;
+
+    /// 后台回收线程
+    std::atomic<bool> scavengerStarted_{false};
+    std::unique_ptr<Thread> scavenger_;
+    std::mutex scavengerMutex_;
+    std::condition_variable scavengerCond_;
+    bool stopping_ = false;
+};
+
+/**
+ * @brief 一个大小类的汇总统计
+ */
+struct SizeClassStats {
+    /// 块大小
+    uint64_t size = 0;
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    uint64_t misses = 0;
+    uint64_t fetchedBlocks = 0;
+    uint64_t returns = 0;
+    uint64_t returnedBlocks = 0;
+    int64_t requestedBytes = 0;
+    /// 中心缓存里这个大小类的 span 个数、切出来的块数、还没分给线程的块数
+    uint64_t spans = 0;
+    uint64_t spanBlocks = 0;
+    uint64_t centralFreeBlocks = 0;
+    uint64_t spanAllocs = 0;
+    uint64_t spanFrees = 0;
+
+    /// 调用方正在使用的块数
+    uint64_t inUseBlocks() const { return allocs > frees ? allocs - frees : 0; }
+    /// 缓存在各线程自由链表里的块数：取来的 + 释放的 - 分配的 - 还回去的
+    uint64_t threadCachedBlocks() const;
+    /// 线程缓存命中率
+    double hitRate() const { return allocs ? 1 - (double)misses / allocs : 0; }
+};
+
+/**
+ * @brief 内存池汇总统计
+ * @details 字节数的关系：inUseBytes 是调用方拿着的块(按大小类大小)，其中 requestedBytes 是真正申请的，
+ *          差值是取整浪费；threadCachedBytes、centralCachedBytes 是缓存着没人用的块；
+ *          pageCache 里是空闲的页。
+ */
+struct MemoryPoolStats {
+    std::vector<SizeClassStats> classes;
+    /// 注册过 ThreadCache 的线程数(包括已经退出的)和还活着的线程数
+    uint64_t threads = 0;
+    uint64_t liveThreads = 0;
+    /// 超过 MAX_BYTES 直接 malloc 的分配
+    uint64_t largeAllocs = 0;
+    uint64_t largeFrees = 0;
+    int64_t largeBytes = 0;
+    PageCacheStats pageCache;
+
+    uint64_t allocs() const;
+    uint64_t misses() const;
+    uint64_t inUseBytes() const;
+    int64_t requestedBytes() const;
+    uint64_t threadCachedBytes() const;
+    uint64_t centralCachedBytes() const;
+};
+
+/**
+ * @brief 一个分配调用栈的采样统计
+ */
+struct AllocSample {
+    /// 调用栈，栈顶在前
+    std::vector<std::string> stack;
+    /// 采样到的次数和这些次采样时申请的字节数
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    /// 估算这个调用栈分配的字节数：每次采样代表 memory_pool.sample_interval 字节
+    uint64_t estimatedBytes = 0;
+};
+
+/**
+ * @brief 内存池统计和分配采样
+ * @details 计数一直开着：每个线程的 ThreadCache 自己计数，线程退出时并到全局，GetStats 时加锁汇总。
+ *          memory_pool.sample_interval 不为 0 时，每个线程大约每分配这么多字节记一次调用栈
+ *          (间隔带随机抖动，避免和固定的分配模式同步)，按调用栈汇总，用来找谁分配得最多。
+ *          采样只取栈地址，翻译成符号在 ListSamples 里做。
+ */
+class MemoryPoolProfiler
+{
+public:
+    /**
+     * @brief 当前的采样间隔(字节)，0 表示关闭
+     */
+    static uint64_t GetSampleInterval();
+
+    static MemoryPoolStats GetStats();
+
+    /**
+     * @brief 采样结果，按估算字节数从大到小排列
+     * @param[in] limit 最多返回的调用栈个数，0 表示不限
+     */
+    static void ListSamples(std::vector<AllocSample> &samples, size_t limit = 0);
+
+    /**
+     * @brief 清空采样结果
+     */
+    static void ResetSamples();
+
+    /**
+     * @brief 汇总一行，classes 为 true 时每个用到的大小类再输出一行
+     */
+    static std::ostream &Dump(std::ostream &os, bool classes = false);
+
+    /**
+     * @brief 输出采样结果
+     */
+    static std::ostream &DumpSamples(std::ostream &os, size_t limit = 20);
 };
 
 struct MemoryPool_Initer {
@@ -0,0 +1,145 @@
+#ifndef __SYLAR_PAGE_MAP_H__
+#define __SYLAR_PAGE_MAP_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+
+namespace sylar
+{
+
+/**
+ * @brief 页号 -> T* 的三级基数树
+ * @details 按 48 位虚拟地址、4KB 页算，页号 36 位，每级 12 位。根节点内嵌在对象里，
+ *          中间节点和叶子节点第一次用到时 mmap 出来，之后不再释放(直到对象析构)。
+ *          读不加锁；写只发生在持有对应内存区域的锁时，不同区域并发写不同的槽位，
+ *          新建节点用 CAS 安装，抢输的一方释放自己建的节点。
+ */
+template <class T>
+class RadixPageMap
+{
+public:
+    static const size_t PAGE_SHIFT = 12;
+    static const size_t LEVEL_BITS = 12;
+    static const size_t LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const size_t PAGE_BITS = 48 - PAGE_SHIFT;
+
+    RadixPageMap()
+    {
+        for (auto &i : m_root) {
+            i.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~RadixPageMap()
+    {
+        for (auto &i : m_root) {
+            Mid *mid = i.load(std::memory_order_relaxed);
+            if (!mid) {
+                continue;
+            }
+            for (auto &j : mid->leaves) {
+                Leaf *leaf = j.load(std::memory_order_relaxed);
+                if (leaf) {
+                    munmap(leaf, sizeof(Leaf));
+                }
+            }
+            munmap(mid, sizeof(Mid));
+        }
+    }
+
+    static uintptr_t PageId(const void *addr) { return (uintptr_t)addr >> PAGE_SHIFT; }
+
+    /**
+     * @brief 查询页号对应的值，没有设置过返回 nullptr
+     */
+    T *get(uintptr_t page) const
+    {
+        if (page >> PAGE_BITS) {
+            return nullptr;
+        }
+        Mid *mid = m_root[page >> (2 * LEVEL_BITS)].load(std::memory_order_acquire);
+        if (!mid) {
+            return nullptr;
+        }
+        Leaf *leaf = mid->leaves[(page >> LEVEL_BITS) & (LEVEL_SIZE - 1)].load(
+            std::memory_order_acquire);
+        if (!leaf) {
+            return nullptr;
+        }
+        return leaf->values[page & (LEVEL_SIZE - 1)].load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 设置页号对应的值，要先对这一页调用过 ensure
+     */
+    void set(uintptr_t page, T *v)
+    {
+        Mid *mid = m_root[page >> (2 * LEVEL_BITS)].load(std::memory_order_relaxed);
+        Leaf *leaf = mid->leaves[(page >> LEVEL_BITS) & (LEVEL_SIZE - 1)].load(
+            std::memory_order_relaxed);
+        leaf->values[page & (LEVEL_SIZE - 1)].store(v, std::memory_order_release);
+    }
+
+    /**
+     * @brief 为 [page, page + n) 建好节点
+     * @return mmap 失败或者超出地址范围返回 false
+     */
+    bool ensure(uintptr_t page, size_t n)
+    {
+        if ((page + n - 1) >> PAGE_BITS) {
+            return false;
+        }
+        for (uintptr_t key = page; key < page + n;) {
+            Mid *mid = Install(m_root[key >> (2 * LEVEL_BITS)]);
+            if (!mid) {
+                return false;
+            }
+            if (!Install(mid->leaves[(key >> LEVEL_BITS) & (LEVEL_SIZE - 1)])) {
+                return false;
+            }
+            // 跳到下一个叶子节点覆盖的第一页
+            key = ((key >> LEVEL_BITS) + 1) << LEVEL_BITS;
+        }
+        return true;
+    }
+
+private:
+    struct Leaf {
+        std::atomic<T *> values[LEVEL_SIZE];
+    };
+    struct Mid {
+        std::atomic<Leaf *> leaves[LEVEL_SIZE];
+    };
+
+    /**
+     * @brief 槽位为空时装上一个新节点，返回槽位里的节点
+     * @details mmap 出来的内存全是 0，正好是空指针
+     */
+    template <class N>
+    static N *Install(std::atomic<N *> &slot)
+    {
+        N *node = slot.load(std::memory_order_acquire);
+        if (node) {
+            return node;
+        }
+        void *ptr = mmap(nullptr, sizeof(N), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1, 0);
+        if (ptr == MAP_FAILED) {
+            return nullptr;
+        }
+        if (slot.compare_exchange_strong(node, (N *)ptr, std::memory_order_acq_rel)) {
+            return (N *)ptr;
+        }
+        munmap(ptr, sizeof(N));
+        return node;
+    }
+
+private:
+    std::atomic<Mid *> m_root[LEVEL_SIZE];
+};
+
+} // namespace sylar
+
+#endif
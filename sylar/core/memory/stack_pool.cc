@@ -0,0 +1,466 @@
+#include "sylar/core/memory/stack_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "sylar/core/config/config.h"
+#include "sylar/core/log/log.h"
+#include "sylar/core/memory/memorypool.h"
+#include "sylar/core/mutex.h"
+#include "sylar/core/util/topology.h"
+#include "sylar/core/util/util.h"
+
+namespace sylar
+{
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_max_cached = Config::Lookup<uint32_t>(
+    "fiber.stack_pool.max_cached", 64, "max cached fiber stacks per thread per size");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_idle_ms = Config::Lookup<uint32_t>(
+    "fiber.stack_pool.idle_ms", 5000, "release physical pages of stacks idle longer than this, 0=never");
+
+static ConfigVar<bool>::ptr g_stack_pool_madv_free = Config::Lookup<bool>(
+    "fiber.stack_pool.madv_free", false, "use MADV_FREE instead of MADV_DONTNEED when trimming");
+
+static ConfigVar<bool>::ptr g_stack_pool_use_arena = Config::Lookup<bool>(
+    "fiber.stack_pool.use_arena", false,
+    "allocate fiber stacks from the memory pool page cache, sharing its (huge page) regions; "
+    "these stacks have no guard page");
+
+static ConfigVar<bool>::ptr g_stack_watermark = Config::Lookup<bool>(
+    "fiber.stack_watermark", false,
+    "measure the stack high-water mark of every finished fiber, aggregated per creation site");
+
+/// 两次 trim 检查之间的最小间隔
+static const uint64_t TRIM_CHECK_INTERVAL_MS = 1000;
+
+static std::atomic<uint64_t> s_allocs{0};
+static std::atomic<uint64_t> s_hits{0};
+static std::atomic<uint64_t> s_mmaps{0};
+static std::atomic<uint64_t> s_arena_allocs{0};
+static std::atomic<uint64_t> s_munmaps{0};
+static std::atomic<uint64_t> s_trims{0};
+static std::atomic<uint64_t> s_in_use_bytes{0};
+static std::atomic<uint64_t> s_cached_bytes{0};
+/// 缓存中已经 madvise 过的字节数
+static std::atomic<uint64_t> s_trimmed_bytes{0};
+
+static thread_local bool t_pool_destroyed = false;
+
+static size_t PageSize()
+{
+    static size_t s_page_size = getpagesize();
+    return s_page_size;
+}
+
+/**
+ * @brief 栈是不是从页缓存分配的
+ * @details 页缓存的区域不会 munmap，自己 mmap 的栈不会落在里面，查页号映射就能区分
+ */
+static bool IsArenaStack(char *stack)
+{
+    Span *span = PageCache::GetInstance().getSpan(stack);
+    return span && span->pageAddr == stack;
+}
+
+static void UnmapStack(char *stack, size_t size)
+{
+    if (IsArenaStack(stack)) {
+        PageCache::GetInstance().deallocateSpan(stack, size / PageCache::PAGE_SIZE);
+    } else if (munmap(stack, size)) {
+        SYLAR_LOG_ERROR(g_logger) << "munmap fiber stack " << (void *)stack << " size=" << size
+                                  << " error: " << strerror(errno);
+    }
+    ++s_munmaps;
+}
+
+FiberStackPool *FiberStackPool::GetThis()
+{
+    static thread_local FiberStackPool s_pool;
+    return t_pool_destroyed ? nullptr : &s_pool;
+}
+
+FiberStackPool::~FiberStackPool()
+{
+    t_pool_destroyed = true;
+    for (auto &b : m_buckets) {
+        for (auto &i : b.stacks) {
+            UnmapStack(i.first, b.size);
+        }
+        s_cached_bytes -= b.size * b.stacks.size();
+        s_trimmed_bytes -= b.size * b.trimmed;
+    }
+    m_buckets.clear();
+}
+
+char *FiberStackPool::Allocate(size_t &size)
+{
+    size_t page = PageSize();
+    size = (size + page - 1) / page * page;
+    ++s_allocs;
+    FiberStackPool *pool = GetThis();
+    if (pool) {
+        char *stack = pool->allocate(size);
+        if (stack) {
+            ++s_hits;
+            s_in_use_bytes += size;
+            return stack;
+        }
+    }
+
+    if (g_stack_pool_use_arena->getValue() && page == PageCache::PAGE_SIZE) {
+        // 页缓存的区域可能是大页，按 4KB 设保护页会把大页拆开，所以不设
+        void *ptr = PageCache::GetInstance().allocateSpan(size / page);
+        if (ptr) {
+            ++s_arena_allocs;
+            s_in_use_bytes += size;
+            return (char *)ptr;
+        }
+    }
+
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+                     -1, 0);
+    if (ptr == MAP_FAILED) {
+        SYLAR_LOG_ERROR(g_logger) << "mmap fiber stack size=" << size
+                                  << " error: " << strerror(errno);
+        return nullptr;
+    }
+    ++s_mmaps;
+    s_in_use_bytes += size;
+    // 栈页在协程第一次跑到时才分配，先绑到当前线程的节点上；池是每个线程一个，复用时也还在这个节点
+    auto topo = CpuTopologyMgr::GetInstance();
+    topo->bindMemory(ptr, size, topo->currentNode());
+    // 保护页设置在低地址处，随栈一起复用，直到 munmap
+    SYLAR_MALLOC_PROTECT(ptr, size);
+    return (char *)ptr;
+}
+
+void FiberStackPool::Deallocate(char *stack, size_t size)
+{
+    s_in_use_bytes -= size;
+    FiberStackPool *pool = GetThis();
+    if (pool) {
+        pool->deallocate(stack, size);
+    } else {
+        UnmapStack(stack, size);
+    }
+}
+
+void FiberStackPool::Trim(bool force)
+{
+    FiberStackPool *pool = GetThis();
+    if (pool) {
+        pool->trim(force);
+    }
+}
+
+FiberStackStats FiberStackPool::GetStats()
+{
+    FiberStackStats stats;
+    stats.allocs = s_allocs;
+    stats.hits = s_hits;
+    stats.mmaps = s_mmaps;
+    stats.arenaAllocs = s_arena_allocs;
+    stats.munmaps = s_munmaps;
+    stats.trims = s_trims;
+    stats.inUseBytes = s_in_use_bytes;
+    stats.cachedBytes = s_cached_bytes;
+    stats.residentBytes = stats.inUseBytes + stats.cachedBytes - s_trimmed_bytes;
+    return stats;
+}
+
+std::ostream &FiberStackPool::Dump(std::ostream &os)
+{
+    FiberStackStats stats = GetStats();
+    os << "[FiberStackPool allocs=" << stats.allocs << " hits=" << stats.hits
+       << " hit_rate=" << stats.hitRate() << " mmaps=" << stats.mmaps
+       << " arena_allocs=" << stats.arenaAllocs
+       << " munmaps=" << stats.munmaps << " trims=" << stats.trims
+       << " in_use_bytes=" << stats.inUseBytes << " cached_bytes=" << stats.cachedBytes
+       << " resident_bytes=" << stats.residentBytes << "]";
+    return os;
+}
+
+FiberStackPool::Bucket &FiberStackPool::getBucket(size_t size)
+{
+    // 栈大小的种类很少，线性查找即可
+    for (auto &b : m_buckets) {
+        if (b.size == size) {
+            return b;
+        }
+    }
+    m_buckets.emplace_back();
+    m_buckets.back().size = size;
+    return m_buckets.back();
+}
+
+char *FiberStackPool::allocate(size_t size)
+{
+    trim(false);
+    Bucket &b = getBucket(size);
+    if (b.stacks.empty()) {
+        return nullptr;
+    }
+    char *stack = b.stacks.back().first;
+    b.stacks.pop_back();
+    s_cached_bytes -= size;
+    if (b.trimmed > b.stacks.size()) {
+        // 取走的是已经 madvise 过的栈
+        b.trimmed = b.stacks.size();
+        s_trimmed_bytes -= size;
+    }
+    return stack;
+}
+
+void FiberStackPool::deallocate(char *stack, size_t size)
+{
+    Bucket &b = getBucket(size);
+    if (b.stacks.size() >= g_stack_pool_max_cached->getValue()) {
+        if (b.stacks.empty()) {
+            UnmapStack(stack, size);
+            return;
+        }
+        // 满了淘汰最旧的，留下刚释放、还在 cache 里的
+        UnmapStack(b.stacks.front().first, size);
+        b.stacks.erase(b.stacks.begin());
+        s_cached_bytes -= size;
+        if (b.trimmed) {
+            --b.trimmed;
+            s_trimmed_bytes -= size;
+        }
+    }
+    b.stacks.emplace_back(stack, GetCurrentMS());
+    s_cached_bytes += size;
+}
+
+void FiberStackPool::trim(bool force)
+{
+    uint64_t now = GetCurrentMS();
+    if (!force && now - m_lastTrim < TRIM_CHECK_INTERVAL_MS) {
+        return;
+    }
+    m_lastTrim = now;
+    uint64_t idle_ms = g_stack_pool_idle_ms->getValue();
+    if (!force && idle_ms == 0) {
+        return;
+    }
+
+    int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+    if (g_stack_pool_madv_free->getValue()) {
+        advice = MADV_FREE;
+    }
+#endif
+    for (auto &b : m_buckets) {
+        while (b.trimmed < b.stacks.size()
+               && (force || now - b.stacks[b.trimmed].second >= idle_ms)) {
+            if (IsArenaStack(b.stacks[b.trimmed].first)) {
+                // 页缓存里的栈直接还回去，由页缓存按大页整块还给系统
+                UnmapStack(b.stacks[b.trimmed].first, b.size);
+                b.stacks.erase(b.stacks.begin() + b.trimmed);
+                s_cached_bytes -= b.size;
+                continue;
+            }
+            if (madvise(b.stacks[b.trimmed].first, b.size, advice)) {
+                SYLAR_LOG_ERROR(g_logger) << "madvise fiber stack "
+                                          << (void *)b.stacks[b.trimmed].first
+                                          << " error: " << strerror(errno);
+            }
+            ++b.trimmed;
+            ++s_trims;
+            s_trimmed_bytes += b.size;
+        }
+    }
+}
+
+// FiberStackWatermark -------------------
+
+/// 每个协程结束时都要判断，缓存开关
+static std::atomic<bool> s_watermark_enabled{false};
+
+struct _StackWatermarkIniter {
+    _StackWatermarkIniter()
+    {
+        s_watermark_enabled = g_stack_watermark->getValue();
+        g_stack_watermark->addListener([](const bool &, const bool &new_value) {
+            s_watermark_enabled = new_value;
+        });
+    }
+};
+
+static _StackWatermarkIniter s_stack_watermark_initer;
+
+/**
+ * @brief 一个线程的统计，只有本线程写，汇总时加锁读
+ */
+struct ThreadStackSites {
+    struct Key {
+        const char *file;
+        const char *function;
+        uint32_t line;
+        uint64_t stackSize;
+
+        bool operator==(const Key &rhs) const
+        {
+            return file == rhs.file && function == rhs.function && line == rhs.line
+                   && stackSize == rhs.stackSize;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const
+        {
+            return std::hash<const void *>()(k.file) ^ (k.line * 0x9e3779b97f4a7c15ull)
+                   ^ (k.stackSize << 7);
+        }
+    };
+
+    struct Stat {
+        uint64_t count = 0;
+        uint64_t maxBytes = 0;
+        uint64_t totalBytes = 0;
+    };
+
+    Spinlock mutex;
+    std::unordered_map<Key, Stat, KeyHash> sites;
+};
+
+static Mutex &GetSitesMutex()
+{
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+/**
+ * 线程退出后统计还要保留，用 shared_ptr 挂在全局列表上
+ */
+static std::vector<std::shared_ptr<ThreadStackSites> > &GetAllSites()
+{
+    static std::vector<std::shared_ptr<ThreadStackSites> > s_sites;
+    return s_sites;
+}
+
+static ThreadStackSites *GetThreadSites()
+{
+    static thread_local std::shared_ptr<ThreadStackSites> t_sites;
+    if (!t_sites) {
+        t_sites = std::make_shared<ThreadStackSites>();
+        Mutex::Lock lock(GetSitesMutex());
+        GetAllSites().push_back(t_sites);
+    }
+    return t_sites.get();
+}
+
+bool FiberStackWatermark::IsEnabled()
+{
+    return s_watermark_enabled.load(std::memory_order_relaxed);
+}
+
+size_t FiberStackWatermark::Measure(char *stack, size_t size)
+{
+    size_t page = PageSize();
+    size_t pages = size / page;
+    static thread_local std::vector<unsigned char> t_vec;
+    t_vec.resize(pages);
+    if (mincore(stack, size, t_vec.data())) {
+        return 0;
+    }
+    // 栈从高地址往低地址长，最低的驻留页就是写到过的最深处(保护页不会驻留)
+    size_t low = 0;
+    while (low < pages && !(t_vec[low] & 1)) {
+        ++low;
+    }
+    if (low == pages) {
+        return 0;
+    }
+    uint64_t *begin = (uint64_t *)(stack + low * page);
+    uint64_t *end = (uint64_t *)(stack + size);
+    uint64_t *p = begin;
+    while (p < end && *p == 0) {
+        ++p;
+    }
+    if (p == end) {
+        return 0;
+    }
+    // 协程已经执行完，整块栈都不再使用
+    memset(p, 0, (char *)end - (char *)p);
+    return (char *)end - (char *)p;
+}
+
+void FiberStackWatermark::Record(const std::source_location &site, size_t stackSize,
+                                 size_t used)
+{
+    ThreadStackSites *sites = GetThreadSites();
+    ThreadStackSites::Key key{site.file_name(), site.function_name(), site.line(), stackSize};
+    Spinlock::Lock lock(sites->mutex);
+    auto &stat = sites->sites[key];
+    ++stat.count;
+    stat.totalBytes += used;
+    stat.maxBytes = std::max<uint64_t>(stat.maxBytes, used);
+}
+
+void FiberStackWatermark::List(std::vector<FiberStackSiteStats> &result)
+{
+    std::unordered_map<ThreadStackSites::Key, ThreadStackSites::Stat, ThreadStackSites::KeyHash>
+        merged;
+    {
+        Mutex::Lock lock(GetSitesMutex());
+        for (auto &sites : GetAllSites()) {
+            Spinlock::Lock lock2(sites->mutex);
+            for (auto &i : sites->sites) {
+                auto &stat = merged[i.first];
+                stat.count += i.second.count;
+                stat.totalBytes += i.second.totalBytes;
+                stat.maxBytes = std::max(stat.maxBytes, i.second.maxBytes);
+            }
+        }
+    }
+    result.clear();
+    for (auto &i : merged) {
+        FiberStackSiteStats st;
+        std::stringstream ss;
+        ss << i.first.file << ":" << i.first.line << " " << i.first.function;
+        st.site = ss.str();
+        st.stackSize = i.first.stackSize;
+        st.count = i.second.count;
+        st.maxBytes = i.second.maxBytes;
+        st.totalBytes = i.second.totalBytes;
+        result.push_back(std::move(st));
+    }
+    std::sort(result.begin(), result.end(),
+              [](const FiberStackSiteStats &a, const FiberStackSiteStats &b) {
+                  return a.maxBytes > b.maxBytes;
+              });
+}
+
+void FiberStackWatermark::Reset()
+{
+    Mutex::Lock lock(GetSitesMutex());
+    for (auto &sites : GetAllSites()) {
+        Spinlock::Lock lock2(sites->mutex);
+        sites->sites.clear();
+    }
+}
+
+std::ostream &FiberStackWatermark::Dump(std::ostream &os)
+{
+    std::vector<FiberStackSiteStats> sites;
+    List(sites);
+    os << "[FiberStackWatermark enabled=" << IsEnabled() << " sites=" << sites.size() << "]";
+    for (auto &i : sites) {
+        os << std::endl
+           << "    stack_size=" << i.stackSize << " count=" << i.count << " max=" << i.maxBytes
+           << " avg=" << i.avgBytes() << " " << i.site;
+    }
+    return os;
+}
+
+} // namespace sylar
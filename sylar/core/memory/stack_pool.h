@@ -0,0 +1,171 @@
+#ifndef __SYLAR_STACK_POOL_H__
+#define __SYLAR_STACK_POOL_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <source_location>
+#include <string>
+#include <vector>
+
+namespace sylar
+{
+
+/**
+ * @brief 协程栈池统计，所有线程的栈池汇总
+ */
+struct FiberStackStats {
+    /// 分配次数
+    uint64_t allocs = 0;
+    /// 从池中命中的次数
+    uint64_t hits = 0;
+    /// 向系统 mmap 的次数
+    uint64_t mmaps = 0;
+    /// 从页缓存分配的次数(fiber.stack_pool.use_arena)
+    uint64_t arenaAllocs = 0;
+    /// 还给系统 munmap(或者还给页缓存)的次数
+    uint64_t munmaps = 0;
+    /// madvise 回收物理页的次数
+    uint64_t trims = 0;
+    /// 正在被协程使用的栈字节数
+    uint64_t inUseBytes = 0;
+    /// 缓存在池里的栈字节数
+    uint64_t cachedBytes = 0;
+    /// 驻留字节数（使用中 + 池里还没被 madvise 回收的），是物理内存占用的上界
+    uint64_t residentBytes = 0;
+
+    double hitRate() const { return allocs ? (double)hits / allocs : 0; }
+};
+
+/**
+ * @brief 线程级协程栈池
+ * @details 栈用 mmap 分配，低地址处的保护页只在 mmap 时 mprotect 一次，之后随栈一起复用。
+ *          按栈大小分桶，每个桶 LIFO 复用，最近释放的栈还在 cache 里。
+ *          空闲超过 fiber.stack_pool.idle_ms 的栈用 madvise 归还物理页，但保留虚拟地址，
+ *          下次复用时缺页重新分配；每个桶最多缓存 fiber.stack_pool.max_cached 个，多余的直接 munmap。
+ *          协程可能在别的线程析构，栈还给析构所在线程的池。
+ *          打开 fiber.stack_pool.use_arena 后新栈从 PageCache 分配，和内存池共用(可能是大页的)区域，
+ *          这样的栈没有保护页，空闲超时后整个还给页缓存而不是 madvise。
+ */
+class FiberStackPool
+{
+public:
+    /**
+     * @brief 分配协程栈
+     * @param[in,out] size 栈大小，向上取整为页大小的整数倍
+     * @return 栈的低地址，失败返回 nullptr
+     */
+    static char *Allocate(size_t &size);
+
+    /**
+     * @brief 归还协程栈到当前线程的栈池，线程正在退出时直接 munmap
+     * @param[in] stack Allocate 返回的地址
+     * @param[in] size Allocate 返回的大小
+     */
+    static void Deallocate(char *stack, size_t size);
+
+    /**
+     * @brief 回收当前线程栈池里空闲太久的栈的物理页
+     * @param[in] force 为 true 时忽略空闲时间，回收所有缓存的栈
+     * @details 距离上次检查不足 1 秒时直接返回，可以放心在 idle 循环里调用
+     */
+    static void Trim(bool force = false);
+
+    /**
+     * @brief 所有线程汇总的统计信息
+     */
+    static FiberStackStats GetStats();
+
+    static std::ostream &Dump(std::ostream &os);
+
+private:
+    FiberStackPool() = default;
+    ~FiberStackPool();
+
+    struct Bucket {
+        size_t size = 0;
+        /// 按释放时间从旧到新排列，尾部最热
+        std::vector<std::pair<char *, uint64_t> > stacks;
+        /// stacks 前 trimmed 个已经 madvise 过
+        size_t trimmed = 0;
+    };
+
+    /**
+     * @brief 当前线程的栈池，线程退出、栈池已经析构时返回 nullptr
+     */
+    static FiberStackPool *GetThis();
+
+    char *allocate(size_t size);
+    void deallocate(char *stack, size_t size);
+    void trim(bool force);
+    Bucket &getBucket(size_t size);
+
+private:
+    std::vector<Bucket> m_buckets;
+    uint64_t m_lastTrim = 0;
+};
+
+/**
+ * @brief 一个创建位置的协程栈用量统计
+ */
+struct FiberStackSiteStats {
+    /// 创建位置，文件:行 函数
+    std::string site;
+    /// 栈大小
+    uint64_t stackSize = 0;
+    /// 统计到的协程数
+    uint64_t count = 0;
+    /// 最大用量(字节)
+    uint64_t maxBytes = 0;
+    /// 用量总和(字节)
+    uint64_t totalBytes = 0;
+
+    uint64_t avgBytes() const { return count ? totalBytes / count : 0; }
+};
+
+/**
+ * @brief 协程栈用量(高水位)统计
+ * @details fiber.stack_watermark 打开后，私有栈协程执行完时测量栈的最大用量，按创建位置汇总。
+ *          测量方法：新 mmap 的栈全是 0，mincore 找到最深的驻留页，从那里往栈底找第一个非 0 的字，
+ *          就是最深写到的位置；测完把用过的部分清 0，下一个复用这块栈的协程从干净的栈开始测。
+ *          开关打开之前就在用、被复用的栈，以及从页缓存分配的栈(不一定全是 0)第一次测量可能偏大。
+ *          每个协程结束时多一次 mincore 和一次清 0(正比于栈用量)，默认关闭，用来决定每个创建位置的栈大小档位。
+ */
+class FiberStackWatermark
+{
+public:
+    /**
+     * @brief 是否打开了统计
+     */
+    static bool IsEnabled();
+
+    /**
+     * @brief 测量已经执行完的协程的栈用量，并把用过的部分清 0
+     * @param[in] stack 栈的低地址
+     * @param[in] size 栈大小
+     * @return 用量(字节)
+     */
+    static size_t Measure(char *stack, size_t size);
+
+    /**
+     * @brief 记录一次测量结果
+     * @param[in] site 协程的创建位置
+     */
+    static void Record(const std::source_location &site, size_t stackSize, size_t used);
+
+    /**
+     * @brief 所有线程汇总的统计，按最大用量从大到小排列
+     */
+    static void List(std::vector<FiberStackSiteStats> &sites);
+
+    /**
+     * @brief 清空统计
+     */
+    static void Reset();
+
+    static std::ostream &Dump(std::ostream &os);
+};
+
+} // namespace sylar
+
+#endif
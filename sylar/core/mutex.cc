@@ -64,18 +64,38 @@ void FiberSemaphore::wait()
             --m_concurrency;
             return;
         }
-        m_waiters.push_back(std::make_pair(Scheduler::GetThis(), Fiber::GetThis()));
+        m_waiters.push_back(Waiter{Scheduler::GetThis(), Fiber::GetThis(), nullptr});
     }
     Fiber::GetThis()->yield();
 }
 
+bool FiberSemaphore::waitAsync(Scheduler *scheduler, TaskFunction cb)
+{
+    SYLAR_ASSERT(scheduler);
+    MutexType::Lock lock(m_mutex);
+    if (m_concurrency > 0u) {
+        --m_concurrency;
+        return false;
+    }
+    m_waiters.push_back(Waiter{scheduler, nullptr, std::move(cb)});
+    return true;
+}
+
+void FiberSemaphore::Wake(Waiter &waiter)
+{
+    if (waiter.fiber) {
+        waiter.scheduler->schedule(std::move(waiter.fiber));
+    } else {
+        waiter.scheduler->schedule(std::move(waiter.cb));
+    }
+}
+
 void FiberSemaphore::notify()
 {
     MutexType::Lock lock(m_mutex);
     if (!m_waiters.empty()) {
-        auto next = m_waiters.front();
+        Wake(m_waiters.front());
         m_waiters.pop_front();
-        next.first->schedule(next.second);
     } else {
         ++m_concurrency;
     }
@@ -85,7 +105,7 @@ void FiberSemaphore::notifyAll()
 {
     MutexType::Lock lock(m_mutex);
     for (auto &i : m_waiters) {
-        i.first->schedule(i.second);
+        Wake(i);
     }
     m_waiters.clear();
 }
@@ -463,15 +463,37 @@ public:
 
     bool tryWait();
     void wait();
+
+    /**
+     * @brief 不挂起协程的等待，C++20 协程使用
+     * @details 拿到了直接返回 false；否则把 cb 挂到等待队列，notify 时调度 cb，返回 true
+     */
+    bool waitAsync(Scheduler *scheduler, TaskFunction cb);
+
     void notify();
     void notifyAll();
 
     size_t getConcurrency() const { return m_concurrency; }
     void reset() { m_concurrency = 0; }
 
+private:
+    /**
+     * @brief 等待者，挂起的协程或者唤醒时调度的回调
+     */
+    struct Waiter {
+        Scheduler *scheduler;
+        Fiber::ptr fiber;
+        TaskFunction cb;
+    };
+
+    /**
+     * @brief 调度等待者
+     */
+    static void Wake(Waiter &waiter);
+
 private:
     MutexType m_mutex;
-    std::list<std::pair<Scheduler *, Fiber::ptr>> m_waiters;
+    std::list<Waiter> m_waiters;
     size_t m_concurrency;
 };
 
@@ -1,6 +1,9 @@
 #include "scheduler.h"
 #include "sylar/core/common/macro.h"
+#include "sylar/core/config/config.h"
 #include "hook.h"
+#include "watchdog.h"
+#include "sylar/core/util/topology.h"
 
 namespace sylar
 {
@@ -36,11 +39,51 @@ static thread_local Scheduler *t_scheduler = nullptr;
  */
 static thread_local Fiber *t_scheduler_fiber = nullptr;
 
-Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) : m_name(name)
+/**
+ * 当前线程在 t_scheduler->m_queues 中的下标，非调度线程为 -1
+ */
+static thread_local int t_queue_slot = -1;
+
+static ConfigVar<uint32_t>::ptr g_local_queue_size = Config::Lookup<uint32_t>(
+    "scheduler.local_queue_size", 256, "scheduler per-thread local queue capacity");
+
+static ConfigVar<uint32_t>::ptr g_global_queue_size = Config::Lookup<uint32_t>(
+    "scheduler.global_queue_size", 4096, "scheduler lock-free global queue capacity");
+
+static ConfigVar<uint32_t>::ptr g_background_interval = Config::Lookup<uint32_t>(
+    "scheduler.background_interval", 8,
+    "scheduler takes at least one background task every N dequeues while background work is queued");
+
+static ConfigVar<bool>::ptr g_queue_wait_stats = Config::Lookup<bool>(
+    "scheduler.queue_wait_stats", false, "scheduler records per-priority queue wait histograms");
+
+static ConfigVar<uint32_t>::ptr g_stall_threshold_ms = Config::Lookup<uint32_t>(
+    "scheduler.stall_threshold_ms", 0,
+    "a fiber running longer than this without yielding is reported by the watchdog thread "
+    "with its backtrace, also enables run slice histograms, 0 disables");
+
+static ConfigVar<std::map<std::string, std::string> >::ptr g_cpu_affinity =
+    Config::Lookup("scheduler.cpu_affinity", std::map<std::string, std::string>(),
+                   "pin scheduler threads to cpus, scheduler name -> cpu list like \"0-3,8\" or "
+                   "\"node:1\", one cpu per thread in turn");
+
+/// 每从本地队列取这么多次任务，先看一次全局队列（取质数，避免和业务周期共振）
+static const uint32_t GLOBAL_QUEUE_CHECK_INTERVAL = 61;
+
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name)
+    : m_name(name), m_inject(g_global_queue_size->getValue())
 {
     SYLAR_ASSERT(threads > 0);
 
     m_useCaller = use_caller;
+    m_backgroundInterval = std::max<uint32_t>(g_background_interval->getValue(), 1);
+    m_queueWaitStats = g_queue_wait_stats->getValue();
+    m_stallThresholdMs = g_stall_threshold_ms->getValue();
+
+    m_queues.resize(threads);
+    for (auto &q : m_queues) {
+        q.reset(new LocalQueue(g_local_queue_size->getValue()));
+    }
 
     if (use_caller) { // 主线程也添加到 调度
         threads--;
@@ -61,10 +104,30 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) :
         sylar::Thread::SetName(m_name);
         m_rootThread = sylar::GetThreadId();
         m_threadIds.push_back(m_rootThread); // 线程池，线程ID数组
+
+        // caller线程固定使用0号本地队列，构造之后在caller线程里schedule的任务就能被子线程窃取
+        m_queues[0]->threadId = m_rootThread;
+        t_queue_slot = 0;
+        m_nextSlot = 1;
     } else {
         m_rootThread = -1;
     }
     m_threadCount = threads;
+    if (m_stallThresholdMs) {
+        FiberWatchdogMgr::GetInstance()->add(this);
+    }
+
+    auto affinity = g_cpu_affinity->getValue();
+    auto it = affinity.find(m_name);
+    if (it != affinity.end()) {
+        std::vector<int> cpus;
+        if (CpuTopologyMgr::GetInstance()->parseCpuList(it->second, cpus)) {
+            setAffinity(cpus);
+        } else {
+            SYLAR_LOG_ERROR(g_logger) << "scheduler " << m_name << " invalid cpu_affinity "
+                                      << it->second;
+        }
+    }
 }
 
 Scheduler *Scheduler::GetThis()
@@ -94,12 +157,90 @@ void Scheduler::switchTo(int thread)
     Fiber::GetThis()->yield();
 }
 
+/// 每个线程缓存的空闲任务节点数上限
+static const size_t TASK_NODE_CACHE_MAX = 1024;
+
+/**
+ * 线程本地的空闲任务节点链表
+ * 任务大多在调度线程之间产生和消费，节点回收到释放它的线程，之后在这个线程上入队的任务直接复用
+ */
+struct TaskNodeCache {
+    struct Node {
+        Node *next;
+    };
+
+    ~TaskNodeCache();
+
+    Node *head = nullptr;
+    size_t size = 0;
+};
+
+static thread_local bool t_task_cache_destroyed = false;
+static thread_local TaskNodeCache t_task_cache;
+
+TaskNodeCache::~TaskNodeCache()
+{
+    t_task_cache_destroyed = true;
+    while (head) {
+        Node *n = head;
+        head = n->next;
+        ::operator delete(n);
+    }
+    size = 0;
+}
+
+void *Scheduler::ScheduleTask::operator new(size_t size)
+{
+    SYLAR_ASSERT(size == sizeof(ScheduleTask));
+    if (!t_task_cache_destroyed && t_task_cache.head) {
+        TaskNodeCache::Node *n = t_task_cache.head;
+        t_task_cache.head = n->next;
+        --t_task_cache.size;
+        return n;
+    }
+    return ::operator new(size);
+}
+
+void Scheduler::ScheduleTask::operator delete(void *p) noexcept
+{
+    if (!p) {
+        return;
+    }
+    if (t_task_cache_destroyed || t_task_cache.size >= TASK_NODE_CACHE_MAX) {
+        ::operator delete(p);
+        return;
+    }
+    TaskNodeCache::Node *n = static_cast<TaskNodeCache::Node *>(p);
+    n->next = t_task_cache.head;
+    t_task_cache.head = n;
+    ++t_task_cache.size;
+}
+
 Scheduler::~Scheduler()
 {
     SYLAR_LOG_DEBUG(g_logger) << "Scheduler::~Scheduler()";
     SYLAR_ASSERT(m_stopping);
+    if (m_stallThresholdMs) {
+        FiberWatchdogMgr::GetInstance()->del(this);
+    }
     if (GetThis() == this) {
         t_scheduler = nullptr;
+        t_queue_slot = -1;
+    }
+    for (auto &q : m_queues) {
+        while (ScheduleTask *t = q->tasks.pop()) {
+            delete t;
+        }
+        while (ScheduleTask *t = q->pinned.pop()) {
+            delete t;
+        }
+    }
+    ScheduleTask *t = nullptr;
+    while (m_inject.pop(t)) {
+        delete t;
+    }
+    for (ScheduleTask *t : m_background) {
+        delete t;
     }
 }
 
@@ -131,14 +272,13 @@ void Scheduler::start()
 
 bool Scheduler::stopping()
 {
-    RWMutexType::ReadLock lock(m_mutex);
     // 停止，任务队列为空，线程池都结束了任务
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+    return m_stopping && m_taskCount == 0 && m_activeThreadCount == 0;
 }
 
-void Scheduler::tickle()
+void Scheduler::tickle(int thread)
 {
-    SYLAR_LOG_DEBUG(g_logger) << "Scheduler::tickle()";
+    SYLAR_LOG_DEBUG(g_logger) << "Scheduler::tickle(" << thread << ")";
 }
 
 void Scheduler::idle()
@@ -233,44 +373,30 @@ void Scheduler::run()
             sylar::Fiber::GetThis().get(); // 此时的子线程 还没主协程，故，创建并赋值给
                                            // t_scheduler_fiber，作为当前线程的调度协程~
     } // use_caller主线程，在调度器初始化时，已经把 主线程的调度协程，赋值给 t_scheduler_fiber
+    // 绑定本线程的本地队列
+    size_t slot = sylar::GetThreadId() == m_rootThread ? 0 : m_nextSlot++;
+    SYLAR_ASSERT(slot < m_queues.size());
+    LocalQueue *local = m_queues[slot].get();
+    local->threadId = sylar::GetThreadId();
+    t_queue_slot = slot;
+    if (sylar::GetThreadId() != m_rootThread) {
+        RWMutexType::ReadLock lock(m_mutex);
+        int cpu = affinityCpu(slot);
+        lock.unlock();
+        if (cpu >= 0) {
+            CpuTopology::SetThreadAffinity(0, {cpu});
+        }
+    }
+
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this))); // 空转 协程
-    Fiber::ptr cb_fiber; // 用于封装 cb 仿函数任务的协程
+    // 用于封装 cb 仿函数任务的协程，每个栈大小档位一个
+    Fiber::ptr cb_fibers[Fiber::STACK_CLASS_COUNT];
 
     ScheduleTask task;
     while (true) {
         task.reset();
         bool tickle_me = false; // 是否 tickle 其他线程进行任务调度
-        bool is_active = false;
-        {
-            RWMutexType::WriteLock lock(m_mutex);
-            auto it = m_tasks.begin();
-            while (it != m_tasks.end()) {
-                // 如果当前的任务 不在 目标线程里
-                if (it->thread != -1 && it->thread != sylar::GetThreadId()) {
-                    // 指定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行调度，
-                    // 然后跳过这个任务，继续下一个
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-
-                SYLAR_ASSERT(it->fiber || it->cb);
-
-                if (it->fiber && it->fiber->getState() == Fiber::RUNNING) {
-                    ++it;
-                    continue;
-                }
-                // 当前调度线程找到一个任务，准备开始调度，将其从任务队列中剔除，活动线程数加1
-                task = *it;
-                m_tasks.erase(it++);
-                ++m_activeThreadCount;
-                is_active = true;
-                break;
-            }
-
-            // 当前线程拿完一个任务后，发现任务队列还有剩余，那么tickle一下其他线程
-            tickle_me |= (it != m_tasks.end());
-        }
+        bool is_active = dequeue(local, task, tickle_me);
 
         if (tickle_me) {
             tickle(); // 实际 tickle 不会通知，因为 只要 调度不停止，就会不断拿去 任务~
@@ -283,21 +409,31 @@ void Scheduler::run()
             // 1. 子线程，主协程（调度协程） --> 任务协程
             // 2. use_caller线程，子协程（调度协程）--> 任务协程
             // 再次强调，use_caller线程里的主协程并不操作任务
+            beginSlice(local, task.fiber->getId());
             task.fiber->resume();
+            endSlice(local);
             --m_activeThreadCount;
             task.reset();
         } else if (task.cb) {
+            Fiber::ptr &cb_fiber = cb_fibers[task.stackClass];
             if (cb_fiber) {
-                cb_fiber->reset(task.cb);
+                cb_fiber->reset(std::move(task.cb), task.site);
             } else {
-                cb_fiber.reset(new Fiber(task.cb));
+                cb_fiber.reset(new Fiber(std::move(task.cb), Fiber::GetStackSize(task.stackClass),
+                                         true, false, task.site));
             }
 
             task.reset();
             // 同上
+            beginSlice(local, cb_fiber->getId());
             cb_fiber->resume();
+            endSlice(local);
             --m_activeThreadCount;
-            cb_fiber.reset();
+            // 执行完并且没有别人引用，留着给下一个 cb 任务复用，省掉协程对象和栈的分配；
+            // 半路 yield 的协程已经交给了别人(事件、定时器或者重新调度)，这里放手
+            if (cb_fiber->getState() != Fiber::TERM || cb_fiber.use_count() > 1) {
+                cb_fiber.reset();
+            }
         } else {
             if (is_active) {
                 --m_activeThreadCount;
@@ -309,18 +445,458 @@ void Scheduler::run()
                 break;
             }
             ++m_idleThreadCount;
+            local->idling = true;
             // 同上
             idle_fiber->resume();
+            local->idling = false;
             --m_idleThreadCount;
         }
     }
 }
 
+int Scheduler::currentSlot() const
+{
+    return t_scheduler == this ? t_queue_slot : -1;
+}
+
+int Scheduler::findSlot(int thread) const
+{
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+        if (m_queues[i]->threadId == thread) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool Scheduler::hasPendingTasks(int slot) const
+{
+    if (m_queues[slot]->pinnedCount > 0 || !m_inject.empty() || m_overflowCount > 0
+        || m_backgroundCount > 0) {
+        return true;
+    }
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+        if ((int)i != slot && !m_queues[i]->tasks.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Scheduler::LocalQueue *Scheduler::findQueue(int thread)
+{
+    for (auto &q : m_queues) {
+        if (q->threadId == thread) {
+            return q.get();
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::enqueue(ScheduleTask &task)
+{
+    ++m_taskCount;
+    if (m_queueWaitStats) {
+        task.enqueueUs = GetCurrentUS();
+    }
+    ScheduleTask *t = new ScheduleTask(std::move(task));
+    if (t->thread != -1) {
+        LocalQueue *q = findQueue(t->thread);
+        if (q) {
+            ++q->pinnedCount;
+            q->pinned.push(t);
+            return true;
+        }
+    } else if (t->priority == BACKGROUND) {
+        return pushBackground(t);
+    } else if (t_scheduler == this && t_queue_slot >= 0
+               && !(t->fiber && t->fiber->getId() == Fiber::GetFiberId())) {
+        LocalQueue *local = m_queues[t_queue_slot].get();
+        bool need_tickle = local->tasks.empty();
+        if (local->tasks.push(t)) {
+            return need_tickle;
+        }
+        // 本地队列满了，溢出到全局队列
+    }
+
+    bool need_tickle = m_inject.empty();
+    if (m_inject.push(t)) {
+        return need_tickle;
+    }
+    pushOverflow(t);
+    return true;
+}
+
+void Scheduler::pushOverflow(ScheduleTask *task)
+{
+    RWMutexType::WriteLock lock(m_mutex);
+    m_tasks.push_back(std::move(*task));
+    ++m_overflowCount;
+    lock.unlock();
+    delete task;
+}
+
+bool Scheduler::dequeue(LocalQueue *local, ScheduleTask &task, bool &tickle_me)
+{
+    bool found = false;
+    // 0. 后台任务的最低配额，交互任务一直不断时也能轮到后台任务
+    if (m_backgroundCount > 0 && ++local->backgroundTicks % m_backgroundInterval == 0) {
+        found = takeBackground(task, tickle_me);
+    }
+
+    // 1. 指定到本线程的任务
+    if (!found && local->pinnedCount > 0) {
+        // 生产者还没链接完成时 pop 会拿到空，下一轮再取
+        ScheduleTask *t = local->pinned.pop();
+        if (t) {
+            if (t->fiber && t->fiber->getState() == Fiber::RUNNING) {
+                // 协程还没yield出来（比如在别的线程里把自己放回队列），放回队尾
+                local->pinned.push(t);
+                tickle_me = true;
+            } else {
+                task = std::move(*t);
+                delete t;
+                --local->pinnedCount;
+                found = true;
+            }
+        }
+    }
+
+    // 2. 定期先看一眼全局队列
+    if (!found && ++local->localTicks % GLOBAL_QUEUE_CHECK_INTERVAL == 0) {
+        found = takeGlobal(local, task, tickle_me);
+    }
+
+    // 3. 本地队列，LIFO
+    while (!found) {
+        ScheduleTask *t = local->tasks.pop();
+        if (!t) {
+            break;
+        }
+        if (t->fiber && t->fiber->getState() == Fiber::RUNNING) {
+            pushOverflow(t);
+        } else {
+            task = std::move(*t);
+            found = true;
+            delete t;
+        }
+    }
+    if (found && !local->tasks.empty()) {
+        // 本地还有剩余，叫醒空闲线程来窃取
+        tickle_me = true;
+    }
+
+    // 4. 全局队列  5. 窃取  6. 后台队列
+    if (!found) {
+        found = takeGlobal(local, task, tickle_me) || stealFromOthers(local, task, tickle_me)
+                || takeBackground(task, tickle_me);
+    }
+
+    if (found) {
+        SYLAR_ASSERT(task.fiber || task.cb);
+        if (m_queueWaitStats) {
+            recordQueueWait(task);
+        }
+        // 先加活跃数再减任务数，保证 stopping() 不会看到两者同时为0的中间状态
+        ++m_activeThreadCount;
+        --m_taskCount;
+    }
+    return found;
+}
+
+bool Scheduler::takeGlobal(LocalQueue *local, ScheduleTask &task, bool &tickle_me)
+{
+    int thread_id = sylar::GetThreadId();
+    bool found = false;
+    // 顺带搬到本地队列的数量，按线程数平分全局队列
+    size_t batch = std::min(m_inject.size() / m_queues.size(), local->tasks.capacity() / 2);
+
+    // 1. 无锁环形队列
+    ScheduleTask *t = nullptr;
+    while ((!found || batch > 0) && m_inject.pop(t)) {
+        if (t->thread != -1) {
+            // 入队时目标线程还没就绪，现在能找到就转投到它的亲和队列
+            int thread = t->thread;
+            LocalQueue *q = findQueue(thread);
+            if (q) {
+                ++q->pinnedCount;
+                q->pinned.push(t);
+                tickle(thread);
+            } else {
+                pushOverflow(t);
+                tickle_me = true;
+            }
+            continue;
+        }
+        if (t->fiber && t->fiber->getState() == Fiber::RUNNING) {
+            pushOverflow(t);
+            continue;
+        }
+        if (!found) {
+            task = std::move(*t);
+            delete t;
+            found = true;
+            continue;
+        }
+        if (!local->tasks.push(t)) {
+            pushOverflow(t);
+            break;
+        }
+        --batch;
+    }
+
+    // 2. 溢出链表
+    if (!found && m_overflowCount > 0) {
+        RWMutexType::WriteLock lock(m_mutex);
+        batch = std::min(m_tasks.size() / m_queues.size(), local->tasks.capacity() / 2);
+        auto it = m_tasks.begin();
+        while (it != m_tasks.end()) {
+            if (it->thread != -1 && it->thread != thread_id) {
+                LocalQueue *q = findQueue(it->thread);
+                if (q) {
+                    ++q->pinnedCount;
+                    q->pinned.push(new ScheduleTask(std::move(*it)));
+                    it = m_tasks.erase(it);
+                    --m_overflowCount;
+                } else {
+                    ++it;
+                }
+                tickle_me = true;
+                continue;
+            }
+
+            if (it->fiber && it->fiber->getState() == Fiber::RUNNING) {
+                ++it;
+                continue;
+            }
+
+            if (!found) {
+                task = std::move(*it);
+                it = m_tasks.erase(it);
+                --m_overflowCount;
+                found = true;
+                continue;
+            }
+
+            if (batch == 0 || it->thread != -1) {
+                break;
+            }
+            t = new ScheduleTask(std::move(*it));
+            if (!local->tasks.push(t)) {
+                *it = std::move(*t);
+                delete t;
+                break;
+            }
+            it = m_tasks.erase(it);
+            --m_overflowCount;
+            --batch;
+        }
+        tickle_me |= it != m_tasks.end();
+    }
+
+    // 当前线程拿完任务后，发现还有剩余，那么tickle一下其他线程
+    tickle_me |= !m_inject.empty() || !local->tasks.empty();
+    return found;
+}
+
+bool Scheduler::stealFromOthers(LocalQueue *local, ScheduleTask &task, bool &tickle_me)
+{
+    size_t n = m_queues.size();
+    if (n <= 1) {
+        return false;
+    }
+    // 每次从不同的位置开始，分散窃取压力
+    size_t start = t_queue_slot + local->localTicks;
+    for (size_t i = 0; i < n; ++i) {
+        LocalQueue *victim = m_queues[(start + i) % n].get();
+        if (victim == local) {
+            continue;
+        }
+        if (victim->pinnedCount > 0 && victim->idling) {
+            // 目标线程还在idle里，tickle 它
+            tickle(victim->threadId);
+        }
+        ScheduleTask *t = victim->tasks.steal();
+        if (!t) {
+            continue;
+        }
+        if (t->fiber && t->fiber->getState() == Fiber::RUNNING) {
+            pushOverflow(t);
+            continue;
+        }
+        task = std::move(*t);
+        delete t;
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::pushBackground(ScheduleTask *task)
+{
+    Spinlock::Lock lock(m_backgroundMutex);
+    bool need_tickle = m_background.empty();
+    m_background.push_back(task);
+    ++m_backgroundCount;
+    return need_tickle;
+}
+
+bool Scheduler::takeBackground(ScheduleTask &task, bool &tickle_me)
+{
+    if (m_backgroundCount == 0) {
+        return false;
+    }
+    Spinlock::Lock lock(m_backgroundMutex);
+    for (size_t n = m_background.size(); n > 0; --n) {
+        ScheduleTask *t = m_background.front();
+        m_background.pop_front();
+        if (t->fiber && t->fiber->getState() == Fiber::RUNNING) {
+            // 协程还没yield出来，放回队尾
+            m_background.push_back(t);
+            tickle_me = true;
+            continue;
+        }
+        --m_backgroundCount;
+        tickle_me |= !m_background.empty();
+        lock.unlock();
+        task = std::move(*t);
+        delete t;
+        return true;
+    }
+    return false;
+}
+
+void Scheduler::recordQueueWait(const ScheduleTask &task)
+{
+    uint64_t now = GetCurrentUS();
+    uint64_t wait = now > task.enqueueUs ? now - task.enqueueUs : 0;
+    size_t bucket = wait ? 64 - __builtin_clzll(wait) : 0;
+    bucket = std::min(bucket, QueueWaitStats::BUCKETS - 1);
+    m_queueWait[task.priority][bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+Scheduler::QueueWaitStats Scheduler::getQueueWaitStats(Priority priority) const
+{
+    QueueWaitStats stats;
+    for (size_t i = 0; i < QueueWaitStats::BUCKETS; ++i) {
+        stats.buckets[i] = m_queueWait[priority][i].load(std::memory_order_relaxed);
+        stats.count += stats.buckets[i];
+    }
+    return stats;
+}
+
+void Scheduler::resetQueueWaitStats()
+{
+    for (auto &lane : m_queueWait) {
+        for (auto &bucket : lane) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void Scheduler::beginSlice(LocalQueue *local, uint64_t fiber_id)
+{
+    if (!m_stallThresholdMs) {
+        return;
+    }
+    local->sliceFiberId.store(fiber_id, std::memory_order_relaxed);
+    local->sliceStartUs.store(GetCurrentUS(), std::memory_order_release);
+}
+
+void Scheduler::endSlice(LocalQueue *local)
+{
+    if (!m_stallThresholdMs) {
+        return;
+    }
+    uint64_t start = local->sliceStartUs.exchange(0, std::memory_order_relaxed);
+    uint64_t now = GetCurrentUS();
+    uint64_t used = now > start ? now - start : 0;
+    size_t bucket = used ? 64 - __builtin_clzll(used) : 0;
+    bucket = std::min(bucket, QueueWaitStats::BUCKETS - 1);
+    m_runSlice[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+Scheduler::RunSliceStats Scheduler::getRunSliceStats() const
+{
+    RunSliceStats stats;
+    for (size_t i = 0; i < RunSliceStats::BUCKETS; ++i) {
+        stats.buckets[i] = m_runSlice[i].load(std::memory_order_relaxed);
+        stats.count += stats.buckets[i];
+    }
+    return stats;
+}
+
+void Scheduler::listRunningSlices(std::vector<RunningSlice> &slices) const
+{
+    for (auto &q : m_queues) {
+        uint64_t start = q->sliceStartUs.load(std::memory_order_acquire);
+        if (!start) {
+            continue;
+        }
+        uint64_t fiber_id = q->sliceFiberId.load(std::memory_order_relaxed);
+        // 读协程id的同时线程可能已经换了协程，开始时间没变才是同一次运行
+        if (q->sliceStartUs.load(std::memory_order_acquire) != start) {
+            continue;
+        }
+        slices.push_back({q->threadId.load(), fiber_id, start});
+    }
+}
+
+uint64_t Scheduler::QueueWaitStats::percentile(double p) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>((uint64_t)(count * p + 0.5), 1);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        sum += buckets[i];
+        if (sum >= target) {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (BUCKETS - 1);
+}
+
+void Scheduler::setAffinity(const std::vector<int> &cpus)
+{
+    RWMutexType::WriteLock lock(m_mutex);
+    m_cpus = cpus;
+    int node = -1;
+    for (size_t i = 0; i < m_cpus.size(); ++i) {
+        int n = CpuTopologyMgr::GetInstance()->getNodeOfCpu(m_cpus[i]);
+        if (i && n != node) {
+            node = -1;
+            break;
+        }
+        node = n;
+    }
+    m_numaNode = node;
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+        int tid = m_queues[i]->threadId;
+        int cpu = affinityCpu(i);
+        if (tid != -1 && tid != m_rootThread && cpu >= 0) {
+            CpuTopology::SetThreadAffinity(tid, {cpu});
+        }
+    }
+}
+
+std::vector<int> Scheduler::getAffinity()
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_cpus;
+}
+
+int Scheduler::affinityCpu(size_t slot) const
+{
+    return m_cpus.empty() ? -1 : m_cpus[slot % m_cpus.size()];
+}
+
 std::ostream &Scheduler::dump(std::ostream &os)
 {
     os << "[Scheduler name=" << m_name << " size=" << m_threadCount
        << " active_count=" << m_activeThreadCount << " idle_count=" << m_idleThreadCount
-       << " stopping=" << m_stopping << " ]" << std::endl
+       << " task_count=" << m_taskCount << " background_count=" << m_backgroundCount
+       << " stopping=" << m_stopping << " numa_node=" << m_numaNode << " ]" << std::endl
        << "    ";
     for (size_t i = 0; i < m_threadIds.size(); ++i) {
         if (i) {
@@ -328,6 +904,23 @@ std::ostream &Scheduler::dump(std::ostream &os)
         }
         os << m_threadIds[i];
     }
+    if (m_queueWaitStats) {
+        static const char *s_names[PRIORITY_COUNT] = {"interactive", "background"};
+        for (int i = 0; i < PRIORITY_COUNT; ++i) {
+            QueueWaitStats stats = getQueueWaitStats((Priority)i);
+            os << std::endl
+               << "    " << s_names[i] << " queue_wait count=" << stats.count
+               << " p50<" << stats.percentile(0.5) << "us p99<" << stats.percentile(0.99)
+               << "us p999<" << stats.percentile(0.999) << "us";
+        }
+    }
+    if (m_stallThresholdMs) {
+        RunSliceStats stats = getRunSliceStats();
+        os << std::endl
+           << "    run_slice count=" << stats.count << " p50<" << stats.percentile(0.5)
+           << "us p99<" << stats.percentile(0.99) << "us p999<" << stats.percentile(0.999)
+           << "us";
+    }
     return os;
 }
 
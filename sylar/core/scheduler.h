@@ -8,15 +8,20 @@
 #ifndef __SYLAR_SCHEDULER_H__
 #define __SYLAR_SCHEDULER_H__
 
+#include <deque>
 #include <functional>
 #include <list>
 #include <memory>
+#include <source_location>
 #include <string>
 #include <iostream>
 
 #include "sylar/core/fiber.h"
+#include "sylar/core/common/task_function.h"
 #include "sylar/core/log/log.h"
 #include "sylar/core/thread.h"
+#include "sylar/core/ds/work_steal_queue.h"
+#include "sylar/core/common/lock_free_queue.h"
 
 namespace sylar
 {
@@ -25,6 +30,16 @@ namespace sylar
  * @brief 协程调度器
  * @details 封装的是N-M的协程调度器
  *          内部有一个线程池,支持协程在线程池里面切换
+ *
+ *          任务队列分三层：
+ *          1. 每个调度线程一个本地队列（Chase-Lev），owner LIFO 取，空闲线程 FIFO 窃取
+ *          2. 每个调度线程一个亲和队列（无锁MPSC），存放 schedule(fc, thread) 指定线程的任务
+ *          3. 全局队列，接收外部线程提交的任务和本地队列的溢出。
+ *             先进无锁环形队列，满了才进加锁的溢出链表，外部线程提交时互不阻塞
+ *
+ *          任务分两个优先级：上面三层都是交互任务；后台任务(没有指定线程的)单独一个加锁队列，
+ *          交互任务都取完了才取，另外每 scheduler.background_interval 次取任务给后台队列一次机会，
+ *          避免后台任务被饿死
  */
 class Scheduler
 {
@@ -33,6 +48,55 @@ public:
     // typedef MutexRWMutexType;
     typedef RWSpinlock RWMutexType;
 
+    /**
+     * @brief 任务优先级
+     */
+    enum Priority {
+        /// 交互任务：请求处理、IO 就绪唤醒的协程，默认优先级
+        INTERACTIVE = 0,
+        /// 后台任务：批处理、定时刷新、连接检查，交互任务空闲时才执行(有最低配额)
+        BACKGROUND = 1,
+        PRIORITY_COUNT
+    };
+
+    /**
+     * @brief 任务排队等待时间统计，scheduler.queue_wait_stats 打开时才记录
+     * @details 从入队到被调度线程取出的时间，按 2 的幂分桶：
+     *          buckets[0] 不到 1 微秒，buckets[i] 落在 [2^(i-1), 2^i) 微秒
+     */
+    struct QueueWaitStats {
+        static const size_t BUCKETS = 32;
+
+        /// 任务数
+        uint64_t count = 0;
+        /// 各个桶的任务数
+        uint64_t buckets[BUCKETS] = {};
+
+        /**
+         * @brief 分位数所在桶的上界(微秒)
+         * @param[in] p 0~1，比如 0.99
+         */
+        uint64_t percentile(double p) const;
+    };
+
+    /**
+     * @brief 协程单次运行时长(一次 resume 到返回)的统计，分桶方式同 QueueWaitStats，
+     *        scheduler.stall_threshold_ms 大于 0 时才记录
+     */
+    typedef QueueWaitStats RunSliceStats;
+
+    /**
+     * @brief 调度线程上正在运行的协程，给 FiberWatchdog 检查卡住的协程
+     */
+    struct RunningSlice {
+        /// 调度线程id
+        int thread;
+        /// 协程id
+        uint64_t fiberId;
+        /// 开始运行的时间(微秒)
+        uint64_t startUs;
+    };
+
     /**
      * @brief 创建调度器
      * @param[in] threads 线程数
@@ -68,28 +132,27 @@ public:
      * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
      * @param[] fc 协程对象或指针
      * @param[] thread 指定运行该任务的线程号，-1表示任意线程
+     * @param[] priority 优先级，指定了线程的任务进目标线程的亲和队列，不区分优先级
+     * @param[] stack_class 回调任务运行在多大的栈上，协程任务忽略
+     * @param[] site 调用位置，回调任务的栈用量按它汇总
      *
      *
      * 设计：
      * 使用模板函数，传入 Fiber或 仿函数
-     * 设置锁，在锁内调用无锁的 模板函数scheduleNoLock
+     * 由 enqueue 根据调用线程、目标线程和优先级选择队列，各队列自己负责同步
      */
     template <class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1)
+    void schedule(FiberOrCb fc, int thread = -1, Priority priority = INTERACTIVE,
+                  Fiber::StackClass stack_class = Fiber::STACK_DEFAULT,
+                  std::source_location site = std::source_location::current())
     {
         if (stopping()) { // 如果关闭，那么不能添加任务了。（子线程也能添加）
             std::cout << __FILE__ << ":" << __LINE__
                       << " Attempt to add task to a stopping scheduler, task ignored." << std::endl;
             return;
         }
-        bool need_tickle = false;
-        {
-            RWMutexType::WriteLock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
-
-        if (need_tickle) {
-            tickle(); // 唤醒idle协程
+        if (scheduleImpl(std::move(fc), thread, priority, stack_class, site)) {
+            tickle(thread); // 唤醒idle协程，指定了线程的优先唤醒目标线程
         }
     }
 
@@ -97,17 +160,20 @@ public:
      * @brief 批量调度协程
      * @param[in] begin 协程数组的开始
      * @param[in] end 协程数组的结束
+     * @param[in] stack_class 回调任务运行在多大的栈上
+     * @param[in] site 调用位置
      */
     template <class InputIterator>
-    void schedule(InputIterator begin, InputIterator end)
+    void schedule(InputIterator begin, InputIterator end,
+                  Fiber::StackClass stack_class = Fiber::STACK_DEFAULT,
+                  std::source_location site = std::source_location::current())
     {
         bool need_tickle = false;
-        {
-            RWMutexType::WriteLock lock(m_mutex);
-            while (begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin;
-            }
+        while (begin != end) {
+            int thread = -1;
+            need_tickle =
+                scheduleImpl(&*begin, thread, INTERACTIVE, stack_class, site) || need_tickle;
+            ++begin;
         }
         if (need_tickle) {
             tickle();
@@ -128,7 +194,7 @@ public:
 
     size_t threadCount() const { return m_threadCount; }
 
-    size_t getTasksSize() const { return m_tasks.size(); }
+    size_t getTasksSize() const { return m_taskCount; }
 
     size_t getIdleThreadSize() const { return m_idleThreadCount; }
 
@@ -136,11 +202,56 @@ public:
 
     std::ostream &dump(std::ostream &os);
 
+    /**
+     * @brief 某个优先级的排队等待时间统计
+     */
+    QueueWaitStats getQueueWaitStats(Priority priority) const;
+
+    /**
+     * @brief 清空排队等待时间统计
+     */
+    void resetQueueWaitStats();
+
+    /**
+     * @brief 协程单次运行时长统计
+     */
+    RunSliceStats getRunSliceStats() const;
+
+    /**
+     * @brief 卡住报警的阈值(毫秒)，构造时从 scheduler.stall_threshold_ms 读取，0 表示不检查
+     */
+    uint32_t getStallThreshold() const { return m_stallThresholdMs; }
+
+    /**
+     * @brief 列出各调度线程上正在运行的协程，没有在跑协程的线程不列出
+     */
+    void listRunningSlices(std::vector<RunningSlice> &slices) const;
+
+    /**
+     * @brief 把调度线程绑定到 CPU 上
+     * @details 每个调度线程绑一个 CPU，按线程槽位轮流取 cpus 里的 CPU(线程比 CPU 多时会有多个线程共用)；
+     *          已经在运行的线程立刻生效，之后启动的线程进入 run() 时生效。use_caller 的主线程不绑定。
+     *          构造时按调度器名称从 scheduler.cpu_affinity 读取一次。
+     * @param[in] cpus CPU 列表，空表示不绑定(已经绑定的线程保持原样)
+     */
+    void setAffinity(const std::vector<int> &cpus);
+
+    /**
+     * @brief 绑定的 CPU 列表
+     */
+    std::vector<int> getAffinity();
+
+    /**
+     * @brief 绑定的 CPU 都在同一个 NUMA 节点上时返回这个节点，否则返回 -1
+     */
+    int getNumaNode() const { return m_numaNode; }
+
 protected:
     /**
      * @brief 通知协程调度器有任务了
+     * @param[in] thread 任务的目标线程号，-1 表示任意线程
      */
-    virtual void tickle();
+    virtual void tickle(int thread = -1);
 
     /**
      * @brief 协程调度函数
@@ -162,60 +273,251 @@ protected:
      */
     void setThis();
 
+    /**
+     * @brief 调度线程槽位个数(包含 use_caller 的主线程)，每个槽位对应一个 LocalQueue
+     */
+    size_t slotCount() const { return m_queues.size(); }
+
+    /**
+     * @brief 当前线程的槽位，不是本调度器的调度线程返回 -1
+     */
+    int currentSlot() const;
+
+    /**
+     * @brief 线程id对应的槽位，线程还没进入 run() 或者不是调度线程返回 -1
+     */
+    int findSlot(int thread) const;
+
+    /**
+     * @brief 槽位 slot 的线程是否还有任务可做，idle 挂起之前检查
+     * @details 亲和队列、全局队列、溢出链表和其他线程可以窃取的本地队列
+     */
+    bool hasPendingTasks(int slot) const;
+
 private:
     /**
-     * @brief 添加调度任务，无锁
+     * @brief 构造调度任务并入队
      * @tparam FiberOrCb 调度任务类型，可以是协程对象或函数指针
      * @param[] fc 协程对象或指针
-     * @param[] thread 指定运行该任务的线程号，-1表示任意线程
+     * @param[in,out] thread 指定运行该任务的线程号，-1表示任意线程；
+     *                 返回实际的目标线程(共享栈协程会绑定到运行过的线程)
+     * @param[] priority 优先级
+     * @param[] stack_class 栈大小档位
+     * @param[] site 调用位置
+     * @return 是否需要 tickle
      */
     template <class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread)
+    bool scheduleImpl(FiberOrCb fc, int &thread, Priority priority, Fiber::StackClass stack_class,
+                      const std::source_location &site)
     {
-        bool need_tickle = m_tasks.empty();
-        ScheduleTask task(fc, thread);
-        if (task.fiber || task.cb) {
-            m_tasks.push_back(task);
+        ScheduleTask task(std::move(fc), thread);
+        if (!task.fiber && !task.cb) {
+            return false;
         }
-        return need_tickle;
+        task.priority = priority;
+        task.stackClass = stack_class;
+        task.site = site;
+        thread = task.thread;
+        return enqueue(task);
     }
 
 private:
     /**
      * @brief 调度任务，协程/函数二选一，可指定在哪个线程上调度
+     * @details 只能移动，出队时整个搬走，回调不会被拷贝
      */
-    struct ScheduleTask {
+    struct ScheduleTask : public ds::MpscNode {
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        TaskFunction cb;
         int thread;
+        /// 优先级
+        Priority priority = INTERACTIVE;
+        /// 入队时间(微秒)，打开排队等待统计时才记录
+        uint64_t enqueueUs = 0;
+        /// 回调任务的栈大小档位
+        Fiber::StackClass stackClass = Fiber::STACK_DEFAULT;
+        /// 回调任务的调用位置
+        std::source_location site;
+
+        ScheduleTask(Fiber::ptr f, int thr) : fiber(std::move(f)), thread(BindThread(fiber, thr)) {}
+
+        ScheduleTask(Fiber::ptr *f, int thr) : thread(thr)
+        {
+            fiber.swap(*f);
+            thread = BindThread(fiber, thr);
+        }
 
-        ScheduleTask(Fiber::ptr f, int thr) : fiber(f), thread(thr) {}
-
-        ScheduleTask(Fiber::ptr *f, int thr) : thread(thr) { fiber.swap(*f); }
-
-        ScheduleTask(std::function<void()> f, int thr) : cb(f), thread(thr) {}
+        ScheduleTask(TaskFunction f, int thr) : cb(std::move(f)), thread(thr) {}
 
-        ScheduleTask(std::function<void()> *f, int thr) : thread(thr) { cb.swap(*f); }
+        /**
+         * @brief 批量调度时传入的是回调的地址(TaskFunction、std::function 等)，直接搬走
+         */
+        template <class F, class = std::enable_if_t<!std::is_function<F>::value> >
+        ScheduleTask(F *f, int thr) : cb(std::move(*f)), thread(thr)
+        {
+        }
 
         ScheduleTask() : thread(-1) {}
 
+        /**
+         * @brief 任务节点从线程本地的空闲链表分配，在哪个线程释放就回收到哪个线程
+         */
+        static void *operator new(size_t size);
+        static void operator delete(void *p) noexcept;
+
         void reset()
         {
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            priority = INTERACTIVE;
+            enqueueUs = 0;
+            stackClass = Fiber::STACK_DEFAULT;
+        }
+
+        /**
+         * @brief 共享栈协程运行过之后只能回到绑定的线程
+         */
+        static int BindThread(const Fiber::ptr &f, int thr)
+        {
+            int bind = f ? f->getContext().getThread() : -1;
+            return bind != -1 ? bind : thr;
         }
     };
 
+    /**
+     * @brief 调度线程独占的任务队列
+     * @details tasks 只有 owner 线程 push/pop，其他线程只能 steal；
+     *          pinned 多生产者，只有 owner 消费
+     */
+    struct LocalQueue {
+        LocalQueue(size_t capacity) : tasks(capacity) {}
+
+        /// 绑定的线程id，线程进入 run() 之前为 -1
+        std::atomic<int> threadId = {-1};
+        /// 本地任务队列
+        ds::WorkStealQueue<ScheduleTask *> tasks;
+        /// 亲和队列
+        ds::MpscQueue<ScheduleTask> pinned;
+        /// 亲和队列任务数，入队前加、出队后减，用于判空
+        std::atomic<size_t> pinnedCount = {0};
+        /// 线程是否处于idle
+        std::atomic<bool> idling = {false};
+        /// 连续从本地取任务的次数，周期性让全局队列插队，避免其饿死
+        uint32_t localTicks = 0;
+        /// 后台队列非空时取任务的次数，周期性让后台任务插队
+        uint32_t backgroundTicks = 0;
+        /// 正在运行的协程开始运行的时间(微秒)，0 表示没有在跑协程
+        std::atomic<uint64_t> sliceStartUs = {0};
+        /// 正在运行的协程id
+        std::atomic<uint64_t> sliceFiberId = {0};
+    };
+
+    /**
+     * @brief 任务入队
+     * @details 1. 指定了线程：进入目标线程的亲和队列，目标线程还没进入 run() 则进全局队列
+     *          2. 协程把自己重新放回调度（yield 语义）：进全局队列，避免 LIFO 下反复抢占
+     *          3. 当前线程是本调度器的调度线程：压入本地队列，满了溢出到全局队列
+     *          4. 外部线程：进全局队列
+     * @return 是否需要 tickle
+     */
+    bool enqueue(ScheduleTask &task);
+
+    /**
+     * @brief 放入全局溢出链表，接管 task 的所有权
+     */
+    void pushOverflow(ScheduleTask *task);
+
+    /**
+     * @brief 按线程id查找 LocalQueue，找不到返回 nullptr
+     */
+    LocalQueue *findQueue(int thread);
+
+    /**
+     * @brief 调度线程取下一个任务：亲和队列 -> 本地队列 -> 全局队列 -> 窃取
+     * @param[in] local 当前线程的 LocalQueue
+     * @param[out] task 取到的任务
+     * @param[out] tickle_me 是否需要通知其他线程
+     * @return 是否取到任务
+     */
+    bool dequeue(LocalQueue *local, ScheduleTask &task, bool &tickle_me);
+
+    /**
+     * @brief 从全局队列取任务，顺带搬一批到本地队列，减少全局锁竞争
+     */
+    bool takeGlobal(LocalQueue *local, ScheduleTask &task, bool &tickle_me);
+
+    /**
+     * @brief 从其他线程的本地队列窃取一个任务
+     */
+    bool stealFromOthers(LocalQueue *local, ScheduleTask &task, bool &tickle_me);
+
+    /**
+     * @brief 放入后台队列，接管 task 的所有权
+     * @return 是否需要 tickle
+     */
+    bool pushBackground(ScheduleTask *task);
+
+    /**
+     * @brief 从后台队列取一个任务
+     */
+    bool takeBackground(ScheduleTask &task, bool &tickle_me);
+
+    /**
+     * @brief 记录任务的排队等待时间
+     */
+    void recordQueueWait(const ScheduleTask &task);
+
+    /**
+     * @brief 槽位 slot 的线程应该绑定的 CPU，没有配置返回 -1，调用时持有 m_mutex
+     */
+    int affinityCpu(size_t slot) const;
+
+    /**
+     * @brief 切到任务协程之前公布开始时间，给 FiberWatchdog 看
+     */
+    void beginSlice(LocalQueue *local, uint64_t fiber_id);
+
+    /**
+     * @brief 任务协程返回之后清掉开始时间，记录这次运行的时长
+     */
+    void endSlice(LocalQueue *local);
+
 private:
     /// 协程调度器名称
     std::string m_name;
-    /// 互斥锁
+    /// 互斥锁，保护全局溢出链表和线程池
     RWMutexType m_mutex;
     /// 线程池
     std::vector<Thread::ptr> m_threads;
-    /// 任务队列
+    /// 全局无锁队列
+    ds::MpmcRing<ScheduleTask *> m_inject;
+    /// 全局溢出链表，m_inject 满了或者任务暂时不能执行时放这里
     std::list<ScheduleTask> m_tasks;
+    /// m_tasks 的大小，用于无锁判空
+    std::atomic<size_t> m_overflowCount = {0};
+    /// 保护后台队列
+    Spinlock m_backgroundMutex;
+    /// 后台队列，没有指定线程的后台任务
+    std::deque<ScheduleTask *> m_background;
+    /// m_background 的大小，用于无锁判空
+    std::atomic<size_t> m_backgroundCount = {0};
+    /// 后台队列非空时，每取这么多次任务至少取一次后台任务
+    uint32_t m_backgroundInterval = 8;
+    /// 是否记录排队等待时间
+    bool m_queueWaitStats = false;
+    /// 每个优先级的排队等待时间直方图
+    std::atomic<uint64_t> m_queueWait[PRIORITY_COUNT][QueueWaitStats::BUCKETS] = {};
+    /// 卡住报警的阈值(毫秒)，大于 0 时记录每次运行的时长并交给 FiberWatchdog 检查
+    uint32_t m_stallThresholdMs = 0;
+    /// 协程单次运行时长直方图
+    std::atomic<uint64_t> m_runSlice[QueueWaitStats::BUCKETS] = {};
+    /// 每个调度线程的本地队列，use_caller 时主线程占 0 号
+    std::vector<std::unique_ptr<LocalQueue> > m_queues;
+    /// 下一个分配给调度线程的 m_queues 下标
+    std::atomic<size_t> m_nextSlot = {0};
+    /// 所有队列中的任务总数
+    std::atomic<size_t> m_taskCount = {0};
     /// 线程池的线程ID数组
     std::vector<int> m_threadIds;
     /// 工作线程数量，不包含use_caller的主线程
@@ -232,6 +534,11 @@ private:
     /// use_caller为true时，调度器所在线程的id
     int m_rootThread = 0;
 
+    /// 绑定的 CPU 列表，m_mutex 保护
+    std::vector<int> m_cpus;
+    /// m_cpus 所在的 NUMA 节点，不在同一个节点上为 -1
+    std::atomic<int> m_numaNode = {-1};
+
     /// 是否正在停止
     bool m_stopping = false;
 };
@@ -260,4 +567,4 @@ private:
 
 } // end namespace sylar
 
-#endif
\ No newline at end of file
+#endif
@@ -1,9 +1,16 @@
 #include "sylar/core/timermanager.h"
+
+#include <set>
+
+#include "sylar/core/config/config.h"
 #include "sylar/core/util/util.h"
 
 namespace sylar
 {
 
+static ConfigVar<bool>::ptr g_timer_wheel = Config::Lookup<bool>(
+    "timer.wheel", true, "use hierarchical timing wheel instead of std::set for timers");
+
 bool Timer::Comparator::operator()(const Timer::ptr &lhs, const Timer::ptr &rhs) const
 {
     if (!lhs && !rhs) {
@@ -29,10 +36,150 @@ bool Timer::Comparator::operator()(const Timer::ptr &lhs, const Timer::ptr &rhs)
     return lhs.get() < rhs.get();
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager)
-    : m_ms(ms), m_cb(cb), m_recurring(recurring), m_manager(manager)
+/**
+ * @brief 定时器分片，所有接口都要在持有 mutex 时调用
+ */
+class TimerShard
+{
+public:
+    virtual ~TimerShard() {}
+
+    /**
+     * @brief 插入定时器，按 m_next 到期
+     */
+    virtual void insert(const Timer::ptr &timer) = 0;
+
+    /**
+     * @brief 移除定时器，不在分片里返回 false
+     */
+    virtual bool erase(Timer *timer) = 0;
+
+    /**
+     * @brief 最近的到期时间(绝对毫秒)，可以是偏早的估计，没有定时器返回 ~0ull
+     */
+    virtual uint64_t next() = 0;
+
+    /**
+     * @brief 取出到期时间 <= now_ms 的定时器，all 为 true 时取出全部
+     */
+    virtual void expire(uint64_t now_ms, bool all, std::vector<Timer::ptr> &expired) = 0;
+
+    /// 定时器个数，不加锁读取，只用来跳过空分片
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+public:
+    TimerManager::MutexType mutex;
+
+protected:
+    std::atomic<size_t> m_size{0};
+};
+
+/**
+ * @brief std::set 实现的分片
+ */
+class TimerSetShard : public TimerShard
+{
+public:
+    void insert(const Timer::ptr &timer) override
+    {
+        m_timers.insert(timer);
+        m_size.store(m_timers.size(), std::memory_order_relaxed);
+    }
+
+    bool erase(Timer *timer) override
+    {
+        auto it = m_timers.find(timer->shared_from_this());
+        if (it == m_timers.end()) {
+            return false;
+        }
+        m_timers.erase(it);
+        m_size.store(m_timers.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    uint64_t next() override { return m_timers.empty() ? ~0ull : (*m_timers.begin())->m_next; }
+
+    void expire(uint64_t now_ms, bool all, std::vector<Timer::ptr> &expired) override
+    {
+        // 如果系统时间被往前调整了 1个小时，就把全部定时器的事件 返回。
+        // 这个就比较粗暴了~
+        auto it = m_timers.begin();
+        while (it != m_timers.end() && (all || (*it)->m_next <= now_ms)) {
+            ++it;
+        }
+        expired.insert(expired.end(), m_timers.begin(), it);
+        m_timers.erase(m_timers.begin(), it);
+        m_size.store(m_timers.size(), std::memory_order_relaxed);
+    }
+
+private:
+    std::set<Timer::ptr, Timer::Comparator> m_timers;
+};
+
+/**
+ * @brief 时间轮实现的分片，见 ds::TimingWheel
+ */
+class TimerWheelShard : public TimerShard
+{
+public:
+    TimerWheelShard() : m_wheel(GetCurrentMS()) {}
+
+    ~TimerWheelShard()
+    {
+        // 打破 m_wheelSelf 的循环引用
+        m_wheel.clear([](ds::TimingWheelNode *node) { Cast(node)->m_wheelSelf.reset(); });
+    }
+
+    void insert(const Timer::ptr &timer) override
+    {
+        m_wheel.insert(timer.get(), timer->m_next);
+        timer->m_wheelSelf = timer;
+        m_size.store(m_wheel.size(), std::memory_order_relaxed);
+    }
+
+    bool erase(Timer *timer) override
+    {
+        if (!m_wheel.erase(timer)) {
+            return false;
+        }
+        m_size.store(m_wheel.size(), std::memory_order_relaxed);
+        // 调用方还持有 shared_ptr，这里释放自引用是安全的
+        timer->m_wheelSelf.reset();
+        return true;
+    }
+
+    uint64_t next() override { return m_wheel.next(); }
+
+    void expire(uint64_t now_ms, bool all, std::vector<Timer::ptr> &expired) override
+    {
+        auto take = [&expired](ds::TimingWheelNode *node) {
+            expired.push_back(std::move(Cast(node)->m_wheelSelf));
+        };
+        if (all) {
+            m_wheel.clear(take);
+        } else {
+            m_wheel.expire(now_ms, take);
+        }
+        m_size.store(m_wheel.size(), std::memory_order_relaxed);
+    }
+
+private:
+    static Timer *Cast(ds::TimingWheelNode *node) { return static_cast<Timer *>(node); }
+
+private:
+    ds::TimingWheel m_wheel;
+};
+
+Timer::Timer(uint64_t ms, TaskFunction cb, bool recurring, TimerManager *manager)
+    : m_ms(ms), m_recurring(recurring), m_manager(manager)
 {
     m_next = GetCurrentMS() + m_ms; // 执行的 绝对时间
+    if (recurring && cb) {
+        m_recurringCb = std::make_shared<TaskFunction>(std::move(cb));
+        m_cb = [cb = m_recurringCb]() { (*cb)(); };
+    } else {
+        m_cb = std::move(cb);
+    }
 }
 
 Timer::Timer(uint64_t next) : m_next(next)
@@ -42,11 +189,11 @@ Timer::Timer(uint64_t next) : m_next(next)
 // 取消定时器
 bool Timer::cancel()
 {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+    TimerManager::MutexType::Lock lock(m_shard->mutex);
     if (m_cb) {
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+        m_recurringCb.reset();
+        m_shard->erase(this);
         return true;
     }
     return false;
@@ -55,19 +202,17 @@ bool Timer::cancel()
 // 刷新设置定时器的执行时间
 bool Timer::refresh()
 {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+    TimerManager::MutexType::Lock lock(m_shard->mutex);
     if (!m_cb) {
         return false;
     }
 
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    if (!m_shard->erase(this)) {
         return false;
     }
 
-    m_manager->m_timers.erase(it);
     m_next = sylar::GetCurrentMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    m_shard->insert(shared_from_this());
     return true;
 }
 
@@ -77,16 +222,14 @@ bool Timer::reset(uint64_t ms, bool from_now)
     if (m_ms == ms && !from_now) {
         return true;
     }
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+    TimerManager::MutexType::Lock lock(m_shard->mutex);
     // 如果 执行的周期不变，也没从现在开始 from_now false。那就退出。
     if (!m_cb) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    if (!m_shard->erase(this)) {
         return false;
     }
-    m_manager->m_timers.erase(it);
 
     uint64_t start = 0;
     if (from_now) {
@@ -101,19 +244,32 @@ bool Timer::reset(uint64_t ms, bool from_now)
     return true;
 }
 
-TimerManager::TimerManager()
+TimerManager::TimerManager(size_t shards)
 {
     m_previouseTime = GetCurrentMS();
+    bool wheel = g_timer_wheel->getValue();
+    for (size_t i = 0; i < std::max(shards, (size_t)1); ++i) {
+        if (wheel) {
+            m_shards.emplace_back(new TimerWheelShard);
+        } else {
+            m_shards.emplace_back(new TimerSetShard);
+        }
+    }
 }
 
 TimerManager::~TimerManager()
 {
 }
 
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring)
+/// 线程第一次添加定时器时分配的序号，用来挑选分片，相邻创建的线程落在不同的分片上
+static std::atomic<size_t> s_shard_seq{0};
+static thread_local size_t t_shard_seq = s_shard_seq++;
+
+Timer::ptr TimerManager::addTimer(uint64_t ms, TaskFunction cb, bool recurring)
 {
-    Timer::ptr timer = sylar::protected_make_shared<Timer>(ms, cb, recurring, this);
-    RWMutexType::WriteLock lock(m_mutex);
+    Timer::ptr timer = sylar::protected_make_shared<Timer>(ms, std::move(cb), recurring, this);
+    timer->m_shard = m_shards[t_shard_seq % m_shards.size()].get();
+    MutexType::Lock lock(timer->m_shard->mutex);
     addTimer(timer, lock);
     return timer;
 }
@@ -126,111 +282,102 @@ Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool re
 // 这种模式常用于需要对象关联生命周期的定时任务，例如：
 // 网络连接超时检测（当连接已关闭时无需触发超时回调）
 // 资源释放校验（当资源持有者已销毁时取消清理操作）
-static void OnTimer(std::weak_ptr<void> weak_ptr, std::function<void()> cb)
-{
-    std::shared_ptr<void> it = weak_ptr.lock();
-    if (it) {
-        cb();
-    }
-}
-
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb,
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, TaskFunction cb,
                                            std::weak_ptr<void> weak_cond, bool recurring)
 {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+    return addTimer(
+        ms,
+        [weak_cond, cb = std::move(cb)]() {
+            std::shared_ptr<void> it = weak_cond.lock();
+            if (it) {
+                cb();
+            }
+        },
+        recurring);
 }
 
 uint64_t TimerManager::getNextTimer()
 {
-    RWMutexType::ReadLock lock(m_mutex);
     // 获取下一次最近执行事件的 相对事件，重置 m_tickle
     m_tickled = false;
-    if (m_timers.empty()) {
+    uint64_t next = ~0ull;
+    for (auto &shard : m_shards) {
+        if (!shard->size()) {
+            continue;
+        }
+        MutexType::Lock lock(shard->mutex);
+        next = std::min(next, shard->next());
+    }
+    m_nextWake = next;
+    if (next == ~0ull) {
         return ~0ull;
     }
 
-    const Timer::ptr &next = *m_timers.begin();
     uint64_t now_ms = GetCurrentMS();
-    if (now_ms >= next->m_next) {
+    if (now_ms >= next) {
         return 0;
     } else {
-        return next->m_next - now_ms;
+        return next - now_ms;
     }
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()> > &cbs)
+void TimerManager::listExpiredCb(std::vector<TaskFunction> &cbs)
 {
-    uint64_t now_ms = GetCurrentMS();
-    std::vector<Timer::ptr> expired;
-    {
-        RWMutexType::ReadLock lock(m_mutex);
-        if (m_timers.empty()) {
-            return;
-        }
-    }
-
-    RWMutexType::WriteLock lock(m_mutex);
-    if (m_timers.empty()) {
+    if (!hasTimer()) {
         return;
     }
-
+    uint64_t now_ms = GetCurrentMS();
     bool rollover = detectClockRollover(now_ms);
-    if (!rollover && ((*m_timers.begin())->m_next > now_ms)) {
-        return;
-    }
-
-    Timer::ptr now_timer = sylar::protected_make_shared<Timer>(now_ms);
-    // 获取到第一个 发生时间 < 现在。即需要执行的事件
-    // 如果系统时间被往前调整了 1个小时，就把全部定时器的事件 返回。
-    // 这个就比较粗暴了~
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while (it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
-
-    for (auto &timer : expired) {
-        cbs.push_back(timer->m_cb);
-        // 如果事件需要重复执行，再次写回 m_timers
-        if (timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
-        } else {
-            timer->m_cb = nullptr;
+    std::vector<Timer::ptr> expired;
+    for (auto &shard : m_shards) {
+        if (!shard->size()) {
+            continue;
+        }
+        MutexType::Lock lock(shard->mutex);
+        expired.clear();
+        shard->expire(now_ms, rollover, expired);
+        for (auto &timer : expired) {
+            // 如果事件需要重复执行，再次插回分片
+            if (timer->m_recurring) {
+                cbs.push_back([cb = timer->m_recurringCb]() { (*cb)(); });
+                timer->m_next = now_ms + timer->m_ms;
+                shard->insert(timer);
+            } else {
+                cbs.push_back(std::move(timer->m_cb));
+                timer->m_cb = nullptr;
+            }
         }
     }
 }
 
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock &lock)
+void TimerManager::addTimer(Timer::ptr val, MutexType::Lock &lock)
 {
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
-    if (at_front) {
-        m_tickled = true;
-    }
+    val->m_shard->insert(val);
     lock.unlock();
 
-    if (at_front) {
+    // 比 epoll_wait 等待的时间更早到期，需要唤醒
+    if (val->m_next < m_nextWake && !m_tickled.exchange(true)) {
         onTimerInsertedAtFront();
     }
 }
 
 bool TimerManager::hasTimer()
 {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    for (auto &shard : m_shards) {
+        if (shard->size()) {
+            return true;
+        }
+    }
+    return false;
 }
 
 bool TimerManager::detectClockRollover(uint64_t now_ms)
 {
     bool rollover = false;
-    if (now_ms < m_previouseTime && now_ms < (m_previouseTime - 60 * 60 * 1000)) {
+    uint64_t prev = m_previouseTime.exchange(now_ms);
+    if (now_ms < prev && now_ms < (prev - 60 * 60 * 1000)) {
         rollover = true;
     }
-    m_previouseTime = now_ms;
     return rollover;
 }
 
@@ -1,22 +1,28 @@
 #ifndef __SYLAR_TIMEMANAGER_H__
 #define __SYLAR_TIMEMANAGER_H__
 
+#include <atomic>
+#include <functional>
 #include <memory>
-#include <set>
 #include <vector>
 
 #include "mutex.h"
+#include "sylar/core/common/task_function.h"
+#include "sylar/core/ds/timing_wheel.h"
 
 namespace sylar
 {
 
 class TimerManager;
+class TimerShard;
 /**
  * 定时器
  */
-class Timer : public std::enable_shared_from_this<Timer>
+class Timer : public std::enable_shared_from_this<Timer>, private ds::TimingWheelNode
 {
     friend class TimerManager;
+    friend class TimerSetShard;
+    friend class TimerWheelShard;
 
 public:
     typedef std::shared_ptr<Timer> ptr;
@@ -39,7 +45,7 @@ protected:
      * @param[in] recurring 是否循环
      * @param[in] manager 定时器管理器
      */
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager);
+    Timer(uint64_t ms, TaskFunction cb, bool recurring, TimerManager *manager);
 
     /**
      * @brief 构造函数
@@ -52,12 +58,18 @@ private:
     uint64_t m_ms = 0;
     /// 精确的执行时间
     uint64_t m_next = 0;
-    /// 回调函数
-    std::function<void()> m_cb;
+    /// 回调函数，取消或者一次性定时器到期之后为空
+    TaskFunction m_cb;
+    /// 循环定时器的回调。TaskFunction 不能拷贝，每次到期交出去的是共享同一个回调的包装
+    std::shared_ptr<TaskFunction> m_recurringCb;
     /// 是否循环定时器
     bool m_recurring = false;
     /// 定时器管理器
     TimerManager *m_manager = nullptr;
+    /// 所属分片，创建时确定，之后不变
+    TimerShard *m_shard = nullptr;
+    /// 挂在时间轮上时持有自己，保证到期前不被释放
+    Timer::ptr m_wheelSelf;
 
 private:
     /**
@@ -68,21 +80,33 @@ private:
     };
 };
 
+/**
+ * @brief 定时器管理器
+ * @details 定时器按线程分片，每个分片一把自旋锁，添加定时器时落在当前线程对应的分片上，
+ *          取消/刷新只锁定时器所在的分片。
+ *          分片的实现由 timer.wheel 决定：
+ *          1. true（默认）：分层时间轮，1ms 精度，插入/取消 O(1)
+ *          2. false：std::set，按到期时间排序，插入/取消 O(log n)
+ */
 class TimerManager
 {
     friend class Timer;
 
 public:
-    typedef RWSpinlock RWMutexType;
+    typedef Spinlock MutexType;
 
-    TimerManager();
+    /**
+     * @brief 构造函数
+     * @param[in] shards 分片数，一般等于 IOManager 的线程数
+     */
+    TimerManager(size_t shards = 1);
 
     virtual ~TimerManager();
 
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    Timer::ptr addTimer(uint64_t ms, TaskFunction cb, bool recurring = false);
 
     // 附带条件的添加定时器
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb,
+    Timer::ptr addConditionTimer(uint64_t ms, TaskFunction cb,
                                  std::weak_ptr<void> weak_cond, bool recurring = false);
 
     // 获取下一个最近的定时器
@@ -92,7 +116,7 @@ public:
      * @brief 获取需要执行的定时器的回调函数列表
      * @param[out] cbs 回调函数数组
      */
-    void listExpiredCb(std::vector<std::function<void()> > &cbs);
+    void listExpiredCb(std::vector<TaskFunction> &cbs);
 
     /**
      * @brief 是否有定时器
@@ -111,20 +135,22 @@ protected:
     virtual void onTimerInsertedAtFront() = 0;
 
     /**
-     * @brief 将定时器添加到管理器中
+     * @brief 将定时器添加到所属分片中，lock 是分片的锁
      *
      * 在这里添加了 m_tickled
-     * 保证当事件处于front，只会执行一次 onTimerInsertedAtFront()，唤醒 epoll_wait，处理事件~
+     * 保证定时器比 epoll_wait 等待的时间更早到期时，只会执行一次 onTimerInsertedAtFront()，唤醒 epoll_wait，处理事件~
      */
-    void addTimer(Timer::ptr val, RWMutexType::WriteLock &lock);
+    void addTimer(Timer::ptr val, MutexType::Lock &lock);
 
 private:
-    RWMutexType m_mutex;
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
+    /// 定时器分片
+    std::vector<std::unique_ptr<TimerShard> > m_shards;
     /// 是否触发onTimerInsertedAtFront
-    bool m_tickled = false;
+    std::atomic<bool> m_tickled{false};
+    /// 上次 getNextTimer 算出的最近到期时间，比它更早到期的定时器需要唤醒 epoll_wait
+    std::atomic<uint64_t> m_nextWake{~0ull};
     /// 上次执行时间
-    uint64_t m_previouseTime = 0;
+    std::atomic<uint64_t> m_previouseTime{0};
 };
 
 } // namespace sylar
@@ -0,0 +1,209 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "sylar/core/uring.h"
+#include "sylar/core/log/log.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+namespace sylar
+{
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                              void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static bool Probe()
+{
+    IoUring *ring = IoUring::Create(4);
+    if (!ring) {
+        return false;
+    }
+    bool ok = true;
+    // 用到的操作都要支持
+    size_t len = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+    io_uring_probe *probe = (io_uring_probe *)calloc(1, len);
+    if (sys_io_uring_register(ring->getFd(), IORING_REGISTER_PROBE, probe, IORING_OP_LAST)) {
+        ok = false;
+    } else {
+        for (int op : {IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL,
+                       IORING_OP_LINK_TIMEOUT, IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                       IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_READV, IORING_OP_WRITEV}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                ok = false;
+            }
+        }
+    }
+    free(probe);
+
+    // 不支持 IORING_ASYNC_CANCEL_FD 的内核会返回 -EINVAL，
+    // 支持的返回取消的个数，没有可以取消的请求时返回 -ENOENT
+    if (ok) {
+        io_uring_sqe sqe;
+        IoUring::PrepCancelFd(sqe, ring->getFd(), 0);
+        int res = -EINVAL;
+        if (ring->submit(sqe, false) && ring->wait(1000) == 0) {
+            ring->reap([&res](const io_uring_cqe &cqe) { res = cqe.res; });
+        }
+        ok = res != -EINVAL;
+    }
+    delete ring;
+    return ok;
+}
+
+bool IoUring::IsSupported()
+{
+    static bool s_supported = Probe();
+    return s_supported;
+}
+
+IoUring *IoUring::Create(unsigned entries)
+{
+    IoUring *ring = new IoUring;
+    if (!ring->init(entries)) {
+        delete ring;
+        return nullptr;
+    }
+    return ring;
+}
+
+bool IoUring::init(unsigned entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // multishot poll 每个 fd 都可能产生很多完成事件，完成队列开大一些
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    p.cq_entries = entries * 8;
+    m_fd = sys_io_uring_setup(entries, &p);
+    if (m_fd < 0) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno << " "
+                                 << strerror(errno);
+        m_fd = -1;
+        return false;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)
+        || !(p.features & IORING_FEAT_EXT_ARG)) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring features=" << std::hex << p.features
+                                 << " not supported";
+        return false;
+    }
+
+    // 提交队列和完成队列共用一块映射
+    m_ringSize = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                          p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+    m_ringPtr = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+                     IORING_OFF_SQ_RING);
+    if (m_ringPtr == MAP_FAILED) {
+        m_ringPtr = nullptr;
+        return false;
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        return false;
+    }
+
+    char *ptr = (char *)m_ringPtr;
+    m_sqEntries = p.sq_entries;
+    m_sqHead = (unsigned *)(ptr + p.sq_off.head);
+    m_sqTail = (unsigned *)(ptr + p.sq_off.tail);
+    m_sqMask = *(unsigned *)(ptr + p.sq_off.ring_mask);
+    // 提交队列的下标数组固定成一一对应，之后只需要移动 tail
+    unsigned *array = (unsigned *)(ptr + p.sq_off.array);
+    for (unsigned i = 0; i < m_sqEntries; ++i) {
+        array[i] = i;
+    }
+
+    m_cqHead = (unsigned *)(ptr + p.cq_off.head);
+    m_cqTail = (unsigned *)(ptr + p.cq_off.tail);
+    m_cqMask = *(unsigned *)(ptr + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(ptr + p.cq_off.cqes);
+    return true;
+}
+
+IoUring::~IoUring()
+{
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_ringPtr) {
+        munmap(m_ringPtr, m_ringSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IoUring::submit(const io_uring_sqe *sqes, unsigned n, bool flush)
+{
+    MutexType::Lock lock(m_mutex);
+    unsigned tail = *m_sqTail;
+    // 提交队列满了，先交给内核腾出位置
+    while (tail + n - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) > m_sqEntries) {
+        int rt = enter(0, 0, nullptr, 0);
+        if (rt < 0 && rt != -EINTR && rt != -EAGAIN && rt != -EBUSY) {
+            SYLAR_LOG_ERROR(g_logger) << "io_uring_enter(" << m_fd << ") submit error=" << -rt
+                                      << " " << strerror(-rt);
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        m_sqes[(tail + i) & m_sqMask] = sqes[i];
+    }
+    __atomic_store_n(m_sqTail, tail + n, __ATOMIC_RELEASE);
+    if (!flush) {
+        return true;
+    }
+    int rt = enter(0, 0, nullptr, 0);
+    if (rt < 0 && rt != -EINTR) {
+        // 请求已经在提交队列里了，下一次 io_uring_enter 还会再交给内核
+        SYLAR_LOG_ERROR(g_logger) << "io_uring_enter(" << m_fd << ") submit error=" << -rt << " "
+                                  << strerror(-rt);
+    }
+    return true;
+}
+
+int IoUring::wait(uint64_t timeout_ms)
+{
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = timeout_ms % 1000 * 1000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)&ts;
+    int rt = enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (rt < 0 && rt != -ETIME && rt != -EINTR) {
+        return rt;
+    }
+    return 0;
+}
+
+int IoUring::enter(unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+    // to_submit 只能传提交队列里实际有的请求数：内核提交的个数比 to_submit 少时不会等待完成事件。
+    // 别的线程同时提交的请求被谁交给内核都一样，这里少算了也只是留给下一次 io_uring_enter
+    unsigned to_submit =
+        __atomic_load_n(m_sqTail, __ATOMIC_ACQUIRE) - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    int rt = sys_io_uring_enter(m_fd, to_submit, min_complete, flags, arg, argsz);
+    return rt < 0 ? -errno : rt;
+}
+
+} // namespace sylar
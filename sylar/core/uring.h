@@ -0,0 +1,222 @@
+#ifndef __SYLAR_URING_H__
+#define __SYLAR_URING_H__
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "sylar/core/mutex.h"
+
+namespace sylar
+{
+
+/**
+ * @brief io_uring 实例的薄封装，直接使用系统调用，不依赖 liburing
+ * @details 提交队列可以多线程写入，用 m_mutex 保护；完成队列只有 owner 线程消费。
+ *          owner 线程提交的请求可以先放在提交队列里，等到 wait 时和等待合并成一次 io_uring_enter；
+ *          其他线程提交的请求马上 io_uring_enter，否则要等 owner 线程下一次进入 wait 才会被处理。
+ */
+class IoUring : Noncopyable
+{
+public:
+    typedef Spinlock MutexType;
+
+    /**
+     * @brief 内核是否支持 IOManager 用到的特性
+     * @details 需要 EXT_ARG(等待带超时)、NODROP(完成队列不丢事件)、multishot poll、
+     *          按 fd 批量取消(IORING_ASYNC_CANCEL_FD)，大约对应 5.19 以上的内核。
+     *          进程内只探测一次
+     */
+    static bool IsSupported();
+
+    /**
+     * @brief 创建 io_uring
+     * @param[in] entries 提交队列长度，完成队列是它的 8 倍
+     * @return 失败返回 nullptr
+     */
+    static IoUring *Create(unsigned entries);
+
+    ~IoUring();
+
+    int getFd() const { return m_fd; }
+
+    /// 消费完成队列的线程id，还没有线程认领时为 -1
+    int getOwner() const { return m_owner; }
+
+    void setOwner(int thread) { m_owner = thread; }
+
+    /**
+     * @brief 提交一组请求，保证在提交队列里连续(IOSQE_IO_LINK 需要)
+     * @param[in] sqes 请求内容，拷贝进提交队列
+     * @param[in] n 请求个数
+     * @param[in] flush 是否马上 io_uring_enter，owner 线程可以传 false 推迟到 wait
+     * @return 是否成功
+     */
+    bool submit(const io_uring_sqe *sqes, unsigned n, bool flush);
+
+    bool submit(const io_uring_sqe &sqe, bool flush) { return submit(&sqe, 1, flush); }
+
+    /**
+     * @brief 提交队列里的请求交给内核，并等待至少一个完成事件，只能在 owner 线程调用
+     * @param[in] timeout_ms 最多等待的毫秒数
+     * @return 成功、超时或者被信号打断返回 0，其他错误返回 -errno
+     */
+    int wait(uint64_t timeout_ms);
+
+    /**
+     * @brief 消费完成队列，只能在 owner 线程调用
+     * @param[in] cb 对每个完成事件调用 cb(const io_uring_cqe &)
+     * @return 处理的完成事件个数
+     */
+    template <class F>
+    unsigned reap(F cb)
+    {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        unsigned count = tail - head;
+        for (; head != tail; ++head) {
+            cb(m_cqes[head & m_cqMask]);
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    /// 填充 IORING_OP_POLL_ADD，multishot 时一次注册持续通知
+    static void PrepPollAdd(io_uring_sqe &sqe, int fd, uint32_t mask, bool multishot,
+                            uint64_t user_data)
+    {
+        Prep(sqe, IORING_OP_POLL_ADD, fd, user_data);
+        sqe.poll32_events = mask;
+        sqe.len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    }
+
+    /// 填充 IORING_OP_POLL_REMOVE，target 是要删除的 POLL_ADD 的 user_data
+    static void PrepPollRemove(io_uring_sqe &sqe, uint64_t target, uint64_t user_data)
+    {
+        Prep(sqe, IORING_OP_POLL_REMOVE, -1, user_data);
+        sqe.addr = target;
+    }
+
+    /// 填充 IORING_OP_ASYNC_CANCEL，取消 fd 上所有还没完成的请求
+    static void PrepCancelFd(io_uring_sqe &sqe, int fd, uint64_t user_data)
+    {
+        Prep(sqe, IORING_OP_ASYNC_CANCEL, fd, user_data);
+        sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    }
+
+    /// 填充 IORING_OP_LINK_TIMEOUT，前一个带 IOSQE_IO_LINK 的请求超时后被取消
+    static void PrepLinkTimeout(io_uring_sqe &sqe, const __kernel_timespec *ts, uint64_t user_data)
+    {
+        Prep(sqe, IORING_OP_LINK_TIMEOUT, -1, user_data);
+        sqe.addr = (uint64_t)ts;
+        sqe.len = 1;
+    }
+
+    static void PrepRecv(io_uring_sqe &sqe, int fd, void *buf, size_t len, int flags)
+    {
+        Prep(sqe, IORING_OP_RECV, fd, 0);
+        sqe.addr = (uint64_t)buf;
+        sqe.len = len;
+        sqe.msg_flags = flags;
+    }
+
+    static void PrepSend(io_uring_sqe &sqe, int fd, const void *buf, size_t len, int flags)
+    {
+        Prep(sqe, IORING_OP_SEND, fd, 0);
+        sqe.addr = (uint64_t)buf;
+        sqe.len = len;
+        sqe.msg_flags = flags;
+    }
+
+    static void PrepRecvmsg(io_uring_sqe &sqe, int fd, struct msghdr *msg, int flags)
+    {
+        Prep(sqe, IORING_OP_RECVMSG, fd, 0);
+        sqe.addr = (uint64_t)msg;
+        sqe.len = 1;
+        sqe.msg_flags = flags;
+    }
+
+    static void PrepSendmsg(io_uring_sqe &sqe, int fd, const struct msghdr *msg, int flags)
+    {
+        Prep(sqe, IORING_OP_SENDMSG, fd, 0);
+        sqe.addr = (uint64_t)msg;
+        sqe.len = 1;
+        sqe.msg_flags = flags;
+    }
+
+    /// socket 没有文件位置，off 传 -1 表示使用当前位置
+    static void PrepReadv(io_uring_sqe &sqe, int fd, const struct iovec *iov, int iovcnt)
+    {
+        Prep(sqe, IORING_OP_READV, fd, 0);
+        sqe.addr = (uint64_t)iov;
+        sqe.len = iovcnt;
+        sqe.off = (uint64_t)-1;
+    }
+
+    static void PrepWritev(io_uring_sqe &sqe, int fd, const struct iovec *iov, int iovcnt)
+    {
+        Prep(sqe, IORING_OP_WRITEV, fd, 0);
+        sqe.addr = (uint64_t)iov;
+        sqe.len = iovcnt;
+        sqe.off = (uint64_t)-1;
+    }
+
+    static void PrepAccept(io_uring_sqe &sqe, int fd, struct sockaddr *addr, socklen_t *addrlen,
+                           int flags)
+    {
+        Prep(sqe, IORING_OP_ACCEPT, fd, 0);
+        sqe.addr = (uint64_t)addr;
+        sqe.addr2 = (uint64_t)addrlen;
+        sqe.accept_flags = flags;
+    }
+
+private:
+    IoUring() = default;
+
+    static void Prep(io_uring_sqe &sqe, uint8_t opcode, int fd, uint64_t user_data)
+    {
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.user_data = user_data;
+    }
+
+    /**
+     * @brief 映射提交/完成队列
+     */
+    bool init(unsigned entries);
+
+    /**
+     * @brief 调用 io_uring_enter，把提交队列里所有的请求交给内核
+     */
+    int enter(unsigned min_complete, unsigned flags, void *arg, size_t argsz);
+
+private:
+    int m_fd = -1;
+    std::atomic<int> m_owner{-1};
+    /// 保护提交队列的写入
+    MutexType m_mutex;
+
+    unsigned m_sqEntries = 0;
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    io_uring_sqe *m_sqes = nullptr;
+
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+
+    void *m_ringPtr = nullptr;
+    size_t m_ringSize = 0;
+    size_t m_sqesSize = 0;
+};
+
+} // namespace sylar
+
+#endif
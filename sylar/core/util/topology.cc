@@ -0,0 +1,192 @@
+#include "topology.h"
+#include "sylar/core/config/config.h"
+#include "sylar/core/log/log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sylar
+{
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<bool>::ptr g_numa_local_alloc = Config::Lookup<bool>(
+    "numa.local_alloc", true,
+    "allocate fiber stacks and memory pool spans on the NUMA node of the allocating thread, "
+    "only takes effect on machines with more than one node");
+
+/// mbind 的策略，和 <numaif.h> 里的 MPOL_PREFERRED 相同，这里不依赖 libnuma 的头文件
+static const int SYLAR_MPOL_PREFERRED = 1;
+
+/**
+ * @brief 解析 "0-3,8" 这种内核格式的列表，不检查范围
+ */
+static bool ParseRanges(const std::string &str, std::vector<int> &out)
+{
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos) {
+            end = str.size();
+        }
+        std::string item = str.substr(pos, end - pos);
+        pos = end + 1;
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        if (item.empty()) {
+            continue;
+        }
+        char *p = nullptr;
+        long lo = strtol(item.c_str(), &p, 10);
+        long hi = lo;
+        if (p == item.c_str()) {
+            return false;
+        }
+        if (*p == '-') {
+            const char *begin = p + 1;
+            hi = strtol(begin, &p, 10);
+            if (p == begin) {
+                return false;
+            }
+        }
+        if (*p != '\0') {
+            return false;
+        }
+        if (lo < 0 || hi < lo) {
+            return false;
+        }
+        for (long i = lo; i <= hi; ++i) {
+            out.push_back(i);
+        }
+    }
+    return true;
+}
+
+CpuTopology::CpuTopology()
+{
+    int ncpu = std::max<long>(sysconf(_SC_NPROCESSORS_CONF), 1);
+    m_cpuNode.assign(ncpu, 0);
+
+    // 节点号可能不连续(比如只有 node0 和 node2)，按节点号存，空的节点保留一个空列表
+    const char *base = "/sys/devices/system/node";
+    DIR *dir = opendir(base);
+    if (dir) {
+        while (dirent *ent = readdir(dir)) {
+            int node = -1;
+            if (sscanf(ent->d_name, "node%d", &node) != 1 || node < 0) {
+                continue;
+            }
+            std::ifstream ifs(std::string(base) + "/" + ent->d_name + "/cpulist");
+            std::string line;
+            std::getline(ifs, line);
+            std::vector<int> cpus;
+            if (!ParseRanges(line, cpus)) {
+                continue;
+            }
+            if ((int)m_nodes.size() <= node) {
+                m_nodes.resize(node + 1);
+            }
+            for (int cpu : cpus) {
+                if (cpu < ncpu) {
+                    m_nodes[node].push_back(cpu);
+                    m_cpuNode[cpu] = node;
+                }
+            }
+        }
+        closedir(dir);
+    }
+    if (m_nodes.empty()) {
+        m_nodes.resize(1);
+        for (int i = 0; i < ncpu; ++i) {
+            m_nodes[0].push_back(i);
+        }
+    }
+    for (auto &i : m_nodes) {
+        std::sort(i.begin(), i.end());
+    }
+}
+
+const std::vector<int> &CpuTopology::getCpusOfNode(int node) const
+{
+    static const std::vector<int> s_empty;
+    return node >= 0 && node < (int)m_nodes.size() ? m_nodes[node] : s_empty;
+}
+
+int CpuTopology::CurrentCpu()
+{
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu;
+}
+
+bool CpuTopology::parseCpuList(const std::string &str, std::vector<int> &cpus) const
+{
+    cpus.clear();
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos) {
+            end = str.size();
+        }
+        std::string item = str.substr(pos, end - pos);
+        pos = end + 1;
+        int node = -1;
+        if (sscanf(item.c_str(), " node:%d", &node) == 1) {
+            if (node < 0 || node >= getNodeCount()) {
+                return false;
+            }
+            auto &n = getCpusOfNode(node);
+            cpus.insert(cpus.end(), n.begin(), n.end());
+        } else if (!ParseRanges(item, cpus)) {
+            return false;
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus.empty() || cpus.back() < getCpuCount();
+}
+
+bool CpuTopology::SetThreadAffinity(pid_t tid, const std::vector<int> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (sched_setaffinity(tid, sizeof(set), &set)) {
+        SYLAR_LOG_ERROR(g_logger) << "sched_setaffinity tid=" << tid << " cpus=" << cpus.size()
+                                  << " error: " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool CpuTopology::isLocalAlloc() const
+{
+    // 静态初始化阶段内存池就可能被用到，这时配置项可能还没构造
+    return m_nodes.size() > 1 && (!g_numa_local_alloc || g_numa_local_alloc->getValue());
+}
+
+bool CpuTopology::bindMemory(void *addr, size_t len, int node) const
+{
+    if (!isLocalAlloc() || node < 0 || node >= (int)(sizeof(unsigned long) * 8)) {
+        return true;
+    }
+    unsigned long mask = 1ul << node;
+    // maxnode 是位数加 1(内核会先减 1)
+    if (syscall(SYS_mbind, addr, len, SYLAR_MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0)) {
+        SYLAR_LOG_ERROR(g_logger) << "mbind addr=" << addr << " len=" << len << " node=" << node
+                                  << " error: " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+} // namespace sylar
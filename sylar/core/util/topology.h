@@ -0,0 +1,95 @@
+/**
+ * @file topology.h
+ * @brief CPU/NUMA 拓扑，线程绑核和内存就近分配
+ * @details 启动时从 /sys/devices/system/node 读取每个 NUMA 节点的 CPU 列表，没有这个目录时当作一个节点。
+ *          内存绑定直接调用 mbind 系统调用(MPOL_PREFERRED)，不依赖 libnuma；
+ *          只有一个节点或者 numa.local_alloc 关闭时，所有就近分配的操作什么也不做。
+ */
+#ifndef __SYLAR_UTIL_TOPOLOGY_H__
+#define __SYLAR_UTIL_TOPOLOGY_H__
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "sylar/core/common/singleton.h"
+
+namespace sylar
+{
+
+class CpuTopology
+{
+public:
+    CpuTopology();
+
+    /**
+     * @brief NUMA 节点个数，至少为 1
+     */
+    int getNodeCount() const { return m_nodes.size(); }
+
+    /**
+     * @brief 配置的 CPU 个数
+     */
+    int getCpuCount() const { return m_cpuNode.size(); }
+
+    /**
+     * @brief CPU 所在的节点，不认识的 CPU 返回 0
+     */
+    int getNodeOfCpu(int cpu) const
+    {
+        return cpu >= 0 && cpu < (int)m_cpuNode.size() ? m_cpuNode[cpu] : 0;
+    }
+
+    /**
+     * @brief 节点上的 CPU 列表
+     */
+    const std::vector<int> &getCpusOfNode(int node) const;
+
+    /**
+     * @brief 当前线程正在运行的 CPU
+     */
+    static int CurrentCpu();
+
+    /**
+     * @brief 当前线程正在运行的 CPU 所在的节点
+     */
+    int currentNode() const { return getNodeOfCpu(CurrentCpu()); }
+
+    /**
+     * @brief 解析 CPU 列表
+     * @param[in] str 逗号分隔的 CPU 号或者区间，例如 "0-3,8,10-11"；
+     *            "node:1" 表示节点 1 上所有的 CPU，可以和别的项混用
+     * @param[out] cpus 去重之后按从小到大排列
+     * @return 格式错误或者有不存在的 CPU 返回 false
+     */
+    bool parseCpuList(const std::string &str, std::vector<int> &cpus) const;
+
+    /**
+     * @brief 把线程 tid 绑定到 cpus 上，tid 为 0 表示当前线程
+     */
+    static bool SetThreadAffinity(pid_t tid, const std::vector<int> &cpus);
+
+    /**
+     * @brief 是否做就近分配：节点数大于 1 并且 numa.local_alloc 打开
+     */
+    bool isLocalAlloc() const;
+
+    /**
+     * @brief 让 [addr, addr + len) 的物理页优先从节点 node 分配，要在第一次访问之前调用
+     * @details isLocalAlloc() 为 false 时什么也不做，返回 true
+     */
+    bool bindMemory(void *addr, size_t len, int node) const;
+
+private:
+    /// 每个节点的 CPU 列表
+    std::vector<std::vector<int> > m_nodes;
+    /// 每个 CPU 所在的节点
+    std::vector<int> m_cpuNode;
+};
+
+typedef sylar::Singleton<CpuTopology> CpuTopologyMgr;
+
+} // namespace sylar
+
+#endif
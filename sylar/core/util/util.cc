@@ -44,6 +44,7 @@ static std::string demangle(const char *str)
         }
     }
     if (1 == sscanf(str, "%255s", &rt[0])) {
+        rt.resize(strlen(rt.c_str()));
         return rt;
     }
     return str;
@@ -53,19 +54,23 @@ void Backtrace(std::vector<std::string> &bt, int size, int skip)
 {
     void **array = (void **)malloc((sizeof(void *) * size));
     size_t s = ::backtrace(array, size);
+    BacktraceSymbols(array, s, bt, skip);
+    free(array);
+}
 
-    char **strings = backtrace_symbols(array, s);
+void BacktraceSymbols(void *const *frames, int size, std::vector<std::string> &bt, int skip)
+{
+    char **strings = backtrace_symbols(frames, size);
     if (strings == NULL) {
         SYLAR_LOG_ERROR(g_logger) << "backtrace_synbols error";
         return;
     }
 
-    for (size_t i = skip; i < s; ++i) {
+    for (int i = skip; i < size; ++i) {
         bt.push_back(demangle(strings[i]));
     }
 
     free(strings);
-    free(array);
 }
 
 std::string BacktraceToString(int size, int skip, const std::string &prefix)
@@ -51,6 +51,16 @@ uint32_t GetFiberId();
  */
 void Backtrace(std::vector<std::string> &bt, int size = 64, int skip = 1);
 
+/**
+ * @brief 把 ::backtrace 取到的地址翻译成符号
+ * @details 取栈(信号处理函数里只能做这一步)和翻译分开，翻译在别的线程里做
+ * @param[in] frames 栈地址
+ * @param[in] size 地址个数
+ * @param[out] bt 保存调用栈
+ * @param[in] skip 跳过栈顶的层数
+ */
+void BacktraceSymbols(void *const *frames, int size, std::vector<std::string> &bt, int skip = 0);
+
 /**
  * @brief 获取当前栈信息的字符串
  * @param[in] size 栈的最大层数
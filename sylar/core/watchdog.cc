@@ -0,0 +1,252 @@
+#include "watchdog.h"
+#include "scheduler.h"
+#include "fiber.h"
+#include "sylar/core/log/log.h"
+#include "sylar/core/util/util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <execinfo.h>
+#include <fstream>
+#include <signal.h>
+#include <sstream>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sylar
+{
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+/// 最多保留的卡住记录
+static const size_t MAX_STALLS = 64;
+/// 取栈的最大层数
+static const int MAX_FRAMES = 64;
+/// 等对方线程响应取栈信号的最长时间(毫秒)
+static const int CAPTURE_WAIT_MS = 100;
+
+/**
+ * 同一时间只有看门狗线程在取一个线程的栈，用一份全局的缓冲区
+ */
+enum CaptureState {
+    CAPTURE_IDLE,
+    CAPTURE_REQUESTED,
+    CAPTURE_RUNNING,
+    CAPTURE_DONE,
+};
+static void *s_frames[MAX_FRAMES];
+static std::atomic<int> s_frameCount{0};
+static std::atomic<int> s_captureState{CAPTURE_IDLE};
+static std::atomic<int> s_captureThread{0};
+/// 取栈时线程上正在运行的协程
+static std::atomic<uint64_t> s_captureFiber{0};
+
+static int CaptureSignal()
+{
+    return SIGRTMIN + 4;
+}
+
+static void OnCaptureSignal(int)
+{
+    // 只响应被点名的线程，信号处理函数里只取栈地址
+    if (s_captureThread != GetThreadId()) {
+        return;
+    }
+    int expected = CAPTURE_REQUESTED;
+    if (!s_captureState.compare_exchange_strong(expected, CAPTURE_RUNNING)) {
+        return;
+    }
+    int saved_errno = errno;
+    s_captureFiber = Fiber::GetFiberId();
+    s_frameCount = ::backtrace(s_frames, MAX_FRAMES);
+    errno = saved_errno;
+    s_captureState = CAPTURE_DONE;
+}
+
+/**
+ * 线程阻塞在系统调用里时(/proc 里的状态是 S 或 D)发信号会打断 sleep/poll 这类调用，
+ * 改变程序的行为，这时不取栈，只记下阻塞的系统调用号
+ */
+static bool BlockedInSyscall(int thread, std::string &desc)
+{
+    std::string dir = "/proc/self/task/" + std::to_string(thread);
+    std::ifstream stat(dir + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) {
+        return false;
+    }
+    // 线程名里可能有空格和括号，状态在最后一个 ')' 之后
+    size_t pos = line.rfind(')');
+    if (pos == std::string::npos || pos + 2 >= line.size()) {
+        return false;
+    }
+    char state = line[pos + 2];
+    if (state != 'S' && state != 'D') {
+        return false;
+    }
+    std::ifstream syscall(dir + "/syscall");
+    std::string nr;
+    syscall >> nr;
+    desc = std::string("blocked in syscall ") + (nr.empty() ? "?" : nr) + " state=" + state;
+    return true;
+}
+
+FiberWatchdog::FiberWatchdog()
+{
+    // backtrace 第一次调用会加载 libgcc，先在普通上下文里调用一次，信号处理函数里就不会再分配内存
+    void *warm[1];
+    ::backtrace(warm, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnCaptureSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(CaptureSignal(), &sa, nullptr);
+}
+
+FiberWatchdog::~FiberWatchdog()
+{
+    m_stop = true;
+    if (m_thread) {
+        m_thread->join();
+    }
+}
+
+void FiberWatchdog::add(Scheduler *scheduler)
+{
+    MutexType::Lock lock(m_mutex);
+    m_schedulers.insert(scheduler);
+    uint32_t interval = std::max<uint32_t>(scheduler->getStallThreshold() / 4, 1);
+    if (!m_intervalMs || interval < m_intervalMs) {
+        m_intervalMs = interval;
+    }
+    if (!m_thread) {
+        m_thread.reset(new Thread(std::bind(&FiberWatchdog::run, this), "watchdog"));
+    }
+}
+
+void FiberWatchdog::del(Scheduler *scheduler)
+{
+    MutexType::Lock lock(m_mutex);
+    m_schedulers.erase(scheduler);
+}
+
+void FiberWatchdog::listStalls(std::vector<Stall> &stalls)
+{
+    MutexType::Lock lock(m_mutex);
+    stalls.assign(m_stalls.begin(), m_stalls.end());
+}
+
+void FiberWatchdog::run()
+{
+    while (!m_stop) {
+        usleep(m_intervalMs * 1000);
+        check();
+    }
+}
+
+void FiberWatchdog::check()
+{
+    std::vector<Scheduler::RunningSlice> slices;
+    MutexType::Lock lock(m_mutex);
+    for (Scheduler *s : m_schedulers) {
+        slices.clear();
+        s->listRunningSlices(slices);
+        uint64_t threshold_us = s->getStallThreshold() * 1000ull;
+        for (auto &slice : slices) {
+            uint64_t now = GetCurrentUS();
+            if (now < slice.startUs + threshold_us) {
+                continue;
+            }
+            // 已经记过的，更新运行时间
+            auto it = std::find_if(m_stalls.rbegin(), m_stalls.rend(), [&slice](const Stall &st) {
+                return st.thread == slice.thread && st.startUs == slice.startUs;
+            });
+            if (it != m_stalls.rend()) {
+                it->usedMs = (now - slice.startUs) / 1000;
+                continue;
+            }
+
+            Stall stall;
+            stall.scheduler = s->getName();
+            stall.thread = slice.thread;
+            stall.fiberId = slice.fiberId;
+            stall.startUs = slice.startUs;
+            stall.usedMs = (now - slice.startUs) / 1000;
+            std::string blocked;
+            if (BlockedInSyscall(slice.thread, blocked)) {
+                stall.backtrace.push_back(blocked);
+            } else if (capture(slice.thread, stall.backtrace)
+                       && s_captureFiber != slice.fiberId) {
+                // 信号到的时候协程已经让出了，栈不是它的
+                stall.backtrace.clear();
+            }
+
+            std::stringstream ss;
+            for (auto &frame : stall.backtrace) {
+                ss << std::endl << "    " << frame;
+            }
+            SYLAR_LOG_WARN(g_logger) << "fiber stall scheduler=" << stall.scheduler
+                                     << " thread=" << stall.thread << " fiber_id=" << stall.fiberId
+                                     << " used=" << stall.usedMs << "ms" << ss.str();
+            ++m_stallCount;
+            m_stalls.push_back(std::move(stall));
+            if (m_stalls.size() > MAX_STALLS) {
+                m_stalls.pop_front();
+            }
+        }
+    }
+}
+
+bool FiberWatchdog::capture(int thread, std::vector<std::string> &bt)
+{
+    s_captureThread = thread;
+    s_captureState = CAPTURE_REQUESTED;
+    if (syscall(SYS_tgkill, getpid(), thread, CaptureSignal()) != 0) {
+        s_captureState = CAPTURE_IDLE;
+        return false;
+    }
+    for (int i = 0; i < CAPTURE_WAIT_MS && s_captureState != CAPTURE_DONE; ++i) {
+        usleep(1000);
+    }
+    int expected = CAPTURE_REQUESTED;
+    if (s_captureState.compare_exchange_strong(expected, CAPTURE_IDLE)) {
+        // 对方屏蔽了信号或者一直没被调度到
+        return false;
+    }
+    while (s_captureState != CAPTURE_DONE) {
+        sched_yield();
+    }
+    // 跳过信号处理函数和内核插入的 __restore_rt
+    BacktraceSymbols(s_frames, s_frameCount, bt, 2);
+    s_captureState = CAPTURE_IDLE;
+    return true;
+}
+
+std::ostream &FiberWatchdog::dump(std::ostream &os)
+{
+    MutexType::Lock lock(m_mutex);
+    os << "[FiberWatchdog schedulers=" << m_schedulers.size() << " interval=" << m_intervalMs
+       << "ms stalls=" << m_stallCount << "]";
+    for (Scheduler *s : m_schedulers) {
+        Scheduler::RunSliceStats stats = s->getRunSliceStats();
+        os << std::endl
+           << "    " << s->getName() << " threshold=" << s->getStallThreshold()
+           << "ms run_slice count=" << stats.count << " p50<" << stats.percentile(0.5)
+           << "us p99<" << stats.percentile(0.99) << "us p999<" << stats.percentile(0.999)
+           << "us";
+    }
+    for (auto &stall : m_stalls) {
+        os << std::endl
+           << "    stall scheduler=" << stall.scheduler << " thread=" << stall.thread
+           << " fiber_id=" << stall.fiberId << " start=" << Time2Str(stall.startUs / 1000000)
+           << " used=" << stall.usedMs << "ms";
+        for (auto &frame : stall.backtrace) {
+            os << std::endl << "        " << frame;
+        }
+    }
+    return os;
+}
+
+} // namespace sylar
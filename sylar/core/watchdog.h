@@ -0,0 +1,108 @@
+/**
+ * @file watchdog.h
+ * @brief 协程卡住检测
+ * @details 一个 CPU 密集的处理函数或者一次没有 hook 的阻塞系统调用会卡住整个调度线程。
+ *          scheduler.stall_threshold_ms 大于 0 时，调度器在切到任务协程前后公布开始时间，
+ *          看门狗线程定期检查，运行超过阈值的协程记一次卡住：给那个线程发信号，
+ *          在信号处理函数里取栈(只取地址)，回到看门狗线程再翻译成符号，打日志并保留最近的记录。
+ *          线程阻塞在没有 hook 的系统调用里时不发信号(会打断 sleep/poll 这类调用)，只记系统调用号。
+ */
+#ifndef __SYLAR_WATCHDOG_H__
+#define __SYLAR_WATCHDOG_H__
+
+#include <atomic>
+#include <deque>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "sylar/core/common/noncopyable.h"
+#include "sylar/core/common/singleton.h"
+#include "sylar/core/mutex.h"
+#include "sylar/core/thread.h"
+
+namespace sylar
+{
+
+class Scheduler;
+
+class FiberWatchdog : Noncopyable
+{
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 一次卡住
+     */
+    struct Stall {
+        /// 调度器名称
+        std::string scheduler;
+        /// 调度线程id
+        int thread = 0;
+        /// 协程id
+        uint64_t fiberId = 0;
+        /// 开始运行的时间(微秒)
+        uint64_t startUs = 0;
+        /// 已经运行的时间(毫秒)，卡住期间每次检查都会更新
+        uint64_t usedMs = 0;
+        /// 第一次超过阈值时的调用栈；阻塞在系统调用里时只有一行系统调用号；取不到时为空
+        std::vector<std::string> backtrace;
+    };
+
+    FiberWatchdog();
+    ~FiberWatchdog();
+
+    /**
+     * @brief 开始检查调度器，第一个调度器加入时启动看门狗线程
+     */
+    void add(Scheduler *scheduler);
+
+    /**
+     * @brief 停止检查调度器，调度器析构时调用
+     */
+    void del(Scheduler *scheduler);
+
+    /**
+     * @brief 最近的卡住记录，按发生的先后顺序
+     */
+    void listStalls(std::vector<Stall> &stalls);
+
+    /**
+     * @brief 累计卡住次数
+     */
+    uint64_t getStallCount() const { return m_stallCount; }
+
+    std::ostream &dump(std::ostream &os);
+
+private:
+    void run();
+
+    /**
+     * @brief 检查一遍所有调度器
+     */
+    void check();
+
+    /**
+     * @brief 取线程 thread 当前的调用栈，对方没有及时响应返回 false
+     */
+    bool capture(int thread, std::vector<std::string> &bt);
+
+private:
+    MutexType m_mutex;
+    /// 正在检查的调度器
+    std::set<Scheduler *> m_schedulers;
+    /// 最近的卡住记录
+    std::deque<Stall> m_stalls;
+    std::atomic<uint64_t> m_stallCount{0};
+    /// 检查间隔(毫秒)，取各个调度器阈值里最小的一个的 1/4
+    std::atomic<uint32_t> m_intervalMs{0};
+    Thread::ptr m_thread;
+    std::atomic<bool> m_stop{false};
+};
+
+typedef sylar::Singleton<FiberWatchdog> FiberWatchdogMgr;
+
+} // namespace sylar
+
+#endif
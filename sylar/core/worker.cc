@@ -1,9 +1,13 @@
 #include "sylar/core/worker.h"
 #include "sylar/core/config/config.h"
 #include "sylar/core/util/util.h"
+#include "sylar/core/util/topology.h"
+#include "sylar/core/log/log.h"
 
 namespace sylar {
 
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
 static sylar::ConfigVar<std::map<std::string, std::map<std::string, std::string> > >::ptr g_worker_config
     = sylar::Config::Lookup("workers", std::map<std::string, std::map<std::string, std::string> >(), "worker config");
 
@@ -67,6 +71,23 @@ Scheduler::ptr WorkerManager::get(const std::string& name) {
     if(it->second.size() == 1) {
         return it->second[0];
     }
+    // 多个 NUMA 节点时优先挑绑在当前节点上的实例，没有再随便挑
+    auto topo = CpuTopologyMgr::GetInstance();
+    if(topo->getNodeCount() > 1) {
+        int node = topo->currentNode();
+        size_t count = 0;
+        for(auto& s : it->second) {
+            count += s->getNumaNode() == node;
+        }
+        if(count) {
+            size_t k = rand() % count;
+            for(auto& s : it->second) {
+                if(s->getNumaNode() == node && !k--) {
+                    return s;
+                }
+            }
+        }
+    }
     return it->second[rand() % it->second.size()];
 }
 
@@ -79,6 +100,14 @@ bool WorkerManager::init(const std::map<std::string, std::map<std::string, std::
         std::string name = i.first;
         int32_t thread_num = sylar::GetParamValue(i.second, "thread_num", 1);
         int32_t worker_num = sylar::GetParamValue(i.second, "worker_num", 1);
+        // cpus: 所有实例的线程绑在这些 CPU 上；numa_spread: 第 x 个实例绑在节点 x % 节点数 的 CPU 上
+        std::string cpus_str = sylar::GetParamValue<std::string>(i.second, "cpus", "");
+        bool numa_spread = sylar::GetParamValue(i.second, "numa_spread", 0);
+        auto topo = CpuTopologyMgr::GetInstance();
+        std::vector<int> cpus;
+        if(!cpus_str.empty() && !topo->parseCpuList(cpus_str, cpus)) {
+            SYLAR_LOG_ERROR(g_logger) << "worker " << name << " invalid cpus " << cpus_str;
+        }
 
         for(int32_t x = 0; x < worker_num; ++x) {
             Scheduler::ptr s;
@@ -87,6 +116,11 @@ bool WorkerManager::init(const std::map<std::string, std::map<std::string, std::
             } else {
                 s = std::make_shared<IOManager>(thread_num, false, name + "-" + std::to_string(x));
             }
+            if(numa_spread) {
+                s->setAffinity(topo->getCpusOfNode(x % topo->getNodeCount()));
+            } else if(!cpus.empty()) {
+                s->setAffinity(cpus);
+            }
             add(s);
         }
     }
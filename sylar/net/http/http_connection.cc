@@ -401,6 +401,35 @@ HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req
     return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
 }
 
+Future<HttpResult::ptr> HttpConnectionPool::asyncDoGet(const std::string& url
+                                     , uint64_t timeout_ms
+                                     , const std::map<std::string, std::string>& headers
+                                     , const std::string& body)
+{
+    return Async(nullptr, [this, url, timeout_ms, headers, body]() {
+        return doGet(url, timeout_ms, headers, body);
+    });
+}
+
+Future<HttpResult::ptr> HttpConnectionPool::asyncDoPost(const std::string& url
+                                      , uint64_t timeout_ms
+                                      , const std::map<std::string, std::string>& headers
+                                      , const std::string& body)
+{
+    return Async(nullptr, [this, url, timeout_ms, headers, body]() {
+        return doPost(url, timeout_ms, headers, body);
+    });
+}
+
+Future<HttpResult::ptr> HttpConnectionPool::asyncDoRequest(HttpRequest::ptr req
+                                         , uint64_t timeout_ms
+                                         , Scheduler* scheduler)
+{
+    return Async(scheduler, [this, req, timeout_ms]() {
+        return doRequest(req, timeout_ms);
+    });
+}
+
 void HttpConnectionPool::ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool)
 {
     ++ptr->m_request;
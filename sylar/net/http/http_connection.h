@@ -6,6 +6,7 @@
 #include "http.h"
 #include "../uri.h"
 #include "sylar/core/thread.h"
+#include "sylar/core/future.h"
 
 #include <list>
 #include <stdint.h>
@@ -318,6 +319,36 @@ public:
      */
     HttpResult::ptr doRequest(HttpRequest::ptr req
                             , uint64_t timeout_ms);
+
+    /**
+     * @brief 异步发送HTTP的GET请求
+     * @details 请求在当前调度器的另一个协程里执行，调用方可以同时发起多个请求，
+     *          再用 WhenAll/WhenAny 等结果；连接池要活到结果就绪之后
+     * @return 就绪时得到和 doGet 一样的结果
+     */
+    Future<HttpResult::ptr> asyncDoGet(const std::string& url
+                                     , uint64_t timeout_ms
+                                     , const std::map<std::string, std::string>& headers = {}
+                                     , const std::string& body = "");
+
+    /**
+     * @brief 异步发送HTTP的POST请求
+     * @details 同 asyncDoGet
+     */
+    Future<HttpResult::ptr> asyncDoPost(const std::string& url
+                                      , uint64_t timeout_ms
+                                      , const std::map<std::string, std::string>& headers = {}
+                                      , const std::string& body = "");
+
+    /**
+     * @brief 异步发送HTTP请求
+     * @param[in] req 请求结构体
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] scheduler 执行请求的调度器，nullptr 使用当前调度器
+     */
+    Future<HttpResult::ptr> asyncDoRequest(HttpRequest::ptr req
+                                         , uint64_t timeout_ms
+                                         , Scheduler* scheduler = nullptr);
 private:
     static void ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool);
 private:
@@ -0,0 +1,118 @@
+#include "memory_servlet.h"
+#include "sylar/core/memory/memorypool.h"
+#include "sylar/core/memory/stack_pool.h"
+#include "sylar/core/util/json_util.h"
+
+namespace sylar
+{
+namespace http
+{
+
+    MemoryServlet::MemoryServlet() : Servlet("MemoryServlet")
+    {
+    }
+
+    static Json::Value ToJson(const MemoryPoolStats &stats)
+    {
+        Json::Value v;
+        uint64_t allocs = stats.allocs();
+        v["threads"] = (Json::UInt64)stats.threads;
+        v["live_threads"] = (Json::UInt64)stats.liveThreads;
+        v["allocs"] = (Json::UInt64)allocs;
+        v["hit_rate"] = allocs ? 1 - (double)stats.misses() / allocs : 0;
+        v["in_use_bytes"] = (Json::UInt64)stats.inUseBytes();
+        v["requested_bytes"] = (Json::Int64)stats.requestedBytes();
+        v["thread_cached_bytes"] = (Json::UInt64)stats.threadCachedBytes();
+        v["central_cached_bytes"] = (Json::UInt64)stats.centralCachedBytes();
+        v["large_allocs"] = (Json::UInt64)stats.largeAllocs;
+        v["large_frees"] = (Json::UInt64)stats.largeFrees;
+        v["large_bytes"] = (Json::Int64)stats.largeBytes;
+
+        Json::Value &pc = v["page_cache"];
+        pc["system_bytes"] = (Json::UInt64)stats.pageCache.systemBytes;
+        pc["huge_page_bytes"] = (Json::UInt64)stats.pageCache.hugePageBytes;
+        pc["in_use_spans"] = (Json::UInt64)stats.pageCache.inUseSpans;
+        pc["in_use_pages"] = (Json::UInt64)stats.pageCache.inUsePages;
+        pc["free_spans"] = (Json::UInt64)stats.pageCache.freeSpans;
+        pc["free_bytes"] = (Json::UInt64)stats.pageCache.retainedBytes();
+        pc["released_bytes"] = (Json::UInt64)stats.pageCache.releasedBytes();
+        pc["released_bytes_total"] = (Json::UInt64)stats.pageCache.releasedBytesTotal;
+
+        Json::Value &classes = v["classes"];
+        classes = Json::Value(Json::arrayValue);
+        for (auto &i : stats.classes) {
+            if (!i.allocs && !i.spans) {
+                continue;
+            }
+            Json::Value c;
+            c["size"] = (Json::UInt64)i.size;
+            c["allocs"] = (Json::UInt64)i.allocs;
+            c["frees"] = (Json::UInt64)i.frees;
+            c["hit_rate"] = i.hitRate();
+            c["misses"] = (Json::UInt64)i.misses;
+            c["fetched_blocks"] = (Json::UInt64)i.fetchedBlocks;
+            c["returns"] = (Json::UInt64)i.returns;
+            c["returned_blocks"] = (Json::UInt64)i.returnedBlocks;
+            c["in_use_blocks"] = (Json::UInt64)i.inUseBlocks();
+            c["requested_bytes"] = (Json::Int64)i.requestedBytes;
+            c["thread_cached_blocks"] = (Json::UInt64)i.threadCachedBlocks();
+            c["spans"] = (Json::UInt64)i.spans;
+            c["span_blocks"] = (Json::UInt64)i.spanBlocks;
+            c["central_free_blocks"] = (Json::UInt64)i.centralFreeBlocks;
+            c["span_allocs"] = (Json::UInt64)i.spanAllocs;
+            c["span_frees"] = (Json::UInt64)i.spanFrees;
+            classes.append(c);
+        }
+        return v;
+    }
+
+    int32_t MemoryServlet::handle(sylar::http::HttpRequest::ptr request,
+                                  sylar::http::HttpResponse::ptr response,
+                                  sylar::SocketStream::ptr session)
+    {
+        std::string type = request->getParam("type");
+        size_t limit = request->getParamAs<uint64_t>("limit", 20);
+        bool reset = request->getParamAs<int>("reset", 0);
+        if (type == "json") {
+            response->setHeader("Content-Type", "text/json charset=utf-8");
+            Json::Value v = ToJson(MemoryPoolProfiler::GetStats());
+            v["sample_interval"] = (Json::UInt64)MemoryPoolProfiler::GetSampleInterval();
+            std::vector<AllocSample> samples;
+            MemoryPoolProfiler::ListSamples(samples, limit);
+            Json::Value &js = v["samples"];
+            js = Json::Value(Json::arrayValue);
+            for (auto &i : samples) {
+                Json::Value s;
+                s["estimated_bytes"] = (Json::UInt64)i.estimatedBytes;
+                s["count"] = (Json::UInt64)i.count;
+                s["bytes"] = (Json::UInt64)i.bytes;
+                Json::Value &stack = s["stack"];
+                stack = Json::Value(Json::arrayValue);
+                for (auto &f : i.stack) {
+                    stack.append(f);
+                }
+                js.append(s);
+            }
+            response->setBody(JsonUtil::ToString(v));
+        } else {
+            response->setHeader("Content-Type", "text/text; charset=utf-8");
+            std::stringstream ss;
+            ss << "===================================================" << std::endl;
+            ss << "<MemoryPool>" << std::endl;
+            MemoryPoolProfiler::Dump(ss, true) << std::endl;
+            ss << "===================================================" << std::endl;
+            ss << "<FiberStack>" << std::endl;
+            FiberStackPool::Dump(ss) << std::endl;
+            ss << "===================================================" << std::endl;
+            ss << "<AllocSamples>" << std::endl;
+            MemoryPoolProfiler::DumpSamples(ss, limit) << std::endl;
+            response->setBody(ss.str());
+        }
+        if (reset) {
+            MemoryPoolProfiler::ResetSamples();
+        }
+        return 0;
+    }
+
+} // namespace http
+} // namespace sylar
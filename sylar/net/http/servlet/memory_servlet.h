@@ -0,0 +1,25 @@
+#pragma once
+
+#include "sylar/net/http/servlet.h"
+
+namespace sylar
+{
+namespace http
+{
+
+    /**
+     * @brief 内存池统计和分配采样
+     * @details 参数：type=json 输出 json，默认文本；limit=N 最多输出 N 个采样调用栈，默认 20；
+     *          reset=1 输出之后清空采样结果
+     */
+    class MemoryServlet : public Servlet
+    {
+    public:
+        MemoryServlet();
+        virtual int32_t handle(sylar::http::HttpRequest::ptr request,
+                               sylar::http::HttpResponse::ptr response,
+                               sylar::SocketStream::ptr session) override;
+    };
+
+} // namespace http
+} // namespace sylar
@@ -1,5 +1,7 @@
 #include "status_servlet.h"
 #include "sylar/sylar.h"
+#include "sylar/core/memory/memorypool.h"
+#include "sylar/core/memory/stack_pool.h"
 
 namespace sylar
 {
@@ -86,6 +88,16 @@ namespace http
         ss << "===================================================" << std::endl;
         ss << "<Woker>" << std::endl;
         sylar::WorkerMgr::GetInstance()->dump(ss) << std::endl;
+        ss << "===================================================" << std::endl;
+        ss << "<FiberWatchdog>" << std::endl;
+        sylar::FiberWatchdogMgr::GetInstance()->dump(ss) << std::endl;
+        ss << "===================================================" << std::endl;
+        ss << "<FiberStack>" << std::endl;
+        sylar::FiberStackPool::Dump(ss) << std::endl;
+        sylar::FiberStackWatermark::Dump(ss) << std::endl;
+        ss << "===================================================" << std::endl;
+        ss << "<MemoryPool>" << std::endl;
+        sylar::MemoryPoolProfiler::Dump(ss) << std::endl;
 
         std::map<std::string, std::vector<TcpServer::ptr> > servers;
         sylar::Application::GetInstance()->listAllServer(servers);
@@ -2,6 +2,7 @@
 #include "sylar/core/log/log.h"
 #include "http2_session.h"
 #include "sylar/net/http/servlet/config_servlet.h"
+#include "sylar/net/http/servlet/memory_servlet.h"
 #include "sylar/net/http/servlet/status_servlet.h"
 
 namespace sylar::http2
@@ -17,6 +18,7 @@ Http2Server::Http2Server(sylar::IOManager *worker, sylar::IOManager *io_worker,
     m_dispatch = std::make_shared<http::ServletDispatch>();
     m_dispatch->addServlet("/_/status", std::make_shared<http::StatusServlet>());
     m_dispatch->addServlet("/_/config", std::make_shared<http::ConfigServlet>());
+    m_dispatch->addServlet("/_/memory", std::make_shared<http::MemoryServlet>());
 }
 
 void Http2Server::setName(const std::string &v)
@@ -36,7 +38,7 @@ void Http2Server::handleClient(Socket::ptr client)
         session->close();
         return;
     }
-    session->setWorker(m_worker);
+    session->setWorker(getProcessWorker());
     session->start();
 }
 
@@ -93,8 +93,7 @@ void Http2Stream::close()
         // 通知处理函数流已关闭
         m_handler(nullptr);
     }
-    m_data.push(nullptr); // 推送空数据表示流结束
-    // m_data.notifyAll();
+    m_data.close(); // 关闭通道，recvData 取完剩余数据后返回 nullptr 表示流结束
 }
 
 /**
@@ -155,8 +154,8 @@ int32_t Http2Stream::handleFrame(Frame::ptr frame, bool is_client)
     if (frame->header.flags & (uint8_t)FrameFlagHeaders::END_STREAM) {
         m_state = State::CLOSED;
         if (m_isStream) {
-            // 对于流式传输，推送空数据表示流结束
-            m_data.push(nullptr);
+            // 对于流式传输，关闭通道表示流结束
+            m_data.close();
         }
         if (is_client) {
             // 客户端模式下，构建响应对象
@@ -192,8 +191,8 @@ std::string Http2Stream::getDataBody()
 {
     std::stringstream ss;
     // 将接收到的所有数据帧内容拼接成完整的请求体
-    while (!m_data.empty()) {
-        auto data = m_data.pop();
+    DataFrame::ptr data;
+    while (m_data.tryRecv(data)) {
         ss << data->data;
     }
     return ss.str();
@@ -278,8 +277,8 @@ int32_t Http2Stream::handleDataFrame(Frame::ptr frame, bool is_client)
                                   << frame->toString();
         return -1;
     }
-    // 将数据帧加入队列等待处理
-    m_data.push(data);
+    // 将数据帧放入通道等待处理，通道不限长度，不会挂起读协程
+    m_data.send(std::move(data));
     // m_body += data->data;
     // SYLAR_LOG_DEBUG(g_logger) << "stream_id=" << m_id << " cur_body_size=" << m_body.size();
     // if(is_client) {
@@ -294,11 +293,13 @@ int32_t Http2Stream::handleDataFrame(Frame::ptr frame, bool is_client)
 
 /**
  * @brief 接收数据帧
- * @return 接收到的数据帧，如果队列为空则返回nullptr
+ * @return 接收到的数据帧，没有数据时挂起等待，流结束返回nullptr
  */
 DataFrame::ptr Http2Stream::recvData()
 {
-    return m_data.pop();
+    DataFrame::ptr data;
+    m_data.recv(data);
+    return data;
 }
 
 /**
@@ -5,7 +5,7 @@
 #include <functional>
 #include <unordered_map>
 #include "sylar/net/http/http.h"
-#include "sylar/core/ds/blocking_queue.h"
+#include "sylar/core/channel.h"
 #include "hpack.h"
 
 namespace sylar::http2
@@ -249,8 +249,8 @@ public:
     std::string getDataBody();
 
     /**
-     * @brief 接收数据帧
-     * @return 数据帧智能指针
+     * @brief 接收数据帧，没有数据时挂起当前协程
+     * @return 数据帧智能指针，流结束返回 nullptr
      */
     DataFrame::ptr recvData();
 
@@ -319,7 +319,7 @@ private:
     HPack::ptr m_recvHPack; ///< HPack 解码器（用于接收头部）
     frame_handler m_handler; ///< 帧处理函数
     //std::string m_body; // 注释掉的成员变量，原始实现使用阻塞队列存储数据帧
-    sylar::ds::BlockingQueue<DataFrame> m_data; ///< 数据帧阻塞队列
+    sylar::FiberChannel<DataFrame::ptr> m_data; ///< 数据帧通道，流结束时关闭
 
     int32_t m_sendWindow = 0; ///< 发送窗口大小
     int32_t m_recvWindow = 0; ///< 接收窗口大小
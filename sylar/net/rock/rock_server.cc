@@ -23,7 +23,7 @@ void RockServer::handleClient(Socket::ptr client)
 {
     SYLAR_LOG_DEBUG(g_logger) << "handleClient " << *client;
     sylar::RockSession::ptr session = std::make_shared<sylar::RockSession>(client);
-    session->setWorker(m_worker);
+    session->setWorker(getProcessWorker());
     ModuleMgr::GetInstance()->foreach (Module::ROCK,
                                        [session](Module::ptr m) { m->onConnect(session); });
     session->setDisconnectCb([](AsyncSocketStream::ptr stream) {
@@ -91,6 +91,52 @@ RockResult::ptr RockStream::request(RockRequest::ptr req, uint32_t timeout_ms)
     }
 }
 
+Future<RockResult::ptr> RockStream::asyncRequest(RockRequest::ptr req, uint32_t timeout_ms)
+{
+    if (!isConnected()) {
+        auto rt = std::make_shared<RockResult>(AsyncSocketStream::NOT_CONNECT,
+                                               "not_connect " + getRemoteAddressString(), 0,
+                                               nullptr, req);
+        rt->server = getRemoteAddressString();
+        return MakeReadyFuture<RockResult::ptr>(rt);
+    }
+    if (req->getSn() == 0) {
+        req->setSn(sylar::Atomic::addFetch(m_sn));
+    }
+    RockAsyncCtx::ptr ctx = std::make_shared<RockAsyncCtx>();
+    ctx->request = req;
+    ctx->sn = req->getSn();
+    ctx->timeout = timeout_ms;
+    ctx->startMs = sylar::GetCurrentMS();
+    ctx->server = getRemoteAddressString();
+    Future<RockResult::ptr> future = ctx->promise.getFuture();
+    addCtx(ctx);
+    ctx->timer = sylar::IOManager::GetThis()->addTimer(
+        timeout_ms, std::bind(&RockStream::onTimeOut, shared_from_this(), ctx));
+    enqueue(ctx);
+    return future;
+}
+
+// 异步请求上下文：应答/超时/断开只处理一次，直接设置结果
+void RockStream::RockAsyncCtx::doRsp()
+{
+    if (done.exchange(true)) {
+        return;
+    }
+    if (timer) {
+        timer->cancel();
+        timer = nullptr;
+    }
+    if (timed) {
+        result = TIMEOUT;
+        resultStr = "timeout";
+    }
+    auto rt = std::make_shared<RockResult>(result, resultStr, sylar::GetCurrentMS() - startMs,
+                                           response, request);
+    rt->server = server;
+    promise.setValue(rt);
+}
+
 // 发送上下文：序列化并写出消息
 bool RockStream::RockSendCtx::doSend(AsyncSocketStream::ptr stream)
 {
@@ -309,4 +355,14 @@ RockResult::ptr RockSDLoadBalance::request(const std::string &domain, const std:
     return r;
 }
 
+Future<RockResult::ptr> RockSDLoadBalance::asyncRequest(const std::string &domain,
+                                                        const std::string &service,
+                                                        RockRequest::ptr req, uint32_t timeout_ms,
+                                                        uint64_t idx)
+{
+    return Async(nullptr, [this, domain, service, req, timeout_ms, idx]() {
+        return request(domain, service, req, timeout_ms, idx);
+    });
+}
+
 } // namespace sylar
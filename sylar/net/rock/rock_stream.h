@@ -13,6 +13,7 @@
 #include "rock_protocol.h"
 #include "load_balance.h"
 #include "sylar/core/common/singleton.h"
+#include "sylar/core/future.h"
 #include <boost/any.hpp>
 
 namespace sylar
@@ -53,6 +54,8 @@ public:
     int32_t sendMessage(Message::ptr msg);
     // 发送请求并等待应答，超时返回 TIMEOUT
     RockResult::ptr request(RockRequest::ptr req, uint32_t timeout_ms);
+    // 发送请求但不挂起当前协程，应答、超时或者断开时 Future 就绪，结果和 request 一致
+    Future<RockResult::ptr> asyncRequest(RockRequest::ptr req, uint32_t timeout_ms);
 
     request_handler getRequestHandler() const { return m_requestHandler; }
     notify_handler getNotifyHandler() const { return m_notifyHandler; }
@@ -95,6 +98,17 @@ protected:
         virtual bool doSend(AsyncSocketStream::ptr stream) override;
     };
 
+    // 异步请求上下文：没有等待的协程，应答时直接设置 Promise
+    struct RockAsyncCtx : public RockCtx {
+        typedef std::shared_ptr<RockAsyncCtx> ptr;
+        Promise<RockResult::ptr> promise;
+        std::atomic<bool> done{false};
+        uint64_t startMs = 0;
+        std::string server;
+
+        virtual void doRsp() override;
+    };
+
     virtual Ctx::ptr doRecv() override;
 
     // 内部分发到业务层回调
@@ -141,6 +155,10 @@ public:
     // 通过 domain/service 选择连接并发起请求
     RockResult::ptr request(const std::string &domain, const std::string &service,
                             RockRequest::ptr req, uint32_t timeout_ms, uint64_t idx = -1);
+    // 在当前调度器的另一个协程里执行 request，用于同时请求多个服务；负载均衡对象要活到结果就绪之后
+    Future<RockResult::ptr> asyncRequest(const std::string &domain, const std::string &service,
+                                         RockRequest::ptr req, uint32_t timeout_ms,
+                                         uint64_t idx = -1);
 };
 
 } // namespace sylar
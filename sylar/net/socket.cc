@@ -4,6 +4,7 @@
 #include "sylar/core/log/log.h"
 #include "sylar/core/common/macro.h"
 #include "sylar/core/hook.h"
+#include "sylar/core/config/config.h"
 #include <limits.h>
 #include <sys/sendfile.h>
 #include <unistd.h>
@@ -13,6 +14,11 @@ namespace sylar
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<int32_t>::ptr g_socket_busy_poll_us = sylar::Config::Lookup(
+    "socket.busy_poll_us", (int32_t)0,
+    "SO_BUSY_POLL microseconds for tcp sockets, the kernel busy polls the device queue in "
+    "blocking reads and epoll_wait, 0 disables");
+
 Socket::ptr Socket::CreateTCP(sylar::Address::ptr address)
 {
     return std::make_shared<Socket>(address->getFamily(), TCP, 0);
@@ -431,6 +437,18 @@ Address::ptr Socket::getLocalAddress()
     return m_localAddress;
 }
 
+bool Socket::setReusePort()
+{
+    if (!isValid()) {
+        newSock();
+        if (SYLAR_UNLIKELY(!isValid())) {
+            return false;
+        }
+    }
+    int val = 1;
+    return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 bool Socket::isValid() const
 {
     return m_sock != -1;
@@ -561,6 +579,11 @@ void Socket::initSock()
     setOption(SOL_SOCKET, SO_REUSEADDR, val);
     if (m_type == SOCK_STREAM) {
         setOption(IPPROTO_TCP, TCP_NODELAY, val);
+        int busy_poll = g_socket_busy_poll_us->getValue();
+        if (busy_poll > 0) {
+            // 需要 CAP_NET_ADMIN 才能调大，失败只记录日志
+            setOption(SOL_SOCKET, SO_BUSY_POLL, busy_poll);
+        }
     }
 }
 
@@ -156,6 +156,12 @@ public:
         return setOption(level, option, &value, sizeof(T));
     }
 
+    /**
+     * @brief 开启 SO_REUSEPORT，多个 socket 可以监听同一个地址
+     * @details 句柄在 bind 时才创建，这里还没有句柄时先创建，必须在 bind 之前调用
+     */
+    bool setReusePort();
+
     /**
      * @brief 接收connect链接
      * @return 成功返回新连接的socket,失败返回nullptr
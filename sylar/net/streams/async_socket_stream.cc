@@ -3,6 +3,8 @@
 #include "sylar/core/log/log.h"
 #include "sylar/core/common/macro.h"
 
+#include <sched.h>
+
 namespace sylar
 {
 
@@ -54,11 +56,19 @@ void AsyncSocketStream::Ctx::doRsp()
  * @details 初始化父类SocketStream，设置信号量初始值，初始化序列号、自动重连状态等成员变量
  */
 AsyncSocketStream::AsyncSocketStream(Socket::ptr sock, bool owner)
-    : SocketStream(sock, owner), m_waitSem(2), m_sn(0), m_autoConnect(false), m_tryConnectCount(0),
-      m_iomanager(nullptr), m_worker(nullptr)
+    : SocketStream(sock, owner), m_waitSem(2), m_queueSize(0), m_sn(0), m_autoConnect(false),
+      m_tryConnectCount(0), m_iomanager(nullptr), m_worker(nullptr)
 {
 }
 
+AsyncSocketStream::~AsyncSocketStream()
+{
+    // 读写协程都持有 shared_from_this()，走到这里已经没有消费者了
+    while (SendNode *node = m_queue.pop()) {
+        delete node;
+    }
+}
+
 /**
  * @brief 启动异步Socket流
  * @return 启动是否成功
@@ -201,20 +211,14 @@ void AsyncSocketStream::doWrite()
                 break;
             }
 
-            std::list<SendCtx::ptr> ctxs;
-            {
-                RWMutexType::WriteLock lock(m_queueMutex);
-                // 交换队列，减少锁的持有时间
-                m_queue.swap(ctxs);
-            }
             auto self = shared_from_this();
-            // 逐个执行发送操作
-            for (auto &i : ctxs) {
+            // 逐个执行发送操作，发送期间新入队的也一并发完（只有队列从空变非空时才会 notify）
+            while (SendCtx::ptr ctx = dequeue()) {
                 // 在每次发送前检查连接状态和关闭状态
                 if (!isConnected() || m_closing.load()) {
                     break;
                 }
-                if (!i->doSend(self)) {
+                if (!ctx->doSend(self)) {
                     // 发送失败，关闭连接
                     innerClose();
                     break;
@@ -226,10 +230,7 @@ void AsyncSocketStream::doWrite()
     }
     SYLAR_LOG_DEBUG(g_logger) << "doWrite out " << this;
     // 清理发送队列
-    {
-        RWMutexType::WriteLock lock(m_queueMutex);
-        m_queue.clear();
-    }
+    clearQueue();
     m_waitSem.notify();
 }
 
@@ -318,15 +319,15 @@ bool AsyncSocketStream::addCtx(Ctx::ptr ctx)
  * @brief 将发送上下文加入发送队列
  * @param ctx 发送上下文对象指针
  * @return 队列是否从空变为非空
- * @details 使用写锁保护发送队列的并发访问，如果队列为空则通知写协程
+ * @details 无锁入队，多个生产者之间互不阻塞，如果队列为空则通知写协程
  */
 bool AsyncSocketStream::enqueue(SendCtx::ptr ctx)
 {
     SYLAR_ASSERT(ctx);
-    RWMutexType::WriteLock lock(m_queueMutex);
-    bool empty = m_queue.empty();
-    m_queue.push_back(ctx);
-    lock.unlock();
+    SendNode *node = new SendNode;
+    node->ctx.swap(ctx);
+    bool empty = m_queueSize.fetch_add(1) == 0;
+    m_queue.push(node);
     // 如果队列为空，则通知写协程有新数据需要发送
     if (empty) {
         m_sem.notify();
@@ -334,6 +335,39 @@ bool AsyncSocketStream::enqueue(SendCtx::ptr ctx)
     return empty;
 }
 
+/**
+ * @brief 从发送队列取出一个发送上下文
+ * @return 队列为空返回nullptr
+ * @details 计数大于0却取不到节点，说明生产者已经计数但还没完成链接，让出CPU稍后重试
+ */
+AsyncSocketStream::SendCtx::ptr AsyncSocketStream::dequeue()
+{
+    while (m_queueSize > 0) {
+        SendNode *node = m_queue.pop();
+        if (!node) {
+            sched_yield();
+            continue;
+        }
+        --m_queueSize;
+        SendCtx::ptr ctx;
+        ctx.swap(node->ctx);
+        delete node;
+        return ctx;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief 丢弃发送队列中当前的发送上下文
+ * @details 只处理调用时已经入队的数量，避免生产者持续入队时一直清不完
+ */
+void AsyncSocketStream::clearQueue()
+{
+    size_t n = m_queueSize;
+    while (n-- && dequeue()) {
+    }
+}
+
 /**
  * @brief 内部关闭方法
  * @return 关闭是否成功
@@ -372,11 +406,7 @@ bool AsyncSocketStream::innerClose()
         RWMutexType::WriteLock lock(m_mutex);
         ctxs.swap(m_ctxs);
     }
-    // 清理发送队列
-    {
-        RWMutexType::WriteLock lock(m_queueMutex);
-        m_queue.clear();
-    }
+    // 发送队列由写协程退出时清理，这里不是消费者不能动它
     // 通知所有等待的协程操作失败
     for (auto &i : ctxs) {
         i.second->result = IO_ERROR;
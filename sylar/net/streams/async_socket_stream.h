@@ -4,6 +4,7 @@
 #include <memory>
 #include "sylar/core/iomanager.h"
 #include "sylar/core/mutex.h"
+#include "sylar/core/common/lock_free_queue.h"
 #include "socket_stream.h"
 #include <boost/any.hpp>
 
@@ -31,6 +32,11 @@ public:
      */
     AsyncSocketStream(Socket::ptr sock, bool owner = true);
 
+    /**
+     * @brief 析构函数，释放发送队列中剩余的节点
+     */
+    virtual ~AsyncSocketStream();
+
     /**
      * @brief 启动异步读写
      * @return 启动是否成功
@@ -74,6 +80,13 @@ protected:
         virtual bool doSend(AsyncSocketStream::ptr stream) = 0;
     };
 
+    /**
+     * @brief 发送队列节点
+     */
+    struct SendNode : public ds::MpscNode {
+        SendCtx::ptr ctx;
+    };
+
     /**
      * @brief 上下文类，继承自SendCtx，用于管理请求-响应模式的上下文
      * @details 包含请求序列号、超时设置、结果信息、调度器、协程和定时器等
@@ -299,6 +312,17 @@ protected:
      */
     bool enqueue(SendCtx::ptr ctx);
 
+    /**
+     * @brief 从发送队列取出一个发送上下文，只能由写协程调用
+     * @return 队列为空返回nullptr
+     */
+    SendCtx::ptr dequeue();
+
+    /**
+     * @brief 丢弃发送队列中当前的所有发送上下文，只能由写协程调用
+     */
+    void clearQueue();
+
     /**
      * @brief 内部关闭方法
      * @return 关闭是否成功
@@ -316,8 +340,8 @@ protected:
 protected:
     sylar::FiberSemaphore m_sem;                   // 信号量，用于控制写操作
     sylar::FiberSemaphore m_waitSem;               // 信号量，用于等待协程结束
-    RWMutexType m_queueMutex;                      // 保护发送队列的读写锁
-    std::list<SendCtx::ptr> m_queue;               // 发送队列
+    ds::MpscQueue<SendNode> m_queue;               // 发送队列，生产者无锁入队，只有写协程消费
+    std::atomic<size_t> m_queueSize;               // 发送队列长度，入队前加，出队后减
     RWMutexType m_mutex;                           // 保护上下文库的读写锁
     std::unordered_map<uint32_t, Ctx::ptr> m_ctxs; // 上下文库，存储请求-响应上下文
 
@@ -1,6 +1,7 @@
 #include "socket_stream.h"
 #include "sylar/core/util/util.h"
 #include "sylar/core/log/log.h"
+#include "sylar/core/hook.h"
 
 namespace sylar
 {
@@ -52,6 +53,43 @@ int SocketStream::read(ByteArray::ptr ba, size_t length)
     return rt;
 }
 
+Task<int> SocketStream::coRead(void *buffer, size_t length)
+{
+    if (!isConnected()) {
+        co_return -1;
+    }
+    int fd = m_socket->getSocket();
+    uint64_t to = m_socket->getRecvTimeout();
+    while (true) {
+        // 直接用原始的 recv，EAGAIN 时挂起的是无栈协程，不走 hook 让出有栈协程
+        ssize_t n = recv_f(fd, buffer, length, 0);
+        if (n >= 0 || (errno != EAGAIN && errno != EINTR)) {
+            co_return n;
+        }
+        if (errno == EAGAIN && co_await CoWaitEvent(fd, IOManager::READ, to)) {
+            co_return -1;
+        }
+    }
+}
+
+Task<int> SocketStream::coWrite(const void *buffer, size_t length)
+{
+    if (!isConnected()) {
+        co_return -1;
+    }
+    int fd = m_socket->getSocket();
+    uint64_t to = m_socket->getSendTimeout();
+    while (true) {
+        ssize_t n = send_f(fd, buffer, length, 0);
+        if (n >= 0 || (errno != EAGAIN && errno != EINTR)) {
+            co_return n;
+        }
+        if (errno == EAGAIN && co_await CoWaitEvent(fd, IOManager::WRITE, to)) {
+            co_return -1;
+        }
+    }
+}
+
 int SocketStream::write(const void *buffer, size_t length)
 {
     if (!isConnected()) {
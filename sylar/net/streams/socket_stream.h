@@ -13,6 +13,7 @@
 #include "sylar/net/socket.h"
 #include "sylar/core/mutex.h"
 #include "sylar/core/iomanager.h"
+#include "sylar/core/coroutine.h"
 
 namespace sylar
 {
@@ -82,6 +83,18 @@ public:
      */
     virtual int write(ByteArray::ptr ba, size_t length) override;
 
+    /**
+     * @brief C++20 协程版本的 read，语义和返回值相同
+     * @details 数据没有就绪时挂起的是无栈协程，不占用协程栈；超时使用 socket 的接收超时
+     */
+    Task<int> coRead(void *buffer, size_t length);
+
+    /**
+     * @brief C++20 协程版本的 write，语义和返回值相同
+     * @details 发送缓冲满时挂起的是无栈协程，不占用协程栈；超时使用 socket 的发送超时
+     */
+    Task<int> coWrite(const void *buffer, size_t length);
+
     /**
      * @brief 关闭socket
      */
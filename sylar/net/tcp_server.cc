@@ -20,6 +20,10 @@ TcpServer::TcpServer(sylar::IOManager *worker, sylar::IOManager *io_worker,
 
 TcpServer::~TcpServer()
 {
+    // 没有调用过 stop，分片上也没有持有这个对象的任务，这里停掉分片
+    if (!m_shards.empty() && !m_shardsStopped.exchange(true)) {
+        stopShards();
+    }
     for (auto &i : m_socks) {
         i->close();
     }
@@ -31,6 +35,22 @@ void TcpServer::setConf(const TcpServerConf &v)
     m_conf.reset(new TcpServerConf(v));
 }
 
+void TcpServer::setShards(size_t shards, const std::vector<int> &cpus)
+{
+    SYLAR_ASSERT2(m_socks.empty(), "setShards must be called before bind");
+    m_shards.clear();
+    m_shardCpus.clear();
+    m_shardClients.assign(shards, {});
+    for (size_t i = 0; i < shards; ++i) {
+        m_shards.push_back(
+            std::make_shared<IOManager>(1, false, m_name + "_shard_" + std::to_string(i)));
+        if (!cpus.empty()) {
+            m_shardCpus.push_back(cpus[i % cpus.size()]);
+            m_shards.back()->setAffinity({m_shardCpus.back()});
+        }
+    }
+}
+
 bool TcpServer::bind(sylar::Address::ptr addr, bool ssl)
 {
     std::vector<Address::ptr> addrs;
@@ -43,23 +63,41 @@ bool TcpServer::bind(const std::vector<Address::ptr> &addrs, std::vector<Address
                      bool ssl)
 {
     m_ssl = ssl;
+    // 分片模式下每个地址在每个分片上各监听一次，m_socks 按 地址 x 分片 排列
+    size_t copies = m_shards.empty() ? 1 : m_shards.size();
     for (auto &addr : addrs) {
-        Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
-        if (!sock->bind(addr)) {
-            SYLAR_LOG_ERROR(g_logger)
-                << "bind fail errno=" << errno << " errstr=" << strerror(errno) << " addr=["
-                << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
-        }
-        if (!sock->listen()) {
-            SYLAR_LOG_ERROR(g_logger)
-                << "listen fail errno=" << errno << " errstr=" << strerror(errno) << " addr=["
-                << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        for (size_t i = 0; i < copies; ++i) {
+            Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
+            if (!m_shards.empty() && !sock->setReusePort()) {
+                SYLAR_LOG_ERROR(g_logger)
+                    << "set SO_REUSEPORT fail errno=" << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            // 失败不影响监听，只是连接不再按 CPU 分配
+            if (!m_shardCpus.empty()
+                && !sock->setOption(SOL_SOCKET, SO_INCOMING_CPU, m_shardCpus[i])) {
+                SYLAR_LOG_WARN(g_logger)
+                    << "set SO_INCOMING_CPU fail errno=" << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+            }
+            if (!sock->bind(addr)) {
+                SYLAR_LOG_ERROR(g_logger)
+                    << "bind fail errno=" << errno << " errstr=" << strerror(errno) << " addr=["
+                    << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if (!sock->listen()) {
+                SYLAR_LOG_ERROR(g_logger)
+                    << "listen fail errno=" << errno << " errstr=" << strerror(errno) << " addr=["
+                    << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            m_socks.push_back(sock);
         }
-        m_socks.push_back(sock);
     }
 
     if (!fails.empty()) {
@@ -76,12 +114,31 @@ bool TcpServer::bind(const std::vector<Address::ptr> &addrs, std::vector<Address
 
 void TcpServer::startAccept(Socket::ptr sock)
 {
+    // 分片模式下连接留在接收它的分片上处理
+    IOManager *worker = m_shards.empty() ? m_ioWorker : IOManager::GetThis();
+    size_t shard = 0;
+    while (shard < m_shards.size() && m_shards[shard].get() != worker) {
+        ++shard;
+    }
     while (!m_isStop) {
         Socket::ptr client = sock->accept();
         if (client) {
             client->setRecvTimeout(m_recvTimeout);
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
-        } else {
+            std::function<void()> cb;
+            if (m_shards.empty()) {
+                cb = std::bind(&TcpServer::handleClient, shared_from_this(), client);
+            } else {
+                cb = std::bind(&TcpServer::handleShardClient, shared_from_this(), shard, client);
+            }
+            if (m_conf && m_conf->shared_stack) {
+                // 连接协程大部分时间挂起在读上，用共享栈只保留实际用到的栈内容
+                Fiber::ptr fiber(new Fiber(std::move(cb), 0, true, true));
+                worker->schedule(fiber);
+            } else {
+                worker->schedule(std::move(cb));
+            }
+        } else if (!m_isStop) {
+            // 停止时监听 socket 被关闭，accept 失败是正常的
             SYLAR_LOG_ERROR(g_logger) << "accept errno=" << errno << " errstr=" << strerror(errno);
         }
     }
@@ -93,8 +150,11 @@ bool TcpServer::start()
         return true;
     }
     m_isStop = false;
-    for (auto &sock : m_socks) {
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+    for (size_t i = 0; i < m_socks.size(); ++i) {
+        IOManager *accept_worker =
+            m_shards.empty() ? m_acceptWorker : m_shards[i % m_shards.size()].get();
+        accept_worker->schedule(
+            std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]));
     }
     return true;
 }
@@ -103,6 +163,21 @@ void TcpServer::stop()
 {
     m_isStop = true;
     auto self = shared_from_this();
+    if (!m_shards.empty() || m_shardsStopped) {
+        // 分片只停一次，可能已经有别的线程在等分片退出
+        if (m_shardsStopped.exchange(true)) {
+            return;
+        }
+        // 分片不能在自己的线程上等自己退出
+        for (auto &i : m_shards) {
+            if (i.get() == IOManager::GetThis()) {
+                Thread::ptr(new Thread([self]() { self->stopShards(); }, m_name + "_stop"));
+                return;
+            }
+        }
+        stopShards();
+        return;
+    }
     m_acceptWorker->schedule([this, self]() {
         for (auto &sock : m_socks) {
             sock->cancelAll();
@@ -112,6 +187,50 @@ void TcpServer::stop()
     });
 }
 
+void TcpServer::stopShards()
+{
+    size_t shards = m_shards.size();
+    for (size_t s = 0; s < shards; ++s) {
+        SYLAR_ASSERT2(m_shards[s].get() != IOManager::GetThis(),
+                      "TcpServer::stopShards on shard " << s);
+        // 监听 socket 的等待事件在各自分片的 IOManager 上，只能在那里取消
+        std::vector<Socket::ptr> socks;
+        for (size_t i = s; i < m_socks.size(); i += shards) {
+            socks.push_back(m_socks[i]);
+        }
+        m_shards[s]->schedule([this, s, socks]() {
+            for (auto &sock : socks) {
+                sock->cancelAll();
+                sock->close();
+            }
+            // 长连接挂在读上，读到 EOF 之后自己结束，分片才能退出
+            for (auto &client : m_shardClients[s]) {
+                ::shutdown(client->getSocket(), SHUT_RDWR);
+            }
+        });
+    }
+    m_socks.clear();
+    // 等分片上的任务全部结束、线程退出，之后没有任务再持有 shared_from_this()，
+    // 分片的 IOManager 也不会在自己的线程上析构
+    for (auto &i : m_shards) {
+        i->stop();
+    }
+    m_shards.clear();
+    m_shardClients.clear();
+}
+
+void TcpServer::handleShardClient(size_t shard, Socket::ptr client)
+{
+    // 停止之后才开始处理的连接直接关掉，不然分片要等它读超时才能退出
+    if (m_isStop) {
+        return;
+    }
+    auto &clients = m_shardClients[shard];
+    clients.insert(client);
+    handleClient(client);
+    clients.erase(client);
+}
+
 void TcpServer::handleClient(Socket::ptr client)
 {
     SYLAR_LOG_INFO(g_logger) << "handleClient: " << *client;
@@ -136,6 +255,7 @@ std::string TcpServer::toString(const std::string &prefix)
     ss << prefix << "[type=" << m_type << " name=" << m_name << " ssl=" << m_ssl
        << " worker=" << (m_worker ? m_worker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
+       << " shards=" << m_shards.size()
        << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
     for (auto &i : m_socks) {
@@ -9,8 +9,10 @@
 #ifndef __SYLAR_TCP_SERVER_H__
 #define __SYLAR_TCP_SERVER_H__
 
+#include <atomic>
 #include <memory>
 #include <functional>
+#include <unordered_set>
 #include "address.h"
 #include "sylar/core/iomanager.h"
 #include "socket.h"
@@ -27,6 +29,14 @@ struct TcpServerConf {
     int keepalive = 0;
     int timeout = 1000 * 2 * 60;
     int ssl = 0;
+    /// 连接协程是否使用共享栈，适合大量长连接、多数时间挂起的场景
+    int shared_stack = 0;
+    /// 分片数，大于 0 时每个分片一个单线程 IOManager 和一组 SO_REUSEPORT 监听 socket，
+    /// 连接在接收它的分片上处理，不再交给 accept_worker / io_worker
+    int shards = 0;
+    /// 分片绑定的 CPU 列表，例如 "0-3" 或 "node:0"，第 i 个分片绑在第 i % n 个 CPU 上，
+    /// 监听 socket 设置 SO_INCOMING_CPU，内核优先把网卡在这个 CPU 上收到的连接交给它
+    std::string cpus;
     std::string id;
     /// 服务器类型，http, ws, rock
     std::string type = "http";
@@ -43,7 +53,9 @@ struct TcpServerConf {
     bool operator==(const TcpServerConf &oth) const
     {
         return address == oth.address && keepalive == oth.keepalive && timeout == oth.timeout
-               && name == oth.name && ssl == oth.ssl && cert_file == oth.cert_file
+               && name == oth.name && ssl == oth.ssl && shared_stack == oth.shared_stack && shards == oth.shards
+               && cpus == oth.cpus
+               && cert_file == oth.cert_file
                && key_file == oth.key_file && accept_worker == oth.accept_worker
                && io_worker == oth.io_worker && process_worker == oth.process_worker
                && args == oth.args && id == oth.id && type == oth.type;
@@ -64,6 +76,9 @@ public:
         conf.timeout = node["timeout"].as<int>(conf.timeout);
         conf.name = node["name"].as<std::string>(conf.name);
         conf.ssl = node["ssl"].as<int>(conf.ssl);
+        conf.shared_stack = node["shared_stack"].as<int>(conf.shared_stack);
+        conf.shards = node["shards"].as<int>(conf.shards);
+        conf.cpus = node["cpus"].as<std::string>(conf.cpus);
         conf.cert_file = node["cert_file"].as<std::string>(conf.cert_file);
         conf.key_file = node["key_file"].as<std::string>(conf.key_file);
         conf.accept_worker = node["accept_worker"].as<std::string>();
@@ -93,6 +108,9 @@ public:
         node["keepalive"] = conf.keepalive;
         node["timeout"] = conf.timeout;
         node["ssl"] = conf.ssl;
+        node["shared_stack"] = conf.shared_stack;
+        node["shards"] = conf.shards;
+        node["cpus"] = conf.cpus;
         node["cert_file"] = conf.cert_file;
         node["key_file"] = conf.key_file;
         node["accept_worker"] = conf.accept_worker;
@@ -155,6 +173,8 @@ public:
 
     /**
       * @brief 停止服务
+      * @details 分片模式下关闭监听 socket、让分片上的连接读到 EOF 结束，然后停止并等待所有分片退出。
+      *          在分片的线程上调用时换一个线程去等
       */
     virtual void stop();
 
@@ -191,6 +211,18 @@ public:
 
     std::vector<Socket::ptr> getSocks() const { return m_socks; }
 
+    /**
+      * @brief 设置分片数，需要在 bind 之前调用
+      * @details 大于 0 时创建 shards 个单线程 IOManager，各自有独立的 epoll、定时器和任务队列；
+      *          bind 为每个地址在每个分片上创建一个 SO_REUSEPORT 监听 socket，
+      *          由内核把新连接分散到各个分片，连接的接收和处理都在同一个线程上，没有跨线程交接
+      * @param[in] cpus 非空时第 i 个分片的线程绑在 cpus[i % cpus.size()] 上，
+      *            它的监听 socket 设置 SO_INCOMING_CPU 为同一个 CPU
+      */
+    void setShards(size_t shards, const std::vector<int> &cpus = {});
+
+    size_t getShards() const { return m_shards.size(); }
+
 protected:
     /**
       * @brief 处理新连接的Socket类
@@ -202,6 +234,24 @@ protected:
       */
     virtual void startAccept(Socket::ptr sock);
 
+    /**
+      * @brief 分片模式下处理新连接，记下正在处理的连接，停止时通知它们结束
+      */
+    void handleShardClient(size_t shard, Socket::ptr client);
+
+    /**
+      * @brief 停止并等待所有分片退出，之后分片上没有任务再持有这个对象，不能在分片的线程上调用
+      */
+    void stopShards();
+
+    /**
+      * @brief 处理请求的调度器，分片模式下是当前分片，否则是 m_worker
+      */
+    IOManager *getProcessWorker() const
+    {
+        return m_shards.empty() ? m_worker : IOManager::GetThis();
+    }
+
 protected:
     /// 监听Socket数组
     std::vector<Socket::ptr> m_socks;
@@ -210,6 +260,14 @@ protected:
     IOManager *m_ioWorker;
     /// 服务器Socket接收连接的调度器
     IOManager *m_acceptWorker;
+    /// 分片模式下每个分片的 IOManager，m_socks[i] 属于 m_shards[i % m_shards.size()]
+    std::vector<IOManager::ptr> m_shards;
+    /// 每个分片上正在处理的连接，只在分片自己的线程上读写
+    std::vector<std::unordered_set<Socket::ptr> > m_shardClients;
+    /// 分片是否已经(开始)停止
+    std::atomic<bool> m_shardsStopped{false};
+    /// 每个分片绑定的 CPU，没有绑定为空
+    std::vector<int> m_shardCpus;
     /// 接收超时时间(毫秒)
     uint64_t m_recvTimeout;
     /// 服务器名称
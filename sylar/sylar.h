@@ -11,6 +11,10 @@
 #include "sylar/core/scheduler.h"
 #include "sylar/core/iomanager.h"
 #include "sylar/core/timermanager.h"
+#include "sylar/core/channel.h"
+#include "sylar/core/coroutine.h"
+#include "sylar/core/future.h"
+#include "sylar/core/watchdog.h"
 #include "sylar/core/memory/memorypool.h"
 #include "sylar/core/worker.h"
 #include "sylar/core/env.h"
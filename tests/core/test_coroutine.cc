@@ -0,0 +1,267 @@
+#include "sylar/sylar.h"
+#include "sylar/core/coroutine.h"
+#include "sylar/core/fd_manager.h"
+#include "sylar/core/hook.h"
+
+#include <sys/socket.h>
+#include <atomic>
+
+/**
+ * C++20 无栈协程测试
+ * 1. Task 嵌套 co_await、返回值、异常，有栈协程里 CoWait 等结果(包括共享栈协程)
+ * 2. 定时器(CoSleep)、fd 就绪和超时(CoWaitEvent)、FiberSemaphore(CoAcquire)
+ * 3. 反方向：协程里 CoRunInFiber 调用 hook 过的阻塞接口
+ * 4. 切换开销：直接 resume/yield(有栈) 对比 resume/挂起(无栈)；
+ *    经过调度器让出再回来：有栈协程 schedule(self)+yield 对比 co_await CoYield()
+ *
+ * 用法：test_coroutine [switches=1000000] [yields=200000]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::Task<int> add(int a, int b)
+{
+    co_return a + b;
+}
+
+static sylar::Task<int> sum(int n)
+{
+    int total = 0;
+    for (int i = 0; i < n; ++i) {
+        total = co_await add(total, i);
+    }
+    co_return total;
+}
+
+static sylar::Task<> fail()
+{
+    co_await add(1, 2);
+    throw std::runtime_error("fail");
+}
+
+static sylar::Task<uint64_t> sleep_for(uint64_t ms)
+{
+    uint64_t begin = sylar::GetCurrentMS();
+    co_await sylar::CoSleep(ms);
+    co_return sylar::GetCurrentMS() - begin;
+}
+
+static void test_task()
+{
+    sylar::IOManager iom(2, false, "task");
+    iom.schedule([]() {
+        // 没有挂起，当前协程不让出
+        SYLAR_ASSERT(sylar::CoWait(sum(100)) == 4950);
+        bool caught = false;
+        try {
+            sylar::CoWait(fail());
+        } catch (std::runtime_error &e) {
+            caught = true;
+        }
+        SYLAR_ASSERT(caught);
+        // 挂起在定时器上，结束后调度回来
+        uint64_t cost = sylar::CoWait(sleep_for(50));
+        SYLAR_ASSERT2(cost >= 45, "cost=" << cost);
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "task ok";
+}
+
+static sylar::Task<int> square_later(int v)
+{
+    co_await sylar::CoSleep(5);
+    co_return v * v;
+}
+
+static void test_shared_stack_wait()
+{
+    // 一批共享栈协程同时挂在 CoWait 上，结果由定时器线程写入，不能写到被覆盖的栈上
+    sylar::IOManager iom(2, false, "shared");
+    const int n = 64;
+    std::atomic<int> done{0};
+    for (int i = 0; i < n; ++i) {
+        iom.schedule(sylar::Fiber::ptr(new sylar::Fiber(
+            [i, &done]() {
+                for (int j = 0; j < 10; ++j) {
+                    int rt = sylar::CoWait(square_later(i + j));
+                    SYLAR_ASSERT2(rt == (i + j) * (i + j), "i=" << i << " j=" << j << " rt=" << rt);
+                }
+                ++done;
+            },
+            0, true, true)));
+    }
+    iom.stop();
+    SYLAR_ASSERT(done == n);
+    SYLAR_LOG_INFO(g_logger) << "shared stack wait ok";
+}
+
+static sylar::Task<> reader(int fd, std::atomic<int> *step)
+{
+    // 没有数据，超时
+    int rt = co_await sylar::CoWaitEvent(fd, sylar::IOManager::READ, 30);
+    SYLAR_ASSERT(rt == -1 && errno == ETIMEDOUT);
+    step->store(1);
+    rt = co_await sylar::CoWaitEvent(fd, sylar::IOManager::READ, 1000);
+    SYLAR_ASSERT(rt == 0);
+    char buf[16];
+    SYLAR_ASSERT(recv_f(fd, buf, sizeof(buf), 0) == 5);
+    step->store(2);
+}
+
+static sylar::Task<> acquirer(sylar::FiberSemaphore *sem, std::atomic<int> *acquired)
+{
+    co_await sylar::CoAcquire(*sem);
+    ++*acquired;
+}
+
+static sylar::Task<int> call_blocking()
+{
+    // 在有栈协程里调用 hook 过的 usleep
+    int v = co_await sylar::CoRunInFiber([]() {
+        usleep(20 * 1000);
+        return 42;
+    });
+    co_return v;
+}
+
+static void test_awaitables()
+{
+    sylar::IOManager iom(2, false, "await");
+    int fds[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::atomic<int> step{0};
+    iom.schedule([&fds, &step]() {
+        // 经过 hook 过的 socket 函数把 fd 交给 FdMgr，设置成非阻塞
+        sylar::FdMgr::GetInstance()->get(fds[0], true);
+        sylar::FdMgr::GetInstance()->get(fds[1], true);
+        sylar::CoSpawn(reader(fds[0], &step));
+        while (step < 1) {
+            usleep(1000);
+        }
+        usleep(10 * 1000);
+        SYLAR_ASSERT(write(fds[1], "hello", 5) == 5);
+    });
+
+    sylar::FiberSemaphore sem;
+    std::atomic<int> acquired{0};
+    for (int i = 0; i < 3; ++i) {
+        sylar::CoSpawn(acquirer(&sem, &acquired), &iom);
+    }
+    iom.schedule([&sem, &acquired]() {
+        usleep(10 * 1000);
+        SYLAR_ASSERT(acquired == 0);
+        sem.notify();
+        sem.notify();
+        usleep(10 * 1000);
+        SYLAR_ASSERT(acquired == 2);
+        sem.notify();
+    });
+
+    std::atomic<int> blocking{0};
+    iom.schedule([&blocking]() { blocking = sylar::CoWait(call_blocking()); });
+    iom.stop();
+    SYLAR_ASSERT(step == 2);
+    SYLAR_ASSERT(acquired == 3);
+    SYLAR_ASSERT(blocking == 42);
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "awaitables ok";
+}
+
+/**
+ * 每次 co_await 都挂起，由调用方 resume
+ */
+struct Pinger {
+    struct promise_type {
+        Pinger get_return_object()
+        {
+            return Pinger{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+static Pinger ping_forever()
+{
+    while (true) {
+        co_await std::suspend_always();
+    }
+}
+
+static void bench_switch(int switches)
+{
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber([]() {
+        while (true) {
+            sylar::Fiber::GetThis()->yield();
+        }
+    }, 0, false));
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int i = 0; i < switches; ++i) {
+        fiber->resume();
+    }
+    uint64_t fiber_us = sylar::GetCurrentUS() - begin;
+
+    Pinger p = ping_forever();
+    begin = sylar::GetCurrentUS();
+    for (int i = 0; i < switches; ++i) {
+        p.handle.resume();
+    }
+    uint64_t co_us = sylar::GetCurrentUS() - begin;
+    p.handle.destroy();
+    std::cout << "resume/suspend x" << switches << " fiber=" << fiber_us * 1000.0 / switches
+              << "ns coroutine=" << co_us * 1000.0 / switches << "ns" << std::endl;
+}
+
+static sylar::Task<> co_yielder(int yields)
+{
+    for (int i = 0; i < yields; ++i) {
+        co_await sylar::CoYield();
+    }
+}
+
+static void bench_yield(int yields)
+{
+    uint64_t fiber_us = 0, co_us = 0;
+    {
+        sylar::IOManager iom(1, false, "yield");
+        uint64_t begin = sylar::GetCurrentUS();
+        iom.schedule([yields]() {
+            for (int i = 0; i < yields; ++i) {
+                sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis());
+                sylar::Fiber::GetThis()->yield();
+            }
+        });
+        iom.stop();
+        fiber_us = sylar::GetCurrentUS() - begin;
+    }
+    {
+        sylar::IOManager iom(1, false, "co_yield");
+        uint64_t begin = sylar::GetCurrentUS();
+        sylar::CoSpawn(co_yielder(yields), &iom);
+        iom.stop();
+        co_us = sylar::GetCurrentUS() - begin;
+    }
+    std::cout << "scheduler yield x" << yields << " fiber=" << fiber_us * 1000.0 / yields
+              << "ns coroutine=" << co_us * 1000.0 / yields << "ns" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    int switches = argc > 1 ? atoi(argv[1]) : 1000000;
+    int yields = argc > 2 ? atoi(argv[2]) : 200000;
+
+    test_task();
+    test_shared_stack_wait();
+    test_awaitables();
+    bench_switch(switches);
+    bench_yield(yields);
+    return 0;
+}
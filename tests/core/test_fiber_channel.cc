@@ -0,0 +1,254 @@
+#include "sylar/sylar.h"
+#include "sylar/core/ds/blocking_queue.h"
+
+#include <atomic>
+
+/**
+ * 协程通道测试
+ * 1. 有界通道：发送方在满的时候挂起，接收顺序和发送顺序一致
+ * 2. 只能移动的元素、关闭之后取完剩余数据再返回 false
+ * 3. select：超时返回 -1，多个通道哪个先就绪选哪个
+ * 4. 共享栈协程在通道上挂起，等待节点不受栈被覆盖的影响
+ * 5. ping-pong 吞吐：两个协程通过一对通道来回传一个计数，对比 FiberChannel 和原来的 ds::BlockingQueue
+ *
+ * 用法：test_fiber_channel [threads=1] [rounds=200000]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void test_bounded()
+{
+    sylar::IOManager iom(2, false, "bounded");
+    sylar::FiberChannel<int> ch(4);
+    const int count = 10000;
+    std::atomic<size_t> max_size{0};
+    iom.schedule([&ch, count]() {
+        for (int i = 0; i < count; ++i) {
+            SYLAR_ASSERT(ch.send(i));
+        }
+        ch.close();
+    });
+    iom.schedule([&ch, &max_size, count]() {
+        int expect = 0, v = 0;
+        while (ch.recv(v)) {
+            SYLAR_ASSERT2(v == expect, "v=" << v << " expect=" << expect);
+            ++expect;
+            max_size = std::max(max_size.load(), ch.size());
+        }
+        SYLAR_ASSERT(expect == count);
+    });
+    iom.stop();
+    SYLAR_ASSERT(max_size <= ch.capacity());
+    SYLAR_LOG_INFO(g_logger) << "bounded ok max_size=" << max_size;
+}
+
+static void test_move_only_close()
+{
+    sylar::IOManager iom(1, false, "close");
+    sylar::FiberChannel<std::unique_ptr<std::string> > ch;
+    iom.schedule([&ch]() {
+        std::unique_ptr<std::string> v;
+        // 先挂起等数据，再由另一个协程发两个元素后关闭
+        SYLAR_ASSERT(ch.recv(v) && *v == "a");
+        SYLAR_ASSERT(ch.recv(v) && *v == "b");
+        SYLAR_ASSERT(!ch.recv(v));
+        SYLAR_ASSERT(!ch.send(std::make_unique<std::string>("c")));
+    });
+    iom.schedule([&ch]() {
+        ch.send(std::make_unique<std::string>("a"));
+        std::unique_ptr<std::string> b = std::make_unique<std::string>("b");
+        SYLAR_ASSERT(ch.trySend(std::move(b)) && !b);
+        ch.close();
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "move only / close ok";
+}
+
+static void test_shared_stack()
+{
+    // 多个共享栈协程轮流在同一个容量为 1 的通道上挂起，挂起期间栈区域被别的协程覆盖
+    sylar::IOManager iom(1, false, "shared");
+    sylar::FiberChannel<int> ch(1);
+    const int producers = 8, count = 2000;
+    std::atomic<int> done{0};
+    std::atomic<int64_t> sum{0};
+    for (int p = 0; p < producers; ++p) {
+        iom.schedule(sylar::Fiber::ptr(new sylar::Fiber(
+            [&ch, &done, count]() {
+                for (int i = 0; i < count; ++i) {
+                    SYLAR_ASSERT(ch.send(i));
+                }
+                if (++done == producers) {
+                    ch.close();
+                }
+            },
+            0, true, true)));
+    }
+    for (int c = 0; c < producers; ++c) {
+        iom.schedule(sylar::Fiber::ptr(new sylar::Fiber(
+            [&ch, &sum]() {
+                int v = 0;
+                while (ch.recv(v, 1000) || !ch.isClosed()) {
+                    sum += v;
+                    v = 0;
+                }
+            },
+            0, true, true)));
+    }
+    iom.stop();
+    SYLAR_ASSERT(sum == (int64_t)producers * count * (count - 1) / 2);
+    SYLAR_LOG_INFO(g_logger) << "shared stack ok";
+}
+
+static void test_select()
+{
+    sylar::IOManager iom(2, false, "select");
+    sylar::FiberChannel<int> a(1), b;
+    iom.schedule([&a, &b]() {
+        int va = 0, vb = 0;
+        {
+            sylar::FiberSelect sel;
+            sel.recv(a, va);
+            sel.recv(b, vb);
+            uint64_t begin = sylar::GetCurrentMS();
+            SYLAR_ASSERT(sel.wait(50) == -1);
+            SYLAR_ASSERT(sylar::GetCurrentMS() - begin >= 45);
+        }
+        {
+            sylar::FiberSelect sel;
+            sel.recv(a, va);
+            int ib = sel.recv(b, vb);
+            SYLAR_ASSERT(sel.wait(1000) == ib && vb == 7);
+        }
+        // a 满了，发送分支不就绪，接收分支先完成
+        int one = 1;
+        SYLAR_ASSERT(a.trySend(std::move(one)));
+        {
+            sylar::FiberSelect sel;
+            int two = 2;
+            sel.send(a, two);
+            int ib = sel.recv(b, vb);
+            SYLAR_ASSERT(sel.wait() == ib && vb == 8);
+        }
+        SYLAR_ASSERT(a.recv(va, 0) && va == 1);
+        SYLAR_ASSERT(!b.recv(vb, 0));
+    });
+    iom.schedule([&b]() {
+        usleep(100 * 1000);
+        b.send(7);
+        usleep(10 * 1000);
+        b.send(8);
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "select ok";
+}
+
+/**
+ * 多个 select 抢同一个通道时数据不能丢：每个接收协程同时等公共通道和自己的退出通道
+ */
+static void test_select_fanin()
+{
+    sylar::IOManager iom(2, false, "fanin");
+    sylar::FiberChannel<int> work(8);
+    const int workers = 8, count = 20000;
+    std::vector<std::unique_ptr<sylar::FiberChannel<int> > > quit;
+    std::atomic<int> received{0};
+    for (int i = 0; i < workers; ++i) {
+        quit.emplace_back(new sylar::FiberChannel<int>());
+        sylar::FiberChannel<int> *q = quit.back().get();
+        iom.schedule([&work, &received, q]() {
+            while (true) {
+                int v = 0, stop = 0;
+                sylar::FiberSelect sel;
+                int iw = sel.recv(work, v);
+                sel.recv(*q, stop);
+                if (sel.wait() != iw) {
+                    return;
+                }
+                ++received;
+            }
+        });
+    }
+    iom.schedule([&work, &quit, &received, count]() {
+        for (int i = 0; i < count; ++i) {
+            work.send(i);
+        }
+        while (received < count) {
+            usleep(1000);
+        }
+        for (auto &q : quit) {
+            q->send(0);
+        }
+    });
+    iom.stop();
+    SYLAR_ASSERT(received == count);
+    SYLAR_LOG_INFO(g_logger) << "select fan-in ok received=" << received;
+}
+
+static void bench_channel(size_t threads, int rounds)
+{
+    sylar::IOManager iom(threads, false, "channel");
+    sylar::FiberChannel<int> ping(1), pong(1);
+    uint64_t begin = sylar::GetCurrentUS();
+    iom.schedule([&ping, &pong, rounds]() {
+        int v = 0;
+        for (int i = 0; i < rounds; ++i) {
+            ping.send(i);
+            pong.recv(v);
+        }
+        ping.close();
+    });
+    iom.schedule([&ping, &pong]() {
+        int v = 0;
+        while (ping.recv(v)) {
+            pong.send(v);
+        }
+    });
+    iom.stop();
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    std::cout << "FiberChannel   threads=" << threads << " rounds=" << rounds
+              << " cost=" << us / 1000 << "ms round_trips/sec="
+              << (uint64_t)(rounds * 1000000.0 / (us ? us : 1)) << std::endl;
+}
+
+static void bench_blocking_queue(size_t threads, int rounds)
+{
+    sylar::IOManager iom(threads, false, "blocking_queue");
+    sylar::ds::BlockingQueue<int> ping, pong;
+    uint64_t begin = sylar::GetCurrentUS();
+    iom.schedule([&ping, &pong, rounds]() {
+        for (int i = 0; i < rounds; ++i) {
+            ping.push(std::make_shared<int>(i));
+            pong.pop();
+        }
+        ping.push(nullptr);
+    });
+    iom.schedule([&ping, &pong]() {
+        while (auto v = ping.pop()) {
+            pong.push(v);
+        }
+    });
+    iom.stop();
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    std::cout << "BlockingQueue  threads=" << threads << " rounds=" << rounds
+              << " cost=" << us / 1000 << "ms round_trips/sec="
+              << (uint64_t)(rounds * 1000000.0 / (us ? us : 1)) << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    size_t threads = argc > 1 ? atoi(argv[1]) : 1;
+    int rounds = argc > 2 ? atoi(argv[2]) : 200000;
+
+    test_bounded();
+    test_move_only_close();
+    test_shared_stack();
+    test_select();
+    test_select_fanin();
+    bench_blocking_queue(threads, rounds);
+    bench_channel(threads, rounds);
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include "sylar/sylar.h"
+#include "sylar/core/fiber_local.h"
+
+#include <atomic>
+#include <set>
+
+/**
+ * 协程局部变量测试
+ * 1. 每个协程各有一份，让出之后被别的线程继续运行，值不变
+ * 2. 协程函数执行完析构，复用的协程(调度器的 cb_fiber、Fiber::reset)看到的是新值
+ * 3. InheritFiberLocals 只带上可继承的变量
+ * 4. 开销：get() 和 thread_local 对比
+ *
+ * 用法：test_fiber_local [loops=10000000]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * 统计构造和析构次数
+ */
+struct Counted {
+    static std::atomic<int> s_alive;
+    int value = 0;
+    Counted() { ++s_alive; }
+    Counted(const Counted &rhs) : value(rhs.value) { ++s_alive; }
+    Counted &operator=(const Counted &) = default;
+    ~Counted() { --s_alive; }
+};
+std::atomic<int> Counted::s_alive{0};
+
+static sylar::FiberLocal<std::string> s_trace_id("trace_id", true);
+static sylar::FiberLocal<Counted> s_counted("counted");
+static sylar::FiberLocal<uint64_t> s_deadline("deadline", true);
+
+static void test_isolation()
+{
+    std::atomic<int> migrated{0};
+    {
+        sylar::IOManager iom(4, false, "isolation");
+        for (int i = 0; i < 64; ++i) {
+            iom.schedule([i, &migrated]() {
+                std::string id = "req-" + std::to_string(i);
+                SYLAR_ASSERT(s_trace_id.peek() == nullptr);
+                s_trace_id.set(id);
+                s_counted->value = i;
+                int thread = sylar::GetThreadId();
+                for (int j = 0; j < 10; ++j) {
+                    usleep(1000);
+                    SYLAR_ASSERT2(s_trace_id.get() == id, s_trace_id.get() << " != " << id);
+                    SYLAR_ASSERT(s_counted->value == i);
+                }
+                if (thread != sylar::GetThreadId()) {
+                    ++migrated;
+                }
+            });
+        }
+        iom.stop();
+    }
+    SYLAR_ASSERT2(Counted::s_alive == 0, "alive=" << Counted::s_alive);
+    SYLAR_LOG_INFO(g_logger) << "isolation ok, migrated fibers=" << migrated;
+}
+
+static void test_reuse()
+{
+    // 一个线程跑很多个回调任务，调度器会复用同一个 cb_fiber
+    std::atomic<int> fresh{0};
+    {
+        sylar::IOManager iom(1, false, "reuse");
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule([&fresh]() {
+                if (s_counted->value == 0) {
+                    ++fresh;
+                }
+                s_counted->value = 42;
+            });
+        }
+        iom.stop();
+    }
+    SYLAR_ASSERT2(fresh == 100, "fresh=" << fresh);
+    SYLAR_ASSERT(Counted::s_alive == 0);
+
+    // 直接复用 Fiber
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber([]() { s_counted->value = 1; }, 0, false));
+    fiber->resume();
+    SYLAR_ASSERT(Counted::s_alive == 0);
+    fiber->reset([]() {
+        SYLAR_ASSERT(s_counted->value == 0);
+        s_counted->value = 2;
+        sylar::Fiber::GetThis()->yield();
+    });
+    fiber->resume();
+    SYLAR_ASSERT(Counted::s_alive == 1);
+    fiber->resume();
+    SYLAR_ASSERT(Counted::s_alive == 0);
+
+    // 线程主协程也有一份
+    s_counted->value = 3;
+    SYLAR_ASSERT(Counted::s_alive == 1);
+    s_counted.reset();
+    SYLAR_ASSERT(Counted::s_alive == 0);
+    SYLAR_LOG_INFO(g_logger) << "reuse ok";
+}
+
+static void test_inherit()
+{
+    sylar::IOManager iom(2, false, "inherit");
+    std::atomic<int> checked{0};
+    iom.schedule([&iom, &checked]() {
+        s_trace_id.set("parent");
+        s_deadline.set(12345);
+        s_counted->value = 7;
+        iom.schedule(sylar::InheritFiberLocals([&checked]() {
+            SYLAR_ASSERT(s_trace_id.get() == "parent");
+            SYLAR_ASSERT(*s_deadline == 12345);
+            // 不可继承的不带过去
+            SYLAR_ASSERT(s_counted.peek() == nullptr);
+            s_trace_id.set("child");
+            ++checked;
+        }));
+        // 不包装就不继承
+        iom.schedule([&checked]() {
+            SYLAR_ASSERT(s_trace_id.peek() == nullptr);
+            ++checked;
+        });
+        usleep(10 * 1000);
+        // 子任务的修改不影响父协程
+        SYLAR_ASSERT(s_trace_id.get() == "parent");
+    });
+    iom.stop();
+    SYLAR_ASSERT(checked == 2);
+    SYLAR_ASSERT(Counted::s_alive == 0);
+    SYLAR_LOG_INFO(g_logger) << "inherit ok";
+}
+
+static thread_local uint64_t t_value = 0;
+
+static void bench(int loops)
+{
+    sylar::IOManager iom(1, false, "bench");
+    iom.schedule([loops]() {
+        uint64_t begin = sylar::GetCurrentUS();
+        for (int i = 0; i < loops; ++i) {
+            ++s_deadline.get();
+            asm volatile("" ::: "memory");
+        }
+        uint64_t fl = sylar::GetCurrentUS() - begin;
+
+        begin = sylar::GetCurrentUS();
+        for (int i = 0; i < loops; ++i) {
+            ++t_value;
+            asm volatile("" ::: "memory");
+        }
+        uint64_t tl = sylar::GetCurrentUS() - begin;
+        SYLAR_ASSERT(*s_deadline == (uint64_t)loops);
+        std::cout << "loops=" << loops << " FiberLocal::get ns/op=" << fl * 1000.0 / loops
+                  << " thread_local ns/op=" << tl * 1000.0 / loops << std::endl;
+    });
+    iom.stop();
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    int loops = argc > 1 ? atoi(argv[1]) : 10000000;
+
+    test_isolation();
+    test_reuse();
+    test_inherit();
+    bench(loops);
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "sylar/sylar.h"
+#include "sylar/core/memory/memorypool.h"
+#include "sylar/core/memory/stack_pool.h"
+
+#include <iomanip>
+
+/**
+ * 协程栈池测试
+ * 1. 单线程反复创建/运行/销毁协程，统计每秒创建销毁次数
+ * 2. 调度器执行 cb 任务（每个任务一个新协程），统计每秒任务数
+ * 3. 强制 trim 后驻留字节数下降，再次分配依旧命中
+ * 4. fiber.stack_pool.use_arena 打开后栈从页缓存分配，trim 时整个还给页缓存
+ *
+ * 用法：test_fiber_stack_pool [fibers]，默认 200000
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void report(const char *name, uint64_t count, uint64_t us)
+{
+    std::cout << std::left << std::setw(10) << name << " count=" << std::setw(8) << count
+              << " cost=" << std::setw(6) << us / 1000
+              << "ms ops/sec=" << (uint64_t)(count * 1000000.0 / (us ? us : 1)) << std::endl;
+}
+
+static void bench_create(uint64_t n)
+{
+    sylar::Fiber::GetThis();
+    uint64_t sum = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < n; ++i) {
+        sylar::Fiber::ptr fiber(new sylar::Fiber([&sum]() { ++sum; }, 0, false));
+        fiber->resume();
+    }
+    report("create", sum, sylar::GetCurrentUS() - begin);
+}
+
+static void bench_scheduler(uint64_t n)
+{
+    std::atomic<uint64_t> sum{0};
+    sylar::Scheduler sc(1, false, "bench");
+    sc.start();
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < n; ++i) {
+        sc.schedule([&sum]() { ++sum; });
+    }
+    sc.stop();
+    report("scheduler", sum, sylar::GetCurrentUS() - begin);
+}
+
+static void test_trim()
+{
+    std::vector<sylar::Fiber::ptr> fibers;
+    for (int i = 0; i < 16; ++i) {
+        fibers.emplace_back(new sylar::Fiber(
+            []() {
+                // 把栈页都摸一遍，让它们真正驻留
+                char buf[64 * 1024];
+                memset(buf, 1, sizeof(buf));
+                asm volatile("" : : "r"(buf) : "memory");
+            },
+            0, false));
+        fibers.back()->resume();
+    }
+    fibers.clear();
+
+    sylar::FiberStackStats before = sylar::FiberStackPool::GetStats();
+    sylar::FiberStackPool::Trim(true);
+    sylar::FiberStackStats after = sylar::FiberStackPool::GetStats();
+    SYLAR_LOG_INFO(g_logger) << "trim resident_bytes " << before.residentBytes << " -> "
+                             << after.residentBytes;
+    SYLAR_ASSERT(after.residentBytes < before.residentBytes);
+
+    uint64_t hits = after.hits;
+    sylar::Fiber::ptr fiber(new sylar::Fiber([]() {}, 0, false));
+    fiber->resume();
+    SYLAR_ASSERT(sylar::FiberStackPool::GetStats().hits == hits + 1);
+}
+
+static void test_arena()
+{
+    sylar::Config::Lookup<bool>("fiber.stack_pool.use_arena")->setValue(true);
+    // 换一个栈大小，池里没有缓存的 mmap 栈，分配都走页缓存
+    const size_t stack_size = 96 * 1024;
+
+    auto &pc = sylar::PageCache::GetInstance();
+    sylar::FiberStackStats stats0 = sylar::FiberStackPool::GetStats();
+    uint64_t pages0 = pc.getStats().inUsePages;
+    std::vector<sylar::Fiber::ptr> fibers;
+    for (int i = 0; i < 16; ++i) {
+        fibers.emplace_back(new sylar::Fiber([]() {}, stack_size, false));
+        fibers.back()->resume();
+    }
+    sylar::FiberStackStats stats1 = sylar::FiberStackPool::GetStats();
+    SYLAR_ASSERT(stats1.arenaAllocs - stats0.arenaAllocs == 16);
+    SYLAR_ASSERT(pc.getStats().inUsePages - pages0 == 16 * stack_size / sylar::PageCache::PAGE_SIZE);
+
+    // 还回池里的栈还占着页缓存，trim 之后才还给页缓存
+    fibers.clear();
+    SYLAR_ASSERT(pc.getStats().inUsePages > pages0);
+    sylar::FiberStackPool::Trim(true);
+    SYLAR_ASSERT(pc.getStats().inUsePages == pages0);
+    sylar::Config::Lookup<bool>("fiber.stack_pool.use_arena")->setValue(false);
+    SYLAR_LOG_INFO(g_logger) << "arena ok";
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    uint64_t n = argc > 1 ? atoll(argv[1]) : 200000;
+    bench_create(n);
+    bench_scheduler(n);
+    test_trim();
+    test_arena();
+
+    sylar::FiberStackPool::Dump(std::cout) << std::endl;
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "sylar/sylar.h"
+#include "sylar/core/memory/stack_pool.h"
+
+#include <cstring>
+
+/**
+ * 协程栈用量统计和栈大小档位测试
+ * 1. 深栈和浅栈两个创建位置轮流在同一个复用的 cb_fiber 上运行，统计结果按位置分开，浅栈不受深栈影响
+ * 2. 按档位调度的任务运行在对应大小的栈上
+ * 3. 大量挂起的协程，默认栈和小栈占用的栈内存对比
+ * 4. 开销：打开统计前后每个任务的耗时
+ *
+ * 用法：test_fiber_stack_watermark [tasks=200000]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void __attribute__((noinline)) use_stack(size_t bytes)
+{
+    char *buf = (char *)alloca(bytes);
+    memset(buf, 1, bytes);
+    asm volatile("" : : "r"(buf) : "memory");
+}
+
+static const sylar::FiberStackSiteStats *find_site(const std::vector<sylar::FiberStackSiteStats> &sites,
+                                                    const char *function)
+{
+    for (auto &i : sites) {
+        if (i.site.find(function) != std::string::npos) {
+            return &i;
+        }
+    }
+    return nullptr;
+}
+
+static void schedule_deep(sylar::Scheduler *sc)
+{
+    sc->schedule([]() { use_stack(40 * 1024); });
+}
+
+static void schedule_shallow(sylar::Scheduler *sc)
+{
+    sc->schedule([]() { use_stack(256); });
+}
+
+static void schedule_small(sylar::Scheduler *sc)
+{
+    sc->schedule([]() { use_stack(8 * 1024); }, -1, sylar::Scheduler::INTERACTIVE,
+                 sylar::Fiber::STACK_SMALL);
+}
+
+static void test_watermark()
+{
+    sylar::Config::Lookup<bool>("fiber.stack_watermark")->setValue(true);
+    sylar::FiberStackWatermark::Reset();
+    {
+        sylar::IOManager iom(1, false, "watermark");
+        for (int i = 0; i < 100; ++i) {
+            schedule_deep(&iom);
+            schedule_shallow(&iom);
+            schedule_small(&iom);
+        }
+        iom.stop();
+    }
+    std::stringstream ss;
+    sylar::FiberStackWatermark::Dump(ss);
+    SYLAR_LOG_INFO(g_logger) << ss.str();
+
+    std::vector<sylar::FiberStackSiteStats> sites;
+    sylar::FiberStackWatermark::List(sites);
+    auto deep = find_site(sites, "schedule_deep");
+    auto shallow = find_site(sites, "schedule_shallow");
+    auto small = find_site(sites, "schedule_small");
+    SYLAR_ASSERT(deep && shallow && small);
+    SYLAR_ASSERT(deep->count == 100 && shallow->count == 100 && small->count == 100);
+    SYLAR_ASSERT2(deep->maxBytes >= 40 * 1024 && deep->maxBytes < 48 * 1024,
+                  "deep max=" << deep->maxBytes);
+    // 复用了深栈用过的协程栈，测量值也不能被带大
+    SYLAR_ASSERT2(shallow->maxBytes < 4 * 1024, "shallow max=" << shallow->maxBytes);
+    SYLAR_ASSERT(small->stackSize == sylar::Fiber::GetStackSize(sylar::Fiber::STACK_SMALL));
+    SYLAR_ASSERT(small->maxBytes >= 8 * 1024 && small->maxBytes < 16 * 1024);
+    sylar::Config::Lookup<bool>("fiber.stack_watermark")->setValue(false);
+    SYLAR_LOG_INFO(g_logger) << "watermark ok";
+}
+
+/**
+ * 同时挂起 n 个协程，返回栈池使用中的字节数峰值
+ */
+static uint64_t suspended_stack_bytes(int n, sylar::Fiber::StackClass stack_class)
+{
+    uint64_t peak = 0;
+    sylar::IOManager iom(1, false, "suspend");
+    for (int i = 0; i < n; ++i) {
+        iom.schedule([]() { usleep(100 * 1000); }, -1, sylar::Scheduler::INTERACTIVE,
+                     stack_class);
+    }
+    iom.schedule([&peak]() {
+        usleep(50 * 1000);
+        peak = sylar::FiberStackPool::GetStats().inUseBytes;
+    });
+    iom.stop();
+    return peak;
+}
+
+static void bench(int tasks, bool watermark)
+{
+    sylar::Config::Lookup<bool>("fiber.stack_watermark")->setValue(watermark);
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::IOManager iom(1, false, "bench");
+        iom.schedule([&iom, tasks]() {
+            for (int i = 0; i < tasks; ++i) {
+                iom.schedule([]() { use_stack(1024); });
+            }
+        });
+        iom.stop();
+    }
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    std::cout << "stack_watermark=" << watermark << " tasks=" << tasks
+              << " ns/task=" << us * 1000.0 / tasks << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    int tasks = argc > 1 ? atoi(argv[1]) : 200000;
+
+    test_watermark();
+
+    uint64_t def = suspended_stack_bytes(1000, sylar::Fiber::STACK_DEFAULT);
+    uint64_t small = suspended_stack_bytes(1000, sylar::Fiber::STACK_SMALL);
+    std::cout << "1000 suspended fibers stack bytes: default=" << def << " small=" << small
+              << std::endl;
+    SYLAR_ASSERT(small * 2 < def);
+
+    bench(tasks, false);
+    bench(tasks, true);
+    return 0;
+}
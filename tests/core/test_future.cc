@@ -0,0 +1,195 @@
+#include "sylar/sylar.h"
+#include "sylar/core/future.h"
+
+#include <atomic>
+
+/**
+ * Future/Promise 测试
+ * 1. 协程里等待挂起协程：值、异常、Promise 析构、超时之后再等
+ * 2. 不在调度器线程里等待(条件变量)
+ * 3. WhenAll/WhenAny、截止时间、C++20 协程里 co_await
+ * 4. 扇出延迟：backends 个后端各耗时 latency_ms，一个协程里顺序调用对比 Async + WhenAll 并发调用
+ *
+ * 用法：test_future [backends=8] [latency_ms=20]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void test_basic()
+{
+    sylar::IOManager iom(2, false, "basic");
+    iom.schedule([]() {
+        sylar::Promise<int> p;
+        sylar::Future<int> f = p.getFuture();
+        sylar::Async(nullptr, [p = std::move(p)]() mutable {
+            usleep(20 * 1000);
+            p.setValue(42);
+        });
+        SYLAR_ASSERT(!f.isReady());
+        SYLAR_ASSERT(f.get() == 42);
+        SYLAR_ASSERT(!f.valid());
+
+        auto fe = sylar::Async(nullptr, []() -> int { throw std::runtime_error("fail"); });
+        bool caught = false;
+        try {
+            fe.get();
+        } catch (std::runtime_error &) {
+            caught = true;
+        }
+        SYLAR_ASSERT(caught);
+
+        sylar::Future<std::string> fb;
+        {
+            sylar::Promise<std::string> broken;
+            fb = broken.getFuture();
+        }
+        caught = false;
+        try {
+            fb.get();
+        } catch (sylar::BrokenPromise &) {
+            caught = true;
+        }
+        SYLAR_ASSERT(caught);
+
+        auto slow = sylar::Async(nullptr, []() {
+            usleep(100 * 1000);
+            return std::make_unique<int>(7);
+        });
+        uint64_t begin = sylar::GetCurrentMS();
+        SYLAR_ASSERT(!slow.wait(30));
+        SYLAR_ASSERT(sylar::GetCurrentMS() - begin >= 25);
+        SYLAR_ASSERT(slow.wait(1000));
+        SYLAR_ASSERT(*slow.get() == 7);
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "basic ok";
+}
+
+static void test_thread_wait()
+{
+    sylar::IOManager iom(1, false, "thread");
+    auto f = sylar::Async(&iom, []() {
+        usleep(20 * 1000);
+        return 3;
+    });
+    // 主线程不是调度线程，阻塞等待
+    SYLAR_ASSERT(f.get() == 3);
+    auto v = sylar::Async(&iom, []() { usleep(50 * 1000); });
+    SYLAR_ASSERT(!v.wait(10));
+    v.get();
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "thread wait ok";
+}
+
+static sylar::Task<int> co_sum(sylar::IOManager *iom)
+{
+    int a = co_await sylar::Async(iom, []() {
+        usleep(10 * 1000);
+        return 1;
+    });
+    int b = co_await sylar::MakeReadyFuture<int>(2);
+    co_return a + b;
+}
+
+static void test_combinators()
+{
+    sylar::IOManager iom(2, false, "combinators");
+    iom.schedule([&iom]() {
+        std::vector<sylar::Future<int> > fs;
+        for (int i = 0; i < 5; ++i) {
+            fs.push_back(sylar::Async(nullptr, [i]() {
+                usleep((5 - i) * 5 * 1000);
+                return i * i;
+            }));
+        }
+        std::vector<int> values = sylar::WhenAll(std::move(fs)).get();
+        SYLAR_ASSERT(values == std::vector<int>({0, 1, 4, 9, 16}));
+
+        std::vector<sylar::Future<void> > vs;
+        std::atomic<int> done{0};
+        for (int i = 0; i < 3; ++i) {
+            vs.push_back(sylar::Async(nullptr, [&done]() { ++done; }));
+        }
+        sylar::WhenAll(std::move(vs)).get();
+        SYLAR_ASSERT(done == 3);
+        SYLAR_ASSERT(sylar::WhenAll(std::vector<sylar::Future<int> >()).get().empty());
+
+        std::vector<sylar::Future<int> > any;
+        any.push_back(sylar::Async(nullptr, []() {
+            usleep(200 * 1000);
+            return 0;
+        }));
+        any.push_back(sylar::Async(nullptr, []() {
+            usleep(10 * 1000);
+            return 1;
+        }));
+        size_t idx = sylar::WhenAny(any).get();
+        SYLAR_ASSERT(idx == 1 && any[1].get() == 1);
+
+        // 截止时间先到，WhenAll 没有就绪
+        std::vector<sylar::Future<int> > late;
+        late.push_back(std::move(any[0]));
+        late.push_back(sylar::MakeReadyFuture<int>(5));
+        auto all = sylar::WhenAll(std::move(late));
+        SYLAR_ASSERT(!all.waitUntil(sylar::GetCurrentMS() + 20));
+        SYLAR_ASSERT(all.get() == std::vector<int>({0, 5}));
+
+        SYLAR_ASSERT(sylar::CoWait(co_sum(&iom)) == 3);
+    });
+    iom.stop();
+    SYLAR_LOG_INFO(g_logger) << "combinators ok";
+}
+
+/**
+ * 模拟一次后端调用(hook 过的 usleep，挂起的是协程)
+ */
+static int backend(int i, int latency_ms)
+{
+    usleep(latency_ms * 1000);
+    return i;
+}
+
+static void bench_fanout(int backends, int latency_ms)
+{
+    sylar::IOManager iom(1, false, "fanout");
+    uint64_t seq_us = 0, par_us = 0;
+    iom.schedule([&]() {
+        uint64_t begin = sylar::GetCurrentUS();
+        int total = 0;
+        for (int i = 0; i < backends; ++i) {
+            total += backend(i, latency_ms);
+        }
+        seq_us = sylar::GetCurrentUS() - begin;
+
+        begin = sylar::GetCurrentUS();
+        std::vector<sylar::Future<int> > fs;
+        for (int i = 0; i < backends; ++i) {
+            fs.push_back(sylar::Async(nullptr, [i, latency_ms]() { return backend(i, latency_ms); }));
+        }
+        int par_total = 0;
+        for (int v : sylar::WhenAll(std::move(fs)).get()) {
+            par_total += v;
+        }
+        par_us = sylar::GetCurrentUS() - begin;
+        SYLAR_ASSERT(total == par_total);
+    });
+    iom.stop();
+    std::cout << "fan-out backends=" << backends << " latency=" << latency_ms
+              << "ms sequential=" << seq_us / 1000.0 << "ms when_all=" << par_us / 1000.0 << "ms"
+              << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    int backends = argc > 1 ? atoi(argv[1]) : 8;
+    int latency_ms = argc > 2 ? atoi(argv[2]) : 20;
+
+    test_basic();
+    test_thread_wait();
+    test_combinators();
+    bench_fanout(backends, latency_ms);
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "sylar/sylar.h"
+#include "sylar/core/fd_manager.h"
+
+#include <sys/socket.h>
+#include <atomic>
+#include <iomanip>
+#include <new>
+
+/**
+ * hook 读写超时测试
+ * 1. 语义：设置了 SO_RCVTIMEO 的 read 没有数据时 -1 返回，errno 为 ETIMEDOUT，耗时不短于超时时间；
+ *          超时之前数据到达正常返回
+ * 2. 微基准：两个协程通过 socketpair 乒乓，每次 read 都先阻塞再被对端唤醒，
+ *            两端都设置了读超时，统计每秒往返次数和每次往返的堆分配次数
+ *
+ * 用法：test_io_deadline [round_trips]，默认 200000
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_allocs{0};
+
+void *operator new(size_t size)
+{
+    ++s_allocs;
+    void *p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+/**
+ * socketpair 没有被 hook，手动交给 FdMgr 管理，之后的 setsockopt/read/write 才会走 hook
+ */
+static void make_pair(int fds[2])
+{
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    sylar::FdMgr::GetInstance()->get(fds[0], true);
+    sylar::FdMgr::GetInstance()->get(fds[1], true);
+}
+
+static void set_rcv_timeout(int fd, uint64_t ms)
+{
+    struct timeval tv {
+        int(ms / 1000), int(ms % 1000 * 1000)
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static void test_timeout()
+{
+    int fds[2];
+    make_pair(fds);
+    set_rcv_timeout(fds[0], 100);
+
+    char c = 0;
+    uint64_t begin = sylar::GetCurrentMS();
+    ssize_t n = read(fds[0], &c, 1);
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    SYLAR_ASSERT2(n == -1 && errno == ETIMEDOUT, "n=" << n << " errno=" << errno);
+    SYLAR_ASSERT2(cost >= 100, "cost=" << cost);
+
+    // 超时之前数据到达
+    sylar::IOManager::GetThis()->addTimer(20, [fds]() { SYLAR_ASSERT(write(fds[1], "x", 1) == 1); });
+    n = read(fds[0], &c, 1);
+    SYLAR_ASSERT(n == 1 && c == 'x');
+
+    // 连续多次超时，每次都重新计时
+    for (int i = 0; i < 3; ++i) {
+        n = read(fds[0], &c, 1);
+        SYLAR_ASSERT(n == -1 && errno == ETIMEDOUT);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "read timeout cost=" << cost << "ms ok";
+}
+
+static void bench_ping_pong(uint64_t round_trips)
+{
+    int a[2];
+    int b[2];
+    make_pair(a);
+    make_pair(b);
+    set_rcv_timeout(a[1], 5000);
+    set_rcv_timeout(b[0], 5000);
+
+    sylar::IOManager *iom = sylar::IOManager::GetThis();
+    std::atomic<int> done{0};
+    uint64_t begin = sylar::GetCurrentUS();
+    uint64_t allocs = s_allocs;
+    // 回声端：a 读，b 写回
+    iom->schedule([&]() {
+        char c;
+        for (uint64_t i = 0; i < round_trips; ++i) {
+            SYLAR_ASSERT(read(a[1], &c, 1) == 1);
+            SYLAR_ASSERT(write(b[1], &c, 1) == 1);
+        }
+        ++done;
+    });
+    // 发起端：b 读，a 写，每次 read 都会先阻塞
+    iom->schedule([&]() {
+        char c = 'p';
+        for (uint64_t i = 0; i < round_trips; ++i) {
+            SYLAR_ASSERT(write(a[0], &c, 1) == 1);
+            SYLAR_ASSERT(read(b[0], &c, 1) == 1);
+        }
+        ++done;
+    });
+    while (done != 2) {
+        usleep(10 * 1000);
+    }
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    allocs = s_allocs - allocs;
+    std::cout << "ping-pong round_trips=" << round_trips << " cost=" << us / 1000
+              << "ms round_trips/sec=" << (uint64_t)(round_trips * 1000000.0 / (us ? us : 1))
+              << " allocs/round_trip=" << std::fixed << std::setprecision(2)
+              << (double)allocs / round_trips << std::endl;
+    for (int fd : {a[0], a[1], b[0], b[1]}) {
+        close(fd);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    uint64_t n = argc > 1 ? atoll(argv[1]) : 200000;
+    sylar::IOManager iom(1, false, "deadline");
+    iom.schedule([n]() {
+        test_timeout();
+        bench_ping_pong(n);
+    });
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "sylar/sylar.h"
+#include "sylar/core/fd_manager.h"
+#include "sylar/core/hook.h"
+
+#include <sys/socket.h>
+#include <algorithm>
+
+/**
+ * IOManager 忙等阶段的 ping-pong 延迟
+ * 两个 IOManager(各一个线程)通过 socketpair 来回传 1 字节，客户端每轮之间可以停顿 gap_us
+ * (停顿期间两边都没事做，进入 idle)，统计每轮往返延迟的 p50/p99，对比 iomanager.busy_poll_us 开和关
+ *
+ * 用法：test_iomanager_busy_poll [rounds=20000] [busy_poll_us=50] [gap_us=0]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void run(int rounds, uint32_t busy_poll_us, int gap_us)
+{
+    sylar::Config::Lookup<uint32_t>("iomanager.busy_poll_us")->setValue(busy_poll_us);
+    int fds[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::vector<uint64_t> lat(rounds);
+    {
+        sylar::IOManager server(1, false, "server");
+        sylar::IOManager client(1, false, "client");
+        server.schedule([&fds]() {
+            sylar::FdMgr::GetInstance()->get(fds[1], true);
+            char c;
+            while (read(fds[1], &c, 1) == 1) {
+                SYLAR_ASSERT(write(fds[1], &c, 1) == 1);
+            }
+        });
+        client.schedule([&fds, &lat, rounds, gap_us]() {
+            sylar::FdMgr::GetInstance()->get(fds[0], true);
+            char c = 'x';
+            for (int i = 0; i < rounds; ++i) {
+                if (gap_us > 0) {
+                    usleep(gap_us);
+                }
+                uint64_t begin = sylar::GetCurrentUS();
+                SYLAR_ASSERT(write(fds[0], &c, 1) == 1);
+                SYLAR_ASSERT(read(fds[0], &c, 1) == 1);
+                lat[i] = sylar::GetCurrentUS() - begin;
+            }
+            shutdown(fds[0], SHUT_WR);
+        });
+        client.stop();
+        server.stop();
+    }
+    close(fds[0]);
+    close(fds[1]);
+    std::sort(lat.begin(), lat.end());
+    std::cout << "busy_poll_us=" << busy_poll_us << " gap_us=" << gap_us << " rounds=" << rounds
+              << " p50=" << lat[rounds / 2] << "us p99=" << lat[rounds * 99 / 100]
+              << "us max=" << lat.back() << "us" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+    uint32_t busy_poll_us = argc > 2 ? atoi(argv[2]) : 50;
+    int gap_us = argc > 3 ? atoi(argv[3]) : 0;
+
+    run(rounds, 0, gap_us);
+    run(rounds, busy_poll_us, gap_us);
+    return 0;
+}
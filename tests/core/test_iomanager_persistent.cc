@@ -0,0 +1,123 @@
+#include "sylar/sylar.h"
+#include "sylar/core/fd_manager.h"
+
+#include <dirent.h>
+#include <sys/socket.h>
+#include <atomic>
+
+/**
+ * 持久注册模式(iomanager.persistent_epoll)下 fd 在 IOManager 之间移动
+ * 1. fd 只注册在等待它的 IOManager 上，换到别的 IOManager 等待后从原来的 epoll 里注销
+ * 2. 在别的 IOManager 上关闭，原来的 IOManager 也注销，同号的新 fd 可以正常等待
+ *
+ * 用法：test_iomanager_persistent
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * 有多少个 epoll 实例注册了 fd，从 /proc/self/fdinfo 里数
+ */
+static int epoll_count(int fd)
+{
+    int count = 0;
+    DIR *dir = opendir("/proc/self/fd");
+    SYLAR_ASSERT(dir);
+    while (dirent *ent = readdir(dir)) {
+        char path[64], link[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%s", ent->d_name);
+        ssize_t n = readlink(path, link, sizeof(link) - 1);
+        if (n <= 0) {
+            continue;
+        }
+        link[n] = 0;
+        if (strcmp(link, "anon_inode:[eventpoll]")) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/self/fdinfo/%s", ent->d_name);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            continue;
+        }
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            int tfd = -1;
+            if (sscanf(line, "tfd: %d", &tfd) == 1 && tfd == fd) {
+                ++count;
+            }
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return count;
+}
+
+/**
+ * 在 iom 上的协程里读一个字节，等它挂起之后从外面写一个字节，返回读到的字节
+ */
+static char read_on(sylar::IOManager &iom, int fd, int peer, char c, int *registered)
+{
+    std::atomic<int> got{-1};
+    iom.schedule([fd, &got]() {
+        char buf = 0;
+        got = read(fd, &buf, 1) == 1 ? buf : 0;
+    });
+    usleep(50 * 1000);
+    if (registered) {
+        *registered = epoll_count(fd);
+    }
+    SYLAR_ASSERT(write(peer, &c, 1) == 1);
+    for (int i = 0; i < 1000 && got < 0; ++i) {
+        usleep(1000);
+    }
+    return got;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    sylar::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(true);
+
+    sylar::IOManager a(1, false, "a");
+    sylar::IOManager b(1, false, "b");
+
+    // 1. 先在 a 上等，再换到 b 上等
+    int sv[2];
+    SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    sylar::FdMgr::GetInstance()->get(sv[0], true);
+    int registered = 0;
+    SYLAR_ASSERT(read_on(a, sv[0], sv[1], 'x', &registered) == 'x');
+    SYLAR_LOG_INFO(g_logger) << "wait on a: epoll instances=" << registered;
+    SYLAR_ASSERT(registered == 1);
+    SYLAR_ASSERT(read_on(b, sv[0], sv[1], 'y', &registered) == 'y');
+    SYLAR_LOG_INFO(g_logger) << "moved to b: epoll instances=" << registered;
+    SYLAR_ASSERT(registered == 1);
+    SYLAR_ASSERT(sylar::FdMgr::GetInstance()->get(sv[0])->getIOManager() == &b);
+
+    // 2. 在 a 上关闭，b 上的注册也要清掉，同号的新 fd 在 b 上还能等到数据
+    int old_fd = sv[0];
+    std::atomic<bool> closed{false};
+    a.schedule([old_fd, &closed]() {
+        close(old_fd);
+        closed = true;
+    });
+    while (!closed) {
+        usleep(1000);
+    }
+    close(sv[1]);
+    SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    sylar::FdMgr::GetInstance()->get(sv[0], true);
+    SYLAR_LOG_INFO(g_logger) << "reopened fd=" << sv[0] << " old fd=" << old_fd;
+    SYLAR_ASSERT(read_on(b, sv[0], sv[1], 'z', &registered) == 'z');
+    SYLAR_ASSERT(registered == 1);
+
+    a.schedule([&sv]() {
+        close(sv[0]);
+        close(sv[1]);
+    });
+    a.stop();
+    b.stop();
+    SYLAR_LOG_INFO(g_logger) << "persistent move ok";
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include "sylar/sylar.h"
+#include "sylar/core/common/lock_free_queue.h"
+#include "sylar/core/ds/blocking_queue.h"
+
+#include <atomic>
+#include <iomanip>
+
+/**
+ * 无锁队列测试
+ * 1. 压力测试：MpscQueue 多生产者单消费者，校验每个生产者内部有序、总数不丢；
+ *              MpmcRing 多生产者多消费者，校验总数和求和
+ * 2. 吞吐测试：多生产者单消费者场景下 MpscQueue / MpmcRing / BlockingQueue 对比
+ *
+ * 用法：test_lock_free_queue [producers]，默认 4
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const uint64_t ITEMS_PER_PRODUCER = 200000;
+
+struct Item : public sylar::ds::MpscNode {
+    int producer = 0;
+    uint64_t seq = 0;
+};
+
+static void stress_mpsc(int producers)
+{
+    sylar::ds::MpscQueue<Item> queue;
+    std::vector<Item> items(producers * ITEMS_PER_PRODUCER);
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int p = 0; p < producers; ++p) {
+        thrs.push_back(std::make_shared<sylar::Thread>(
+            [&queue, &items, p]() {
+                for (uint64_t i = 0; i < ITEMS_PER_PRODUCER; ++i) {
+                    Item &item = items[p * ITEMS_PER_PRODUCER + i];
+                    item.producer = p;
+                    item.seq = i;
+                    queue.push(&item);
+                }
+            },
+            "mpsc_" + std::to_string(p)));
+    }
+
+    std::vector<uint64_t> next(producers, 0);
+    uint64_t total = producers * ITEMS_PER_PRODUCER;
+    for (uint64_t n = 0; n < total;) {
+        Item *item = queue.pop();
+        if (!item) {
+            continue;
+        }
+        SYLAR_ASSERT2(item->seq == next[item->producer], "producer=" << item->producer);
+        ++next[item->producer];
+        ++n;
+    }
+    SYLAR_ASSERT(queue.pop() == nullptr);
+    for (auto &i : thrs) {
+        i->join();
+    }
+    SYLAR_LOG_INFO(g_logger) << "stress mpsc producers=" << producers << " items=" << total << " ok";
+}
+
+static void stress_mpmc(int producers)
+{
+    sylar::ds::MpmcRing<uint64_t> ring(1024);
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> count{0};
+    uint64_t total = producers * ITEMS_PER_PRODUCER;
+
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int p = 0; p < producers; ++p) {
+        thrs.push_back(std::make_shared<sylar::Thread>(
+            [&ring, p]() {
+                for (uint64_t i = 0; i < ITEMS_PER_PRODUCER; ++i) {
+                    uint64_t v = p * ITEMS_PER_PRODUCER + i + 1;
+                    while (!ring.push(v)) {
+                        sched_yield();
+                    }
+                }
+            },
+            "mpmc_p" + std::to_string(p)));
+        thrs.push_back(std::make_shared<sylar::Thread>(
+            [&ring, &sum, &count, total]() {
+                uint64_t v = 0;
+                while (count < total) {
+                    if (ring.pop(v)) {
+                        sum += v;
+                        ++count;
+                    } else {
+                        sched_yield();
+                    }
+                }
+            },
+            "mpmc_c" + std::to_string(p)));
+    }
+    for (auto &i : thrs) {
+        i->join();
+    }
+    SYLAR_ASSERT(count == total);
+    SYLAR_ASSERT(sum == total * (total + 1) / 2);
+    SYLAR_ASSERT(ring.empty());
+    SYLAR_LOG_INFO(g_logger) << "stress mpmc producers=consumers=" << producers
+                             << " items=" << total << " ok";
+}
+
+static void report(const char *name, int producers, uint64_t items, uint64_t us)
+{
+    std::cout << std::left << std::setw(14) << name << " producers=" << std::setw(3) << producers
+              << " items=" << std::setw(8) << items << " cost=" << std::setw(6) << us / 1000
+              << "ms ops/sec=" << (uint64_t)(items * 1000000.0 / (us ? us : 1)) << std::endl;
+}
+
+/**
+ * 生产者都是普通线程，消费者跑在调度器的协程里（BlockingQueue 需要协程环境）
+ */
+template <class Produce, class Consume>
+static void bench(const char *name, int producers, Produce produce, Consume consume)
+{
+    uint64_t total = producers * ITEMS_PER_PRODUCER;
+    sylar::Scheduler sc(1, false, "bench");
+    sc.start();
+    uint64_t begin = sylar::GetCurrentUS();
+    sc.schedule([&consume, total]() {
+        for (uint64_t n = 0; n < total;) {
+            n += consume();
+        }
+    });
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int p = 0; p < producers; ++p) {
+        thrs.push_back(std::make_shared<sylar::Thread>(
+            [&produce]() {
+                for (uint64_t i = 0; i < ITEMS_PER_PRODUCER; ++i) {
+                    produce();
+                }
+            },
+            "producer_" + std::to_string(p)));
+    }
+    for (auto &i : thrs) {
+        i->join();
+    }
+    sc.stop();
+    report(name, producers, total, sylar::GetCurrentUS() - begin);
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    int producers = argc > 1 ? atoi(argv[1]) : 4;
+
+    stress_mpsc(producers);
+    stress_mpmc(producers);
+
+    {
+        // 节点由生产者分配、消费者释放，和 BlockingQueue 的 shared_ptr 开销对齐
+        sylar::ds::MpscQueue<Item> queue;
+        bench(
+            "MpscQueue", producers, [&queue]() { queue.push(new Item); },
+            [&queue]() -> uint64_t {
+                Item *item = queue.pop();
+                delete item;
+                return item ? 1 : 0;
+            });
+    }
+    {
+        sylar::ds::MpmcRing<Item *> ring(65536);
+        bench(
+            "MpmcRing", producers,
+            [&ring]() {
+                Item *item = new Item;
+                while (!ring.push(item)) {
+                    sched_yield();
+                }
+            },
+            [&ring]() -> uint64_t {
+                Item *item = nullptr;
+                if (!ring.pop(item)) {
+                    return 0;
+                }
+                delete item;
+                return 1;
+            });
+    }
+    {
+        sylar::ds::BlockingQueue<Item> queue;
+        bench(
+            "BlockingQueue", producers, [&queue]() { queue.push(std::make_shared<Item>()); },
+            [&queue]() -> uint64_t {
+                queue.pop();
+                return 1;
+            });
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "sylar/sylar.h"
+#include "sylar/core/memory/memorypool.h"
+#include "sylar/net/http/servlet/memory_servlet.h"
+
+#include <thread>
+
+/**
+ * 内存池统计和分配采样测试
+ * 1. 每个大小类的分配、释放、缺失、和中心缓存之间的往来计数，线程退出后计数还在
+ * 2. 块守恒：线程缓存 + 中心缓存空闲 + 使用中 = 中心缓存切出来的块数
+ * 3. 按 memory_pool.sample_interval 采样调用栈，估算的字节数接近实际分配量
+ * 4. 采样打开前后的分配吞吐
+ * 5. /_/memory 的文本和 json 输出
+ *
+ * 用法：test_memory_profiler [ops=2000000]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::SizeClassStats class_stats(size_t size)
+{
+    return sylar::MemoryPoolProfiler::GetStats().classes[sylar::SizeClass::getIndex(size)];
+}
+
+static void test_counters()
+{
+    const size_t size = 100;
+    const int n = 10000;
+    auto before = class_stats(size);
+    auto before_all = sylar::MemoryPoolProfiler::GetStats();
+
+    std::atomic<int> step{0};
+    std::thread t([&]() {
+        std::vector<void *> ptrs;
+        for (int i = 0; i < n; ++i) {
+            ptrs.push_back(sylar::ThreadCache::GetInstance()->allocate(size - i % 2));
+        }
+        step = 1;
+        while (step != 2) {
+            usleep(1000);
+        }
+        for (int i = 0; i < n; ++i) {
+            sylar::ThreadCache::GetInstance()->deallocate(ptrs[i], size - i % 2);
+        }
+    });
+    while (step != 1) {
+        usleep(1000);
+    }
+    auto mid = class_stats(size);
+    auto mid_all = sylar::MemoryPoolProfiler::GetStats();
+    SYLAR_LOG_INFO(g_logger) << "allocated: allocs=" << mid.allocs - before.allocs
+                             << " misses=" << mid.misses - before.misses
+                             << " in_use=" << mid.inUseBlocks() << " spans=" << mid.spans;
+    SYLAR_ASSERT(mid.allocs - before.allocs == n);
+    SYLAR_ASSERT(mid.inUseBlocks() - before.inUseBlocks() == n);
+    SYLAR_ASSERT(mid.requestedBytes - before.requestedBytes == n * size - n / 2);
+    SYLAR_ASSERT(mid.misses > before.misses && mid.misses - before.misses < n);
+    SYLAR_ASSERT(mid.spans > 0);
+    SYLAR_ASSERT(mid_all.liveThreads == before_all.liveThreads + 1);
+    // 分出去的块要么在用，要么缓存在线程里，要么还在中心缓存的 span 里
+    SYLAR_ASSERT(mid.inUseBlocks() + mid.threadCachedBlocks() + mid.centralFreeBlocks
+                 == mid.spanBlocks);
+
+    step = 2;
+    t.join();
+    auto after = class_stats(size);
+    auto after_all = sylar::MemoryPoolProfiler::GetStats();
+    SYLAR_LOG_INFO(g_logger) << "freed: frees=" << after.frees - before.frees
+                             << " returns=" << after.returns - before.returns
+                             << " thread_cached=" << after.threadCachedBlocks()
+                             << " spans=" << after.spans;
+    // 线程退出后计数并到全局，缓存的块都还给了中心缓存
+    SYLAR_ASSERT(after.allocs - before.allocs == n);
+    SYLAR_ASSERT(after.frees - before.frees == n);
+    SYLAR_ASSERT(after.inUseBlocks() == before.inUseBlocks());
+    SYLAR_ASSERT(after.requestedBytes == before.requestedBytes);
+    SYLAR_ASSERT(after.threadCachedBlocks() == before.threadCachedBlocks());
+    SYLAR_ASSERT(after.returns > before.returns);
+    SYLAR_ASSERT(after.inUseBlocks() + after.threadCachedBlocks() + after.centralFreeBlocks
+                 == after.spanBlocks);
+    SYLAR_ASSERT(after_all.liveThreads == before_all.liveThreads);
+    SYLAR_ASSERT(after_all.threads == before_all.threads + 1);
+    SYLAR_LOG_INFO(g_logger) << "counters ok";
+}
+
+__attribute__((noinline)) static void allocate_a_lot(size_t total, size_t size)
+{
+    std::vector<void *> ptrs;
+    for (size_t i = 0; i < total / size; ++i) {
+        ptrs.push_back(sylar::ThreadCache::GetInstance()->allocate(size));
+        if (ptrs.size() == 1024) {
+            for (void *p : ptrs) {
+                sylar::ThreadCache::GetInstance()->deallocate(p, size);
+            }
+            ptrs.clear();
+        }
+    }
+    for (void *p : ptrs) {
+        sylar::ThreadCache::GetInstance()->deallocate(p, size);
+    }
+}
+
+static void test_samples()
+{
+    auto interval = sylar::Config::Lookup<uint64_t>("memory_pool.sample_interval");
+    interval->setValue(64 * 1024);
+    sylar::MemoryPoolProfiler::ResetSamples();
+
+    const size_t total = 256 << 20;
+    allocate_a_lot(total, 200);
+    interval->setValue(0);
+    // 关掉以后不再采样
+    allocate_a_lot(total, 200);
+
+    std::vector<sylar::AllocSample> samples;
+    sylar::MemoryPoolProfiler::ListSamples(samples);
+    SYLAR_ASSERT(!samples.empty());
+    uint64_t estimated = 0;
+    uint64_t count = 0;
+    for (auto &i : samples) {
+        estimated += i.estimatedBytes;
+        count += i.count;
+    }
+    SYLAR_LOG_INFO(g_logger) << "samples stacks=" << samples.size() << " count=" << count
+                             << " estimated=" << (estimated >> 20) << "MB actual="
+                             << (total >> 20) << "MB";
+    std::stringstream ss;
+    sylar::MemoryPoolProfiler::DumpSamples(ss, 1);
+    SYLAR_LOG_INFO(g_logger) << ss.str();
+    SYLAR_ASSERT(estimated > total * 3 / 4 && estimated < total * 5 / 4);
+    SYLAR_ASSERT(samples[0].count > count * 9 / 10);
+
+    sylar::MemoryPoolProfiler::ResetSamples();
+    sylar::MemoryPoolProfiler::ListSamples(samples);
+    SYLAR_ASSERT(samples.empty());
+    SYLAR_LOG_INFO(g_logger) << "samples ok";
+}
+
+static void bench(size_t ops)
+{
+    auto interval = sylar::Config::Lookup<uint64_t>("memory_pool.sample_interval");
+    for (uint64_t v : {0ul, 512ul * 1024}) {
+        interval->setValue(v);
+        uint64_t begin = sylar::GetCurrentUS();
+        allocate_a_lot(ops * 64, 64);
+        uint64_t us = sylar::GetCurrentUS() - begin;
+        std::cout << "sample_interval=" << v << " ops=" << ops
+                  << " ns/op=" << us * 1000.0 / ops / 2 << std::endl;
+    }
+    interval->setValue(0);
+    sylar::MemoryPoolProfiler::ResetSamples();
+}
+
+static void test_servlet()
+{
+    sylar::http::MemoryServlet servlet;
+    sylar::http::HttpRequest::ptr req = std::make_shared<sylar::http::HttpRequest>();
+    sylar::http::HttpResponse::ptr rsp = std::make_shared<sylar::http::HttpResponse>();
+    servlet.handle(req, rsp, nullptr);
+    SYLAR_ASSERT(rsp->getBody().find("[MemoryPool threads=") != std::string::npos);
+    std::string size = "size=" + std::to_string(sylar::SizeClass::roundUp(100)) + " allocs=";
+    SYLAR_ASSERT(rsp->getBody().find(size) != std::string::npos);
+
+    req->setParam("type", "json");
+    rsp = std::make_shared<sylar::http::HttpResponse>();
+    servlet.handle(req, rsp, nullptr);
+    Json::Value v;
+    SYLAR_ASSERT(sylar::JsonUtil::FromString(v, rsp->getBody()));
+    SYLAR_ASSERT(v["classes"].isArray() && v["classes"].size() > 0);
+    SYLAR_ASSERT(v["page_cache"]["system_bytes"].asUInt64() > 0);
+    SYLAR_LOG_INFO(g_logger) << "servlet ok";
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    size_t ops = argc > 1 ? atol(argv[1]) : 2000000;
+    test_counters();
+    test_samples();
+    bench(ops);
+    test_servlet();
+    sylar::MemoryPoolProfiler::Dump(std::cout) << std::endl;
+    return 0;
+}
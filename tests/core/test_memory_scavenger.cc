@@ -0,0 +1,107 @@
+#include "sylar/sylar.h"
+#include "sylar/core/memory/memorypool.h"
+
+#include <thread>
+
+/**
+ * 内存回收测试
+ * 1. 线程退出时 ThreadCache 的自由链表还给中心缓存，小块全部还回来的 span 还给页缓存
+ * 2. 流量高峰过后，后台线程把空闲的 span 还给系统，RSS 降下来
+ * 3. 每秒还给系统的字节数受 memory_pool.release_rate 限制
+ *
+ * 用法：test_memory_scavenger [spike_mb=256]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static size_t rss_bytes()
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * getpagesize();
+}
+
+/**
+ * 在新线程里分配 bytes 字节的小对象，写一遍，全部释放后退出
+ */
+static void spike(size_t bytes)
+{
+    std::thread t([bytes]() {
+        std::vector<std::pair<void *, size_t> > ptrs;
+        size_t total = 0;
+        for (size_t i = 0; total < bytes; ++i) {
+            size_t size = 64 + (i * 37) % 4096;
+            void *p = sylar::ThreadCache::GetInstance()->allocate(size);
+            memset(p, 1, size);
+            ptrs.emplace_back(p, size);
+            total += size;
+        }
+        for (auto &i : ptrs) {
+            sylar::ThreadCache::GetInstance()->deallocate(i.first, i.second);
+        }
+    });
+    t.join();
+}
+
+static std::ostream &operator<<(std::ostream &os, const sylar::PageCacheStats &s)
+{
+    return os << "in_use_pages=" << s.inUsePages << " retained=" << s.retainedBytes()
+              << " released=" << s.releasedBytes() << " released_total=" << s.releasedBytesTotal
+              << " release_count=" << s.releaseCount;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    size_t spike_mb = argc > 1 ? atoi(argv[1]) : 256;
+    auto &pc = sylar::PageCache::GetInstance();
+    auto idle = sylar::Config::Lookup<uint32_t>("memory_pool.release_idle_ms");
+    auto rate = sylar::Config::Lookup<uint64_t>("memory_pool.release_rate");
+    idle->setValue(0);
+
+    // 1. 线程退出后它用过的页全部回到页缓存
+    auto before = pc.getStats();
+    size_t rss0 = rss_bytes();
+    spike(spike_mb << 20);
+    auto after = pc.getStats();
+    size_t rss1 = rss_bytes();
+    SYLAR_LOG_INFO(g_logger) << "after spike: " << after << " rss=" << (rss1 >> 20) << "MB";
+    SYLAR_ASSERT(after.inUsePages == before.inUsePages);
+    SYLAR_ASSERT(after.retainedBytes() >= (spike_mb << 20) / 2);
+    SYLAR_ASSERT(rss1 > rss0 + (spike_mb << 20) / 2);
+
+    // 2. 限速：每秒最多还 rate 字节
+    uint64_t limit = 16 << 20;
+    rate->setValue(limit);
+    idle->setValue(50);
+    // 回收线程在第一次有 span 还回页缓存时启动，上面关着，这里再触发一次
+    spike(1 << 20);
+    sleep(1);
+    auto limited = pc.getStats();
+    uint64_t released = limited.releasedBytesTotal - after.releasedBytesTotal;
+    SYLAR_LOG_INFO(g_logger) << "rate limited 1s: released " << (released >> 20) << "MB limit "
+                             << (limit >> 20) << "MB/s";
+    SYLAR_ASSERT(released > 0);
+    SYLAR_ASSERT(released <= limit + limit / 4);
+
+    // 3. 放开速率，空闲的页都还给系统
+    rate->setValue(1ull << 40);
+    sleep(1);
+    auto done = pc.getStats();
+    size_t rss2 = rss_bytes();
+    SYLAR_LOG_INFO(g_logger) << "released: " << done << " rss=" << (rss2 >> 20) << "MB";
+    SYLAR_ASSERT(done.retainedBytes() < (4 << 20));
+    SYLAR_ASSERT(rss2 + (spike_mb << 20) / 2 < rss1);
+
+    // 还给系统的页可以再用
+    spike(spike_mb << 19);
+    SYLAR_ASSERT(pc.getStats().inUsePages == before.inUsePages);
+    SYLAR_LOG_INFO(g_logger) << "scavenger ok";
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+
+#include "sylar/core/memory/memorypool.h"
+
+/**
+ * 内存池大小类测试
+ * 1. 正确性：随机大小分配，写满再校验，块之间不重叠
+ * 2. 每个线程的常驻内存：N 个线程各分配一次(初始化 ThreadCache)后挂起，看 RSS 增量
+ * 3. 吞吐：单线程 / 多线程随机大小分配释放，和 new/delete 对比
+ *
+ * 用法：test_memorypool_optimized [threads=64] [ops=2000000]
+ */
+
+using namespace std::chrono;
+
+static size_t rss_bytes()
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * getpagesize();
+}
+
+static void test_correctness()
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> dist(1, sylar::MAX_BYTES);
+    std::uniform_int_distribution<size_t> small(1, 2048);
+    std::vector<std::pair<unsigned char *, size_t> > ptrs;
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < 500; ++i) {
+            size_t size = i % 8 ? small(rng) : dist(rng);
+            auto p = (unsigned char *)sylar::ThreadCache::GetInstance()->allocate(size);
+            if (!p) {
+                std::cout << "allocate " << size << " failed" << std::endl;
+                exit(1);
+            }
+            memset(p, (unsigned char)(ptrs.size() * 131), size);
+            ptrs.emplace_back(p, size);
+        }
+        // 校验之后释放一半，让后面的分配复用这些块
+        for (size_t i = 0; i < ptrs.size(); ++i) {
+            unsigned char tag = (unsigned char)(i * 131);
+            for (size_t j = 0; j < ptrs[i].second; j += 61) {
+                if (ptrs[i].first[j] != tag) {
+                    std::cout << "corrupted block size=" << ptrs[i].second << std::endl;
+                    exit(1);
+                }
+            }
+        }
+        size_t keep = ptrs.size() / 2;
+        for (size_t i = keep; i < ptrs.size(); ++i) {
+            sylar::ThreadCache::GetInstance()->deallocate(ptrs[i].first, ptrs[i].second);
+        }
+        ptrs.resize(keep);
+    }
+    for (auto &i : ptrs) {
+        sylar::ThreadCache::GetInstance()->deallocate(i.first, i.second);
+    }
+    std::cout << "size classes=" << sylar::FREE_LIST_SIZE << " correctness ok" << std::endl;
+}
+
+static void test_thread_rss(int threads)
+{
+    std::atomic<int> ready{0};
+    std::atomic<bool> quit{false};
+    std::vector<std::thread> ts;
+    // 先起线程不碰内存池，扣掉线程栈本身的开销
+    size_t before = rss_bytes();
+    for (int i = 0; i < threads; ++i) {
+        ts.emplace_back([&]() {
+            ++ready;
+            while (!quit) {
+                usleep(1000);
+            }
+        });
+    }
+    while (ready < threads) {
+        usleep(1000);
+    }
+    size_t plain = rss_bytes();
+    quit = true;
+    for (auto &t : ts) {
+        t.join();
+    }
+    ts.clear();
+
+    ready = 0;
+    quit = false;
+    size_t before_pool = rss_bytes();
+    for (int i = 0; i < threads; ++i) {
+        ts.emplace_back([&]() {
+            void *p = sylar::ThreadCache::GetInstance()->allocate(64);
+            sylar::ThreadCache::GetInstance()->deallocate(p, 64);
+            ++ready;
+            while (!quit) {
+                usleep(1000);
+            }
+        });
+    }
+    while (ready < threads) {
+        usleep(1000);
+    }
+    size_t pooled = rss_bytes();
+    quit = true;
+    for (auto &t : ts) {
+        t.join();
+    }
+    double plain_per = (double)((ssize_t)plain - (ssize_t)before) / threads;
+    double pooled_per = (double)((ssize_t)pooled - (ssize_t)before_pool) / threads;
+    std::cout << "threads=" << threads << " rss/thread plain=" << std::fixed << std::setprecision(1)
+              << plain_per / 1024 << "KB with_pool=" << pooled_per / 1024
+              << "KB thread_cache=" << (pooled_per - plain_per) / 1024 << "KB" << std::endl;
+}
+
+template <class Alloc, class Free>
+static double run_ops(size_t ops, Alloc alloc, Free free_fn)
+{
+    std::mt19937 rng(7);
+    // 大部分是小对象，偶尔有几 KB 的
+    std::vector<size_t> sizes(4096);
+    for (auto &s : sizes) {
+        s = rng() % 16 ? 8 + rng() % 512 : 512 + rng() % 8192;
+    }
+    std::vector<std::pair<void *, size_t> > live(256, {nullptr, 0});
+    auto begin = steady_clock::now();
+    for (size_t i = 0; i < ops; ++i) {
+        auto &slot = live[i % live.size()];
+        if (slot.first) {
+            free_fn(slot.first, slot.second);
+        }
+        size_t size = sizes[i % sizes.size()];
+        slot.first = alloc(size);
+        slot.second = size;
+        *(char *)slot.first = 1;
+    }
+    for (auto &slot : live) {
+        if (slot.first) {
+            free_fn(slot.first, slot.second);
+        }
+    }
+    return duration_cast<nanoseconds>(steady_clock::now() - begin).count() / 1e9;
+}
+
+static void bench(int threads, size_t ops)
+{
+    auto pool_alloc = [](size_t size) { return sylar::ThreadCache::GetInstance()->allocate(size); };
+    auto pool_free = [](void *p, size_t size) {
+        sylar::ThreadCache::GetInstance()->deallocate(p, size);
+    };
+    auto sys_alloc = [](size_t size) { return (void *)new char[size]; };
+    auto sys_free = [](void *p, size_t) { delete[] (char *)p; };
+
+    for (int pool = 1; pool >= 0; --pool) {
+        std::vector<std::thread> ts;
+        auto begin = steady_clock::now();
+        for (int i = 0; i < threads; ++i) {
+            ts.emplace_back([&]() {
+                if (pool) {
+                    run_ops(ops, pool_alloc, pool_free);
+                } else {
+                    run_ops(ops, sys_alloc, sys_free);
+                }
+            });
+        }
+        for (auto &t : ts) {
+            t.join();
+        }
+        double sec = duration_cast<nanoseconds>(steady_clock::now() - begin).count() / 1e9;
+        std::cout << (pool ? "memory pool" : "new/delete ") << " threads=" << threads
+                  << " Mops/s=" << std::fixed << std::setprecision(2)
+                  << ops * threads / sec / 1e6 << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 64;
+    size_t ops = argc > 2 ? atol(argv[2]) : 2000000;
+
+    test_correctness();
+    test_thread_rss(threads);
+    bench(1, ops);
+    bench(4, ops / 4);
+    return 0;
+}
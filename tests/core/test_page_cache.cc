@@ -0,0 +1,121 @@
+#include "sylar/sylar.h"
+#include "sylar/core/memory/memorypool.h"
+
+#include <random>
+#include <thread>
+
+/**
+ * 页缓存测试
+ * 1. 随机大小的 span 随机顺序释放，全部释放后相邻的空闲 span 合并回整块
+ * 2. 非 span 起始地址的释放被忽略
+ * 3. 多线程分配释放的吞吐
+ *
+ * 用法：test_page_cache [threads=4] [ops=200000]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void test_coalesce()
+{
+    auto &pc = sylar::PageCache::GetInstance();
+    auto before = pc.getStats();
+
+    std::mt19937 rng(1);
+    std::vector<std::pair<char *, size_t> > spans;
+    for (int i = 0; i < 2000; ++i) {
+        size_t pages = rng() % 8 ? 1 + rng() % 16 : 1 + rng() % 600;
+        char *p = (char *)pc.allocateSpan(pages);
+        SYLAR_ASSERT(p);
+        // 首尾各写一下，span 之间不能重叠
+        p[0] = (char)i;
+        p[pages * sylar::PageCache::PAGE_SIZE - 1] = (char)i;
+        spans.emplace_back(p, pages);
+    }
+    for (size_t i = 0; i < spans.size(); ++i) {
+        SYLAR_ASSERT(spans[i].first[0] == (char)i);
+        SYLAR_ASSERT(spans[i].first[spans[i].second * sylar::PageCache::PAGE_SIZE - 1] == (char)i);
+    }
+    auto mid = pc.getStats();
+    SYLAR_ASSERT(mid.inUseSpans - before.inUseSpans == spans.size());
+
+    std::shuffle(spans.begin(), spans.end(), rng);
+    for (auto &i : spans) {
+        pc.deallocateSpan(i.first, i.second);
+    }
+    auto after = pc.getStats();
+    uint64_t regions = (after.systemBytes - before.systemBytes)
+                       / (sylar::PageCache::SYSTEM_ALLOC_PAGES * sylar::PageCache::PAGE_SIZE);
+    SYLAR_LOG_INFO(g_logger) << "system_bytes=" << after.systemBytes
+                             << " free_spans=" << after.freeSpans
+                             << " free_pages=" << after.freePages
+                             << " released_pages=" << after.releasedPages << " regions<=" << regions;
+    SYLAR_ASSERT(after.inUseSpans == before.inUseSpans);
+    SYLAR_ASSERT(after.inUsePages == before.inUsePages);
+    SYLAR_ASSERT((after.freePages + after.releasedPages) * sylar::PageCache::PAGE_SIZE
+                 == after.systemBytes - after.inUsePages * sylar::PageCache::PAGE_SIZE);
+    // 用过的页合并成一个空闲 span，区域末尾没碰过的页是另一个(不和用过的合并)，相邻的区域还可能合并在一起
+    SYLAR_ASSERT(after.freeSpans - before.freeSpans <= regions * 2);
+    SYLAR_LOG_INFO(g_logger) << "coalesce ok";
+}
+
+static void test_invalid_free()
+{
+    auto &pc = sylar::PageCache::GetInstance();
+    char *p = (char *)pc.allocateSpan(4);
+    auto before = pc.getStats();
+    // 中间页和没分配过的地址都不处理
+    pc.deallocateSpan(p + sylar::PageCache::PAGE_SIZE, 3);
+    int x = 0;
+    pc.deallocateSpan(&x, 1);
+    auto after = pc.getStats();
+    SYLAR_ASSERT(after.inUseSpans == before.inUseSpans);
+    pc.deallocateSpan(p, 4);
+    // 重复释放也不处理
+    pc.deallocateSpan(p, 4);
+    SYLAR_ASSERT(pc.getStats().inUseSpans == before.inUseSpans - 1);
+    SYLAR_LOG_INFO(g_logger) << "invalid free ok";
+}
+
+static void bench(int threads, int ops)
+{
+    uint64_t begin = sylar::GetCurrentUS();
+    std::vector<std::thread> ts;
+    for (int t = 0; t < threads; ++t) {
+        ts.emplace_back([ops, t]() {
+            auto &pc = sylar::PageCache::GetInstance();
+            std::mt19937 rng(t);
+            std::vector<std::pair<void *, size_t> > live(64, {nullptr, 0});
+            for (int i = 0; i < ops; ++i) {
+                auto &slot = live[rng() % live.size()];
+                if (slot.first) {
+                    pc.deallocateSpan(slot.first, slot.second);
+                }
+                slot.second = 1 + rng() % 16;
+                slot.first = pc.allocateSpan(slot.second);
+            }
+            for (auto &slot : live) {
+                if (slot.first) {
+                    pc.deallocateSpan(slot.first, slot.second);
+                }
+            }
+        });
+    }
+    for (auto &t : ts) {
+        t.join();
+    }
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    std::cout << "threads=" << threads << " ops=" << ops * threads
+              << " ns/op=" << us * 1000.0 / ops / threads << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int ops = argc > 2 ? atoi(argv[2]) : 200000;
+    test_coalesce();
+    test_invalid_free();
+    bench(1, ops);
+    bench(threads, ops / threads);
+    return 0;
+}
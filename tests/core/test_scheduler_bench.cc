@@ -0,0 +1,174 @@
+#include "sylar/sylar.h"
+
+#include <atomic>
+#include <iomanip>
+#include <new>
+
+/**
+ * 调度器吞吐测试，分别测 1/8/32 个线程下每秒完成的任务数和每个任务的堆分配次数
+ * 1. external: 外部线程提交任务（全局队列）
+ * 2. fanout:   任务在调度线程里继续派生任务（本地队列 + 窃取）
+ * 3. pinned:   任务指定线程执行（亲和队列）
+ * 4. capture:  同 fanout，回调捕获两个 shared_ptr 和两个整数（48 字节），
+ *              和 TcpServer::startAccept 里 bind(handleClient, self, client) 的大小相当
+ *
+ * 用法：test_scheduler_bench [threads...]，默认 1 8 32
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_done{0};
+
+static std::atomic<uint64_t> s_allocs{0};
+
+void *operator new(size_t size)
+{
+    ++s_allocs;
+    void *p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+static const uint64_t TASKS = 100000;
+
+static void empty_task()
+{
+    ++s_done;
+}
+
+static void fanout_task(int depth)
+{
+    ++s_done;
+    if (depth > 0) {
+        sylar::Scheduler::GetThis()->schedule(std::bind(&fanout_task, depth - 1));
+        sylar::Scheduler::GetThis()->schedule(std::bind(&fanout_task, depth - 1));
+    }
+}
+
+static void capture_task(std::shared_ptr<int> a, std::shared_ptr<int> b, int depth, int spare)
+{
+    ++s_done;
+    if (depth > 0) {
+        for (int i = 0; i < 2; ++i) {
+            sylar::Scheduler::GetThis()->schedule([a, b, depth, spare]() {
+                capture_task(a, b, depth - 1, spare);
+            });
+        }
+    }
+}
+
+static void report(const char *name, size_t threads, uint64_t tasks, uint64_t us, uint64_t allocs)
+{
+    std::cout << std::left << std::setw(10) << name << " threads=" << std::setw(4) << threads
+              << " tasks=" << std::setw(8) << tasks << " cost=" << std::setw(8) << us / 1000
+              << "ms tasks/sec=" << std::setw(10) << (uint64_t)(tasks * 1000000.0 / (us ? us : 1))
+              << " allocs/task=" << std::fixed << std::setprecision(2)
+              << (double)allocs / (tasks ? tasks : 1) << std::endl;
+}
+
+static void bench_external(size_t threads)
+{
+    s_done = 0;
+    sylar::Scheduler sc(threads, false, "bench");
+    sc.start();
+    uint64_t allocs = s_allocs;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < TASKS; ++i) {
+        sc.schedule(&empty_task);
+    }
+    sc.stop();
+    report("external", threads, s_done, sylar::GetCurrentUS() - begin, s_allocs - allocs);
+}
+
+static void bench_fanout(size_t threads)
+{
+    s_done = 0;
+    // 2^17 - 1 个任务
+    const int depth = 16;
+    sylar::Scheduler sc(threads, false, "bench");
+    sc.start();
+    uint64_t allocs = s_allocs;
+    uint64_t begin = sylar::GetCurrentUS();
+    sc.schedule(std::bind(&fanout_task, depth));
+    sc.stop();
+    report("fanout", threads, s_done, sylar::GetCurrentUS() - begin, s_allocs - allocs);
+}
+
+static void bench_capture(size_t threads)
+{
+    s_done = 0;
+    const int depth = 16;
+    sylar::Scheduler sc(threads, false, "bench");
+    sc.start();
+    std::shared_ptr<int> a = std::make_shared<int>(1), b = std::make_shared<int>(2);
+    uint64_t allocs = s_allocs;
+    uint64_t begin = sylar::GetCurrentUS();
+    sc.schedule([a, b, depth]() { capture_task(a, b, depth, 0); });
+    sc.stop();
+    report("capture", threads, s_done, sylar::GetCurrentUS() - begin, s_allocs - allocs);
+}
+
+static void bench_pinned(size_t threads)
+{
+    s_done = 0;
+    sylar::Scheduler sc(threads, false, "bench");
+    sc.start();
+    // 先在每个线程上跑一个任务拿到线程id
+    std::vector<int> ids;
+    sylar::Mutex mutex;
+    for (size_t i = 0; i < threads; ++i) {
+        sc.schedule([&ids, &mutex]() {
+            sylar::Mutex::Lock lock(mutex);
+            ids.push_back(sylar::GetThreadId());
+        });
+    }
+    while (true) {
+        sylar::Mutex::Lock lock(mutex);
+        if (ids.size() >= threads) {
+            break;
+        }
+        lock.unlock();
+        usleep(1000);
+    }
+    uint64_t allocs = s_allocs;
+    uint64_t begin = sylar::GetCurrentUS();
+    for (uint64_t i = 0; i < TASKS; ++i) {
+        sc.schedule(&empty_task, ids[i % ids.size()]);
+    }
+    sc.stop();
+    report("pinned", threads, s_done - threads, sylar::GetCurrentUS() - begin, s_allocs - allocs);
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    std::vector<size_t> thread_nums;
+    for (int i = 1; i < argc; ++i) {
+        thread_nums.push_back(atoi(argv[i]));
+    }
+    if (thread_nums.empty()) {
+        thread_nums = {1, 8, 32};
+    }
+
+    for (size_t threads : thread_nums) {
+        bench_external(threads);
+        bench_fanout(threads);
+        bench_pinned(threads);
+        bench_capture(threads);
+    }
+    return 0;
+}
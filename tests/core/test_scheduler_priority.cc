@@ -0,0 +1,124 @@
+#include "sylar/sylar.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <thread>
+
+/**
+ * 调度器优先级测试
+ * 1. 配额：单线程调度器先堵住，积压交互任务和后台任务，放开之后检查执行顺序：
+ *    交互任务优先，但后台任务每 scheduler.background_interval 次至少轮到一次
+ * 2. 延迟：后台任务(每个占 200us CPU)持续积压的同时，每 1ms 提交一个交互任务，
+ *    对比后台任务走后台队列(lanes)和全部按交互任务调度(fifo)时交互任务的排队等待 p50/p99，
+ *    lanes 模式再输出调度器按优先级统计的排队等待直方图(scheduler.queue_wait_stats)
+ *
+ * 用法：test_scheduler_priority [threads=2] [background_tasks=2000] [interactive_tasks=300]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void busy(uint64_t us)
+{
+    uint64_t end = sylar::GetCurrentUS() + us;
+    while (sylar::GetCurrentUS() < end) {
+    }
+}
+
+static void test_quota()
+{
+    const uint32_t interval =
+        sylar::Config::Lookup<uint32_t>("scheduler.background_interval")->getValue();
+    const int interactive = 80, background = 10;
+    std::vector<int> order; // 1 交互，2 后台
+    std::atomic<bool> gate{false};
+
+    sylar::Scheduler sc(1, false, "quota");
+    sc.start();
+    // 普通 Scheduler 没有 IOManager，不能用 hook 过的 sleep
+    sc.schedule([&gate]() {
+        while (!gate) {
+            std::this_thread::yield();
+        }
+    });
+    usleep(10 * 1000);
+    for (int i = 0; i < background; ++i) {
+        sc.schedule([&order]() { order.push_back(2); }, -1, sylar::Scheduler::BACKGROUND);
+    }
+    for (int i = 0; i < interactive; ++i) {
+        sc.schedule([&order]() { order.push_back(1); });
+    }
+    gate = true;
+    sc.stop();
+
+    SYLAR_ASSERT(order.size() == (size_t)(interactive + background));
+    // 还有交互任务时，相邻两个后台任务之间的交互任务不超过 interval 个
+    size_t gap = 0, interactive_left = interactive;
+    for (int kind : order) {
+        if (kind == 1) {
+            ++gap;
+            --interactive_left;
+        } else {
+            if (interactive_left) {
+                SYLAR_ASSERT2(gap <= interval, "gap=" << gap << " interval=" << interval);
+            }
+            gap = 0;
+        }
+    }
+    // 交互任务整体排在前面：前一半的任务里后台任务不超过配额
+    size_t early_background = 0;
+    for (size_t i = 0; i < order.size() / 2; ++i) {
+        early_background += order[i] == 2;
+    }
+    SYLAR_ASSERT2(early_background <= order.size() / 2 / interval + 1,
+                  "early_background=" << early_background);
+    SYLAR_LOG_INFO(g_logger) << "quota interval=" << interval
+                             << " early_background=" << early_background << " ok";
+}
+
+static void bench_latency(bool lanes, size_t threads, int background, int interactive)
+{
+    sylar::Scheduler sc(threads, false, lanes ? "lanes" : "fifo");
+    sc.start();
+    sylar::Scheduler::Priority bg =
+        lanes ? sylar::Scheduler::BACKGROUND : sylar::Scheduler::INTERACTIVE;
+    for (int i = 0; i < background; ++i) {
+        sc.schedule([]() { busy(200); }, -1, bg);
+    }
+    // 交互任务自己记录从提交到开始执行的时间，两种模式用同一把尺子
+    std::vector<uint64_t> waits(interactive);
+    for (int i = 0; i < interactive; ++i) {
+        uint64_t submit = sylar::GetCurrentUS();
+        sc.schedule([&waits, i, submit]() {
+            waits[i] = sylar::GetCurrentUS() - submit;
+            busy(20);
+        });
+        usleep(1000);
+    }
+    sc.stop();
+
+    std::sort(waits.begin(), waits.end());
+    auto percentile = [&waits](double p) { return waits[(size_t)(p * (waits.size() - 1))]; };
+    std::cout << std::left << std::setw(6) << sc.getName() << " threads=" << threads
+              << " interactive wait p50=" << percentile(0.5) << "us p99=" << percentile(0.99)
+              << "us max=" << waits.back() << "us" << std::endl;
+    if (lanes) {
+        sc.dump(std::cout) << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    sylar::Config::Lookup<bool>("scheduler.queue_wait_stats")->setValue(true);
+
+    size_t threads = argc > 1 ? atoi(argv[1]) : 2;
+    int background = argc > 2 ? atoi(argv[2]) : 2000;
+    int interactive = argc > 3 ? atoi(argv[3]) : 300;
+
+    test_quota();
+    bench_latency(false, threads, background, interactive);
+    bench_latency(true, threads, background, interactive);
+    return 0;
+}
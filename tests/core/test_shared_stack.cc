@@ -0,0 +1,110 @@
+#include "sylar/sylar.h"
+#include "sylar/core/memory/stack_pool.h"
+
+#include <fstream>
+
+/**
+ * 共享栈协程测试
+ * 1. 正确性：大量共享栈协程在调度器里反复 yield，校验栈上数据不被破坏、始终回到绑定线程
+ * 2. 内存：N 个挂起的协程，对比私有栈和共享栈的 RSS 以及共享栈拷出的字节数
+ *
+ * 用法：test_shared_stack [fibers]，默认 20000
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_done{0};
+
+static void yield_back()
+{
+    sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis());
+    sylar::Fiber::GetThis()->yield();
+}
+
+static void check_fiber(int id)
+{
+    char buf[1024];
+    memset(buf, id & 0xff, sizeof(buf));
+    int tid = sylar::GetThreadId();
+    for (int i = 0; i < 10; ++i) {
+        yield_back();
+        SYLAR_ASSERT(tid == sylar::GetThreadId());
+        for (size_t j = 0; j < sizeof(buf); ++j) {
+            SYLAR_ASSERT2(buf[j] == (char)(id & 0xff), "fiber " << id << " stack corrupted");
+        }
+    }
+    ++s_done;
+}
+
+static void test_correctness(int n)
+{
+    s_done = 0;
+    sylar::Scheduler sc(4, false, "shared");
+    sc.start();
+    for (int i = 0; i < n; ++i) {
+        sc.schedule(sylar::Fiber::ptr(new sylar::Fiber(std::bind(&check_fiber, i), 0, true, true)));
+    }
+    sc.stop();
+    SYLAR_ASSERT(s_done == (uint64_t)n);
+    SYLAR_LOG_INFO(g_logger) << "shared stack correctness fibers=" << n << " ok";
+}
+
+static size_t status_kb(const std::string &name)
+{
+    std::ifstream ifs("/proc/self/status");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.compare(0, name.size(), name) == 0) {
+            return atoll(line.c_str() + name.size());
+        }
+    }
+    return 0;
+}
+
+static void parked()
+{
+    // 模拟连接协程：用掉一点栈，然后长时间挂起
+    char buf[2048];
+    memset(buf, 1, sizeof(buf));
+    asm volatile("" : : "r"(buf) : "memory");
+    sylar::Fiber::GetThis()->yield();
+}
+
+static void test_memory(int n, bool shared)
+{
+    sylar::Fiber::GetThis();
+    size_t rss = status_kb("VmRSS:");
+    size_t vm = status_kb("VmSize:");
+    std::vector<sylar::Fiber::ptr> fibers;
+    fibers.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        fibers.emplace_back(new sylar::Fiber(&parked, 0, false, shared));
+        fibers.back()->resume();
+    }
+    size_t saved = 0;
+    for (auto &i : fibers) {
+        saved += i->getContext().getSavedSize();
+    }
+    rss = status_kb("VmRSS:") - rss;
+    vm = status_kb("VmSize:") - vm;
+    std::cout << (shared ? "shared " : "private") << " fibers=" << n << " vm_delta=" << vm / 1024
+              << "MB rss_delta=" << rss / 1024 << "MB"
+              << " saved_bytes=" << saved << std::endl;
+    for (auto &i : fibers) {
+        i->resume();
+    }
+    fibers.clear();
+    sylar::FiberStackPool::Trim(true);
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    int n = argc > 1 ? atoi(argv[1]) : 20000;
+    test_correctness(n / 10);
+    test_memory(n, false);
+    test_memory(n, true);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "sylar/sylar.h"
+#include "sylar/core/util/topology.h"
+#include "sylar/core/memory/memorypool.h"
+#include "sylar/core/worker.h"
+
+#include <sched.h>
+
+/**
+ * CPU 拓扑和调度线程绑核测试
+ * 1. CPU 列表解析：区间、单个 CPU、node:N、错误格式
+ * 2. 调度线程绑核：构造时从 scheduler.cpu_affinity 读取，运行中再改，线程的亲和性跟着变
+ * 3. WorkerManager 的 cpus / numa_spread 参数
+ * 4. 内存池和协程栈在打开就近分配时仍然可用(单节点机器上绑定是空操作)
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::vector<int> current_affinity()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    std::vector<int> cpus;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &set)) {
+            cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+static void test_parse()
+{
+    auto topo = sylar::CpuTopologyMgr::GetInstance();
+    SYLAR_LOG_INFO(g_logger) << "nodes=" << topo->getNodeCount() << " cpus=" << topo->getCpuCount()
+                             << " current_cpu=" << sylar::CpuTopology::CurrentCpu()
+                             << " current_node=" << topo->currentNode();
+    SYLAR_ASSERT(topo->getNodeCount() >= 1 && topo->getCpuCount() >= 1);
+
+    std::vector<int> cpus;
+    SYLAR_ASSERT(topo->parseCpuList("", cpus) && cpus.empty());
+    SYLAR_ASSERT(topo->parseCpuList("0", cpus) && cpus == std::vector<int>{0});
+    SYLAR_ASSERT(topo->parseCpuList("node:0", cpus) && cpus == topo->getCpusOfNode(0));
+    SYLAR_ASSERT(topo->parseCpuList("0, 0-0,node:0", cpus) && cpus == topo->getCpusOfNode(0));
+    SYLAR_ASSERT(!topo->parseCpuList("a", cpus));
+    SYLAR_ASSERT(!topo->parseCpuList("1-", cpus));
+    SYLAR_ASSERT(!topo->parseCpuList("3-1", cpus));
+    SYLAR_ASSERT(!topo->parseCpuList("0x", cpus));
+    SYLAR_ASSERT(!topo->parseCpuList("node:1000", cpus));
+    SYLAR_ASSERT(!topo->parseCpuList("100000", cpus));
+    if (topo->getCpuCount() >= 4) {
+        SYLAR_ASSERT(topo->parseCpuList("3,0-1", cpus) && cpus == std::vector<int>({0, 1, 3}));
+    }
+    SYLAR_LOG_INFO(g_logger) << "parse ok";
+}
+
+static void test_scheduler_affinity()
+{
+    auto topo = sylar::CpuTopologyMgr::GetInstance();
+    int last = topo->getCpuCount() - 1;
+    sylar::Config::Lookup<std::map<std::string, std::string> >("scheduler.cpu_affinity")
+        ->setValue({{"pinned", std::to_string(last)}});
+
+    sylar::IOManager iom(1, false, "pinned");
+    SYLAR_ASSERT(iom.getAffinity() == std::vector<int>{last});
+    SYLAR_ASSERT(iom.getNumaNode() == topo->getNodeOfCpu(last));
+
+    std::vector<int> got;
+    std::atomic<int> cpu{-1};
+    iom.schedule([&]() {
+        got = current_affinity();
+        cpu = sylar::CpuTopology::CurrentCpu();
+    });
+    while (cpu < 0) {
+        usleep(1000);
+    }
+    SYLAR_ASSERT(got == std::vector<int>{last});
+    SYLAR_ASSERT(cpu == last);
+
+    // 运行中的线程改绑
+    iom.setAffinity({0});
+    cpu = -1;
+    iom.schedule([&]() {
+        got = current_affinity();
+        cpu = sylar::CpuTopology::CurrentCpu();
+    });
+    while (cpu < 0) {
+        usleep(1000);
+    }
+    SYLAR_ASSERT(got == std::vector<int>{0});
+    SYLAR_ASSERT(cpu == 0);
+
+    std::stringstream ss;
+    iom.dump(ss);
+    SYLAR_ASSERT(ss.str().find("numa_node=") != std::string::npos);
+    iom.stop();
+    sylar::Config::Lookup<std::map<std::string, std::string> >("scheduler.cpu_affinity")
+        ->setValue({});
+    SYLAR_LOG_INFO(g_logger) << "scheduler affinity ok";
+}
+
+static void test_worker()
+{
+    auto topo = sylar::CpuTopologyMgr::GetInstance();
+    sylar::WorkerManager mgr;
+    mgr.init({{"w_cpus", {{"thread_num", "1"}, {"worker_num", "2"}, {"cpus", "0"}}},
+              {"w_spread", {{"thread_num", "1"}, {"worker_num", "3"}, {"numa_spread", "1"}}}});
+    SYLAR_ASSERT(mgr.get("w_cpus")->getAffinity() == std::vector<int>{0});
+    SYLAR_ASSERT(mgr.get("w_cpus-1")->getAffinity() == std::vector<int>{0});
+    for (int x = 0; x < 3; ++x) {
+        std::string name = x ? "w_spread-" + std::to_string(x) : "w_spread";
+        auto s = mgr.get(name);
+        int node = x % topo->getNodeCount();
+        SYLAR_ASSERT(s->getAffinity() == topo->getCpusOfNode(node));
+        SYLAR_ASSERT(s->getNumaNode() == node);
+    }
+    mgr.stop();
+    SYLAR_LOG_INFO(g_logger) << "worker ok";
+}
+
+static void test_alloc()
+{
+    sylar::IOManager iom(2, false, "alloc");
+    std::atomic<int> done{0};
+    for (int i = 0; i < 100; ++i) {
+        iom.schedule([&done]() {
+            std::vector<void *> ptrs;
+            for (size_t size = 8; size <= 64 * 1024; size *= 2) {
+                void *p = sylar::ThreadCache::GetInstance()->allocate(size);
+                SYLAR_ASSERT(p);
+                memset(p, 0x5a, size);
+                ptrs.push_back(p);
+            }
+            size_t size = 8;
+            for (void *p : ptrs) {
+                sylar::ThreadCache::GetInstance()->deallocate(p, size);
+                size *= 2;
+            }
+            ++done;
+        });
+    }
+    iom.stop();
+    SYLAR_ASSERT(done == 100);
+    SYLAR_LOG_INFO(g_logger) << "alloc ok local_alloc="
+                             << sylar::CpuTopologyMgr::GetInstance()->isLocalAlloc();
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_parse();
+    test_scheduler_affinity();
+    test_worker();
+    test_alloc();
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "sylar/sylar.h"
+#include "sylar/core/hook.h"
+#include "sylar/core/watchdog.h"
+
+#include <atomic>
+
+/**
+ * 协程卡住检测测试
+ * 1. 一个协程空转占着 CPU，一个协程调用没有 hook 的 sleep，看门狗都要记下来并取到栈
+ * 2. 正常让出的协程不报警，运行时长直方图有记录
+ * 3. 开销：大量很短的任务，scheduler.stall_threshold_ms 开和关的每个任务耗时
+ *
+ * 用法：test_watchdog [tasks=1000000]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static void __attribute__((noinline)) burn_cpu(uint64_t ms)
+{
+    uint64_t end = sylar::GetCurrentMS() + ms;
+    volatile uint64_t n = 0;
+    while (sylar::GetCurrentMS() < end) {
+        ++n;
+    }
+}
+
+static void test_stall()
+{
+    sylar::Config::Lookup<uint32_t>("scheduler.stall_threshold_ms")->setValue(50);
+    uint64_t before = sylar::FiberWatchdogMgr::GetInstance()->getStallCount();
+    {
+        sylar::IOManager iom(2, false, "stall");
+        iom.schedule([]() { burn_cpu(300); });
+        iom.schedule([]() { sleep_f(1); });
+        // 正常让出的协程不算
+        iom.schedule([]() {
+            for (int i = 0; i < 10; ++i) {
+                usleep(30 * 1000);
+            }
+        });
+        iom.stop();
+        std::stringstream ss;
+        iom.dump(ss);
+        SYLAR_LOG_INFO(g_logger) << ss.str();
+        SYLAR_ASSERT(iom.getRunSliceStats().count > 0);
+    }
+    std::vector<sylar::FiberWatchdog::Stall> stalls;
+    sylar::FiberWatchdogMgr::GetInstance()->listStalls(stalls);
+    SYLAR_ASSERT2(sylar::FiberWatchdogMgr::GetInstance()->getStallCount() - before == 2,
+                  "stalls=" << sylar::FiberWatchdogMgr::GetInstance()->getStallCount() - before);
+    for (size_t i = stalls.size() - 2; i < stalls.size(); ++i) {
+        SYLAR_ASSERT(stalls[i].usedMs >= 50);
+        SYLAR_ASSERT(!stalls[i].backtrace.empty());
+    }
+    std::stringstream ss;
+    sylar::FiberWatchdogMgr::GetInstance()->dump(ss);
+    SYLAR_LOG_INFO(g_logger) << "stall ok" << std::endl << ss.str();
+}
+
+static void bench(int tasks, uint32_t threshold_ms)
+{
+    sylar::Config::Lookup<uint32_t>("scheduler.stall_threshold_ms")->setValue(threshold_ms);
+    std::atomic<int> done{0};
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::IOManager iom(1, false, "bench");
+        iom.schedule([&iom, &done, tasks]() {
+            for (int i = 0; i < tasks; ++i) {
+                iom.schedule([&done]() { ++done; });
+            }
+        });
+        iom.stop();
+    }
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    SYLAR_ASSERT(done == tasks);
+    std::cout << "stall_threshold_ms=" << threshold_ms << " tasks=" << tasks
+              << " ns/task=" << us * 1000.0 / tasks << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    int tasks = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    test_stall();
+    bench(tasks, 0);
+    bench(tasks, 100);
+    return 0;
+}
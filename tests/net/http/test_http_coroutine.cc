@@ -0,0 +1,228 @@
+#include "sylar/sylar.h"
+#include "sylar/net/streams/socket_stream.h"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <fstream>
+
+/**
+ * 协程版本的 HTTP 处理函数，对比有栈协程(SocketStream::read/write)和
+ * C++20 无栈协程(SocketStream::coRead/coWrite)每个连接占用的内存和处理请求的开销
+ * 服务端跑在父进程，每个连接一个处理函数，读到完整的请求头就回一个固定的响应；
+ * 客户端 fork 出来，先建立 connections 个长连接并保持空闲，服务端在所有连接都挂起等待请求时
+ * 统计进程 RSS/虚拟内存增量，然后客户端每个连接顺序发 requests 个请求。
+ *
+ * 用法：test_http_coroutine [mode=coroutine|fiber] [connections=2000] [requests=200] [client_threads=2]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const char *PORT = "127.0.0.1:8034";
+
+static const std::string REQUEST = "GET /ping HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+static const std::string RESPONSE =
+    "HTTP/1.1 200 OK\r\ncontent-length: 4\r\nConnection: keep-alive\r\n\r\npong";
+
+static std::atomic<int> s_live{0};
+static std::atomic<uint64_t> s_requests{0};
+
+/**
+ * 有栈协程版本，阻塞在 hook 过的 recv/send 上
+ */
+static void handle_fiber(sylar::SocketStream::ptr stream)
+{
+    ++s_live;
+    std::string buf;
+    char tmp[1024];
+    while (true) {
+        int n = stream->read(tmp, sizeof(tmp));
+        if (n <= 0) {
+            break;
+        }
+        buf.append(tmp, n);
+        size_t pos;
+        while ((pos = buf.find("\r\n\r\n")) != std::string::npos) {
+            buf.erase(0, pos + 4);
+            if (stream->writeFixSize(RESPONSE.c_str(), RESPONSE.size()) <= 0) {
+                --s_live;
+                return;
+            }
+            ++s_requests;
+        }
+    }
+    --s_live;
+}
+
+/**
+ * 无栈协程版本，处理逻辑和 handle_fiber 一样，读写换成 co_await
+ */
+static sylar::Task<> handle_coroutine(sylar::SocketStream::ptr stream)
+{
+    ++s_live;
+    std::string buf;
+    char tmp[1024];
+    while (true) {
+        int n = co_await stream->coRead(tmp, sizeof(tmp));
+        if (n <= 0) {
+            break;
+        }
+        buf.append(tmp, n);
+        size_t pos;
+        while ((pos = buf.find("\r\n\r\n")) != std::string::npos) {
+            buf.erase(0, pos + 4);
+            size_t offset = 0;
+            while (offset < RESPONSE.size()) {
+                int rt = co_await stream->coWrite(RESPONSE.c_str() + offset,
+                                                  RESPONSE.size() - offset);
+                if (rt <= 0) {
+                    --s_live;
+                    co_return;
+                }
+                offset += rt;
+            }
+            ++s_requests;
+        }
+    }
+    --s_live;
+}
+
+/**
+ * 进程的虚拟内存和常驻内存(KB)
+ */
+static void memory_kb(uint64_t &vm, uint64_t &rss)
+{
+    std::ifstream ifs("/proc/self/statm");
+    uint64_t pages_vm = 0, pages_rss = 0;
+    ifs >> pages_vm >> pages_rss;
+    vm = pages_vm * getpagesize() / 1024;
+    rss = pages_rss * getpagesize() / 1024;
+}
+
+static bool read_response(int fd, std::string &buf)
+{
+    char tmp[4096];
+    while (true) {
+        size_t pos = buf.find("\r\n\r\n");
+        if (pos != std::string::npos && buf.size() >= pos + 4 + 4) {
+            buf.erase(0, pos + 8);
+            return true;
+        }
+        ssize_t n = read(fd, tmp, sizeof(tmp));
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(tmp, n);
+    }
+}
+
+static void client(int threads, int connections, int requests)
+{
+    sylar::IOManager iom(threads, false, "client");
+    std::vector<sylar::Socket::ptr> socks(connections);
+    std::atomic<int> connected{0};
+    for (int c = 0; c < connections; ++c) {
+        iom.schedule([&socks, &connected, c]() {
+            sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(PORT);
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            while (!sock->connect(addr)) {
+                sock = sylar::Socket::CreateTCP(addr);
+                usleep(10 * 1000);
+            }
+            socks[c] = sock;
+            ++connected;
+        });
+    }
+    while (connected < connections) {
+        usleep(10 * 1000);
+    }
+    // 连接保持空闲，等服务端统计内存
+    sleep(1);
+    std::atomic<uint64_t> ok{0};
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int c = 0; c < connections; ++c) {
+        iom.schedule([&socks, &ok, c, requests]() {
+            int fd = socks[c]->getSocket();
+            std::string buf;
+            for (int i = 0; i < requests; ++i) {
+                if (write(fd, REQUEST.c_str(), REQUEST.size()) <= 0 || !read_response(fd, buf)) {
+                    SYLAR_LOG_ERROR(g_logger) << "request failed i=" << i;
+                    return;
+                }
+                ++ok;
+            }
+            socks[c]->close();
+        });
+    }
+    iom.stop();
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    std::cout << "client requests=" << ok << " cost=" << us / 1000
+              << "ms requests/sec=" << (uint64_t)(ok * 1000000.0 / (us ? us : 1)) << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    signal(SIGPIPE, SIG_IGN);
+
+    bool coroutine = argc <= 1 || std::string(argv[1]) != "fiber";
+    int connections = argc > 2 ? atoi(argv[2]) : 2000;
+    int requests = argc > 3 ? atoi(argv[3]) : 200;
+    int client_threads = argc > 4 ? atoi(argv[4]) : 2;
+
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        client(client_threads, connections, requests);
+        return 0;
+    }
+
+    uint64_t vm_begin = 0, rss_begin = 0;
+    uint64_t vm_peak = 0, rss_peak = 0;
+    sylar::IOManager iom(1, false, "server");
+    iom.schedule([&]() {
+        sylar::Socket::ptr listener = sylar::Socket::CreateTCPSocket();
+        sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(PORT);
+        int on = 1;
+        listener->setOption(SOL_SOCKET, SO_REUSEADDR, on);
+        while (!listener->bind(addr)) {
+            sleep(1);
+        }
+        listener->listen();
+        memory_kb(vm_begin, rss_begin);
+        for (int i = 0; i < connections; ++i) {
+            sylar::Socket::ptr sock = listener->accept();
+            if (!sock) {
+                SYLAR_LOG_ERROR(g_logger) << "accept failed";
+                break;
+            }
+            sylar::SocketStream::ptr stream(new sylar::SocketStream(sock));
+            if (coroutine) {
+                sylar::CoSpawn(handle_coroutine(stream));
+            } else {
+                sylar::IOManager::GetThis()->schedule(std::bind(handle_fiber, stream));
+            }
+        }
+        // 所有连接都已经挂起等待请求
+        while (s_live < connections) {
+            usleep(1000);
+        }
+        usleep(100 * 1000);
+        memory_kb(vm_peak, rss_peak);
+    });
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    iom.stop();
+    std::cout << "server mode=" << (coroutine ? "coroutine" : "fiber")
+              << " connections=" << connections << " requests=" << s_requests
+              << " vm/conn=" << (vm_peak - vm_begin) * 1024 / connections << "B"
+              << " rss/conn=" << (rss_peak - rss_begin) * 1024 / connections << "B" << std::endl;
+    return 0;
+}
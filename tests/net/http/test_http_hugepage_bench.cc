@@ -0,0 +1,228 @@
+#include "sylar/sylar.h"
+#include "sylar/core/memory/memorypool.h"
+#include "sylar/core/memory/stack_pool.h"
+#include "sylar/net/http/http_server.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <atomic>
+
+/**
+ * 大页压测：HTTP 长连接负载下服务端的 dTLB miss
+ * 服务端的协程栈从页缓存分配(fiber.stack_pool.use_arena)，页缓存按 memory_pool.huge_pages 用不用大页，
+ * 连接数多时每个请求都换一个协程栈，栈页分散，普通页下 dTLB 装不下。
+ * 客户端 fork 出来，服务端用 perf_event_open 统计自己(包括之后创建的线程)的 dTLB miss，
+ * 输出格式仿照 perf stat；内核不让用硬件计数器时(虚拟机、perf_event_paranoid)显示 <not supported>，
+ * 这时看 AnonHugePages 和缺页次数确认大页有没有用上。
+ *
+ * 用法：test_http_hugepage_bench [huge_pages=none|thp|hugetlb] [connections=500] [requests=200]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const char *PORT = "127.0.0.1:8032";
+
+static const std::string REQUEST = "GET /ping HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+struct Counter {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd = -1;
+};
+
+static Counter s_counters[] = {
+    {"dTLB-load-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+         | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"dTLB-store-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_WRITE << 8)
+         | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+/**
+ * 打开计数器，先不开始计数；inherit 让之后创建的线程也算进来
+ */
+static void open_counters()
+{
+    for (auto &c : s_counters) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = c.type;
+        attr.config = c.config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        c.fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+static void enable_counters(bool on)
+{
+    for (auto &c : s_counters) {
+        if (c.fd >= 0) {
+            ioctl(c.fd, on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+static size_t anon_huge_kb()
+{
+    size_t total = 0;
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) {
+        return 0;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        size_t kb = 0;
+        if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1
+            || sscanf(line, "Private_Hugetlb: %zu kB", &kb) == 1) {
+            total += kb;
+        }
+    }
+    fclose(f);
+    return total;
+}
+
+/**
+ * 读完一个响应：头部加上 content-length 的 body，多读到的留在 buf 里
+ */
+static bool read_response(int fd, std::string &buf)
+{
+    char tmp[4096];
+    while (true) {
+        size_t pos = buf.find("\r\n\r\n");
+        if (pos != std::string::npos) {
+            size_t len = 0;
+            size_t cl = buf.find("content-length: ");
+            if (cl != std::string::npos && cl < pos) {
+                len = atoi(buf.c_str() + cl + 16);
+            }
+            if (buf.size() >= pos + 4 + len) {
+                buf.erase(0, pos + 4 + len);
+                return true;
+            }
+        }
+        ssize_t n = read(fd, tmp, sizeof(tmp));
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(tmp, n);
+    }
+}
+
+/**
+ * 所有连接先建好，再一起发请求，服务端同时挂着 connections 个会话协程
+ */
+static void client(int connections, int requests)
+{
+    sylar::IOManager iom(1, false, "client");
+    std::atomic<int> connected{0};
+    std::atomic<uint64_t> ok{0};
+    uint64_t begin = 0;
+    for (int c = 0; c < connections; ++c) {
+        iom.schedule([&, requests]() {
+            sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(PORT);
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            while (!sock->connect(addr)) {
+                sock = sylar::Socket::CreateTCP(addr);
+                usleep(10 * 1000);
+            }
+            if (++connected == connections) {
+                begin = sylar::GetCurrentUS();
+            }
+            while (connected < connections) {
+                usleep(1000);
+            }
+            std::string buf;
+            for (int i = 0; i < requests; ++i) {
+                if (write(sock->getSocket(), REQUEST.c_str(), REQUEST.size()) <= 0
+                    || !read_response(sock->getSocket(), buf)) {
+                    SYLAR_LOG_ERROR(g_logger) << "request failed i=" << i;
+                    return;
+                }
+                ++ok;
+            }
+        });
+    }
+    iom.stop();
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    std::cout << "client requests=" << ok << " cost=" << us / 1000
+              << "ms requests/sec=" << (uint64_t)(ok * 1000000.0 / (us ? us : 1)) << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    std::string mode = argc > 1 ? argv[1] : "none";
+    int connections = argc > 2 ? atoi(argv[2]) : 500;
+    int requests = argc > 3 ? atoi(argv[3]) : 200;
+    sylar::Config::Lookup<std::string>("memory_pool.huge_pages")->setValue(mode);
+    sylar::Config::Lookup<bool>("fiber.stack_pool.use_arena")->setValue(true);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        client(connections, requests);
+        return 0;
+    }
+
+    open_counters();
+    sylar::IOManager iom(1, false, "server");
+    sylar::http::HttpServer::ptr server;
+    iom.schedule([&server]() {
+        server.reset(new sylar::http::HttpServer(true));
+        server->getServletDispatch()->addServlet(
+            "/ping", [](sylar::http::HttpRequest::ptr req, sylar::http::HttpResponse::ptr rsp,
+                        sylar::SocketStream::ptr session) {
+                rsp->setBody("pong");
+                return 0;
+            });
+        sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(PORT);
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+    });
+
+    enable_counters(true);
+    uint64_t begin = sylar::GetCurrentUS();
+    int status = 0;
+    waitpid(pid, &status, 0);
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    enable_counters(false);
+
+    auto stats = sylar::PageCache::GetInstance().getStats();
+    uint64_t total = (uint64_t)connections * requests;
+    std::cout << std::endl
+              << " Performance counter stats for 'http keepalive server huge_pages=" << mode
+              << " connections=" << connections << "':" << std::endl
+              << std::endl;
+    for (auto &c : s_counters) {
+        uint64_t value = 0;
+        if (c.fd < 0 || read(c.fd, &value, sizeof(value)) != sizeof(value)) {
+            std::cout << std::setw(20) << "<not supported>"
+                      << "      " << c.name << std::endl;
+            continue;
+        }
+        std::cout << std::setw(20) << value << "      " << c.name << "    # "
+                  << (double)value / total << " per request" << std::endl;
+    }
+    std::cout << std::endl
+              << std::setw(20) << us / 1e6 << " seconds time elapsed" << std::endl
+              << std::endl
+              << "page_cache system_bytes=" << stats.systemBytes
+              << " huge_page_bytes=" << stats.hugePageBytes
+              << " anon_huge_pages=" << anon_huge_kb() << "kB" << std::endl;
+    sylar::FiberStackPool::Dump(std::cout) << std::endl;
+    iom.schedule([&server]() { server->stop(); });
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "sylar/sylar.h"
+#include "sylar/net/http/http_server.h"
+
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <atomic>
+
+/**
+ * HTTP 长连接压测，统计服务端每个请求的 epoll 系统调用次数
+ * 服务端 HttpServer(keepalive) 跑在父进程，客户端 fork 出来，每个连接顺序发 requests 个请求。
+ * 测试程序自己定义 epoll_ctl/epoll_wait，计数之后再走系统调用，父子进程各自计数。
+ *
+ * 用法：test_http_keepalive_bench [persistent_epoll=0|1] [connections=50] [requests=2000]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_epoll_ctl{0};
+static std::atomic<uint64_t> s_epoll_wait{0};
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+    ++s_epoll_ctl;
+    return syscall(SYS_epoll_ctl, epfd, op, fd, event);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    ++s_epoll_wait;
+    return epoll_pwait(epfd, events, maxevents, timeout, nullptr);
+}
+
+static const char *PORT = "127.0.0.1:8031";
+
+static const std::string REQUEST = "GET /ping HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+/**
+ * 读完一个响应：头部加上 content-length 的 body，多读到的留在 buf 里
+ */
+static bool read_response(int fd, std::string &buf)
+{
+    char tmp[4096];
+    while (true) {
+        size_t pos = buf.find("\r\n\r\n");
+        if (pos != std::string::npos) {
+            size_t len = 0;
+            size_t cl = buf.find("content-length: ");
+            if (cl != std::string::npos && cl < pos) {
+                len = atoi(buf.c_str() + cl + 16);
+            }
+            if (buf.size() >= pos + 4 + len) {
+                buf.erase(0, pos + 4 + len);
+                return true;
+            }
+        }
+        ssize_t n = read(fd, tmp, sizeof(tmp));
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(tmp, n);
+    }
+}
+
+static void client(int connections, int requests)
+{
+    sylar::IOManager iom(1, false, "client");
+    std::atomic<uint64_t> ok{0};
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int c = 0; c < connections; ++c) {
+        iom.schedule([&ok, requests]() {
+            sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(PORT);
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            while (!sock->connect(addr)) {
+                sock = sylar::Socket::CreateTCP(addr);
+                usleep(10 * 1000);
+            }
+            std::string buf;
+            for (int i = 0; i < requests; ++i) {
+                if (write(sock->getSocket(), REQUEST.c_str(), REQUEST.size()) <= 0
+                    || !read_response(sock->getSocket(), buf)) {
+                    SYLAR_LOG_ERROR(g_logger) << "request failed i=" << i;
+                    return;
+                }
+                ++ok;
+            }
+        });
+    }
+    iom.stop();
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    std::cout << "client requests=" << ok << " cost=" << us / 1000
+              << "ms requests/sec=" << (uint64_t)(ok * 1000000.0 / (us ? us : 1)) << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    bool persistent = argc > 1 ? atoi(argv[1]) : 0;
+    int connections = argc > 2 ? atoi(argv[2]) : 50;
+    int requests = argc > 3 ? atoi(argv[3]) : 2000;
+    sylar::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(persistent);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        client(connections, requests);
+        return 0;
+    }
+
+    sylar::IOManager iom(1, false, "server");
+    sylar::http::HttpServer::ptr server;
+    iom.schedule([&server]() {
+        server.reset(new sylar::http::HttpServer(true));
+        server->getServletDispatch()->addServlet(
+            "/ping", [](sylar::http::HttpRequest::ptr req, sylar::http::HttpResponse::ptr rsp,
+                        sylar::SocketStream::ptr session) {
+                rsp->setBody("pong");
+                return 0;
+            });
+        sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(PORT);
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+    });
+
+    uint64_t ctl = s_epoll_ctl;
+    uint64_t wait = s_epoll_wait;
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ctl = s_epoll_ctl - ctl;
+    wait = s_epoll_wait - wait;
+    uint64_t total = (uint64_t)connections * requests;
+    std::cout << "server persistent_epoll=" << persistent << " requests=" << total
+              << " epoll_ctl=" << ctl << " epoll_wait=" << wait
+              << " epoll_ctl/req=" << (double)ctl / total
+              << " epoll_wait/req=" << (double)wait / total << std::endl;
+    iom.schedule([&server]() { server->stop(); });
+    return 0;
+}
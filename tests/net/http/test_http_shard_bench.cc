@@ -0,0 +1,148 @@
+#include "sylar/sylar.h"
+#include "sylar/net/http/http_server.h"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <atomic>
+
+/**
+ * HttpServer 分片模式(TcpServer::setShards)的吞吐随核数扩展的压测
+ * 服务端跑在父进程，shards 个分片各自 SO_REUSEPORT 监听同一个端口；
+ * 客户端 fork 出来，用 client_threads 个线程、connections 个长连接，每个连接顺序发 requests 个请求。
+ * shards=0 时是原来的 accept_worker + io_worker 模式，io_worker 用 threads 个线程。
+ * 服务端统计压测期间每秒的上下文切换次数(主动/被动)，用来观察 tickle 唤醒了多少线程。
+ *
+ * 用法：test_http_shard_bench [shards=1] [threads=1] [connections=200] [requests=2000] [client_threads=4]
+ * 例如：for n in 1 2 4 8; do test_http_shard_bench $n; done
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const char *PORT = "127.0.0.1:8033";
+
+static const std::string REQUEST = "GET /ping HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+/**
+ * 读完一个响应：头部加上 content-length 的 body，多读到的留在 buf 里
+ */
+static bool read_response(int fd, std::string &buf)
+{
+    char tmp[4096];
+    while (true) {
+        size_t pos = buf.find("\r\n\r\n");
+        if (pos != std::string::npos) {
+            size_t len = 0;
+            size_t cl = buf.find("content-length: ");
+            if (cl != std::string::npos && cl < pos) {
+                len = atoi(buf.c_str() + cl + 16);
+            }
+            if (buf.size() >= pos + 4 + len) {
+                buf.erase(0, pos + 4 + len);
+                return true;
+            }
+        }
+        ssize_t n = read(fd, tmp, sizeof(tmp));
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(tmp, n);
+    }
+}
+
+static void client(int threads, int connections, int requests)
+{
+    sylar::IOManager iom(threads, false, "client");
+    std::atomic<uint64_t> ok{0};
+    uint64_t begin = sylar::GetCurrentUS();
+    for (int c = 0; c < connections; ++c) {
+        iom.schedule([&ok, requests]() {
+            sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(PORT);
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            while (!sock->connect(addr)) {
+                sock = sylar::Socket::CreateTCP(addr);
+                usleep(10 * 1000);
+            }
+            std::string buf;
+            for (int i = 0; i < requests; ++i) {
+                if (write(sock->getSocket(), REQUEST.c_str(), REQUEST.size()) <= 0
+                    || !read_response(sock->getSocket(), buf)) {
+                    SYLAR_LOG_ERROR(g_logger) << "request failed i=" << i;
+                    return;
+                }
+                ++ok;
+            }
+        });
+    }
+    iom.stop();
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    std::cout << "client requests=" << ok << " cost=" << us / 1000
+              << "ms requests/sec=" << (uint64_t)(ok * 1000000.0 / (us ? us : 1)) << std::endl;
+}
+
+/**
+ * 本进程所有线程的上下文切换次数：主动(等待)，被动(被抢占)
+ */
+static void context_switches(uint64_t &voluntary, uint64_t &involuntary)
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    voluntary = usage.ru_nvcsw;
+    involuntary = usage.ru_nivcsw;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+    int shards = argc > 1 ? atoi(argv[1]) : 1;
+    int threads = argc > 2 ? atoi(argv[2]) : 1;
+    int connections = argc > 3 ? atoi(argv[3]) : 200;
+    int requests = argc > 4 ? atoi(argv[4]) : 2000;
+    int client_threads = argc > 5 ? atoi(argv[5]) : 4;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        client(client_threads, connections, requests);
+        return 0;
+    }
+
+    sylar::IOManager iom(1, false, "main");
+    sylar::IOManager io_worker(threads, false, "io");
+    sylar::http::HttpServer::ptr server;
+    iom.schedule([&server, &io_worker, shards]() {
+        server.reset(new sylar::http::HttpServer(true, &io_worker, &io_worker));
+        server->getServletDispatch()->addServlet(
+            "/ping", [](sylar::http::HttpRequest::ptr req, sylar::http::HttpResponse::ptr rsp,
+                        sylar::SocketStream::ptr session) {
+                rsp->setBody("pong");
+                return 0;
+            });
+        server->setShards(shards);
+        sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(PORT);
+        std::vector<sylar::Address::ptr> addrs{addr}, fails;
+        while (!server->bind(addrs, fails)) {
+            fails.clear();
+            sleep(1);
+        }
+        server->start();
+    });
+
+    uint64_t nvcsw = 0, nivcsw = 0;
+    context_switches(nvcsw, nivcsw);
+    uint64_t begin = sylar::GetCurrentUS();
+    int status = 0;
+    waitpid(pid, &status, 0);
+    uint64_t us = sylar::GetCurrentUS() - begin;
+    uint64_t vol = 0, invol = 0;
+    context_switches(vol, invol);
+    vol -= nvcsw;
+    invol -= nivcsw;
+    double secs = us ? us / 1000000.0 : 1;
+    std::cout << "server shards=" << shards << " io_threads=" << (shards ? 0 : threads)
+              << " connections=" << connections << " csw/sec=" << (uint64_t)((vol + invol) / secs)
+              << " (voluntary=" << (uint64_t)(vol / secs)
+              << " involuntary=" << (uint64_t)(invol / secs) << ")" << std::endl;
+    iom.schedule([&server]() { server->stop(); });
+    return 0;
+}
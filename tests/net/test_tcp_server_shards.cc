@@ -0,0 +1,154 @@
+#include "sylar/sylar.h"
+
+#include <sys/socket.h>
+#include <atomic>
+
+/**
+ * TcpServer 分片模式的停止
+ * 1. 在分片之外调用 stop：挂在读上的长连接读到 EOF 结束，stop 等所有分片退出之后返回，
+ *    分片上不再有任务持有 TcpServer，最后一个引用在调用方手里释放
+ * 2. 在分片的协程里调用 stop：换一个线程等分片退出，分片不会在自己的线程上析构
+ *
+ * 用法：test_tcp_server_shards [shards=2] [connections=20]
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const char *PORT = "127.0.0.1:8034";
+
+static std::atomic<int> s_active{0};
+
+/**
+ * 回显服务器，收到 "stop" 时在分片上停止服务器
+ */
+class EchoServer : public sylar::TcpServer
+{
+protected:
+    void handleClient(sylar::Socket::ptr client) override
+    {
+        ++s_active;
+        char buf[64];
+        while (true) {
+            int rt = client->recv(buf, sizeof(buf));
+            if (rt <= 0) {
+                break;
+            }
+            if (rt == 4 && !memcmp(buf, "stop", 4)) {
+                stop();
+            }
+            client->send(buf, rt);
+        }
+        --s_active;
+    }
+};
+
+static int connect_client()
+{
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(PORT);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    SYLAR_ASSERT(fd >= 0);
+    SYLAR_ASSERT(!connect(fd, addr->getAddr(), addr->getAddrLen()));
+    return fd;
+}
+
+static void echo(int fd, const char *msg)
+{
+    char buf[64];
+    size_t len = strlen(msg);
+    SYLAR_ASSERT(write(fd, msg, len) == (ssize_t)len);
+    SYLAR_ASSERT(read(fd, buf, sizeof(buf)) == (ssize_t)len);
+}
+
+/**
+ * 监听 socket 要在 hook 过的线程上创建，在一个临时的 IOManager 里启动服务器
+ */
+static sylar::TcpServer::ptr start_server(size_t shards)
+{
+    sylar::TcpServer::ptr server(new EchoServer);
+    sylar::IOManager iom(1, false, "main");
+    iom.schedule([server, shards]() {
+        server->setShards(shards);
+        std::vector<sylar::Address::ptr> addrs{sylar::Address::LookupAnyIPAddress(PORT)}, fails;
+        while (!server->bind(addrs, fails)) {
+            fails.clear();
+            sleep(1);
+        }
+        server->start();
+    });
+    iom.stop();
+    return server;
+}
+
+/**
+ * 等所有客户端读到 EOF
+ */
+static void wait_eof(std::vector<int> &fds)
+{
+    for (int fd : fds) {
+        char buf[64];
+        SYLAR_ASSERT(read(fd, buf, sizeof(buf)) == 0);
+        close(fd);
+    }
+    fds.clear();
+}
+
+static void test_stop_outside(size_t shards, int connections)
+{
+    sylar::TcpServer::ptr server = start_server(shards);
+    std::vector<int> fds;
+    for (int i = 0; i < connections; ++i) {
+        fds.push_back(connect_client());
+        echo(fds.back(), "ping");
+    }
+    SYLAR_ASSERT(s_active == connections);
+
+    uint64_t begin = sylar::GetCurrentMS();
+    server->stop();
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "stop outside shards=" << shards << " connections=" << connections
+                             << " cost=" << cost << "ms";
+    // 读超时是 2 分钟，没有通知连接结束的话 stop 要等到超时
+    SYLAR_ASSERT(cost < 5000);
+    SYLAR_ASSERT(s_active == 0);
+    SYLAR_ASSERT(server->getShards() == 0);
+    wait_eof(fds);
+
+    std::weak_ptr<sylar::TcpServer> weak = server;
+    server.reset();
+    SYLAR_ASSERT(weak.expired());
+}
+
+static void test_stop_inside(size_t shards, int connections)
+{
+    sylar::TcpServer::ptr server = start_server(shards);
+    std::weak_ptr<sylar::TcpServer> weak = server;
+    std::vector<int> fds;
+    for (int i = 0; i < connections; ++i) {
+        fds.push_back(connect_client());
+        echo(fds.back(), "ping");
+    }
+    // 调用方先放掉引用，最后一个引用在停止分片的线程上释放
+    server.reset();
+    SYLAR_ASSERT(!weak.expired());
+    echo(fds[0], "stop");
+    wait_eof(fds);
+    for (int i = 0; i < 5000 && !weak.expired(); ++i) {
+        usleep(1000);
+    }
+    SYLAR_LOG_INFO(g_logger) << "stop inside shards=" << shards << " expired=" << weak.expired();
+    SYLAR_ASSERT(weak.expired());
+    SYLAR_ASSERT(s_active == 0);
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::FATAL);
+
+    size_t shards = argc > 1 ? atoi(argv[1]) : 2;
+    int connections = argc > 2 ? atoi(argv[2]) : 20;
+    test_stop_outside(shards, connections);
+    test_stop_inside(shards, connections);
+    SYLAR_LOG_INFO(g_logger) << "tcp server shards ok";
+    return 0;
+}